@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ANALYZE_H_
+#define _ANALYZE_H_
+
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "../include/args.h"   /* For struct Args */
+#include "../include/bmp.h"    /* For struct BMP_file */
+#include "../include/tune.h"   /* For tune_threads() */
+
+/* Forward declarations */
+struct Args;
+struct BMP_file;
+
+struct Analysis {
+	double chi; /* Chi-square p-value over the first segment of the carrier */
+	double ext; /* Fraction of the carrier over which the p-value stays high */
+	double rs;  /* RS estimate of the fraction of LSBs carrying a message */
+};
+
+/*
+ * Runs the chi-square (pairs of values) attack and RS analysis on channel
+ * |chan| (0 = blue, 1 = green, 2 = red in a BMP file, see |bmp->chans|) of
+ * the pixels in |bmp->data|.
+ * The results are stored in |res|.
+ */
+void analyze_channel(struct BMP_file const * const bmp, unsigned int const chan,
+		     struct Analysis * const res);
+
+/*
+ * This function is the public interface of the 'analyze' mode. Every image
+ * in |args->files| is analyzed on a pool of worker threads and its score is
+ * printed to stdout.
+ *
+ * Returns: true if every image could be analyzed, false otherwise.
+ */
+bool analyze(struct Args const * const args);
+
+#endif  /* _ANALYZE_H_ */
@@ -18,26 +18,74 @@
 #ifndef _ARGS_H_
 #define _ARGS_H_
 
+#include <getopt.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "../include/deflate.h" /* For DEFLATE_MAX_LEVEL */
 #include "../include/helper.h"  /* For clean_exit() */
+#include "../include/png.h"     /* For PNG_SEGMENT_LEN */
+#include "../include/tune.h"    /* For TUNE_ENV, TUNE_PROFILE */
+#include "../include/video.h"   /* For VIDEO_MAX_DIM */
+
+enum Mode {
+	MODE_STEG,    /* Hide or reveal (default) */
+	MODE_ANALYZE, /* Steganalysis of one or more images */
+	MODE_SCAN,    /* Search directory trees for stego images */
+	MODE_BATCH,   /* Many payloads into a set of covers */
+	MODE_PLAN,    /* Assign payloads to covers by capacity */
+	MODE_KEYGEN,  /* Derive a key file from a passphrase */
+	MODE_SERVE,   /* Hide in covers passed over a Unix socket */
+	MODE_CLIENT,  /* Reference client of MODE_SERVE */
+	MODE_VIDEO,   /* Hide in a stream of video frames */
+	MODE_COMPARE, /* Distortion of stego images against their covers */
+	MODE_WATCH,   /* Hide the payloads dropped into a directory */
+	MODE_CALIBRATE /* Tune the parameters to this machine */
+};
+
+/* Value of the options which only have a long form */
+#define OPT_SYNC   0x100 /* --sync */
+#define OPT_LEGACY 0x101 /* --legacy */
+#define OPT_DIRECT 0x102 /* --direct */
+#define OPT_TUNE   0x103 /* --tune */
 
 struct Args {
-	bool mflag;           /* -m option */
-	bool tflag;           /* -t option */
-	bool cflag;           /* -c option */
-	bool dflag;           /* -d option */
-	bool eflag;           /* -e option */
-	size_t evallen;       /* Length of value below */
-	char const *mmet;     /* Method passed to -m */
-	char const *ttyp;     /* Type passed to -t */
-	char const *eval;     /* Value passed to -e */
-	char const *bmpfname; /* BMP file name required argument */
+	enum Mode    mode;       /* Sub-command given as first argument */
+	bool         mflag;      /* -m option */
+	bool         tflag;      /* -t option */
+	bool         cflag;      /* -c option */
+	bool         dflag;      /* -d option */
+	bool         eflag;      /* -e option */
+	bool         uflag;      /* -u option (update in place) */
+	bool         aflag;      /* -a option (analyze all channels) */
+	bool         xflag;      /* -x option (run the planned jobs) */
+	bool         kflag;      /* -k option (seal the payload) */
+	bool         fflag;      /* -f option (error correction) */
+	size_t       evallen;    /* Length of value below */
+	char const   *mmet;      /* Method passed to -m */
+	char const   *ttyp;      /* Type passed to -t */
+	char const   *eval;      /* Value passed to -e */
+	char const   *keyfile;   /* Key file passed to -k */
+	char const   *bmpfname;  /* BMP file name required argument */
+	unsigned int layout;     /* Layout passed to -l */
+	unsigned int nthreads;   /* Threads passed to -j, 0 means mode default */
+	char * const *files;     /* Non-option arguments of batch modes */
+	size_t       nfiles;     /* Number of entries in |files| */
+	size_t       cachemb;    /* Cover cache size passed to -C, in MiB */
+	unsigned int iterations; /* PBKDF2 iterations passed to -i, 0 default */
+	char const   *outpath;   /* Output file passed to -o */
+	enum Sync    sync;       /* Durability passed to --sync */
+	unsigned int level;      /* Compression level passed to -z */
+	bool         legacy;     /* --legacy (images with an unmarked header) */
+	bool         direct;     /* --direct (O_DIRECT I/O of the images) */
+	char const   *tunespec;  /* Overrides passed to --tune, or NULL */
+	size_t       width;      /* Raw frame size passed to -s, 0 for Y4M */
+	size_t       height;
 };
 
 void print_usage(char const *n);
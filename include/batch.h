@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "../include/args.h"   /* For struct Args */
+#include "../include/cache.h"  /* For struct Cover_cache */
+#include "../include/stegan.h" /* hide(), capacity() */
+#include "../include/tune.h"   /* For tune_threads() */
+
+/* Default size of the cover cache in MiB */
+#define BATCH_CACHE_MB 512U
+
+/* Forward declarations */
+struct Args;
+
+/* One job: a cover and the payload to hide in it */
+struct Batch_job {
+	char *cover;   /* Cover image */
+	char *payload; /* File name or message to hide */
+};
+
+/*
+ * This function is the public interface of the 'batch' mode. Each line of the
+ * job list |args->files[0]| ("-" for stdin) names a cover and the payload to
+ * hide in it (a file name, or the message itself), separated by a tab. Jobs
+ * run on a pool of worker threads which share a cache of parsed covers, and
+ * one line mapping each job to its output file is printed to stdout.
+ *
+ * Returns: true if every job succeeded, false otherwise.
+ */
+bool batch(struct Args const * const args);
+
+/*
+ * Runs the |njobs| jobs in |jobs| as described for batch(), with the method,
+ * type, layout, threads and cache size given in |args|.
+ *
+ * Returns: true if every job succeeded, false otherwise.
+ */
+bool run_batch(struct Args const * const args, struct Batch_job const *jobs,
+	       size_t const njobs);
+
+#endif  /* _BATCH_H_ */
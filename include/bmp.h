@@ -18,16 +18,64 @@
 #ifndef _BMP_H_
 #define _BMP_H_
 
+/* For O_DIRECT */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <fcntl.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <sys/mman.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * The pixel kernels for 32 bpp images have AVX2 variants, chosen at run time,
+ * next to the SSE2 ones which x86-64 always has.
+ */
+#if defined(__GNUC__) && defined(__x86_64__)
+#define BMP_AVX2
+#include <immintrin.h>
+#endif
 
 #define SUPPORTED_FILE_TYPE     "BM"
 #define SUPPORTED_DIBHEAD_SIZE  124U
-#define SUPPORTED_BPP           24U
-#define SUPPORTED_MIN_FILE_SIZE 26U         /* Smallest possible BMP */
-#define SUPPORTED_MAX_FILE_SIZE 2147483647U /* 2^31 - 1 == 2GB */
+#define SUPPORTED_BPP           24U /* BGR, rows padded to 4 bytes */
+#define SUPPORTED_BPP_ALPHA     32U /* BGRA, one 32-bit word per pixel */
 
 #define BMPFILEHEADERLEN     14L /* Standard BMP file header */
+#define BMP_LAYOUT_OFF       6L  /* bfReserved1, holds the stego layout */
+#define BMP_FLAGS_OFF        8L  /* bfReserved2, holds BMP_FLAG_* */
+
+/*
+ * Alignment of the buffers, offsets and lengths of O_DIRECT transfers, enough
+ * for any logical block size up to a page, and the most moved by one of them
+ * unless the tuning profile says otherwise
+ */
+#define DIRECT_ALIGN         4096U
+#define DIRECT_CHUNK         (8U << 20)
+
+/* Payload bytes whose LSB matching directions are drawn at once */
+#define MATCH_CHUNK          4096U
+
+#define BMP_FLAG_SEALED      0x1U /* Payload is encrypted and authenticated */
+#define BMP_FLAG_FEC         0x2U /* Payload is followed by RS parity */
+#define BMP_FLAG_VARINT      0x4U /* Message length is a varint */
+#define BMP_FLAG_ROWS        0x8U /* Carrier bytes skip the row padding */
+#define BMP_FLAG_ADAPTIVE    0x10U /* Carrier bytes in order of texture */
+#define BMP_FLAG_SIGNED      0x20U /* Length prefix has a signature */
+#define BMP_FLAGS_KNOWN      (BMP_FLAG_SEALED | BMP_FLAG_FEC | \
+			      BMP_FLAG_VARINT | BMP_FLAG_ROWS | \
+			      BMP_FLAG_ADAPTIVE | BMP_FLAG_SIGNED)
+
+#define BI_RGB               0U /* Uncompressed pixels */
+#define BI_BITFIELDS         3U /* Uncompressed, with channel masks */
+#define BMP_BLUE_MASK_OFF    62L /* Blue channel mask of BI_BITFIELDS */
 
 #define BITMAPCOREHEADERLEN  12L
 #define OS22XBITMAPHEADERLEN 64L
@@ -46,16 +94,69 @@ enum DIB_type {
 	BITMAPV5HEADER
 };
 
+/*
+ * Layout of the hidden data in the pixels. It is recorded in the (otherwise
+ * unused) first reserved field of the file header, where 0 means LAYOUT_V1.
+ */
+enum Layout {
+	LAYOUT_V1 = 1, /* One carrier byte per pixel, the blue channel */
+	LAYOUT_V2 = 2  /* Every byte of the pixel data is a carrier byte */
+};
+
+/*
+ * How far a new file is flushed to the disk before it is published, as given
+ * with --sync. Scratch output can skip the cost, archival output should not.
+ */
+enum Sync {
+	SYNC_NONE, /* Left to the kernel (default) */
+	SYNC_DATA, /* fdatasync() the file */
+	SYNC_FULL  /* fsync() the file, and its directory once it is named */
+};
+
+/* Forward declarations */
+struct Carrier_format;
+
+/*
+ * An image hidden in or revealed from: a BMP file, or one of the other
+ * formats of include/carrier.h, whose headers fill in what they know.
+ */
 struct BMP_file {
+	struct Carrier_format const *fmt; /* File format, see probe_carrier() */
+	char const    *chans;    /* Channels of a pixel in order, like "bgr" */
 	enum DIB_type type;      /* DIB header type */
 	unsigned int  bpp;       /* Bits per pixel */
+	unsigned int  pxlen;     /* Bytes per pixel, 1 to 4, see |chans| */
+	size_t        width;     /* Pixels per row */
+	size_t        height;    /* Number of rows */
+	size_t        rowlen;    /* Bytes from one row to the next, padded */
+	bool          topdown;   /* First row is the top of the image */
+	unsigned int  layout;    /* Layout of hidden data, enum Layout */
+	unsigned int  flags;     /* BMP_FLAG_* of the hidden data */
 	size_t        diblen;    /* Length of DIB header */
-	size_t        data_off;  /* Offset where RGB pixels begin in the file */
+	size_t        data_off;  /* Offset where the pixels begin in the file */
 	size_t        datalen;   /* Length in bytes of |data| */
 	size_t        headerlen; /* Length in bytes of file header */
 	size_t        tot_size;  /* Total size of file in bytes */
 	FILE          *fp;       /* File handle */
-	struct RGB    *data;     /* RGB pixels */
+	struct RGB    *data;     /* Pixel data, |pxlen| bytes per pixel */
+	void          *map;      /* The whole file if |data| is mapped from it,
+				    see map_bmp(), or NULL */
+	void          *direct;   /* The whole file if |data| was read into it
+				    with O_DIRECT, see read_direct(), or NULL */
+	unsigned char *header;   /* First |data_off| bytes of the file, or NULL */
+	uint32_t      *order;    /* Offsets of the carrier bytes in |data| in the
+				    order they are used, or NULL for the pixel
+				    order; see texture_order() */
+	void const    *match;    /* ChaCha20 key which draws the direction of
+				    every LSB change, see carrier_put(), or
+				    NULL to replace the LSBs */
+	char const    *outpath;  /* Output file given with -o, or NULL */
+	enum Sync     sync;      /* Durability of the output file */
+	unsigned int  level;     /* Compression level of the output file, 0 to
+				    DEFLATE_MAX_LEVEL, for formats which
+				    compress */
+	unsigned int  nthreads;  /* Threads compressing it, 0 for one per CPU */
+	char          outname[sizeof("fileXXXXXX")]; /* Set by create_bmp() */
 };
 
 struct RGB {
@@ -64,11 +165,15 @@ struct RGB {
 	unsigned char r;
 };
 
+/* The BMP carrier format, see include/carrier.h */
+extern struct Carrier_format const bmp_format;
+
 /*
- * Initializes |bmp| struct with BMP information such as type of header,
- * header length, total file size, etc.
+ * Initializes |bmp| struct with image information such as the file format,
+ * dimensions, total file size, etc.
  *
- * This function will also validate that the input file is a valid BMP file.
+ * This function will also validate that the input file is a supported image
+ * file, see probe_carrier().
  *
  * Returns: true if file is supported; false otherwise.
  */
@@ -77,15 +182,90 @@ bool init_bmp(struct BMP_file * const bmp);
 /*
  * Read the RGB pixels (data) of the BMP file.
  * Populates the |bmp| struct with the RGB data and the length of the data.
+ * Pixels which the format compresses, as PNG does, are decoded.
  */
 void read_bmp(struct BMP_file * const bmp);
 
 /*
- * Creates a steganographic BMP file out of |bmp->data|. The header for the
- * new BMP file is copied from the source file.
+ * Like read_bmp(), but maps the file of |bmp| privately instead of reading
+ * its pixels into a buffer. A page of the mapping is the page of the page
+ * cache until it is written, which copies just that page. So an image hidden
+ * in this way and saved by create_bmp() passes through memory once, in that
+ * write, instead of once more on the way in. A file which cannot be mapped,
+ * or whose pixels are compressed, is read. |bmp->data| must be released with
+ * free_bmp().
+ */
+void map_bmp(struct BMP_file * const bmp);
+
+/*
+ * Like read_bmp(), but reads the whole file of |bmp| with O_DIRECT, past the
+ * page cache, into an aligned buffer, |tune.direct_chunk| bytes at a time.
+ * What O_DIRECT does not take, like the end of the file after its last whole
+ * block, is read buffered. A file system which refuses O_DIRECT, when the file
+ * is opened for it or at the first read, gets map_bmp() instead, and
+ * compressed pixels read_bmp(). create_bmp() writes an image read in this way
+ * (not mapped) with O_DIRECT too. |bmp->data| must be released with
+ * free_bmp().
+ */
+void read_direct(struct BMP_file * const bmp);
+
+/*
+ * Releases the pixel data of |bmp|, read by read_bmp() or read_direct(), or
+ * mapped by map_bmp().
+ */
+void free_bmp(struct BMP_file * const bmp);
+
+/*
+ * Creates a steganographic image file out of |bmp->data|, in the format of
+ * its cover, see write_carrier(). The headers for the new file are made from
+ * |bmp->header|, or from the source file if that is NULL. The file is
+ * |bmp->outpath|, which appears complete or not at all; without one, a new
+ * file whose name is stored in |bmp->outname|. It is flushed to the disk as
+ * |bmp->sync| asks. An image read with read_direct() is written with
+ * O_DIRECT, if stamping keeps the length of its headers.
  *
  * Return: file descriptor of new file.
  */
 int create_bmp(struct BMP_file * const bmp);
 
+/*
+ * Number of bytes in |bmp->data| which can carry hidden data in the layout
+ * of |bmp|: the blue channel of every pixel for LAYOUT_V1, every byte of the
+ * pixels for LAYOUT_V2. With BMP_FLAG_ROWS the padding at the end of each row
+ * is skipped; images hidden before that flag see the pixel data as one row.
+ */
+size_t carriers(struct BMP_file const * const bmp);
+
+/*
+ * Returns: the offset in |bmp->data| of carrier byte |c|.
+ */
+size_t carrier_off(struct BMP_file const * const bmp, size_t const c);
+
+/*
+ * Returns: the first carrier byte of the row which holds carrier byte |c|,
+ * or |c| itself where rows are not padded. Carrier bytes can be addressed
+ * relative to it in a copy of the pixel data starting at its offset.
+ */
+size_t carrier_row(struct BMP_file const * const bmp, size_t const c);
+
+/*
+ * Hides the |len| bytes of |src| in the carrier bytes starting at carrier
+ * byte |d|, |bits| bits (1 or 8) in each, least significant bits first: every
+ * byte of |src| takes 8 / |bits| carrier bytes, whose other bits are kept.
+ * With 8 the carrier bytes are replaced, with 1 only their LSBs. Carrier
+ * bytes are numbered in |bmp->order| if it is set. With |bmp->match| set, an
+ * LSB which must change is not replaced: 1 is added to or subtracted from the
+ * carrier byte, as bit c of the keystream of the key says for carrier byte c,
+ * but never beyond 0 or 255.
+ */
+void carrier_put(struct BMP_file * const bmp, unsigned int const bits,
+		 size_t const d, void const *src, size_t const len);
+
+/*
+ * Extracts |len| bytes hidden with carrier_put() at carrier byte |d|, |bits|
+ * bits in each carrier byte, into |dst|.
+ */
+void carrier_get(struct BMP_file const * const bmp, unsigned int const bits,
+		 size_t const d, void *dst, size_t const len);
+
 #endif  /* _BMP_H_ */
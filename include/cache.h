@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+/* For memfd_create() */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysinfo.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "../include/bmp.h"    /* For struct BMP_file */
+
+/* Free memory (in bytes) below which the cache gives memory back */
+#define CACHE_LOW_MEMORY (64UL << 20)
+
+/*
+ * A parsed and validated cover image. Its pixel data is kept in a memory file
+ * which every job maps privately, so the pages a job does not modify are
+ * shared with the cache and with all other jobs.
+ */
+struct Cover {
+	dev_t           dev;       /* Key: device, inode, size and mtime */
+	ino_t           ino;
+	off_t           size;
+	struct timespec mtime;
+	struct BMP_file bmp;       /* Headers of the cover, without pixels */
+	int             memfd;     /* Pixel data, or -1 if |pixels| is used */
+	struct RGB      *pixels;   /* Pixel data if no memory file is available */
+	unsigned int    refs;      /* Jobs using this cover, plus one if cached */
+	bool            cached;    /* Still linked into the LRU list */
+	struct Cover    *prev;     /* LRU list, most recently used first */
+	struct Cover    *next;
+};
+
+/*
+ * A cover which one job is loading. The other jobs which miss on the same
+ * file wait for it instead of loading it too.
+ */
+struct Cover_load {
+	struct stat       key;     /* Of the file when the load began */
+	struct Cover      *cover;  /* The cover once loaded, or NULL */
+	bool              done;    /* The load is over, |cover| is set */
+	unsigned int      waiters; /* Jobs waiting for |cover|, each of
+				      which gets a reference to it */
+	struct Cover_load *next;
+};
+
+struct Cover_cache {
+	pthread_mutex_t lock;
+	pthread_cond_t  loaded;     /* Broadcast when a load is over */
+	struct Cover_load *loads;   /* Covers being loaded */
+	struct Cover    *head;      /* Most recently used cover */
+	struct Cover    *tail;      /* Least recently used cover */
+	size_t          bytes;      /* Pixel bytes held by cached covers */
+	size_t          limit;      /* Upper bound of |bytes| */
+	size_t          hits;
+	size_t          misses;
+	size_t          evictions;
+};
+
+/*
+ * Initializes |cache| to hold at most |limit| bytes of pixel data.
+ */
+void cache_init(struct Cover_cache * const cache, size_t const limit);
+
+/*
+ * Releases every cover held by |cache|. No cover may still be in use.
+ */
+void cache_destroy(struct Cover_cache * const cache);
+
+/*
+ * Looks up the cover |fname| in |cache|, loading and validating it on a miss.
+ * The cover is keyed by the device, inode, size and modification time of the
+ * file, so a file which changed is loaded again. If another job is already
+ * loading it, this one waits for that load. The returned cover must be given
+ * back with cache_release().
+ *
+ * Returns: the cover, or NULL if it could not be loaded.
+ */
+struct Cover *cache_get(struct Cover_cache * const cache, char const *fname);
+
+/*
+ * Gives back a cover obtained with cache_get().
+ */
+void cache_release(struct Cover_cache * const cache, struct Cover * const cv);
+
+/*
+ * Sets up |bmp| as a private, copy-on-write view of the cover |cv|. Writes to
+ * |bmp->data| only copy the pages they touch. The view must be removed with
+ * cover_unmap().
+ *
+ * Returns: true if successful, false otherwise.
+ */
+bool cover_map(struct Cover const * const cv, struct BMP_file * const bmp);
+
+/*
+ * Removes a view of |cv| set up by cover_map().
+ */
+void cover_unmap(struct Cover const * const cv, struct BMP_file * const bmp);
+
+#endif  /* _CACHE_H_ */
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CARRIER_H_
+#define _CARRIER_H_
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../include/bmp.h"    /* For struct BMP_file */
+
+#define CARRIER_MIN_FILE_SIZE 10U         /* Smallest image, a 1x1 PGM */
+#define CARRIER_MAX_FILE_SIZE 2147483647U /* 2^31 - 1 == 2GB */
+
+/* Bytes of a file probe_carrier() needs to see all of its headers */
+#define CARRIER_PROBE_LEN     512U
+
+/* Bytes by which stamp_carrier() may make the headers longer */
+#define CARRIER_STAMP_GROW    32U
+
+/*
+ * A file format images can be hidden in. Most are headers followed by the
+ * pixels, uncompressed, so that the pixels are used where they lie in the
+ * file, see map_bmp(), and written back behind the stamped headers, see
+ * create_bmp(); only reading and writing the headers differs. Formats which
+ * compress the pixels decode them into a buffer and encode the stego image
+ * anew, see load_carrier() and write_carrier(), so the same embedding works
+ * on the same decoded rows.
+ */
+struct Carrier_format {
+	char const *name;   /* Short name, like "bmp" */
+	bool fixed_header;  /* stamp() keeps the length of the headers */
+
+	/* Whether the first |len| bytes of a file, |hdr|, are of the format */
+	bool (*match)(unsigned char const *hdr, size_t const len);
+
+	/*
+	 * Parses the headers found in the first |len| bytes of a file, |hdr|,
+	 * into |bmp|, whose |tot_size| holds the size of the file: the shape
+	 * of the pixels, where they start, and the layout and flags of the
+	 * data hidden in them. Formats with |decode| also set the length of
+	 * the decoded pixels, |datalen|. On failure, a description of the
+	 * problem is stored in |err|.
+	 */
+	bool (*probe)(unsigned char const *hdr, size_t const len,
+		      struct BMP_file * const bmp, char *err,
+		      size_t const errlen);
+
+	/*
+	 * Writes the headers of the stego image |bmp| to |dst|: |src|, the
+	 * |bmp->data_off| bytes of the headers of the cover, with the layout
+	 * and flags of |bmp| recorded in them. Returns their length. NULL for
+	 * formats with |encode|.
+	 */
+	size_t (*stamp)(struct BMP_file const * const bmp,
+			unsigned char const *src, unsigned char *dst);
+
+	/*
+	 * Decodes the first |len| bytes of the pixels of |bmp| from |file|,
+	 * the whole of its |bmp->tot_size| bytes, into |dst|. On failure, a
+	 * description of the problem is stored in |err|. NULL for formats
+	 * whose pixels are uncompressed.
+	 */
+	bool (*decode)(struct BMP_file const * const bmp,
+		       unsigned char const *file, unsigned char *dst,
+		       size_t const len, char *err, size_t const errlen);
+
+	/*
+	 * Writes the stego image |bmp| to |fd|, encoding its pixels into a file
+	 * made from |src|, the |bmp->data_off| bytes of the headers of the
+	 * cover. Returns false with |errno| set on failure. NULL for formats
+	 * whose pixels are uncompressed.
+	 */
+	bool (*encode)(struct BMP_file const * const bmp,
+		       unsigned char const *src, int const fd);
+};
+
+/*
+ * Finds the format of the file whose first |len| bytes are |hdr| and parses
+ * its headers into |bmp| with it, setting |bmp->fmt| and the length of the
+ * pixels, |bmp->datalen|. |bmp->tot_size| must hold the size of the file.
+ * Nothing is printed; on failure a description of the problem is stored in
+ * |err|.
+ *
+ * Returns: true if file is supported; false otherwise.
+ */
+bool probe_carrier(unsigned char const *hdr, size_t const len,
+		   struct BMP_file * const bmp, char *err, size_t const errlen);
+
+/*
+ * Reads the first |len| bytes of the pixels of |bmp| from its file, |fd|,
+ * into |dst|, decoding them if the format compresses them. On failure a
+ * description of the problem is stored in |err|.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+bool load_carrier(struct BMP_file const * const bmp, int const fd,
+		  unsigned char *dst, size_t const len, char *err,
+		  size_t const errlen);
+
+/*
+ * Writes the stego image |bmp| to the start of |fd|: the headers of its cover,
+ * the |bmp->data_off| bytes of |src|, stamped, followed by its pixels, or
+ * for a format which compresses them, the file encoded from them.
+ *
+ * Returns: true if successful, false otherwise, with |errno| set.
+ */
+bool write_carrier(struct BMP_file const * const bmp,
+		   unsigned char const *src, int const fd);
+
+/*
+ * Writes the headers of the stego image |bmp| to |dst|, which has room for
+ * |bmp->data_off| + CARRIER_STAMP_GROW bytes: the |bmp->data_off| bytes of
+ * the headers of its cover, |src|, with the layout and flags of |bmp|
+ * recorded in them. |src| and |dst| may be the same if the format has
+ * |fixed_header|.
+ *
+ * Returns: the length of the headers written.
+ */
+size_t stamp_carrier(struct BMP_file const * const bmp,
+		     unsigned char const *src, unsigned char *dst);
+
+#endif  /* _CARRIER_H_ */
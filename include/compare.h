@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _COMPARE_H_
+#define _COMPARE_H_
+
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "../include/args.h"   /* For struct Args */
+#include "../include/bmp.h"    /* For struct BMP_file */
+#include "../include/tune.h"   /* For tune_threads() */
+
+#define COMPARE_TILE  8U /* Side of the square tiles of SSIM, in pixels */
+#define COMPARE_CHANS 4U /* Most channels of a pixel (BGRA) */
+
+/* Forward declarations */
+struct Args;
+struct BMP_file;
+
+/* Distortion of one channel of an image against another */
+struct Distortion {
+	uint64_t     sse;     /* Sum of the squared errors */
+	size_t       n;       /* Samples compared */
+	size_t       changed; /* Samples which differ */
+	unsigned int maxerr;  /* Largest absolute error */
+	double       ssim;    /* Sum of the SSIM of the tiles */
+	size_t       ntiles;  /* Tiles summed in |ssim| */
+};
+
+/*
+ * Measures the distortion of each channel of the pixels of |b| against those
+ * of |a|, which must have the same dimensions and pixel length. The results
+ * are stored in |res|, indexed by channel (0 = blue, 1 = green, 2 = red,
+ * 3 = alpha in a BMP file, see |a->chans|).
+ *
+ * Returns: true if successful, false otherwise.
+ */
+bool compare_images(struct BMP_file const * const a,
+		    struct BMP_file const * const b,
+		    struct Distortion res[COMPARE_CHANS]);
+
+/*
+ * This function is the public interface of the 'compare' mode. The images in
+ * |args->files| are taken in pairs of a cover and a stego image, which are
+ * compared on a pool of worker threads. The distortion of every pair is
+ * printed to stdout.
+ *
+ * Returns: true if every pair could be compared, false otherwise.
+ */
+bool compare(struct Args const * const args);
+
+#endif  /* _COMPARE_H_ */
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CRYPTO_H_
+#define _CRYPTO_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/random.h>
+#include <termios.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * AVX2 is not part of the x86-64 baseline, so the 8-block ChaCha20 kernel is
+ * built for it separately and picked at run time.
+ */
+#if defined(__GNUC__) && defined(__x86_64__)
+#define CHACHA_AVX2
+#include <immintrin.h>
+#endif
+
+#include "../include/args.h"   /* For struct Args */
+
+#define CHACHA_KEY_LEN    32U
+#define CHACHA_NONCE_LEN  12U
+#define CHACHA_BLOCK_LEN  64U
+#define POLY1305_TAG_LEN  16U
+
+/* Bytes a sealed payload takes on top of the plaintext: nonce and tag */
+#define SEAL_OVERHEAD     (CHACHA_NONCE_LEN + POLY1305_TAG_LEN)
+
+/*
+ * Bytes encrypted and embedded per step, so the payload is still in the
+ * cache when the embedder reads it, unless the tuning profile sets another.
+ * Must be a multiple of CHACHA_BLOCK_LEN.
+ */
+#define SEAL_CHUNK        4096U
+
+/*
+ * A key file holds KEYFILE_MAGIC, the PBKDF2-HMAC-SHA256 iteration count
+ * (32-bit little-endian), the salt and the derived key.
+ */
+#define KEYFILE_MAGIC     "STEGKEY1"
+#define KEYFILE_SALT_LEN  16U
+#define KEYFILE_LEN       (8U + 4U + KEYFILE_SALT_LEN + CHACHA_KEY_LEN)
+#define KEYFILE_ITER      200000U
+
+#define SHA256_LEN        32U
+#define SHA256_BLOCK_LEN  64U
+
+/* Forward declarations */
+struct Args;
+
+/* ChaCha20 (RFC 8439) keystream state */
+struct Chacha20 {
+	uint32_t s[16]; /* Input block, s[12] is the next block counter */
+};
+
+/* Poly1305 (RFC 8439) state, in radix 2^44 */
+struct Poly1305 {
+	uint64_t      r[3];
+	uint64_t      h[3];
+	uint64_t      pad[2];
+	unsigned char buf[16]; /* Partial block */
+	size_t        buflen;
+};
+
+/* ChaCha20-Poly1305 AEAD (RFC 8439) without additional data */
+struct Aead {
+	struct Chacha20 cipher;
+	struct Poly1305 mac;
+	uint64_t        len; /* Bytes of ciphertext so far */
+};
+
+struct Sha256 {
+	uint32_t      h[8];
+	uint64_t      len; /* Bytes hashed so far */
+	unsigned char buf[SHA256_BLOCK_LEN];
+	size_t        buflen;
+};
+
+/*
+ * Starts sealing or opening a payload with |key| and |nonce|.
+ */
+void aead_init(struct Aead * const ctx, unsigned char const *key,
+	       unsigned char const *nonce);
+
+/*
+ * Encrypts the |len| bytes of |buf| in place and authenticates them. Every
+ * call but the last must pass a multiple of CHACHA_BLOCK_LEN bytes.
+ */
+void aead_encrypt(struct Aead * const ctx, unsigned char *buf,
+		  size_t const len);
+
+/*
+ * Authenticates the |len| bytes of |buf| and decrypts them in place. Every
+ * call but the last must pass a multiple of CHACHA_BLOCK_LEN bytes.
+ */
+void aead_decrypt(struct Aead * const ctx, unsigned char *buf,
+		  size_t const len);
+
+/*
+ * Computes the tag of everything encrypted or decrypted with |ctx| into |tag|.
+ */
+void aead_final(struct Aead * const ctx, unsigned char *tag);
+
+/*
+ * Compares the tags |a| and |b| in constant time.
+ *
+ * Returns: true if they are equal, false otherwise.
+ */
+bool aead_tag_equal(unsigned char const *a, unsigned char const *b);
+
+/*
+ * Fills |buf| with the |len| bytes of the ChaCha20 keystream of |key|, under
+ * an all-zero nonce, from block |counter| on. Any stretch of it can be made
+ * without the blocks before, so it serves as a keyed, counter-based random
+ * number generator.
+ */
+void chacha20_stream(unsigned char const *key, uint32_t const counter,
+		     unsigned char *buf, size_t const len);
+
+/*
+ * Fills |buf| with |len| bytes from the system random number generator.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+bool random_bytes(void *buf, size_t len);
+
+/*
+ * Derives |dklen| bytes into |dk| from |pass| and |salt| with
+ * PBKDF2-HMAC-SHA256 and |iter| iterations.
+ */
+void pbkdf2_sha256(unsigned char const *pass, size_t const passlen,
+		   unsigned char const *salt, size_t const saltlen,
+		   uint32_t const iter, unsigned char *dk, size_t const dklen);
+
+/*
+ * Loads the key held by the key file |fname| into |key|.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+bool read_key(char const *fname, unsigned char *key);
+
+/*
+ * This function is the public interface of the 'keygen' mode. A passphrase is
+ * read from the terminal (or from the first line of stdin) and stretched with
+ * PBKDF2-HMAC-SHA256 and a random salt into a new key file |args->files[0]|.
+ *
+ * Returns: true if the key file was written, false otherwise.
+ */
+bool keygen(struct Args const * const args);
+
+#endif  /* _CRYPTO_H_ */
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DEFLATE_H_
+#define _DEFLATE_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * DEFLATE (RFC 1951) streams, as found in zlib (RFC 1950) wrappers in PNG
+ * files, and the checksums that go with them.
+ */
+#define DEFLATE_WINDOW     32768U /* Farthest a match may reach back */
+#define DEFLATE_MIN_MATCH  3U
+#define DEFLATE_MAX_MATCH  258U
+#define DEFLATE_MAX_LEVEL  9U
+#define DEFLATE_DEF_LEVEL  6U     /* As in zlib, when none is given */
+#define DEFLATE_BLOCK_SYMS 16384U /* Literals and matches in a block */
+
+/*
+ * Bytes deflate_buf() may produce for |len| bytes of input at most: the
+ * length of stored blocks, which it never exceeds, with a sync flush.
+ */
+#define DEFLATE_BOUND(len) ((len) + ((len) >> 10) + 64)
+
+/*
+ * Updates the Adler-32 checksum |adler| (1 to start with) with the |len|
+ * bytes of |buf|.
+ *
+ * Returns: the new checksum.
+ */
+uint32_t adler32_buf(uint32_t adler, void const *buf, size_t len);
+
+/*
+ * Combines the Adler-32 checksums |a| of a piece of data and |b| of the
+ * |blen| bytes following it.
+ *
+ * Returns: the checksum of both pieces together.
+ */
+uint32_t adler32_combine(uint32_t const a, uint32_t const b,
+			 size_t const blen);
+
+/*
+ * Updates the CRC-32 (ISO 3309, as used by PNG and gzip) |crc| (0 to start
+ * with) with the |len| bytes of |buf|.
+ *
+ * Returns: the new CRC.
+ */
+uint32_t crc32_buf(uint32_t crc, void const *buf, size_t len);
+
+/*
+ * Decodes the raw DEFLATE stream in the |srclen| bytes of |src| into |dst|,
+ * until its last block ends or more comes than the |dstlen| bytes of |dst|
+ * hold, whichever is first. The number of bytes produced is stored in
+ * |outlen| and the number of bytes of |src| taken, up to the end of the last
+ * block, in |inlen|.
+ *
+ * Returns: true if successful, false if the stream is corrupt or ends early.
+ */
+bool inflate_buf(unsigned char const *src, size_t const srclen,
+		 unsigned char *dst, size_t const dstlen, size_t *outlen,
+		 size_t *inlen);
+
+/*
+ * Compresses the |len| bytes of |src| into raw DEFLATE blocks at |level|, 0
+ * (stored, fastest) to DEFLATE_MAX_LEVEL (smallest), and writes them to
+ * |dst|, which has room for DEFLATE_BOUND(|len|) bytes. Matches only reach
+ * back into |src| itself and no block is marked last; the output ends with
+ * an empty stored block, on a byte boundary. So the outputs for consecutive
+ * pieces of data can be compressed independently, in parallel, and simply
+ * concatenated, which a final empty block then ends.
+ *
+ * Returns: the number of bytes written, or 0 if out of memory.
+ */
+size_t deflate_buf(unsigned char const *src, size_t const len,
+		   unsigned int const level, unsigned char *dst);
+
+#endif  /* _DEFLATE_H_ */
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FEC_H_
+#define _FEC_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * PSHUFB (SSSE3) and AVX2 are not part of the x86-64 baseline, so the
+ * Reed-Solomon kernels are built for them separately and picked at run time.
+ */
+#if defined(__GNUC__) && defined(__x86_64__)
+#define FEC_SIMD
+#include <immintrin.h>
+#endif
+
+/*
+ * Reed-Solomon RS(255,223) over GF(2^8): every codeword of up to 255 bytes
+ * holds up to 223 data bytes and 32 parity bytes, and any 16 bytes of it
+ * which are wrong can be corrected.
+ */
+#define FEC_N      255U
+#define FEC_K      223U
+#define FEC_PARITY (FEC_N - FEC_K)
+
+/*
+ * The data is split over as few codewords as possible, interleaved: byte |i|
+ * of the data belongs to codeword |i| % |ncw|. A burst of damaged bytes is
+ * spread evenly over the codewords that way. The data stays in place and the
+ * parity follows it, interleaved the same way: parity byte |j| of codeword
+ * |i| is at |j| * |ncw| + |i|.
+ */
+
+/*
+ * Computes the number of codewords used for |len| bytes of data.
+ *
+ * Returns: the number of codewords.
+ */
+size_t fec_codewords(size_t const len);
+
+/*
+ * Computes the number of parity bytes fec_encode() adds to |len| bytes of
+ * data.
+ *
+ * Returns: the number of parity bytes.
+ */
+size_t fec_parity_len(size_t const len);
+
+/*
+ * Computes the largest amount of data which fits in |room| bytes together
+ * with its parity.
+ *
+ * Returns: the length of the data in bytes.
+ */
+size_t fec_data_len(size_t const room);
+
+/*
+ * Computes the fec_parity_len(|len|) parity bytes of the |len| bytes of
+ * |data| into |parity|.
+ */
+void fec_encode(unsigned char const *data, size_t const len,
+		unsigned char *parity);
+
+/*
+ * Checks the |len| bytes of |data| against their |parity|, made by
+ * fec_encode(), and corrects the errors found in either in place. The number
+ * of bytes corrected is stored in |fixed|.
+ *
+ * Returns: true if |data| is now intact, false if some codeword had more
+ * errors than can be corrected.
+ */
+bool fec_decode(unsigned char *data, size_t const len, unsigned char *parity,
+		size_t *fixed);
+
+#endif  /* _FEC_H_ */
@@ -18,9 +18,16 @@
 #ifndef _HELPER_H_
 #define _HELPER_H_
 
+/* For O_TMPFILE */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -31,11 +38,35 @@
 #include "../include/bmp.h"    /* For struct RGB */
 #include "../include/stegan.h" /* For SUPPORTED_MAX_MSG_LEN */
 
+/* Bytes read_stream() asks for at once */
+#define STREAM_BLOCK_LEN 65536U
+
 /* Forward declarations */
 struct RGB;
 
+/*
+ * An output file which appears under its name only once it is complete, see
+ * out_open(). It is written through |fd|.
+ */
+struct Out_file {
+	int  fd;
+	char path[PATH_MAX]; /* Name it is published under */
+	char tmp[PATH_MAX];  /* Its name until then, empty for an O_TMPFILE */
+};
+
 void clean_exit(FILE *fp, struct RGB *rgbs, int const code);
 
+/*
+ * When set, informational messages printed through info() are suppressed.
+ * Batch modes set this so their per-image results are not drowned out.
+ */
+extern bool quiet;
+
+/*
+ * Prints an informational (progress) message to stdout unless |quiet| is set.
+ */
+void info(char const *fmt, ...) __attribute__((format(printf, 1, 2)));
+
 /*
  * Helper function to get the size of the file pointed to by |fp|.
  * The size of the file is passed by reference to |sz|.
@@ -54,6 +85,89 @@ bool get_file_size(FILE * const fp, size_t *sz);
  */
 unsigned char *read_file(FILE * const hfp, size_t const len);
 
+/*
+ * Helper function to read |fp| up to its end, STREAM_BLOCK_LEN bytes at a
+ * time, into a buffer which the caller must free. Reading stops as soon as
+ * more than |max| bytes came in, so an oversized stream is not kept. The
+ * length of the data is stored in |len|.
+ *
+ * Returns: pointer to the data, or NULL on error; |errno| is EFBIG if the
+ * stream is longer than |max|.
+ */
+unsigned char *read_stream(FILE * const fp, size_t const max, size_t *len);
+
+/*
+ * Helper function to read exactly |len| bytes at offset |off| of |fd| into
+ * |buf|, retrying on short reads.
+ *
+ * Returns: true if successful, false otherwise (including early end of file).
+ */
+bool pread_full(int const fd, void *buf, size_t len, off_t off);
+
+/*
+ * Helper function to write exactly |len| bytes of |buf| at offset |off| of
+ * |fd|, retrying on short writes.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+bool pwrite_full(int const fd, void const *buf, size_t len, off_t off);
+
+/*
+ * Helper function to read |len| bytes of |fd| into |buf|, retrying on short
+ * reads, for pipes and other streams.
+ *
+ * Returns: the number of bytes read, less than |len| only at the end of the
+ * stream, or -1 on error.
+ */
+ssize_t read_full(int const fd, void *buf, size_t len);
+
+/*
+ * Helper function to write the |len| bytes of |buf| to |fd|, retrying on
+ * short writes, for pipes and other streams.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+bool write_full(int const fd, void const *buf, size_t len);
+
+/*
+ * Creates an output file to be published as |path| by out_publish(), in the
+ * same directory so that publishing it is atomic. It has no name at all where
+ * the file system supports O_TMPFILE, and a temporary one next to |path|
+ * otherwise.
+ *
+ * Returns: true if successful, false otherwise, with |errno| set.
+ */
+bool out_open(struct Out_file * const out, char const *path);
+
+/*
+ * Makes the written |out| as durable as |sync| asks and gives it its name,
+ * replacing any file of that name at once. |out->fd| stays open.
+ *
+ * Returns: true if successful, false otherwise, with |errno| set.
+ */
+bool out_publish(struct Out_file * const out, enum Sync const sync);
+
+/*
+ * Throws away |out|, which was not published, and closes it.
+ */
+void out_abort(struct Out_file * const out);
+
+/*
+ * Flushes the data (SYNC_DATA) or the data and the metadata (SYNC_FULL) of
+ * |fd| to the disk.
+ *
+ * Returns: true if successful, false otherwise, with |errno| set.
+ */
+bool sync_fd(int const fd, enum Sync const sync);
+
+/*
+ * Flushes the directory which holds |path| to the disk, so that a name given
+ * to a file in it lasts.
+ *
+ * Returns: true if successful, false otherwise, with |errno| set.
+ */
+bool sync_dir(char const *path);
+
 /*
  * Helper function to perform safe subtraction on unsigned values. The result
  * is stored inside of |r|.
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PLAN_H_
+#define _PLAN_H_
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "../include/args.h"   /* For struct Args */
+#include "../include/batch.h"  /* struct Batch_job, run_batch() */
+#include "../include/carrier.h" /* For probe_carrier() */
+#include "../include/stegan.h" /* capacity() */
+
+/* Forward declarations */
+struct Args;
+
+/*
+ * This function is the public interface of the 'plan' mode. The covers listed
+ * in |args->files[0]| and the payloads listed in |args->files[1]| ("-" for
+ * stdin, one per line) are measured by a pool of worker threads, reading only
+ * the headers of the covers. Every cover takes a single payload, so each
+ * payload, largest first, goes to the smallest free cover it fits in. This
+ * places as many payloads as possible and keeps the larger covers free.
+ *
+ * The assignment is printed to stdout as a job list for batch(), or run
+ * directly if |args->xflag| is set.
+ *
+ * Returns: true if every payload was placed (and its job succeeded), false
+ * otherwise.
+ */
+bool plan(struct Args const * const args);
+
+/*
+ * Measures the capacity of the cover |fname| for the method, type and options
+ * in |args| from the headers of the file, which is all that is read. A cover
+ * which is not supported is reported.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+bool cover_capacity(struct Args const * const args, char const *fname,
+		    size_t *cap);
+
+#endif  /* _PLAN_H_ */
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PNG_H_
+#define _PNG_H_
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../include/carrier.h" /* For struct Carrier_format */
+#include "../include/tune.h"    /* For tune_threads() */
+
+#define PNG_SIGNATURE   "\x89PNG\r\n\x1a\n"
+#define PNG_SIG_LEN     8U
+#define PNG_IHDR_LEN    13U
+#define PNG_CHUNK_EXTRA 12U  /* Length, type and CRC around the data */
+#define PNG_HEADERS_LEN (PNG_SIG_LEN + PNG_CHUNK_EXTRA + PNG_IHDR_LEN)
+#define PNG_MAX_DIM     2147483647UL
+
+#define PNG_GRAY        0U   /* Color types of 8-bit samples supported */
+#define PNG_RGB         2U
+#define PNG_GRAY_ALPHA  4U
+#define PNG_RGB_ALPHA   6U
+
+/*
+ * The layout and flags of the data hidden in a PNG file are recorded in a
+ * private, ancillary chunk of this type right after IHDR: 16 bits each, big
+ * endian. Decoders which do not know it skip it.
+ */
+#define PNG_TAG_TYPE    "stEg"
+#define PNG_TAG_LEN     4U
+
+/*
+ * Filtered bytes compressed as one segment. Segments are compressed in
+ * parallel, independently of each other, each starting a new IDAT chunk.
+ */
+#define PNG_SEGMENT_LEN (256U << 10)
+
+/*
+ * The PNG carrier format: non-interlaced images of 8-bit gray, RGB, gray and
+ * alpha, or RGBA samples. The pixels are the decoded scanlines, rows from the
+ * top down without their filter bytes; the stego image is compressed again at
+ * |bmp->level| on |bmp->nthreads| threads.
+ */
+extern struct Carrier_format const png_format;
+
+#endif  /* _PNG_H_ */
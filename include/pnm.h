@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PNM_H_
+#define _PNM_H_
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/carrier.h" /* For struct Carrier_format */
+
+#define PNM_GRAY        '5' /* P5, binary graymap, one byte per pixel */
+#define PNM_COLOR       '6' /* P6, binary pixmap, RGB */
+#define PNM_MAX_MAXVAL  255U /* Larger maxvals take 2 bytes per sample */
+#define PNM_MAX_DIM     2147483647UL
+
+/*
+ * The layout and flags of the data hidden in a PNM file, which has no spare
+ * fields, are recorded in a comment right after its magic number:
+ * "# steg <layout> <flags>".
+ */
+#define PNM_TAG         "# steg "
+
+/*
+ * The PNM carrier format: binary graymaps (P5) and pixmaps (P6) of at most
+ * 8 bits per sample. Their rows have no padding and run from the top down.
+ */
+extern struct Carrier_format const pnm_format;
+
+#endif  /* _PNM_H_ */
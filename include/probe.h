@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PROBE_H_
+#define _PROBE_H_
+
+/*
+ * Static tracepoints (USDT) of provider "steg", for bpftrace, perf or
+ * SystemTap, e.g.:
+ *
+ *	bpftrace -e 'usdt:./steg:steg:embed__chunk { @[arg0] = sum(arg2); }'
+ *
+ * Each one is a single nop in the code and a note in the ELF file which
+ * tells a tracer where it is and where its arguments are; a tracer attached
+ * to it turns the nop into a breakpoint. The arguments are values already in
+ * registers or in memory, so an untraced probe costs nothing and they stay
+ * in release builds.
+ *
+ * The notes are written by <sys/sdt.h> (systemtap-sdt-dev, or
+ * systemtap-sdt-devel). Without it, or with -DNO_PROBES, the probes compile
+ * to nothing.
+ *
+ * Probes and their arguments:
+ *
+ *	bmp__header	file size, pixel data offset, width, height, bpp
+ *	read__start	bytes of pixel data, how: 0 read, 1 mapped, 2 O_DIRECT,
+ *			3 decoded (PNG)
+ *	read__done	bytes of pixel data, how: as above
+ *	embed__start	method, payload bytes, layout, BMP_FLAG_*
+ *	embed__chunk	bits per carrier byte, first carrier byte, bytes
+ *	embed__done	method, payload bytes
+ *	extract__start	method, payload bytes, layout, BMP_FLAG_*
+ *	extract__chunk	bits per carrier byte, first carrier byte, bytes
+ *	extract__done	method, payload bytes, 1 if it authenticated
+ *	write__start	bytes of the image (of its pixels if compressed), fd
+ *	write__done	bytes of the image (of its pixels if compressed), fd
+ *
+ * The method is a string, as given with -m. A chunk is a piece of the hidden
+ * data: the payload goes PAYLOAD_CHUNK bytes at a time, and the nonce and tag
+ * of a sealed payload and the parity of FEC are chunks of their own.
+ */
+#if !defined(NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define HAVE_PROBES
+#include <sys/sdt.h>
+#endif
+#endif
+
+#ifdef HAVE_PROBES
+#define PROBE2(name, a, b) DTRACE_PROBE2(steg, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(steg, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(steg, name, a, b, c, d)
+#define PROBE5(name, a, b, c, d, e) DTRACE_PROBE5(steg, name, a, b, c, d, e)
+#else
+/* The arguments are named but not evaluated, so none is left unused */
+#define PROBE2(name, a, b) \
+	((void) sizeof(a), (void) sizeof(b))
+#define PROBE3(name, a, b, c) \
+	(PROBE2(name, a, b), (void) sizeof(c))
+#define PROBE4(name, a, b, c, d) \
+	(PROBE3(name, a, b, c), (void) sizeof(d))
+#define PROBE5(name, a, b, c, d, e) \
+	(PROBE4(name, a, b, c, d), (void) sizeof(e))
+#endif
+
+#endif /* _PROBE_H_ */
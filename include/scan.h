@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SCAN_H_
+#define _SCAN_H_
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "../include/args.h"   /* For struct Args */
+#include "../include/carrier.h" /* For probe_carrier() */
+#include "../include/stegan.h" /* decode_prefix() */
+
+/* Number of message characters checked for being printable */
+#define SCAN_PEEK_CHARS 16U
+
+/*
+ * Pixel bytes read from each file, enough for the LSB message check with the
+ * longest length prefix in 32 bpp pixels
+ */
+#define SCAN_PIXEL_LEN  ((8U * PREFIX_MAX_LEN + 8U * SCAN_PEEK_CHARS) * 4U)
+
+/* Forward declarations */
+struct Args;
+
+/*
+ * This function is the public interface of the 'scan' mode. The directory
+ * trees in |args->files| are walked by a pool of worker threads and every
+ * image which seems to carry a payload is printed to stdout, together with
+ * the method, type and length of the payload.
+ *
+ * Returns: true if every directory could be walked, false otherwise.
+ */
+bool scan(struct Args const * const args);
+
+#endif  /* _SCAN_H_ */
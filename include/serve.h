@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SERVE_H_
+#define _SERVE_H_
+
+/* For memfd_create() and MSG_CMSG_CLOEXEC */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+#include "../include/args.h"   /* For struct Args */
+#include "../include/carrier.h" /* For probe_carrier() */
+#include "../include/crypto.h" /* read_key() */
+#include "../include/stegan.h" /* hide_data(), capacity() */
+
+#define SERVE_MAGIC      0x31475453U /* "STG1" */
+#define SERVE_FLAG_FILE  0x1U        /* Payload is a file, not a message */
+#define SERVE_FLAGS_KNOWN SERVE_FLAG_FILE
+#define SERVE_ERR_LEN    256U        /* Longest error text of a reply */
+#define SERVE_BACKLOG    16
+#define SERVE_TIMEOUT    10          /* Seconds a client may stall a request */
+
+/*
+ * A request, sent with the descriptor of the cover (a BMP or TGA file, whose
+ * headers are stamped in place, usually a memfd) attached as SCM_RIGHTS and
+ * followed by |len| bytes of payload. The cover must be sealed against
+ * shrinking (F_SEAL_SHRINK), as the server maps it. Both ends run on the same
+ * host, so the fields are in host byte order.
+ */
+struct Serve_request {
+	uint32_t magic; /* SERVE_MAGIC */
+	uint32_t flags; /* SERVE_FLAG_* */
+	uint64_t len;   /* Length of the payload which follows */
+};
+
+/*
+ * The reply to a request, followed by |errlen| bytes of error text. On
+ * success the descriptor of the cover, with the payload hidden in it, is
+ * attached as SCM_RIGHTS.
+ */
+struct Serve_reply {
+	uint32_t magic;  /* SERVE_MAGIC */
+	uint32_t status; /* 0 on success */
+	uint32_t errlen; /* Length of the error text which follows */
+	uint32_t pad;
+};
+
+/* Forward declarations */
+struct Args;
+
+/*
+ * This function is the public interface of the 'serve' mode. It listens on
+ * the Unix socket |args->files[0]| and hides the payload of every request in
+ * place in the cover whose descriptor came with it, with the method, layout
+ * and options given in |args|. The cover is mapped, not read, and handed back
+ * once it carries the payload. One line is printed for each request. Runs
+ * until interrupted.
+ *
+ * Returns: true if the server shut down cleanly, false otherwise.
+ */
+bool serve(struct Args const * const args);
+
+/*
+ * This function is the public interface of the 'client' mode, a reference
+ * client of serve(). The image |args->files[1]| is copied into a memfd which
+ * is sent to the server at |args->files[0]| along with the payload given with
+ * -e; the cover which comes back is written to |args->outpath|.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+bool client(struct Args const * const args);
+
+/*
+ * Connects to the server listening on the Unix socket |path|.
+ *
+ * Returns: the connected socket, or -1 on error with |errno| set.
+ */
+int serve_connect(char const *path);
+
+/*
+ * Asks the server connected to |sock| to hide the |len| bytes of |payload|
+ * (a file if |flags| has SERVE_FLAG_FILE) in the cover |fd|. If the server
+ * refuses, its reason is stored in |err|.
+ *
+ * Returns: the descriptor of the cover handed back, or -1 on error.
+ */
+int serve_request(int const sock, int const fd, uint32_t const flags,
+		  void const *payload, size_t const len, char *err,
+		  size_t const errlen);
+
+#endif  /* _SERVE_H_ */
@@ -21,12 +21,47 @@
 #include <ctype.h>
 #include <stdio.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "../include/args.h"   /* For struct Args */
 #include "../include/bmp.h"    /* For struct BMP_file */
+#include "../include/crypto.h" /* For struct Aead, read_key() */
+#include "../include/fec.h"    /* fec_encode(), fec_decode() */
 #include "../include/helper.h" /* clean_exit(), read_file(), get_file_size() */
+#include "../include/probe.h"  /* PROBE*() */
+#include "../include/texture.h" /* texture_order() */
+#include "../include/tune.h"   /* For tune */
 
+/* Longest message of images without BMP_FLAG_VARINT */
 #define SUPPORTED_MAX_MSG_LEN 255
 
+/* Longest length: that of a message, as a varint (LEB128) */
+#define VARINT_MAX_LEN 5U
+
+/*
+ * Signature around the length of images with BMP_FLAG_SIGNED: a magic number
+ * and a version before it, and a CRC-8 of both, of the length and of the
+ * layout and flags in the BMP header after it. An image which carries no
+ * payload fails it in the first SIG_HEAD_LEN hidden bytes.
+ */
+#define SIG_MAGIC0   0xB7U
+#define SIG_MAGIC1   0x5EU
+#define SIG_VERSION  1U
+#define SIG_HEAD_LEN 3U /* Magic number and version */
+#define SIG_LEN      4U /* Signature in all, with the CRC-8 */
+#define SIG_CRC_POLY 0x07U
+
+/* Longest length prefix: a message's length with the signature */
+#define PREFIX_MAX_LEN (VARINT_MAX_LEN + SIG_LEN)
+
+/* Payload bytes hidden or extracted at once, one embed__chunk probe each */
+#define PAYLOAD_CHUNK 65536U
+
+/* Unchanged payload bytes across which update() still merges two writes */
+#define UPDATE_MERGE_GAP 16U
+
 /* Forward declarations */
 struct Args;
 struct BMP_file;
@@ -37,10 +72,58 @@ struct BMP_file;
  */
 void hide(struct BMP_file * const bmp, struct Args const * const args);
 
+/*
+ * Hides the |len| bytes of |data| in the pixels of |bmp| with the method,
+ * type, layout and options selected in |args|, setting the layout and flags
+ * of |bmp| to match, but does not write |bmp| anywhere. The payload must fit,
+ * see capacity().
+ *
+ * Returns: true if successful, false otherwise. The pixels of |bmp| may be
+ * changed either way.
+ */
+bool hide_data(struct BMP_file * const bmp, struct Args const * const args,
+	       void const *data, size_t const len);
+
 /*
  * This function is the public interface which invokes the appropriate
  * function for revealing steganographic data.
  */
 void reveal(struct BMP_file * const bmp, struct Args const * const args);
 
+/*
+ * This function is the public interface for replacing the data hidden in the
+ * stego image |bmp| in place. Only the pixel bytes whose hidden bits change
+ * are written back to |bmp->fp|, which must be open for update; the pixels
+ * need not be loaded. The layout of |bmp| is kept.
+ */
+void update(struct BMP_file * const bmp, struct Args const * const args);
+
+/*
+ * Computes how much data the method and type selected in |args| can hide in
+ * |bmp| using the layout |args->layout|. Only the headers of |bmp| are used.
+ *
+ * Returns: the largest payload (file or message) in bytes.
+ */
+size_t capacity(struct BMP_file const * const bmp,
+		struct Args const * const args);
+
+/*
+ * Number of bits of hidden data each carrier byte holds with the method
+ * selected in |args|.
+ */
+unsigned int method_bits(struct Args const * const args);
+
+/*
+ * Decodes the length prefix of a payload hidden in |bmp|, as it is hidden
+ * for a |file| or a message, from |buf|, the first |n| bytes hidden. With
+ * BMP_FLAG_SIGNED, its signature is checked, the magic number and version
+ * before anything else.
+ *
+ * Returns: the length of the prefix in bytes, whose value is stored in |len|,
+ * or 0 if it is malformed, its signature does not match or it does not end
+ * within |n| bytes.
+ */
+size_t decode_prefix(struct BMP_file const * const bmp, bool const file,
+		     unsigned char const *buf, size_t const n, size_t *len);
+
 #endif  /* _STEGAN_H_ */
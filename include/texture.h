@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TEXTURE_H_
+#define _TEXTURE_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "../include/bmp.h"    /* For struct BMP_file */
+#include "../include/tune.h"   /* For tune_threads() */
+
+#define TEXTURE_LEVELS  9U         /* Texture levels, 0 (flat) to 8 */
+#define TEXTURE_BAND    32U        /* Rows of pixels in one tile */
+#define TEXTURE_MIN_MT  (1U << 20) /* Pixel bytes worth a second thread */
+
+/*
+ * Sets |bmp->order| to the offsets in |bmp->data| of the carrier bytes of
+ * |bmp|, the most textured first, so that carrier_put() hides data where it
+ * is hardest to detect. The texture of a carrier byte is its difference to
+ * the same channel of the four neighbouring pixels, and its level is the bit
+ * length of that; ties keep the pixel order. Least significant bits are left
+ * out, so an image gives the same order before and after LSB embedding. The
+ * levels are computed in tiles of TEXTURE_BAND rows by |nthreads| threads (0
+ * for one per CPU). |bmp->order| must be freed by the caller.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+bool texture_order(struct BMP_file * const bmp, unsigned int const nthreads);
+
+#endif  /* _TEXTURE_H_ */
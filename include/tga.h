@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TGA_H_
+#define _TGA_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../include/carrier.h" /* For struct Carrier_format */
+
+#define TGAHEADERLEN     18U
+#define TGA_TRUECOLOR    2U  /* Uncompressed BGR(A) pixels */
+#define TGA_GRAY         3U  /* Uncompressed gray pixels */
+#define TGA_CMAP_OFF     3L  /* Color map specification */
+#define TGA_CMAP_BPP_OFF 7L  /* Bits per entry of the color map */
+#define TGA_DESC_TOP     0x20U /* Image descriptor: rows are top-down */
+
+/*
+ * An image without a color map leaves its specification unused, so the
+ * layout and flags of the hidden data are recorded in its first and second
+ * 16-bit fields, the first entry and the length of the map; the entry size
+ * is set to 0, so that a reader which looks at the length anyway skips
+ * nothing.
+ */
+#define TGA_LAYOUT_OFF   TGA_CMAP_OFF
+#define TGA_FLAGS_OFF    (TGA_CMAP_OFF + 2)
+
+/*
+ * The TGA carrier format: uncompressed true-color images of 24 or 32 bits per
+ * pixel, and gray ones of 8, without a color map. Their rows have no padding.
+ */
+extern struct Carrier_format const tga_format;
+
+#endif  /* _TGA_H_ */
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TUNE_H_
+#define _TUNE_H_
+
+/* For O_DIRECT, posix_fadvise() */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * The tuning profile is TUNE_PROFILE under $XDG_CACHE_HOME, or under
+ * ~/.cache without it. TUNE_ENV names another file instead, or none if empty.
+ */
+#define TUNE_PROFILE    "steg/profile"
+#define TUNE_ENV        "STEG_PROFILE"
+
+/* Bytes of the file the I/O of the calibration is measured on */
+#define TUNE_IO_LEN     (64U << 20)
+
+/* Bytes of pixels each thread of the calibration works on */
+#define TUNE_PIXELS_LEN (4U << 20)
+
+/* Runs of each CPU benchmark of the calibration, the fastest counts */
+#define TUNE_ROUNDS     3U
+
+/* Largest chunk and O_DIRECT transfer a profile may ask for */
+#define TUNE_MAX_CHUNK  (16U << 20)
+#define TUNE_MAX_DIRECT (256U << 20)
+
+/*
+ * Widest vector kernels used for pixels, ChaCha20 and Reed-Solomon, see
+ * find_kernel(). The 128-bit Reed-Solomon kernels need SSSE3 as well.
+ */
+enum Tune_simd {
+	TUNE_SIMD_NONE, /* Scalar and 64-bit word kernels only */
+	TUNE_SIMD_SSE2,
+	TUNE_SIMD_AVX2  /* Where the CPU has it (default) */
+};
+
+/*
+ * The parameters which suit one machine better than another. They start out
+ * with the defaults, are loaded from the tuning profile and then overridden
+ * by --tune, see tune_load().
+ */
+struct Tune {
+	unsigned int   threads; /* Threads of the CPU-bound pools when -j is
+				   not given, 0 for one per CPU */
+	size_t         chunk;   /* Payload bytes sealed and hidden per step,
+				   a multiple of CHACHA_BLOCK_LEN */
+	bool           direct;  /* Read and write images with O_DIRECT, as
+				   --direct does */
+	size_t         direct_chunk; /* Bytes per O_DIRECT transfer, a
+					multiple of DIRECT_ALIGN */
+	enum Tune_simd simd;    /* Widest kernels used */
+};
+
+/* Forward declarations */
+struct Args;
+
+/* The parameters of this run */
+extern struct Tune tune;
+
+/*
+ * Loads the tuning profile into |tune|, if there is one, and applies the
+ * overrides |spec| given with --tune (comma-separated <KEY>=<VALUE> pairs,
+ * with the keys of the profile) on top of it, if not NULL. A profile which
+ * cannot be read is reported and left out.
+ *
+ * Returns: true if successful, false if |spec| is invalid.
+ */
+bool tune_load(char const *spec);
+
+/*
+ * Threads of a pool of CPU-bound workers when -j is not given: those of the
+ * tuning profile, or one per CPU.
+ */
+size_t tune_threads(void);
+
+/*
+ * This function is the public interface of the 'calibrate' mode. Short
+ * benchmarks of the embedding and extracting kernels, of memory bandwidth,
+ * of sealing chunk sizes and of the file I/O in the directory
+ * |args->files[0]| (or the current one) choose the parameters of struct
+ * Tune, which are written to |args->outpath| or the tuning profile.
+ *
+ * Returns: true if the profile was written, false otherwise.
+ */
+bool calibrate(struct Args const * const args);
+
+#endif  /* _TUNE_H_ */
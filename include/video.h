@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _VIDEO_H_
+#define _VIDEO_H_
+
+/* For splice() */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "../include/args.h"   /* For struct Args */
+#include "../include/bmp.h"    /* For carrier_put(), carrier_get() */
+
+#define Y4M_MAGIC        "YUV4MPEG2 " /* First bytes of a YUV4MPEG2 stream */
+#define Y4M_FRAME        "FRAME"      /* First bytes of each of its frames */
+#define Y4M_LINE_MAX     1024U        /* Longest header line we accept */
+#define VIDEO_MAX_DIM    16384U       /* Largest width or height of a frame */
+#define VIDEO_CHUNK_HDR  4U           /* Bytes of the chunk header */
+#define VIDEO_CHUNK_LAST 0x80000000U  /* Chunk header: last chunk */
+#define VIDEO_SPLICE_LEN (1U << 20)   /* Bytes moved by one splice() */
+
+/* Forward declarations */
+struct Args;
+
+/*
+ * A stream of uncompressed frames, either YUV4MPEG2 with 8-bit samples or raw
+ * BGR24 of a known size. One frame is held at a time. The carrier bytes of a
+ * frame are the luma (Y) plane of YUV4MPEG2, and the bytes of the pixels
+ * chosen by the layout for BGR24.
+ */
+struct Video {
+	int             in;       /* Stream the frames are read from */
+	bool            y4m;      /* YUV4MPEG2, raw BGR24 otherwise */
+	size_t          width;
+	size_t          height;
+	size_t          framelen; /* Bytes of pixel data per frame */
+	size_t          frames;   /* Frames read so far */
+	unsigned char   *frame;   /* Pixel data of the current frame */
+	char            line[Y4M_LINE_MAX]; /* Header line of the stream, then
+					       of the current frame */
+	size_t          linelen;  /* Length of |line|, 0 for raw BGR24 */
+	struct BMP_file view;     /* Carrier bytes of |frame| */
+};
+
+/*
+ * This function is the public interface of the 'video' mode. The payload is
+ * hidden in (-e), or recovered from (-d), the stream of frames read from
+ * |args->files[0]| ("-" for stdin) as it goes by, one frame at a time. Each
+ * frame carries a chunk of the payload after a VIDEO_CHUNK_HDR byte header
+ * holding the length of the chunk and VIDEO_CHUNK_LAST, so the payload may
+ * be a pipe of unknown length which is read as data comes in. The frames
+ * after the last chunk are passed on untouched. The output, the frames or the
+ * payload, goes to |args->outpath|, or stdout.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+bool video(struct Args const * const args);
+
+#endif  /* _VIDEO_H_ */
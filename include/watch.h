@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WATCH_H_
+#define _WATCH_H_
+
+/* For the file name of struct inotify_event and O_CLOEXEC */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "../include/args.h"   /* For struct Args */
+#include "../include/batch.h"  /* For BATCH_CACHE_MB */
+#include "../include/cache.h"  /* For struct Cover_cache */
+#include "../include/carrier.h" /* For stamp_carrier() */
+#include "../include/crypto.h" /* read_key() */
+#include "../include/plan.h"   /* cover_capacity() */
+#include "../include/stegan.h" /* hide_data(), capacity() */
+#include "../include/tune.h"   /* tune_threads() */
+
+#define WATCH_CLAIM   ".steg-"  /* Prefix of a payload being hidden */
+#define WATCH_FAILED  ".failed" /* Suffix of a payload which was not hidden */
+#define WATCH_EVENTS  (IN_CLOSE_WRITE | IN_MOVED_TO)
+#define WATCH_BUF_LEN 65536U    /* Bytes of inotify events read at once */
+
+/* Forward declarations */
+struct Args;
+
+/*
+ * This function is the public interface of the 'watch' mode. Payload files
+ * which land in the spool directory |args->files[0]|, or are already there,
+ * are each hidden in the smallest cover of the directory |args->files[1]|
+ * which holds them, with the method, layout and options given in |args|, on
+ * a pool of worker threads sharing a cache of covers. The stego image is
+ * published atomically in the directory |args->files[2]| and the payload is
+ * removed; one line is printed for each. Runs until interrupted.
+ *
+ * Returns: true if the watch ended cleanly, false otherwise.
+ */
+bool watch(struct Args const * const args);
+
+#endif  /* _WATCH_H_ */
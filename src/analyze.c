@@ -0,0 +1,526 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../include/analyze.h"
+
+#define CHI_SEGMENTS  32U   /* Cumulative prefixes tested by the chi-square attack */
+#define CHI_MIN_COUNT 5.0   /* Smallest expected count of a usable category */
+#define RS_TILE       1024U /* Groups gathered per call of the RS kernel */
+
+/* Number of R and S groups for each of the four RS measurements */
+struct RS_counts {
+	size_t r[4]; /* Indexed by RS_M, RS_NM, RS_FM, RS_FNM */
+	size_t s[4];
+};
+
+enum RS_measure {
+	RS_M,   /* Mask M on the image */
+	RS_NM,  /* Mask -M on the image */
+	RS_FM,  /* Mask M on the image with all LSBs flipped */
+	RS_FNM  /* Mask -M on the image with all LSBs flipped */
+};
+
+/* State shared between the worker threads of analyze() */
+struct Analyze_pool {
+	struct Args const *args;
+	size_t next;    /* Index of the next image to analyze */
+	bool   failed;  /* Set if any image could not be analyzed */
+};
+
+static void *analyze_worker(void *arg);
+static bool analyze_file(char const *fname, bool const allch, char *line,
+			 size_t const linelen);
+static void histogram(unsigned char const *px, size_t const n,
+		      size_t const st, uint32_t h[256]);
+static double chi_square_p(uint32_t const h[256]);
+static double gamma_q(double const a, double const x);
+static void rs_tile(int16_t const *x0, int16_t const *x1, int16_t const *x2,
+		    int16_t const *x3, size_t const n, struct RS_counts *c);
+static double rs_estimate(struct RS_counts const *c);
+
+/*
+ * This function is the public interface of the 'analyze' mode. Every image
+ * in |args->files| is analyzed on a pool of worker threads and its score is
+ * printed to stdout.
+ *
+ * Returns: true if every image could be analyzed, false otherwise.
+ */
+bool analyze(struct Args const * const args)
+{
+	struct Analyze_pool pool = {
+		.args = args,
+		.next = 0,
+		.failed = false
+	};
+
+	size_t nthreads = args->nthreads ? args->nthreads : tune_threads();
+	if (nthreads > args->nfiles)
+		nthreads = args->nfiles;
+
+	pthread_t *tids = malloc(nthreads * sizeof(*tids));
+	if (!tids) {
+		perror("malloc");
+		return false;
+	}
+
+	/* Progress messages of init_bmp() and read_bmp() would interleave */
+	quiet = true;
+
+	size_t started = 0;
+	for (; started < nthreads; started++) {
+		if (pthread_create(&tids[started], NULL, analyze_worker,
+				   &pool) != 0) {
+			perror("pthread_create");
+			break;
+		}
+	}
+
+	/* If no thread could be started, do the work on this one */
+	if (started == 0)
+		analyze_worker(&pool);
+
+	for (size_t i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+
+	free(tids);
+	return !pool.failed;
+}
+
+/*
+ * Runs the chi-square (pairs of values) attack and RS analysis on channel
+ * |chan| (0 = blue, 1 = green, 2 = red in a BMP file, see |bmp->chans|) of
+ * the pixels in |bmp->data|.
+ * The results are stored in |res|.
+ */
+void analyze_channel(struct BMP_file const * const bmp, unsigned int const chan,
+		     struct Analysis * const res)
+{
+	unsigned char const *px = (unsigned char const *) bmp->data + chan;
+	size_t const st = bmp->pxlen;
+	size_t const w = bmp->width;
+	size_t const n = w * bmp->height;
+
+	/*
+	 * Chi-square attack. Sequential embedding equalizes the counts of each
+	 * pair of values (2k, 2k + 1) from the start of the carrier onwards, so
+	 * the test is evaluated over growing prefixes of the carrier. Sample
+	 * |i| is pixel |i| % |w| of row |i| / |w|, the padding of the rows is
+	 * not part of the image.
+	 */
+	uint32_t h[256] = { 0 };
+	unsigned int high = 0;
+	bool streak = true;
+
+	res->chi = 0.0;
+	for (size_t s = 0; s < CHI_SEGMENTS; s++) {
+		size_t const lo = n * s / CHI_SEGMENTS;
+		size_t const hi = n * (s + 1) / CHI_SEGMENTS;
+
+		for (size_t i = lo; i < hi;) {
+			size_t const col = i % w;
+			size_t const cnt = hi - i < w - col ? hi - i : w - col;
+
+			histogram(px + i / w * bmp->rowlen + col * st, cnt, st,
+				  h);
+			i += cnt;
+		}
+
+		double const p = chi_square_p(h);
+		if (s == 0)
+			res->chi = p;
+		if (streak && p >= 0.5)
+			high++;
+		else
+			streak = false;
+	}
+	res->ext = (double) high / CHI_SEGMENTS;
+
+	/*
+	 * RS analysis on groups of 4 consecutive samples. The samples are
+	 * gathered into one array per group position so the kernel can work on
+	 * whole vectors of groups. A group does not span two rows.
+	 */
+	int16_t x[4][RS_TILE];
+	struct RS_counts c = { { 0 }, { 0 } };
+	size_t const per_row = w / 4;
+	size_t const ngroups = per_row * bmp->height;
+	size_t row = 0, col = 0;
+	unsigned char const *p = px;
+
+	for (size_t g = 0; g < ngroups; g += RS_TILE) {
+		size_t const cnt = (ngroups - g) < RS_TILE ? (ngroups - g) : RS_TILE;
+
+		for (size_t i = 0; i < cnt; i++, col++, p += 4 * st) {
+			if (col == per_row) {
+				p = px + ++row * bmp->rowlen;
+				col = 0;
+			}
+			x[0][i] = p[0];
+			x[1][i] = p[1 * st];
+			x[2][i] = p[2 * st];
+			x[3][i] = p[3 * st];
+		}
+
+		rs_tile(x[0], x[1], x[2], x[3], cnt, &c);
+	}
+
+	res->rs = rs_estimate(&c);
+}
+
+/*
+ * Worker thread of analyze(). Takes images off the shared pool until none
+ * are left and prints one line of results per image.
+ */
+static void *analyze_worker(void *arg)
+{
+	struct Analyze_pool * const pool = arg;
+	char line[512];
+
+	for (;;) {
+		size_t const i = __atomic_fetch_add(&pool->next, 1,
+						    __ATOMIC_RELAXED);
+		if (i >= pool->args->nfiles)
+			break;
+
+		char const *fname = pool->args->files[i];
+		if (analyze_file(fname, pool->args->aflag, line, sizeof(line))) {
+			/* A single call keeps lines of different threads apart */
+			printf("%s\n", line);
+		} else {
+			fprintf(stderr, "Error: could not analyze %s\n", fname);
+			__atomic_store_n(&pool->failed, true, __ATOMIC_RELAXED);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Loads the image |fname| and formats the analysis of its first channel, the
+ * carrier of layout 1 (or all color channels if |allch| is set) into |line|.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+static bool analyze_file(char const *fname, bool const allch, char *line,
+			 size_t const linelen)
+{
+	struct BMP_file bmp = { .order = NULL };
+
+	if (!(bmp.fp = fopen(fname, "rb"))) {
+		perror("fopen");
+		return false;
+	}
+
+	if (!init_bmp(&bmp)) {
+		fclose(bmp.fp);
+		return false;
+	}
+
+	read_bmp(&bmp);
+
+	size_t off = (size_t) snprintf(line, linelen, "%s", fname);
+	double score = 0.0;
+	unsigned int const nchan = !allch ? 1 : bmp.pxlen < 3 ? bmp.pxlen : 3;
+
+	for (unsigned int c = 0; c < nchan; c++) {
+		struct Analysis res;
+
+		analyze_channel(&bmp, c, &res);
+
+		double const s = res.ext > res.rs ? res.ext : res.rs;
+		if (s > score)
+			score = s;
+
+		if (off < linelen)
+			off += (size_t) snprintf(line + off, linelen - off,
+			    "\t%c: chi=%.4f ext=%.3f rs=%.4f", bmp.chans[c],
+			    res.chi, res.ext, res.rs);
+	}
+
+	if (off < linelen)
+		snprintf(line + off, linelen - off, "\tscore=%.4f",
+			 score > 1.0 ? 1.0 : score);
+
+	free(bmp.data);
+	fclose(bmp.fp);
+	return true;
+}
+
+/*
+ * Adds the values of |n| samples, spaced one pixel (|st| bytes) apart starting
+ * at |px|, to the histogram |h|.
+ *
+ * Four sub-histograms are used so that runs of equal values (common in
+ * images) do not serialize on a single counter.
+ */
+static void histogram(unsigned char const *px, size_t const n,
+		      size_t const st, uint32_t h[256])
+{
+	uint32_t sub[4][256] = { { 0 } };
+	size_t i = 0;
+
+	for (; i + 4 <= n; i += 4, px += 4 * st) {
+		sub[0][px[0]]++;
+		sub[1][px[st]]++;
+		sub[2][px[2 * st]]++;
+		sub[3][px[3 * st]]++;
+	}
+
+	for (; i < n; i++, px += st)
+		sub[0][px[0]]++;
+
+	for (size_t v = 0; v < 256; v++)
+		h[v] += sub[0][v] + sub[1][v] + sub[2][v] + sub[3][v];
+}
+
+/*
+ * Computes the chi-square statistic of the histogram |h| against the
+ * distribution expected after LSB embedding, where both values of every pair
+ * (2k, 2k + 1) occur equally often.
+ *
+ * Returns: the probability that the histogram stems from embedding.
+ */
+static double chi_square_p(uint32_t const h[256])
+{
+	double chi = 0.0;
+	unsigned int cats = 0;
+
+	for (size_t k = 0; k < 128; k++) {
+		double const expect = (h[2 * k] + h[2 * k + 1]) / 2.0;
+		if (expect < CHI_MIN_COUNT)
+			continue;
+
+		double const d = h[2 * k] - expect;
+		chi += d * d / expect;
+		cats++;
+	}
+
+	if (cats < 2)
+		return 0.0;
+
+	return gamma_q((cats - 1) / 2.0, chi / 2.0);
+}
+
+/*
+ * Computes the regularized upper incomplete gamma function Q(a, x), which is
+ * the complement of the chi-square CDF with 2a degrees of freedom at 2x.
+ *
+ * Returns: Q(a, x).
+ */
+static double gamma_q(double const a, double const x)
+{
+	double const eps = 1e-12;
+	double const lga = lgamma(a);
+
+	if (x <= 0.0)
+		return 1.0;
+
+	if (x < a + 1.0) {
+		/* Series expansion of P(a, x) */
+		double ap = a;
+		double del = 1.0 / a;
+		double sum = del;
+
+		for (int i = 0; i < 1000 && fabs(del) > fabs(sum) * eps; i++) {
+			ap += 1.0;
+			del *= x / ap;
+			sum += del;
+		}
+
+		return 1.0 - sum * exp(-x + a * log(x) - lga);
+	}
+
+	/* Continued fraction of Q(a, x), evaluated with Lentz's method */
+	double const tiny = 1e-300;
+	double b = x + 1.0 - a;
+	double c = 1.0 / tiny;
+	double d = 1.0 / b;
+	double f = d;
+
+	for (int i = 1; i < 1000; i++) {
+		double const an = -i * (i - a);
+
+		b += 2.0;
+		d = an * d + b;
+		if (fabs(d) < tiny)
+			d = tiny;
+		c = b + an / c;
+		if (fabs(c) < tiny)
+			c = tiny;
+		d = 1.0 / d;
+
+		double const del = d * c;
+		f *= del;
+		if (fabs(del - 1.0) < eps)
+			break;
+	}
+
+	return exp(-x + a * log(x) - lga) * f;
+}
+
+/*
+ * Discrimination function of RS analysis: the variation of a group of four
+ * samples, |b - a| + |c - b| + |d - c|.
+ */
+static inline int rs_f(int const a, int const b, int const c, int const d)
+{
+	return abs(b - a) + abs(c - b) + abs(d - c);
+}
+
+/* Flipping F1 (0 <-> 1, 2 <-> 3, ...) */
+static inline int rs_f1(int const v)
+{
+	return v ^ 1;
+}
+
+/* Shifted flipping F-1 (-1 <-> 0, 1 <-> 2, ...) */
+static inline int rs_fn1(int const v)
+{
+	return ((v + 1) ^ 1) - 1;
+}
+
+/*
+ * Classifies one group (|a|, |b|, |c|, |d|) under the masks M = [0 1 1 0] and
+ * -M, both on the group itself and with all of its LSBs flipped.
+ */
+static inline void rs_group(int a, int b, int c, int d, struct RS_counts *cnt)
+{
+	for (int flip = 0; flip < 2; flip++) {
+		int const f0 = rs_f(a, b, c, d);
+		int const fm = rs_f(a, rs_f1(b), rs_f1(c), d);
+		int const fn = rs_f(a, rs_fn1(b), rs_fn1(c), d);
+		size_t const m = flip ? RS_FM : RS_M;
+		size_t const nm = flip ? RS_FNM : RS_NM;
+
+		cnt->r[m] += fm > f0;
+		cnt->s[m] += fm < f0;
+		cnt->r[nm] += fn > f0;
+		cnt->s[nm] += fn < f0;
+
+		a ^= 1;
+		b ^= 1;
+		c ^= 1;
+		d ^= 1;
+	}
+}
+
+#ifdef __SSE2__
+static inline __m128i rs_absdiff(__m128i const a, __m128i const b)
+{
+	__m128i const d = _mm_sub_epi16(a, b);
+	return _mm_max_epi16(d, _mm_sub_epi16(_mm_setzero_si128(), d));
+}
+
+static inline __m128i rs_f_vec(__m128i const a, __m128i const b,
+			       __m128i const c, __m128i const d)
+{
+	return _mm_add_epi16(rs_absdiff(b, a),
+			     _mm_add_epi16(rs_absdiff(c, b), rs_absdiff(d, c)));
+}
+
+/* Number of 16-bit lanes set in the comparison result |m| */
+static inline size_t rs_lanes(__m128i const m)
+{
+	return (size_t) __builtin_popcount(_mm_movemask_epi8(m)) / 2;
+}
+#endif
+
+/*
+ * RS kernel. Classifies the |n| groups whose samples are stored in |x0|
+ * through |x3| and adds the results to |c|.
+ */
+static void rs_tile(int16_t const *x0, int16_t const *x1, int16_t const *x2,
+		    int16_t const *x3, size_t const n, struct RS_counts *c)
+{
+	size_t i = 0;
+
+#ifdef __SSE2__
+	__m128i const one = _mm_set1_epi16(1);
+
+	for (; i + 8 <= n; i += 8) {
+		__m128i a = _mm_loadu_si128((__m128i const *) (x0 + i));
+		__m128i b = _mm_loadu_si128((__m128i const *) (x1 + i));
+		__m128i e = _mm_loadu_si128((__m128i const *) (x2 + i));
+		__m128i d = _mm_loadu_si128((__m128i const *) (x3 + i));
+
+		for (int flip = 0; flip < 2; flip++) {
+			__m128i const f0 = rs_f_vec(a, b, e, d);
+			__m128i const fm = rs_f_vec(a, _mm_xor_si128(b, one),
+						    _mm_xor_si128(e, one), d);
+			__m128i const bn = _mm_sub_epi16(
+			    _mm_xor_si128(_mm_add_epi16(b, one), one), one);
+			__m128i const en = _mm_sub_epi16(
+			    _mm_xor_si128(_mm_add_epi16(e, one), one), one);
+			__m128i const fn = rs_f_vec(a, bn, en, d);
+			size_t const m = flip ? RS_FM : RS_M;
+			size_t const nm = flip ? RS_FNM : RS_NM;
+
+			c->r[m] += rs_lanes(_mm_cmpgt_epi16(fm, f0));
+			c->s[m] += rs_lanes(_mm_cmpgt_epi16(f0, fm));
+			c->r[nm] += rs_lanes(_mm_cmpgt_epi16(fn, f0));
+			c->s[nm] += rs_lanes(_mm_cmpgt_epi16(f0, fn));
+
+			a = _mm_xor_si128(a, one);
+			b = _mm_xor_si128(b, one);
+			e = _mm_xor_si128(e, one);
+			d = _mm_xor_si128(d, one);
+		}
+	}
+#endif
+
+	for (; i < n; i++)
+		rs_group(x0[i], x1[i], x2[i], x3[i], c);
+}
+
+/*
+ * Solves the RS quadratic for the embedding rate from the group counts |c|.
+ * Source: Fridrich, Goljan and Du, "Reliable detection of LSB steganography
+ * in color and grayscale images", 2001.
+ *
+ * Returns: estimated fraction of samples whose LSB carries a message.
+ */
+static double rs_estimate(struct RS_counts const *c)
+{
+	double const d0 = (double) c->r[RS_M] - (double) c->s[RS_M];
+	double const d1 = (double) c->r[RS_FM] - (double) c->s[RS_FM];
+	double const n0 = (double) c->r[RS_NM] - (double) c->s[RS_NM];
+	double const n1 = (double) c->r[RS_FNM] - (double) c->s[RS_FNM];
+
+	double const qa = 2.0 * (d1 + d0);
+	double const qb = n0 - n1 - d1 - 3.0 * d0;
+	double const qc = d0 - n0;
+	double z;
+
+	if (fabs(qa) < 1e-9) {
+		if (fabs(qb) < 1e-9)
+			return 0.0;
+		z = -qc / qb;
+	} else {
+		double const disc = qb * qb - 4.0 * qa * qc;
+		if (disc < 0.0)
+			return 0.0;
+
+		double const z1 = (-qb + sqrt(disc)) / (2.0 * qa);
+		double const z2 = (-qb - sqrt(disc)) / (2.0 * qa);
+		z = fabs(z1) < fabs(z2) ? z1 : z2;
+	}
+
+	double const p = z / (z - 0.5);
+	if (!(p > 0.0))
+		return 0.0;
+	return p > 1.0 ? 1.0 : p;
+}
@@ -17,58 +17,267 @@
 
 #include "../include/args.h"
 
+/* Sub-commands which may be given as the first argument */
+struct Mode_desc {
+	char const *name;    /* Name of the sub-command */
+	enum Mode  mode;
+	char const *opts;    /* Options accepted, in getopt() syntax */
+	char const *operand; /* Description of the required operands */
+	size_t     nargs;    /* Exact number of operands, 0 for one or more */
+	bool       needmt;   /* Whether -m and -t are required */
+	bool       writes;   /* Whether it writes images, and takes --sync */
+};
+
+static struct Mode_desc const modes[] = {
+	{ "analyze", MODE_ANALYZE, "haj:",         "images",      0, false,
+	  false },
+	{ "scan",    MODE_SCAN,    "hm:t:j:",      "directories", 0, false,
+	  false },
+	{ "batch",   MODE_BATCH,   "hm:t:l:j:C:k:fz:", "job list",    1, true,
+	  true },
+	{ "plan",    MODE_PLAN,    "hm:t:l:j:xC:k:fz:",
+	  "cover list and payload list", 2, true, true },
+	{ "keygen",  MODE_KEYGEN,  "hi:",             "key file",    1, false,
+	  false },
+	{ "serve",   MODE_SERVE,   "hm:l:k:f",        "socket",      1, false,
+	  false },
+	{ "client",  MODE_CLIENT,  "ht:e:o:",         "socket and image",
+	  2, false, true },
+	{ "video",   MODE_VIDEO,   "hm:t:l:s:e:do:",  "video",       1, false,
+	  true },
+	{ "compare", MODE_COMPARE, "hj:",             "cover and stego image",
+	  0, false, false },
+	{ "watch",   MODE_WATCH,   "hm:l:j:C:k:fz:",  "spool, cover and output "
+	  "directory", 3, false, true },
+	{ "calibrate", MODE_CALIBRATE, "ho:",         "directory",   1, false,
+	  false },
+};
+
+/* Long forms of the options of the default mode */
+static struct option const longopts[] = {
+	{ "update", required_argument, NULL, 'u' },
+	{ "output", required_argument, NULL, 'o' },
+	{ "sync",   required_argument, NULL, OPT_SYNC },
+	{ "legacy", no_argument,       NULL, OPT_LEGACY },
+	{ "direct", no_argument,       NULL, OPT_DIRECT },
+	{ "tune",   required_argument, NULL, OPT_TUNE },
+	{ NULL,     0,                 NULL, 0 }
+};
+
+/*
+ * Long options of the sub-commands which write images, of the others, and of
+ * calibrate, which starts out from the defaults rather than the profile
+ */
+static struct option const writeopts[] = {
+	{ "sync", required_argument, NULL, OPT_SYNC },
+	{ "tune", required_argument, NULL, OPT_TUNE },
+	{ NULL,   0,                 NULL, 0 }
+};
+static struct option const readopts[] = {
+	{ "tune", required_argument, NULL, OPT_TUNE },
+	{ NULL,   0,                 NULL, 0 }
+};
+static struct option const noopts[] = {
+	{ NULL, 0, NULL, 0 }
+};
+
+static bool parse_mode_args(int const argc, char * const *argv,
+			    struct Mode_desc const *desc,
+			    struct Args * const args);
+static bool parse_method(char const *val, struct Args * const args);
+static bool parse_type(char const *val, struct Args * const args);
+static bool parse_layout(char const *val, struct Args * const args);
+static bool parse_sync(char const *val, struct Args * const args);
+static bool parse_size(char const *val, struct Args * const args);
+static bool parse_threads(char const *val, unsigned int *n);
+static bool parse_count(char const *val, unsigned int *n);
+static bool parse_level(char const *val, unsigned int *level);
+
 void print_usage(char const *n)
 {
 	fprintf(stderr,
-		"Usage: %s [-h] [-m <METHOD>] [-t <TYPE>] [-d | -e <VAL>] <BMP>\n\n"
+		"Usage: %s [-h] [-m <METHOD>] [-t <TYPE>] [-l <LAYOUT>]\n"
+		"          [-k <KEY>] [-f] [-o <PATH>] [--sync <POLICY>] [--direct]\n"
+		"          [-z <LEVEL>] [-d | -e <VAL> | -u <VAL>] [--legacy] <BMP>\n"
+		"       %s analyze [-a] [-j <N>] <BMP>...\n"
+		"       %s scan [-m <METHOD>] [-t <TYPE>] [-j <N>] <DIR>...\n"
+		"       %s batch -m <METHOD> -t <TYPE> [-l <LAYOUT>] [-j <N>]\n"
+		"                [-C <MiB>] [-k <KEY>] [-f] [-z <LEVEL>] [--sync <POLICY>]\n"
+		"                <JOBS>\n"
+		"       %s plan -m <METHOD> -t <TYPE> [-l <LAYOUT>] [-j <N>]\n"
+		"               [-x [-C <MiB>]] [-k <KEY>] [-f] [-z <LEVEL>]\n"
+		"               [--sync <POLICY>]\n"
+		"               <COVERS> <PAYLOADS>\n"
+		"       %s keygen [-i <N>] <KEY>\n"
+		"       %s serve -m <METHOD> [-l <LAYOUT>] [-k <KEY>] [-f] <SOCKET>\n"
+		"       %s client [-t <TYPE>] -e <VAL> -o <PATH> [--sync <POLICY>]\n"
+		"                 <SOCKET> <BMP>\n"
+		"       %s video -m <METHOD> [-t <TYPE>] [-l <LAYOUT>] [-s <W>x<H>]\n"
+		"                (-d | -e <VAL>) [-o <PATH>] [--sync <POLICY>] <VIDEO>\n"
+		"       %s compare [-j <N>] (<COVER> <STEGO>)...\n"
+		"       %s watch -m <METHOD> [-l <LAYOUT>] [-j <N>] [-C <MiB>] [-k <KEY>]\n"
+		"                [-f] [-z <LEVEL>] [--sync <POLICY>] <SPOOL> <COVERS> <OUTDIR>\n"
+		"       %s calibrate [-o <PATH>] [<DIR>]\n\n"
+		"Every mode but calibrate also takes --tune <KEY>=<VALUE>[,...].\n\n"
+		"<BMP> may also be a PNG (8-bit, not interlaced), binary PNM (P5, P6)\n"
+		"or uncompressed TGA image.\n\n"
 		"Options:\n"
 		" -h           Print this help.\n\n"
 		" -m <METHOD>  Method to use for steganography.\n"
-		"              <METHOD> can be 'lsb' or 'simple'.\n"
+		"              <METHOD> can be 'lsb', 'simple', 'adaptive' or\n"
+		"              'match'.\n"
 		"              'lsb' is least significant bit (beter at hiding).\n"
-		"              'simple' just replaces the pixels outright.\n\n"
+		"              'simple' just replaces the pixels outright.\n"
+		"              'adaptive' is 'lsb' in the most textured pixels\n"
+		"              first, where changes are hardest to detect.\n"
+		"              'match' is 'lsb' which adds or subtracts 1 at\n"
+		"              random instead of setting the bit (revealed as\n"
+		"              'lsb').\n\n"
 		" -t <TYPE>    Type of steganography to perform.\n"
 		"              <TYPE> can be 'message' or 'file'.\n"
 		"              'message' is for hiding messages.\n"
 		"              'file' is for hiding files (or images) within <BMP>.\n\n"
+		" -l <LAYOUT>  Layout of the hidden data when encoding (default 1).\n"
+		"              '1' uses only the first channel of every pixel\n"
+		"              (blue in BMP and TGA, red in PNM).\n"
+		"              '2' uses consecutive bytes of the pixel data, which\n"
+		"              touches a third of the memory. Decoding reads the\n"
+		"              layout from the header of <BMP>.\n\n"
+		" -k <KEY>     Seal (encrypt and authenticate) the payload with the\n"
+		"              key file <KEY>, made by keygen. Needed again to\n"
+		"              decode. Sealing takes %u bytes of the capacity.\n\n"
+		" -f           Add Reed-Solomon error correction when encoding, so\n"
+		"              up to %u damaged bytes in every %u can be repaired\n"
+		"              when decoding. Takes an eighth of the capacity.\n\n"
 		" -d           Decode [message | file] found in <BMP>.\n\n"
 		" -e <VAL>     <VAL> can be a message or a file name.\n"
-		"              When <TYPE> is 'message', <VAL> is encoded in <BMP>.\n"
-		"              When <TYPE> is 'file', <VAL> is the file to hide in <BMP>.\n"
-		, n);
+		"              When <TYPE> is 'message', <VAL> is encoded in <BMP>;\n"
+		"              '-' reads the message from stdin instead.\n"
+		"              When <TYPE> is 'file', <VAL> is the file to hide in <BMP>.\n\n"
+		" -u <VAL>,    Like -e, but replaces the data hidden in the stego\n"
+		" --update <VAL>\n"
+		"              image <BMP> in place, writing only the pixel bytes\n"
+		"              which change. The layout of <BMP> is kept.\n\n"
+		" -o <PATH>,   Write the stego image made by -e, or the file found\n"
+		" --output <PATH>\n"
+		"              by -d, to <PATH> instead of a new file in the current\n"
+		"              directory. <PATH> only appears once it is complete,\n"
+		"              replacing any file of that name at once.\n\n"
+		" --sync <POLICY>\n"
+		"              How far new or updated files are flushed to the disk.\n"
+		"              <POLICY> can be 'none' (default), 'data' (fdatasync)\n"
+		"              or 'full' (fsync, and the directory of a new file).\n\n"
+		, n, n, n, n, n, n, n, n, n, n, n, n, SEAL_OVERHEAD, FEC_PARITY / 2, FEC_N);
+	fprintf(stderr,
+		" --direct     Read <BMP>, and write the stego image made by -e, with\n"
+		"              O_DIRECT, so that huge images do not push other\n"
+		"              files out of the page cache. Falls back to buffered\n"
+		"              I/O where the file system refuses it.\n\n"
+		" -z <LEVEL>   Compression level of a PNG stego image, 0 (none,\n"
+		"              fastest) to 9 (smallest); default %u. It is\n"
+		"              compressed on one thread per CPU, in independent\n"
+		"              pieces of about %u KiB of rows.\n\n"
+		" --legacy     Let -d and -u take an image whose header does not\n"
+		"              mark it as a stego image, as older versions of steg\n"
+		"              could leave it. Such an image cannot be told from one\n"
+		"              which hides nothing.\n\n"
+		" --tune <KEY>=<VALUE>[,...]\n"
+		"              Override parameters of the tuning profile written by\n"
+		"              calibrate for this run: 'threads' (default threads\n"
+		"              of -j, 0 for one per CPU), 'chunk' (bytes sealed at\n"
+		"              a time by -k), 'direct' (1 acts as --direct),\n"
+		"              'direct_chunk' (bytes per O_DIRECT transfer) and\n"
+		"              'kernels' ('scalar', 'sse2' or 'avx2').\n\n"
+		, DEFLATE_DEF_LEVEL, PNG_SEGMENT_LEN >> 10);
+	fprintf(stderr,
+		"Modes:\n"
+		" analyze      Run the chi-square and RS attacks on each <BMP> and\n"
+		"              print a per-image score (0 = clean, 1 = embedded).\n"
+		"              -a analyzes all channels instead of only the first.\n"
+		"              -j <N> uses <N> threads (default: one per CPU).\n\n"
+		" scan         Walk each <DIR> and print the images which seem to\n"
+		"              carry a payload, reading only their first few hundred\n"
+		"              bytes. -m and -t restrict the methods and types looked\n"
+		"              for. -j <N> uses <N> threads (default: 4 per CPU).\n\n"
+		" batch        Run the jobs listed in the file <JOBS> ('-' for stdin).\n"
+		"              Each line holds a cover and a payload (a file name or\n"
+		"              a message, per -t) separated by a tab. Covers are kept\n"
+		"              in a cache of -C <MiB> (default 512) and shared\n"
+		"              copy-on-write between jobs. -j <N> uses <N> threads.\n\n"
+		" plan         Assign the payloads listed in <PAYLOADS> to the covers\n"
+		"              listed in <COVERS> (one per line, '-' for stdin), each\n"
+		"              payload to the smallest free cover it fits in. Only\n"
+		"              the headers of the covers are read. The assignment is\n"
+		"              printed as a job list for batch, or run directly with\n"
+		"              -x. -j <N> uses <N> threads (default: 4 per CPU).\n\n"
+		" keygen       Derive a new key file <KEY> for -k from a passphrase\n"
+		"              read from the terminal (or stdin), with a random salt\n"
+		"              and -i <N> PBKDF2 iterations (default %u).\n\n"
+		" serve        Listen on the Unix socket <SOCKET> for covers passed\n"
+		"              as file descriptors (memfds) by a program on the same\n"
+		"              host, and hide the payload of each request in place in\n"
+		"              the cover, which is mapped and then passed back. -t is\n"
+		"              chosen by each request. PNM and PNG covers are\n"
+		"              refused, as their headers would have to grow, or the\n"
+		"              whole file be compressed anew.\n\n"
+		" client       Copy <BMP> into a memfd, have the server at <SOCKET>\n"
+		"              hide the message or file given with -e in it, and save\n"
+		"              the result to <PATH>. A reference client for serve.\n\n"
+		" video        Hide the payload given with -e in the frames of <VIDEO>\n"
+		"              ('-' for stdin) as they stream by, or recover it with\n"
+		"              -d. <VIDEO> is YUV4MPEG2 (8-bit, the luma carries the\n"
+		"              data), or raw BGR24 frames of -s <W>x<H> pixels, which\n"
+		"              need the same -l again with -d. A file payload may be a\n"
+		"              pipe; each frame takes what it holds at the time. The\n"
+		"              frames, or the payload, go to -o <PATH> or stdout; a\n"
+		"              message revealed to stdout is printed as for images.\n\n"
+		" compare      Print the distortion of each <STEGO> against the\n"
+		"              <COVER> before it: per channel the MSE, PSNR, largest\n"
+		"              error, number of changed bytes and SSIM (8x8 tiles),\n"
+		"              and the PSNR over all channels. -j <N> uses <N>\n"
+		"              threads (default: one per CPU).\n\n"
+		" watch        Hide every payload file which lands in the directory\n"
+		"              <SPOOL> (or is there already) in the smallest cover of\n"
+		"              the directory <COVERS> it fits in, as soon as it is\n"
+		"              closed or moved in, and publish the image in <OUTDIR>\n"
+		"              with the suffix of the cover, like <payload>.bmp. The\n"
+		"              payload is removed, or renamed to <payload>.failed if\n"
+		"              it cannot be hidden. Covers are kept in a cache of -C\n"
+		"              <MiB> (default 512). -j <N> uses <N> threads (default:\n"
+		"              one per CPU).\n\n"
+		" calibrate    Benchmark the hiding and extracting kernels, memory\n"
+		"              bandwidth, sealing chunk sizes and file I/O in <DIR>\n"
+		"              (default: the current directory), and write the\n"
+		"              parameters which suit this machine best to -o <PATH>\n"
+		"              or the tuning profile which later runs load: $%s,\n"
+		"              or else $XDG_CACHE_HOME/%s. The defaults of -j\n"
+		"              above that say one per CPU then follow the profile.\n"
+		, KEYFILE_ITER, TUNE_ENV, TUNE_PROFILE);
 }
 
 // Returns true if arguments were parsed successfully, false otherwise.
 bool parse_args(int const argc, char * const *argv, struct Args * const args)
 {
-	char gtp;
+	int gtp;
+
+	for (size_t i = 0; argc > 1 && i < sizeof(modes) / sizeof(*modes); i++) {
+		if (strcmp(argv[1], modes[i].name) == 0)
+			return parse_mode_args(argc, argv, &modes[i], args);
+	}
 
-	while ((gtp = getopt(argc, argv, "hm:t:de:")) != -1) {
+	while ((gtp = getopt_long(argc, argv, "hm:t:de:l:u:k:fo:z:", longopts,
+				  NULL)) != -1) {
 		switch (gtp) {
 		case 'h':
 			print_usage(argv[0]);
 			return true;
 		case 'm':
-			args->mflag = true;
-			args->mmet = optarg;
-			if ((strncmp(args->mmet, "lsb", 3) != 0) &&
-			    (strncmp(args->mmet, "simple", 6) != 0)) {
-				fprintf(stderr,
-					"Option -%c only accepts '%s' or '%s'\n",
-					'm', "lsb", "simple");
+			if (!parse_method(optarg, args))
 				return false;
-			}
 			break;
 		case 't':
-			args->tflag = true;
-			args->ttyp = optarg;
-			if ((strncmp(args->ttyp, "message", 7) != 0) &&
-			    (strncmp(args->ttyp, "file", 4) != 0)) {
-				fprintf(stderr,
-					"Option -%c only accepts '%s' or '%s'\n",
-					't', "message", "file");
+			if (!parse_type(optarg, args))
 				return false;
-			}
 			break;
 		case 'd':
 			args->dflag = true;
@@ -78,8 +287,46 @@ bool parse_args(int const argc, char * const *argv, struct Args * const args)
 			args->eval = optarg;
 			args->evallen = strlen(args->eval);
 			break;
+		case 'u':
+			args->uflag = true;
+			args->eval = optarg;
+			args->evallen = strlen(args->eval);
+			break;
+		case 'l':
+			if (!parse_layout(optarg, args))
+				return false;
+			break;
+		case 'k':
+			args->kflag = true;
+			args->keyfile = optarg;
+			break;
+		case 'f':
+			args->fflag = true;
+			break;
+		case 'o':
+			args->outpath = optarg;
+			break;
+		case 'z':
+			if (!parse_level(optarg, &args->level))
+				return false;
+			break;
+		case OPT_SYNC:
+			if (!parse_sync(optarg, args))
+				return false;
+			break;
+		case OPT_LEGACY:
+			args->legacy = true;
+			break;
+		case OPT_DIRECT:
+			args->direct = true;
+			break;
+		case OPT_TUNE:
+			args->tunespec = optarg;
+			break;
 		case '?':
-			if (optopt == 'm' || optopt == 'e')
+			if (optopt == 'm' || optopt == 'e' || optopt == 'l' ||
+			    optopt == 'u' || optopt == 'k' || optopt == 'o' ||
+			    optopt == 'z')
 				fprintf(stderr,
 					"Option -%c requires an argument\n",
 					optopt);
@@ -97,7 +344,8 @@ bool parse_args(int const argc, char * const *argv, struct Args * const args)
 		}
 	}
 
-	if ((args->dflag && argc != 7) || (args->eflag && argc != 8)) {
+	/* Exactly one non-option argument, the BMP file, must remain */
+	if (optind != argc - 1) {
 		print_usage(argv[0]);
 		return false;
 	}
@@ -115,31 +363,397 @@ bool parse_args(int const argc, char * const *argv, struct Args * const args)
 		return false;
 	}
 
-	if (!(args->dflag || args->eflag)) {
+	if (!(args->dflag || args->eflag || args->uflag)) {
 		fprintf(stderr,
-			"Error: one of the two options (-%c, -%c) are "
-			"required \n", 'd', 'e');
+			"Error: one of the options (-%c, -%c, -%c) is "
+			"required \n", 'd', 'e', 'u');
 		return false;
 	}
 
-	if (args->dflag && args->eflag) {
+	if (args->dflag + args->eflag + args->uflag > 1) {
 		fprintf(stderr,
-			"Error: only one of the two options (-%c, -%c) are "
-			"allowed at the same time\n", 'd', 'e');
+			"Error: only one of the options (-%c, -%c, -%c) is "
+			"allowed at the same time\n", 'd', 'e', 'u');
+		return false;
+	}
+
+	char const vopt = args->uflag ? 'u' : 'e';
+
+	if ((args->eflag || args->uflag) && args->evallen == 0) {
+		fprintf(stderr, "Error: value to option -%c is empty\n", vopt);
+		return false;
+	}
+
+	/* Every update of a sealed payload would rewrite all of it */
+	if (args->uflag && args->kflag) {
+		fprintf(stderr, "Error: option -%c cannot be used with -%c\n",
+			'u', 'k');
+		return false;
+	}
+
+	/* Updates write the carrier bytes in the pixel order */
+	if (args->uflag && args->mflag &&
+	    strncmp(args->mmet, "adaptive", 8) == 0) {
+		fprintf(stderr, "Error: option -%c cannot be used with -%c %s\n",
+			'u', 'm', "adaptive");
+		return false;
+	}
+
+	/* An update keeps the error correction the image has */
+	if (args->uflag && args->fflag) {
+		fprintf(stderr, "Error: option -%c cannot be used with -%c\n",
+			'u', 'f');
+		return false;
+	}
+
+	/* Only a new image, or a revealed file, has somewhere to go */
+	if (args->outpath && !(args->eflag ||
+			       (args->dflag && strncmp(args->ttyp, "file", 4) == 0))) {
+		fprintf(stderr, "Error: option -%c needs -%c, or -%c with "
+			"files\n", 'o', 'e', 'd');
+		return false;
+	}
+
+	/* An update reads and writes only a few pixels anyway */
+	if (args->direct && args->uflag) {
+		fprintf(stderr, "Error: option --%s cannot be used with -%c\n",
+			"direct", 'u');
+		return false;
+	}
+
+	/* Hiding does not look for a payload already there */
+	if (args->legacy && args->eflag) {
+		fprintf(stderr, "Error: option --%s needs -%c or -%c\n",
+			"legacy", 'd', 'u');
+		return false;
+	}
+
+	if (args->outpath && *args->outpath == '\0') {
+		fprintf(stderr, "Error: value to option -%c is empty\n", 'o');
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * Parses the options of the sub-command described by |desc|, which follow the
+ * name of the sub-command in |argv|.
+ *
+ * Returns: true if arguments were parsed successfully, false otherwise.
+ */
+static bool parse_mode_args(int const argc, char * const *argv,
+			    struct Mode_desc const *desc,
+			    struct Args * const args)
+{
+	struct option const *lopts = desc->writes ? writeopts : readopts;
+	int gtp;
+
+	args->mode = desc->mode;
+	if (desc->mode == MODE_CALIBRATE)
+		lopts = noopts;
+
+	while ((gtp = getopt_long(argc - 1, argv + 1, desc->opts, lopts,
+				  NULL)) != -1) {
+		switch (gtp) {
+		case 'h':
+			print_usage(argv[0]);
+			return false;
+		case 'a':
+			args->aflag = true;
+			break;
+		case 'x':
+			args->xflag = true;
+			break;
+		case 'e':
+			args->eflag = true;
+			args->eval = optarg;
+			args->evallen = strlen(args->eval);
+			break;
+		case 'o':
+			args->outpath = optarg;
+			break;
+		case 'd':
+			args->dflag = true;
+			break;
+		case 's':
+			if (!parse_size(optarg, args))
+				return false;
+			break;
+		case 'k':
+			args->kflag = true;
+			args->keyfile = optarg;
+			break;
+		case 'f':
+			args->fflag = true;
+			break;
+		case 'i':
+			if (!parse_count(optarg, &args->iterations))
+				return false;
+			break;
+		case 'j':
+			if (!parse_threads(optarg, &args->nthreads))
+				return false;
+			break;
+		case 'z':
+			if (!parse_level(optarg, &args->level))
+				return false;
+			break;
+		case 'm':
+			if (!parse_method(optarg, args))
+				return false;
+			break;
+		case 't':
+			if (!parse_type(optarg, args))
+				return false;
+			break;
+		case 'l':
+			if (!parse_layout(optarg, args))
+				return false;
+			break;
+		case OPT_SYNC:
+			if (!parse_sync(optarg, args))
+				return false;
+			break;
+		case OPT_TUNE:
+			args->tunespec = optarg;
+			break;
+		case 'C': {
+			char *end;
+			unsigned long mb = strtoul(optarg, &end, 10);
+
+			if (*optarg == '\0' || *end != '\0' || mb == 0 ||
+			    mb > (SIZE_MAX >> 20)) {
+				fprintf(stderr, "Error: invalid cache size '%s'\n",
+					optarg);
+				return false;
+			}
+			args->cachemb = (size_t) mb;
+			break;
+		}
+		default:
+			return false;
+		}
+	}
+
+	/* |optind| is relative to |argv| + 1 */
+	args->files = argv + 1 + optind;
+	args->nfiles = (size_t) (argc - 1 - optind);
+
+	/* The directory calibrated in is the current one by default */
+	if (desc->mode == MODE_CALIBRATE && args->nfiles <= desc->nargs)
+		return true;
+
+	if (optind >= argc - 1) {
+		fprintf(stderr, "Error: no %s given to %s\n", desc->operand,
+			desc->name);
+		return false;
+	}
+
+	if (desc->needmt && (!args->mflag || !args->tflag)) {
+		fprintf(stderr, "Error: options -%c and -%c are required\n",
+			'm', 't');
+		return false;
+	}
+
+	if (desc->nargs && args->nfiles != desc->nargs) {
+		fprintf(stderr, "Error: %s takes a %s\n", desc->name,
+			desc->operand);
 		return false;
 	}
 
-	if (args->eflag && args->evallen == 0) {
+	/* Each stego image is measured against the cover before it */
+	if (desc->mode == MODE_COMPARE && args->nfiles % 2 != 0) {
+		fprintf(stderr, "Error: %s takes pairs of a %s\n", desc->name,
+			desc->operand);
+		return false;
+	}
+
+	/* Frames go by once, either to hide a payload or to recover it */
+	if (desc->mode == MODE_VIDEO && args->dflag + args->eflag != 1) {
+		fprintf(stderr, "Error: exactly one of the options -%c, -%c is "
+			"required\n", 'd', 'e');
+		return false;
+	}
+
+	if (desc->mode == MODE_VIDEO && args->eflag && args->evallen == 0) {
 		fprintf(stderr, "Error: value to option -%c is empty\n", 'e');
 		return false;
 	}
 
-	if (args->eflag && args->evallen > SUPPORTED_MAX_MSG_LEN) {
-		fprintf(stderr, "Error: max length for option -%c is %d\n",
-			'e', SUPPORTED_MAX_MSG_LEN);
+	/* The client sends a payload and saves the image it gets back */
+	if (desc->mode == MODE_CLIENT &&
+	    (!args->eflag || args->evallen == 0 || !args->outpath ||
+	     *args->outpath == '\0')) {
+		fprintf(stderr, "Error: options -%c and -%c are required\n",
+			'e', 'o');
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Parses the method given to -m into |args|.
+ *
+ * Returns: true if the method is supported, false otherwise.
+ */
+static bool parse_method(char const *val, struct Args * const args)
+{
+	args->mflag = true;
+	args->mmet = val;
+	if ((strncmp(args->mmet, "lsb", 3) != 0) &&
+	    (strncmp(args->mmet, "simple", 6) != 0) &&
+	    (strncmp(args->mmet, "adaptive", 8) != 0) &&
+	    (strncmp(args->mmet, "match", 5) != 0)) {
+		fprintf(stderr,
+			"Option -%c only accepts '%s', '%s', '%s' or '%s'\n",
+			'm', "lsb", "simple", "adaptive", "match");
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Parses the type given to -t into |args|.
+ *
+ * Returns: true if the type is supported, false otherwise.
+ */
+static bool parse_type(char const *val, struct Args * const args)
+{
+	args->tflag = true;
+	args->ttyp = val;
+	if ((strncmp(args->ttyp, "message", 7) != 0) &&
+	    (strncmp(args->ttyp, "file", 4) != 0)) {
+		fprintf(stderr,
+			"Option -%c only accepts '%s' or '%s'\n",
+			't', "message", "file");
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Parses the layout given to -l into |args|.
+ *
+ * Returns: true if the layout is supported, false otherwise.
+ */
+static bool parse_layout(char const *val, struct Args * const args)
+{
+	if (strcmp(val, "1") != 0 && strcmp(val, "2") != 0) {
+		fprintf(stderr,
+			"Option -%c only accepts '%s' or '%s'\n",
+			'l', "1", "2");
+		return false;
+	}
+
+	args->layout = val[0] == '2' ? LAYOUT_V2 : LAYOUT_V1;
+	return true;
+}
+
+/*
+ * Parses a thread count given to -j into |n|.
+ *
+ * Returns: true if |val| is a number between 1 and 1024, false otherwise.
+ */
+static bool parse_threads(char const *val, unsigned int *n)
+{
+	char *end;
+	unsigned long v = strtoul(val, &end, 10);
+
+	if (*val == '\0' || *end != '\0' || v == 0 || v > 1024) {
+		fprintf(stderr, "Error: invalid thread count '%s'\n", val);
+		return false;
+	}
+
+	*n = (unsigned int) v;
+	return true;
+}
+
+/*
+ * Parses a positive count, such as the iterations given to -i, into |n|.
+ *
+ * Returns: true if the count is valid, false otherwise.
+ */
+static bool parse_count(char const *val, unsigned int *n)
+{
+	char *end;
+	unsigned long v = strtoul(val, &end, 10);
+
+	if (*val == '\0' || *end != '\0' || v == 0 || v > UINT32_MAX) {
+		fprintf(stderr, "Error: invalid count '%s'\n", val);
+		return false;
+	}
+
+	*n = (unsigned int) v;
+	return true;
+}
+
+/*
+ * Parses the compression level given to -z into |level|.
+ *
+ * Returns: true if the level is valid, false otherwise.
+ */
+static bool parse_level(char const *val, unsigned int *level)
+{
+	char *end;
+	unsigned long v = strtoul(val, &end, 10);
+
+	if (*val == '\0' || *end != '\0' || v > DEFLATE_MAX_LEVEL) {
+		fprintf(stderr, "Error: invalid compression level '%s', "
+			"expected 0 to %u\n", val, DEFLATE_MAX_LEVEL);
 		return false;
 	}
 
+	*level = (unsigned int) v;
 	return true;
 }
 
+/*
+ * Parses the policy given to --sync into |args|.
+ *
+ * Returns: true if the policy is supported, false otherwise.
+ */
+static bool parse_sync(char const *val, struct Args * const args)
+{
+	static char const *const names[] = { "none", "data", "full" };
+
+	for (size_t i = 0; i < sizeof(names) / sizeof(*names); i++) {
+		if (strcmp(val, names[i]) == 0) {
+			args->sync = (enum Sync) i;
+			return true;
+		}
+	}
+
+	fprintf(stderr, "Option --%s only accepts '%s', '%s' or '%s'\n",
+		"sync", "none", "data", "full");
+	return false;
+}
+
+/*
+ * Parses the frame size "<W>x<H>" given to -s into |args|.
+ *
+ * Returns: true if the size is valid, false otherwise.
+ */
+static bool parse_size(char const *val, struct Args * const args)
+{
+	char *end;
+	unsigned long const w = strtoul(val, &end, 10);
+	unsigned long h = 0;
+
+	if (end != val && *end == 'x' && isdigit((unsigned char) end[1]))
+		h = strtoul(end + 1, &end, 10);
+
+	if (*end != '\0' || w == 0 || h == 0 || w > VIDEO_MAX_DIM ||
+	    h > VIDEO_MAX_DIM) {
+		fprintf(stderr, "Error: invalid frame size '%s'\n", val);
+		return false;
+	}
+
+	args->width = w;
+	args->height = h;
+	return true;
+}
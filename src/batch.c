@@ -0,0 +1,282 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../include/batch.h"
+
+/* A job list read by batch() */
+struct Batch_list {
+	struct Batch_job *jobs;
+	size_t           njobs;
+};
+
+/* State shared between the worker threads of run_batch() */
+struct Batch_pool {
+	struct Args const      *args;
+	struct Batch_job const *jobs;
+	size_t                 njobs;
+	size_t             next;   /* Index of the next job to run */
+	bool               failed; /* Set if any job failed */
+	struct Cover_cache cache;
+};
+
+static bool read_jobs(char const *fname, struct Batch_list * const list);
+static void *batch_worker(void *arg);
+static bool run_job(struct Batch_pool * const pool,
+		    struct Batch_job const * const job);
+
+/*
+ * This function is the public interface of the 'batch' mode. Each line of the
+ * job list |args->files[0]| ("-" for stdin) names a cover and the payload to
+ * hide in it (a file name, or the message itself), separated by a tab. Jobs
+ * run on a pool of worker threads which share a cache of parsed covers, and
+ * one line mapping each job to its output file is printed to stdout.
+ *
+ * Returns: true if every job succeeded, false otherwise.
+ */
+bool batch(struct Args const * const args)
+{
+	struct Batch_list list = { .jobs = NULL, .njobs = 0 };
+
+	if (!read_jobs(args->files[0], &list))
+		return false;
+
+	bool const ok = run_batch(args, list.jobs, list.njobs);
+
+	for (size_t i = 0; i < list.njobs; i++)
+		free(list.jobs[i].cover);
+	free(list.jobs);
+
+	return ok;
+}
+
+/*
+ * Runs the |njobs| jobs in |jobs| as described for batch(), with the method,
+ * type, layout, threads and cache size given in |args|.
+ *
+ * Returns: true if every job succeeded, false otherwise.
+ */
+bool run_batch(struct Args const * const args, struct Batch_job const *jobs,
+	       size_t const njobs)
+{
+	struct Batch_pool pool = {
+		.args = args,
+		.jobs = jobs,
+		.njobs = njobs,
+		.next = 0,
+		.failed = false
+	};
+
+	size_t const mb = args->cachemb ? args->cachemb : BATCH_CACHE_MB;
+	cache_init(&pool.cache, mb << 20);
+
+	size_t nthreads = args->nthreads ? args->nthreads : tune_threads();
+	if (nthreads > pool.njobs)
+		nthreads = pool.njobs;
+
+	pthread_t *tids = malloc((nthreads ? nthreads : 1) * sizeof(*tids));
+	if (!tids) {
+		perror("malloc");
+		cache_destroy(&pool.cache);
+		return false;
+	}
+
+	/* Progress messages of the jobs would interleave */
+	quiet = true;
+
+	size_t started = 0;
+	for (; started < nthreads; started++) {
+		if (pthread_create(&tids[started], NULL, batch_worker,
+				   &pool) != 0) {
+			perror("pthread_create");
+			break;
+		}
+	}
+
+	/* If no thread could be started, do the work on this one */
+	if (started == 0)
+		batch_worker(&pool);
+
+	for (size_t i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+
+	fprintf(stderr, "Cover cache: %zu hits, %zu misses, %zu evictions\n",
+		pool.cache.hits, pool.cache.misses, pool.cache.evictions);
+
+	cache_destroy(&pool.cache);
+	free(tids);
+
+	return !pool.failed;
+}
+
+/*
+ * Reads the job list |fname| ("-" for stdin) into |list|. Empty lines and
+ * lines starting with '#' are skipped.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+static bool read_jobs(char const *fname, struct Batch_list * const list)
+{
+	bool const in = strcmp(fname, "-") == 0;
+	FILE *fp = in ? stdin : fopen(fname, "r");
+	size_t cap = 0;
+	size_t lineno = 0;
+	char *line = NULL;
+	size_t linecap = 0;
+	ssize_t len;
+	bool ok = true;
+
+	if (!fp) {
+		perror("fopen");
+		return false;
+	}
+
+	while ((len = getline(&line, &linecap, fp)) >= 0) {
+		lineno++;
+
+		while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+			line[--len] = '\0';
+		if (len == 0 || line[0] == '#')
+			continue;
+
+		char *tab = strchr(line, '\t');
+		if (!tab || tab == line || tab[1] == '\0') {
+			fprintf(stderr, "Error: %s:%zu: expected <cover><TAB>"
+				"<payload>\n", fname, lineno);
+			ok = false;
+			break;
+		}
+
+		if (list->njobs == cap) {
+			size_t const ncap = cap ? cap * 2 : 64;
+			struct Batch_job *jobs = realloc(list->jobs,
+							 ncap * sizeof(*jobs));
+			if (!jobs) {
+				perror("realloc");
+				ok = false;
+				break;
+			}
+			list->jobs = jobs;
+			cap = ncap;
+		}
+
+		/* The job owns the line, the payload points into it */
+		*tab = '\0';
+		list->jobs[list->njobs].cover = line;
+		list->jobs[list->njobs].payload = tab + 1;
+		list->njobs++;
+		line = NULL;
+		linecap = 0;
+	}
+
+	if (ferror(fp)) {
+		perror("getline");
+		ok = false;
+	}
+
+	free(line);
+	if (!in)
+		fclose(fp);
+
+	if (!ok) {
+		for (size_t i = 0; i < list->njobs; i++)
+			free(list->jobs[i].cover);
+		free(list->jobs);
+		list->jobs = NULL;
+		list->njobs = 0;
+	}
+
+	return ok;
+}
+
+/*
+ * Worker thread of run_batch(). Takes jobs off the shared pool until none are
+ * left.
+ */
+static void *batch_worker(void *arg)
+{
+	struct Batch_pool * const pool = arg;
+
+	for (;;) {
+		size_t const i = __atomic_fetch_add(&pool->next, 1,
+						    __ATOMIC_RELAXED);
+		if (i >= pool->njobs)
+			break;
+
+		if (!run_job(pool, &pool->jobs[i]))
+			__atomic_store_n(&pool->failed, true, __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+/*
+ * Hides the payload of |job| in a private view of its cover and prints the
+ * name of the output file.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+static bool run_job(struct Batch_pool * const pool,
+		    struct Batch_job const * const job)
+{
+	struct Args jargs = *pool->args;
+	struct BMP_file bmp;
+	struct Cover *cv;
+
+	jargs.eflag = true;
+	jargs.eval = job->payload;
+	jargs.evallen = strlen(job->payload);
+	/* The jobs already keep every thread busy, see texture_order() */
+	jargs.nthreads = 1;
+
+	if (!(cv = cache_get(&pool->cache, job->cover)))
+		return false;
+
+	/* Check the size up front, hide() would end the whole batch */
+	size_t need = jargs.evallen;
+	bool const hidefile = strncmp(jargs.ttyp, "file", 4) == 0;
+	struct stat st;
+
+	if (hidefile) {
+		if (stat(job->payload, &st) != 0 || !S_ISREG(st.st_mode)) {
+			fprintf(stderr, "Error: %s: not a regular file\n",
+				job->payload);
+			cache_release(&pool->cache, cv);
+			return false;
+		}
+		need = (size_t) st.st_size;
+	}
+
+	if (need > capacity(&cv->bmp, &jargs)) {
+		fprintf(stderr, "Error: %s: payload too large for %s\n",
+			hidefile ? job->payload : "message", job->cover);
+		cache_release(&pool->cache, cv);
+		return false;
+	}
+
+	if (!cover_map(cv, &bmp)) {
+		cache_release(&pool->cache, cv);
+		return false;
+	}
+
+	hide(&bmp, &jargs);
+	printf("%s\t%s\t%s\n", job->cover, hidefile ? job->payload : "-",
+	       bmp.outname);
+
+	cover_unmap(cv, &bmp);
+	cache_release(&pool->cache, cv);
+	return true;
+}
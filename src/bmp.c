@@ -16,27 +16,117 @@
  */
 
 #include "../include/bmp.h"
+#include "../include/carrier.h"
+#include "../include/crypto.h"
 #include "../include/helper.h"
+#include "../include/probe.h"
+#include "../include/tune.h"
 
-static size_t find_data_offset(FILE * const fp);
-static size_t find_dib_len(FILE * const fp);
-static void find_bpp(struct BMP_file * const bmp);
+/* Where the carrier bytes are in the pixel data, see carrier_map() */
+struct Carrier_map {
+	size_t run;   /* Carrier bytes per row */
+	size_t step;  /* Bytes from one carrier byte to the next in a row */
+	size_t pitch; /* Bytes from one row to the next */
+};
 
 /*
- * Initializes |bmp| struct with BMP information such as type of header,
- * header length, total file size, etc.
+ * Moves |n| bytes in or out of a run of carrier bytes |step| bytes apart from
+ * |p| on; see find_kernel(). |match|, for 1 bit only, hides them by LSB
+ * matching, in the direction of the bits of |r| laid out as those of |s|.
+ */
+struct Kernel {
+	unsigned int   bits; /* Bits hidden in every carrier byte */
+	size_t         step; /* Spacing of the carrier bytes, 0 for any */
+	enum Tune_simd simd; /* Widest vectors it needs, up to |tune.simd| */
+	void (*put)(unsigned char *p, size_t const step,
+		    unsigned char const *s, size_t const n);
+	void (*get)(unsigned char const *p, size_t const step,
+		    unsigned char *t, size_t const n);
+	void (*match)(unsigned char *p, size_t const step,
+		      unsigned char const *s, unsigned char const *r,
+		      size_t const n);
+};
+
+static bool bmp_match(unsigned char const *hdr, size_t const len);
+static bool bmp_probe(unsigned char const *hdr, size_t const len,
+		      struct BMP_file * const bmp, char *err,
+		      size_t const errlen);
+static size_t bmp_stamp(struct BMP_file const * const bmp,
+			unsigned char const *src, unsigned char *dst);
+static bool write_direct(int const fd, unsigned char const *buf,
+			 size_t const len);
+static uint32_t read_le16(unsigned char const *buf);
+static uint32_t read_le32(unsigned char const *buf);
+static struct Carrier_map carrier_map(struct BMP_file const * const bmp);
+static struct Kernel const *find_kernel(unsigned int const bits,
+					size_t const step);
+static void put_bits(struct BMP_file * const bmp, unsigned int const bits,
+		     size_t const d, unsigned char const *s,
+		     unsigned char const *r, size_t const len);
+static void match_bits(void const *key, size_t const c, unsigned char *r,
+		       size_t const n);
+static void put_copy(unsigned char *p, size_t const step,
+		     unsigned char const *s, size_t const n);
+static void get_copy(unsigned char const *p, size_t const step,
+		     unsigned char *t, size_t const n);
+static void put_qword_lsbs(unsigned char *p, size_t const step,
+			   unsigned char const *s, size_t const n);
+static void get_qword_lsbs(unsigned char const *p, size_t const step,
+			   unsigned char *t, size_t const n);
+static void match_qword_lsbs(unsigned char *p, size_t const step,
+			     unsigned char const *s, unsigned char const *r,
+			     size_t const n);
+#ifdef __SSE2__
+static void put_words(unsigned char *p, size_t const step,
+		      unsigned char const *s, size_t n);
+static void get_words(unsigned char const *p, size_t const step,
+		      unsigned char *t, size_t n);
+static void put_word_lsbs(unsigned char *p, size_t const step,
+			  unsigned char const *s, size_t const n);
+static void get_word_lsbs(unsigned char const *p, size_t const step,
+			  unsigned char *t, size_t const n);
+static void match_word_lsbs(unsigned char *p, size_t const step,
+			    unsigned char const *s, unsigned char const *r,
+			    size_t const n);
+#endif
+#ifdef BMP_AVX2
+static void put_word_lsbs_avx2(unsigned char *p, size_t const step,
+			       unsigned char const *s, size_t const n)
+	__attribute__((target("avx2")));
+static void get_word_lsbs_avx2(unsigned char const *p, size_t const step,
+			       unsigned char *t, size_t const n)
+	__attribute__((target("avx2")));
+static void match_word_lsbs_avx2(unsigned char *p, size_t const step,
+				 unsigned char const *s,
+				 unsigned char const *r, size_t const n)
+	__attribute__((target("avx2")));
+#endif
+
+/* The headers of a BMP file keep their length when they are stamped */
+struct Carrier_format const bmp_format = {
+	.name = "bmp",
+	.fixed_header = true,
+	.match = bmp_match,
+	.probe = bmp_probe,
+	.stamp = bmp_stamp
+};
+
+/*
+ * Initializes |bmp| struct with image information such as the file format,
+ * dimensions, total file size, etc.
  *
- * This function will also validate that the input file is a valid BMP file.
+ * This function will also validate that the input file is a supported image
+ * file, see probe_carrier().
  *
  * Returns: true if file is supported; false otherwise.
  */
 bool init_bmp(struct BMP_file * const bmp)
 {
-	unsigned char const expect[] = SUPPORTED_FILE_TYPE;
-	unsigned char marker[2];
+	unsigned char hdr[CARRIER_PROBE_LEN];
+	char err[128];
 	struct stat statbuf;
 
-	printf("Validating BMP file...\n");
+	info("Validating image file...\n");
 
 	int fd = fileno(bmp->fp);
 	if (fd < 0) {
@@ -53,13 +143,13 @@ bool init_bmp(struct BMP_file * const bmp)
 
 	/* printf("[DEBUG] size of file: %ld\n", statbuf.st_size); */
 
-	if (statbuf.st_size < SUPPORTED_MIN_FILE_SIZE) {
+	if (statbuf.st_size < CARRIER_MIN_FILE_SIZE) {
 		fprintf(stderr,
-			"Error: file is too small to be valid BMP file; possibly corrupt\n");
+			"Error: file is too small to be a valid image; possibly corrupt\n");
 		return false;
 	}
 
-	if (statbuf.st_size > SUPPORTED_MAX_FILE_SIZE) {
+	if (statbuf.st_size > CARRIER_MAX_FILE_SIZE) {
 		fprintf(stderr, "Error: file is too large\n");
 		return false;
 	}
@@ -68,59 +158,203 @@ bool init_bmp(struct BMP_file * const bmp)
 
 	/* Make sure to read from the beginning of the file */
 	rewind(bmp->fp);
-	if (fread(marker, 1, 2, bmp->fp) != 2 && !feof(bmp->fp)) {
+	size_t const hlen = fread(hdr, 1, sizeof(hdr), bmp->fp);
+	if (hlen != sizeof(hdr) && ferror(bmp->fp)) {
 		perror("fread");
 		clean_exit(bmp->fp, NULL, EXIT_FAILURE);
 	}
 
-	/* printf("[DEBUG] expect: %s\n", expect); */
-	/* printf("[DEBUG] marker: %c%c\n", marker[0], marker[1]); */
-
-	if (memcmp(marker, expect, 2) != 0) {
-		fprintf(stderr, "Error: unknown file format\n");
+	if (!probe_carrier(hdr, hlen, bmp, err, sizeof(err))) {
+		fprintf(stderr, "Error: %s\n", err);
 		return false;
 	}
 
-	bmp->diblen = find_dib_len(bmp->fp);
-	bmp->headerlen = BMPFILEHEADERLEN + bmp->diblen;
+	PROBE5(bmp__header, bmp->tot_size, bmp->data_off, bmp->width,
+	       bmp->height, bmp->bpp);
 
-	switch (bmp->diblen) {
-	case BITMAPCOREHEADERLEN:
-		bmp->type = BITMAPCOREHEADER;
-		break;
-	case OS22XBITMAPHEADERLEN:
-		bmp->type = OS22XBITMAPHEADER;
-		break;
-	case BITMAPINFOHEADERLEN:
-		bmp->type = BITMAPINFOHEADER;
-		break;
-	case BITMAPV4HEADERLEN:
-		bmp->type = BITMAPV4HEADER;
-		break;
-	case BITMAPV5HEADERLEN:
-		bmp->type = BITMAPV5HEADER;
-		break;
-	default:
-		fprintf(stderr, "Error: unknown DIB header found\n");
-		return false;
+	info("Found format: %s (%s)\n", bmp->fmt->name, bmp->chans);
+	if (!bmp->fmt->decode)
+		info("Found address of data section: [0x%08zx]\n",
+		     bmp->data_off);
+	info("Found bits per pixel: %u\n", bmp->bpp);
+	info("Found dimensions: %zux%zu (%s)\n", bmp->width, bmp->height,
+	     bmp->topdown ? "top-down" : "bottom-up");
+	info("Done validating image file.\n\n");
+
+	return true;
+}
+
+/*
+ * Like read_bmp(), but maps the file of |bmp| privately instead of reading
+ * its pixels into a buffer. A page of the mapping is the page of the page
+ * cache until it is written, which copies just that page. So an image hidden
+ * in this way and saved by create_bmp() passes through memory once, in that
+ * write, instead of once more on the way in. A file which cannot be mapped,
+ * or whose pixels are compressed, is read. |bmp->data| must be released with
+ * free_bmp().
+ */
+void map_bmp(struct BMP_file * const bmp)
+{
+	void *p = MAP_FAILED;
+
+	/* read_bmp() decodes compressed pixels, and reports missing ones */
+	if (!bmp->fmt->decode && bmp->tot_size > bmp->data_off)
+		p = mmap(NULL, bmp->tot_size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE, fileno(bmp->fp), 0);
+	if (p == MAP_FAILED) {
+		read_bmp(bmp);
+		return;
 	}
 
-	bmp->data_off = find_data_offset(bmp->fp);
-	find_bpp(bmp);
-	printf("Done validating BMP file.\n\n");
+	PROBE2(read__start, bmp->tot_size - bmp->data_off, 1);
 
-	return true;
+	/*
+	 * Pages are read ahead of the faults. MAP_POPULATE would instead copy
+	 * every page, as it populates a writable private mapping for writing.
+	 */
+	madvise(p, bmp->tot_size, MADV_SEQUENTIAL);
+
+	bmp->map = p;
+	bmp->data = (struct RGB *) ((unsigned char *) p + bmp->data_off);
+	bmp->datalen = bmp->tot_size - bmp->data_off;
+	PROBE2(read__done, bmp->datalen, 1);
+}
+
+/*
+ * Releases the pixel data of |bmp|, read by read_bmp() or mapped by
+ * map_bmp().
+ */
+void free_bmp(struct BMP_file * const bmp)
+{
+	if (bmp->map)
+		munmap(bmp->map, bmp->tot_size);
+	else if (bmp->direct)
+		free(bmp->direct);
+	else
+		free(bmp->data);
+
+	bmp->map = NULL;
+	bmp->direct = NULL;
+	bmp->data = NULL;
+}
+
+/*
+ * Like read_bmp(), but reads the whole file of |bmp| with O_DIRECT, past the
+ * page cache, into an aligned buffer, |tune.direct_chunk| bytes at a time.
+ * What O_DIRECT does not take, like the end of the file after its last whole
+ * block, is read buffered. A file system which refuses O_DIRECT, when the file
+ * is opened for it or at the first read, gets map_bmp() instead, and
+ * compressed pixels read_bmp(). create_bmp() writes an image read in this way
+ * (not mapped) with O_DIRECT too. |bmp->data| must be released with
+ * free_bmp().
+ */
+void read_direct(struct BMP_file * const bmp)
+{
+	int const fd = fileno(bmp->fp);
+	int const fl = fcntl(fd, F_GETFL);
+	size_t const tot = bmp->tot_size;
+	size_t const whole = tot - tot % DIRECT_ALIGN;
+	void *buf = NULL;
+	size_t off = 0;
+
+	/* Compressed pixels are decoded into a buffer anyway */
+	if (bmp->fmt->decode) {
+		read_bmp(bmp);
+		return;
+	}
+
+	/* map_bmp() reports a file without pixels */
+	if (tot <= bmp->data_off || fl < 0 ||
+	    fcntl(fd, F_SETFL, fl | O_DIRECT) != 0) {
+		info("O_DIRECT refused, reading buffered\n");
+		map_bmp(bmp);
+		return;
+	}
+
+	/* With room for the end of the file after its last whole block */
+	if (posix_memalign(&buf, DIRECT_ALIGN, whole + DIRECT_ALIGN) != 0) {
+		perror("posix_memalign");
+		clean_exit(bmp->fp, NULL, EXIT_FAILURE);
+	}
+
+	PROBE2(read__start, tot - bmp->data_off, 2);
+	while (off < whole) {
+		size_t const want = whole - off < tune.direct_chunk ?
+		    whole - off : tune.direct_chunk;
+		ssize_t const n = pread(fd, (unsigned char *) buf + off, want,
+					(off_t) off);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		off += (size_t) n;
+
+		/* A short read would leave the next one unaligned */
+		if (off % DIRECT_ALIGN)
+			break;
+	}
+
+	fcntl(fd, F_SETFL, fl);
+
+	/*
+	 * Refused at the first read, not at open: mapped instead, and without
+	 * |bmp->direct| create_bmp() does not try O_DIRECT either
+	 */
+	if (off == 0 && whole > 0) {
+		PROBE2(read__done, 0, 2);
+		free(buf);
+		info("O_DIRECT refused, reading buffered\n");
+		map_bmp(bmp);
+		return;
+	}
+
+	if (!pread_full(fd, (unsigned char *) buf + off, tot - off,
+			(off_t) off)) {
+		perror("pread");
+		free(buf);
+		clean_exit(bmp->fp, NULL, EXIT_FAILURE);
+	}
+
+	bmp->direct = buf;
+	bmp->data = (struct RGB *) ((unsigned char *) buf + bmp->data_off);
+	bmp->datalen = tot - bmp->data_off;
+	PROBE2(read__done, bmp->datalen, 2);
+	info("Read %zu RGB values from input.\n", bmp->datalen);
 }
 
 /*
  * Read the RGB pixels (data) of the BMP file.
  * Populates the |bmp| struct with the RGB data and the length of the data.
+ * Pixels which the format compresses, as PNG does, are decoded.
  */
 void read_bmp(struct BMP_file * const bmp)
 {
 	struct RGB *data;
 	size_t rgblen;
 
+	/* Compressed pixels are decoded, all of them, into a buffer */
+	if (bmp->fmt->decode) {
+		char err[128];
+
+		PROBE2(read__start, bmp->datalen, 3);
+		if (!(data = malloc(bmp->datalen))) {
+			perror("malloc");
+			clean_exit(bmp->fp, NULL, EXIT_FAILURE);
+		}
+
+		if (!load_carrier(bmp, fileno(bmp->fp), (unsigned char *) data,
+				  bmp->datalen, err, sizeof(err))) {
+			fprintf(stderr, "Error: %s\n", err);
+			clean_exit(bmp->fp, data, EXIT_FAILURE);
+		}
+
+		bmp->data = data;
+		PROBE2(read__done, bmp->datalen, 3);
+		info("Decoded %zu RGB values from input.\n", bmp->datalen);
+		return;
+	}
+
 	/* Find length of data section */
 	if (fseek(bmp->fp, 0L, SEEK_END) < 0) {
 		perror("fseek");
@@ -145,6 +379,7 @@ void read_bmp(struct BMP_file * const bmp)
 	}
 
 	/* printf("[DEBUG] rgblen: %zu\n", rgblen); */
+	PROBE2(read__start, rgblen, 0);
 	if (!(data = malloc(rgblen))) {
 		perror("malloc");
 		clean_exit(bmp->fp, NULL, EXIT_FAILURE);
@@ -157,145 +392,1053 @@ void read_bmp(struct BMP_file * const bmp)
 
 	bmp->datalen = rgblen;
 	bmp->data = data;
-	printf("Read %zu RGB values from input.\n", rgblen);
+	PROBE2(read__done, rgblen, 0);
+	info("Read %zu RGB values from input.\n", rgblen);
 }
 
 /*
- * Creates a steganographic BMP file out of |bmp->data|. The header for the
- * new BMP file is copied from the source file.
+ * Creates a steganographic image file out of |bmp->data|, in the format of
+ * its cover, see write_carrier(). The headers for the new file are made from
+ * |bmp->header|, or from the source file if that is NULL. The file is
+ * |bmp->outpath|, which appears complete or not at all; without one, a new
+ * file whose name is stored in |bmp->outname|. It is flushed to the disk as
+ * |bmp->sync| asks. An image read with read_direct() is written with
+ * O_DIRECT, if stamping keeps the length of its headers.
  *
  * Return: file descriptor of new file.
  */
 int create_bmp(struct BMP_file * const bmp)
 {
 	int tmpfd;
-	unsigned char *header;
-	size_t hlen = bmp->headerlen;
-	char tmpfname[] = "fileXXXXXX";
+	unsigned char *header = NULL;
+	size_t const hlen = bmp->data_off;
+	struct Out_file out;
+	char const *name = bmp->outpath ? bmp->outpath : bmp->outname;
 
-	if (!(header = malloc(hlen))) {
-		perror("malloc");
-		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
+	if (bmp->outpath) {
+		if (!out_open(&out, bmp->outpath)) {
+			fprintf(stderr, "Error: could not create %s: %s\n",
+				bmp->outpath, strerror(errno));
+			clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
+		}
+		tmpfd = out.fd;
+	} else {
+		memcpy(bmp->outname, "fileXXXXXX", sizeof(bmp->outname));
+		if ((tmpfd = mkstemp(bmp->outname)) < 0) {
+			perror("mkstemp");
+			clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
+		}
 	}
 
-	if ((tmpfd = mkstemp(tmpfname)) < 0) {
-		perror("mkstemp");
-		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
-	}
+	/*
+	 * The whole image is in the aligned buffer of read_direct(), unless
+	 * stamping would change the length of its headers, moving the pixels.
+	 */
+	bool const direct = bmp->direct && bmp->fmt->fixed_header;
+	unsigned char const *src = bmp->header ? bmp->header : bmp->direct;
 
-	rewind(bmp->fp);
-	if (fread(header, 1, hlen, bmp->fp) != hlen && !feof(bmp->fp)) {
-		perror("fread");
-		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
+	if (!direct && !src) {
+		if (!(header = malloc(hlen))) {
+			perror("malloc");
+			clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
+		}
+		if (pread(fileno(bmp->fp), header, hlen, 0) != (ssize_t) hlen) {
+			perror("pread");
+			clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
+		}
+		src = header;
 	}
 
-	if (write(tmpfd, header, hlen) < 0) {
-		perror("write");
+	/* The pixels of a compressed format are counted before compression */
+	size_t const wlen = bmp->fmt->encode ? bmp->datalen :
+	    hlen + bmp->datalen;
+
+	/* A short write would leave a truncated image behind */
+	PROBE2(write__start, wlen, tmpfd);
+	if (direct)
+		stamp_carrier(bmp, bmp->direct, bmp->direct);
+	if (direct ? !write_direct(tmpfd, bmp->direct, hlen + bmp->datalen) :
+	    !write_carrier(bmp, src, tmpfd)) {
+		fprintf(stderr, "Error: could not write %s: %s\n", name,
+			strerror(errno));
+		if (bmp->outpath)
+			out_abort(&out);
+		else
+			unlink(bmp->outname);
 		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
 	}
+	PROBE2(write__done, wlen, tmpfd);
 
-	if (write(tmpfd, bmp->data, bmp->datalen) < 0) {
-		perror("write");
+	bool const ok = bmp->outpath ? out_publish(&out, bmp->sync) :
+	    sync_fd(tmpfd, bmp->sync) &&
+	    (bmp->sync != SYNC_FULL || sync_dir(bmp->outname));
+	if (!ok) {
+		fprintf(stderr, "Error: could not save %s: %s\n", name,
+			strerror(errno));
+		if (bmp->outpath)
+			out_abort(&out);
 		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
 	}
 
-	printf("Created steganographic file: %s\n", tmpfname);
+	info("Created steganographic file: %s\n", name);
 	free(header);
 
 	return tmpfd;
 }
 
 /*
- * Finds offset at which the data of BMP file resides. This is where the RGB
- * pixel data is stored.
- * Source: https://en.wikipedia.org/wiki/BMP_file_format#Bitmap_file_header
+ * Number of bytes in |bmp->data| which can carry hidden data in the layout
+ * of |bmp|: the blue channel of every pixel for LAYOUT_V1, every byte of the
+ * pixels for LAYOUT_V2. With BMP_FLAG_ROWS the padding at the end of each row
+ * is skipped; images hidden before that flag see the pixel data as one row.
+ */
+size_t carriers(struct BMP_file const * const bmp)
+{
+	struct Carrier_map const m = carrier_map(bmp);
+	size_t len = bmp->datalen;
+
+	/* Anything after the last row, like a color profile, is left alone */
+	if ((bmp->flags & BMP_FLAG_ROWS) && len > bmp->height * bmp->rowlen)
+		len = bmp->height * bmp->rowlen;
+
+	if (!m.pitch)
+		return len / m.step;
+
+	/* Whole rows, then the whole pixels of a cut-off last row */
+	size_t const rest = len % m.pitch / m.step;
+	return len / m.pitch * m.run + (rest < m.run ? rest : m.run);
+}
+
+/*
+ * Returns: the offset in |bmp->data| of carrier byte |c|.
+ */
+size_t carrier_off(struct BMP_file const * const bmp, size_t const c)
+{
+	struct Carrier_map const m = carrier_map(bmp);
+
+	if (!m.pitch)
+		return c * m.step;
+	return c / m.run * m.pitch + c % m.run * m.step;
+}
+
+/*
+ * Returns: the first carrier byte of the row which holds carrier byte |c|,
+ * or |c| itself where rows are not padded. Carrier bytes can be addressed
+ * relative to it in a copy of the pixel data starting at its offset.
+ */
+size_t carrier_row(struct BMP_file const * const bmp, size_t const c)
+{
+	struct Carrier_map const m = carrier_map(bmp);
+
+	return m.pitch ? c - c % m.run : c;
+}
+
+/*
+ * Hides the |len| bytes of |src| in the carrier bytes starting at carrier
+ * byte |d|, |bits| bits (1 or 8) in each, least significant bits first: every
+ * byte of |src| takes 8 / |bits| carrier bytes, whose other bits are kept.
+ * With 8 the carrier bytes are replaced, with 1 only their LSBs. Carrier
+ * bytes are numbered in |bmp->order| if it is set.
+ */
+void carrier_put(struct BMP_file * const bmp, unsigned int const bits,
+		 size_t const d, void const *src, size_t const len)
+{
+	unsigned char const *s = src;
+	unsigned char r[MATCH_CHUNK];
+
+	if (!bmp->match || bits != 1) {
+		put_bits(bmp, bits, d, s, NULL, len);
+		return;
+	}
+
+	/* The directions of a chunk are drawn just before it is hidden */
+	for (size_t off = 0; off < len; off += MATCH_CHUNK) {
+		size_t const n = len - off < MATCH_CHUNK ? len - off :
+		    MATCH_CHUNK;
+
+		match_bits(bmp->match, d + 8 * off, r, n);
+		put_bits(bmp, bits, d + 8 * off, s + off, r, n);
+	}
+}
+
+/*
+ * Extracts |len| bytes hidden with carrier_put() at carrier byte |d|, |bits|
+ * bits in each carrier byte, into |dst|.
+ */
+void carrier_get(struct BMP_file const * const bmp, unsigned int const bits,
+		 size_t const d, void *dst, size_t const len)
+{
+	struct Carrier_map const m = carrier_map(bmp);
+	struct Kernel const *k = find_kernel(bits, m.step);
+	unsigned char const *px = (unsigned char const *) bmp->data;
+	unsigned char *t = dst;
+	unsigned int const mask = (1U << bits) - 1;
+	size_t const per = 8 / bits;
+	size_t const total = per * len;
+
+	if (bmp->order) {
+		for (size_t c = 0; c < total; c++) {
+			if (c % per == 0)
+				t[c / per] = 0;
+			t[c / per] |= (unsigned char)
+			    ((px[bmp->order[d + c]] & mask) << (c % per * bits));
+		}
+		return;
+	}
+
+	for (size_t c = 0; c < total;) {
+		size_t const col = m.pitch ? (d + c) % m.run : d + c;
+		size_t n = !m.pitch || total - c < m.run - col ? total - c :
+		    m.run - col;
+		unsigned char const *p = px +
+		    (m.pitch ? (d + c) / m.run * m.pitch : 0) + col * m.step;
+
+		for (; n > 0 && (c % per != 0 || n < per); n--, c++, p += m.step) {
+			if (c % per == 0)
+				t[c / per] = 0;
+			t[c / per] |= (unsigned char) ((*p & mask) <<
+						       (c % per * bits));
+		}
+
+		k->get(p, m.step, t + c / per, n / per);
+		c += n / per * per;
+	}
+}
+
+/*
+ * Whether the first |len| bytes of a file, |hdr|, are those of a BMP file.
+ */
+static bool bmp_match(unsigned char const *hdr, size_t const len)
+{
+	return len >= 2 && memcmp(hdr, SUPPORTED_FILE_TYPE, 2) == 0;
+}
+
+/*
+ * Parses the headers found in the first |len| bytes of a BMP file, |hdr|, into
+ * |bmp|, see struct Carrier_format.
  *
- * Returns: byte offset where the data portion begins.
+ * Returns: true if file is supported; false otherwise.
  */
-static size_t find_data_offset(FILE * const fp)
+static bool bmp_probe(unsigned char const *hdr, size_t const len,
+		      struct BMP_file * const bmp, char *err,
+		      size_t const errlen)
 {
-	unsigned char addr[4];
+	if (len < BMPFILEHEADERLEN + 4 || bmp->tot_size < len) {
+		snprintf(err, errlen, "file is too small to be valid BMP file; "
+			 "possibly corrupt");
+		return false;
+	}
 
-	/* Seek to 10th byte containing address of data section (4 bytes) */
-	if (fseek(fp, 10L, SEEK_SET) < 0) {
-		perror("fseek");
-		clean_exit(fp, NULL, EXIT_FAILURE);
+	/*
+	 * Length of the DIB header.
+	 * Source:
+	 * https://en.wikipedia.org/wiki/BMP_file_format#DIB_header_.28bitmap_information_header.29
+	 */
+	bmp->diblen = read_le32(hdr + 14);
+	bmp->headerlen = BMPFILEHEADERLEN + bmp->diblen;
+
+	switch (bmp->diblen) {
+	case BITMAPCOREHEADERLEN:
+		bmp->type = BITMAPCOREHEADER;
+		break;
+	case OS22XBITMAPHEADERLEN:
+		bmp->type = OS22XBITMAPHEADER;
+		break;
+	case BITMAPINFOHEADERLEN:
+		bmp->type = BITMAPINFOHEADER;
+		break;
+	case BITMAPV4HEADERLEN:
+		bmp->type = BITMAPV4HEADER;
+		break;
+	case BITMAPV5HEADERLEN:
+		bmp->type = BITMAPV5HEADER;
+		break;
+	default:
+		snprintf(err, errlen, "unknown DIB header found");
+		return false;
 	}
 
-	if (fread(addr, 1, 4, fp) != 4 && !feof(fp)) {
-		perror("fread");
-		clean_exit(fp, NULL, EXIT_FAILURE);
+	/*
+	 * Offset at which the RGB pixel data resides.
+	 * Source: https://en.wikipedia.org/wiki/BMP_file_format#Bitmap_file_header
+	 */
+	bmp->data_off = read_le32(hdr + 10);
+	if (bmp->data_off < bmp->headerlen || bmp->tot_size <= bmp->data_off) {
+		snprintf(err, errlen, "file seems to be missing its data "
+			 "section; possibly corrupt");
+		return false;
 	}
 
-	/* BMP files are in little-endian */
-	printf("Found address of data section: [0x%02x%02x%02x%02x]\n",
-	       addr[3], addr[2], addr[1], addr[0]);
+	/*
+	 * There are two different locations for the bits per pixel which depend
+	 * on the type of header. If the header type is BITMAPCOREHEADER then it's
+	 * located in the 24th byte, otherwise, it's the 28th byte, followed by
+	 * the compression method.
+	 */
+	size_t const bpp_off = bmp->type == BITMAPCOREHEADER ? 24 : 28;
+	size_t const need = bmp->type == BITMAPCOREHEADER ? bpp_off + 2 :
+	    bpp_off + 6;
+	if (len < need) {
+		snprintf(err, errlen, "file is too small to be valid BMP file; "
+			 "possibly corrupt");
+		return false;
+	}
 
-	size_t offset = (size_t) *((unsigned int *) addr);
+	unsigned int const bpp = read_le16(hdr + bpp_off);
+	if (bpp != SUPPORTED_BPP && bpp != SUPPORTED_BPP_ALPHA) {
+		snprintf(err, errlen, "only %u or %u bits per pixel supported, "
+			 "found %u", SUPPORTED_BPP, SUPPORTED_BPP_ALPHA, bpp);
+		return false;
+	}
 
-	return offset;
+	/*
+	 * 32 bpp pixels often come with channel masks. Only those whose first
+	 * byte is the blue channel are taken, so that it is never the alpha.
+	 */
+	uint32_t const comp = bmp->type == BITMAPCOREHEADER ? BI_RGB :
+	    read_le32(hdr + 30);
+	if (comp == BI_BITFIELDS && bpp == SUPPORTED_BPP_ALPHA) {
+		if (len < BMP_BLUE_MASK_OFF + 4 ||
+		    read_le32(hdr + BMP_BLUE_MASK_OFF) != 0xFFU) {
+			snprintf(err, errlen, "only 32 bpp channel masks with "
+				 "blue in the first byte are supported");
+			return false;
+		}
+	} else if (comp != BI_RGB) {
+		snprintf(err, errlen, "compressed BMP files are not supported");
+		return false;
+	}
+
+	/*
+	 * The dimensions follow the header length; those of BITMAPCOREHEADER
+	 * are 16 bits wide. A negative height means the rows are stored from
+	 * the top of the image down.
+	 */
+	int32_t w, h;
+	if (bmp->type == BITMAPCOREHEADER) {
+		w = (int16_t) read_le16(hdr + 18);
+		h = (int16_t) read_le16(hdr + 20);
+	} else {
+		w = (int32_t) read_le32(hdr + 18);
+		h = (int32_t) read_le32(hdr + 22);
+	}
+
+	if (w <= 0 || h == 0 || h == INT32_MIN) {
+		snprintf(err, errlen, "invalid image dimensions %dx%d",
+			 (int) w, (int) h);
+		return false;
+	}
+
+	bmp->pxlen = bpp / 8;
+	bmp->chans = bpp == SUPPORTED_BPP ? "bgr" : "bgra";
+	bmp->width = (size_t) w;
+	bmp->height = (size_t) (h < 0 ? -h : h);
+	bmp->topdown = h < 0;
+
+	/* Every row is padded to a multiple of 4 bytes */
+	bmp->rowlen = (bmp->width * bpp + 31) / 32 * 4;
+
+	/* Images without hidden data (or from older versions) hold 0 here */
+	unsigned int const layout = read_le16(hdr + BMP_LAYOUT_OFF);
+	bmp->layout = layout == 0 ? LAYOUT_V1 : layout;
+	bmp->flags = read_le16(hdr + BMP_FLAGS_OFF);
+
+	bmp->bpp = bpp;
+	return true;
 }
 
 /*
- * Finds the length of DIB header.
- * Source:
- * https://en.wikipedia.org/wiki/BMP_file_format#DIB_header_.28bitmap_information_header.29
+ * Copies the |bmp->data_off| bytes of headers of a BMP file, |src|, to |dst|,
+ * recording the layout and flags of the data hidden in |bmp| in its reserved
+ * fields.
  *
- * Returns: length of DIB header.
+ * Returns: the length of the headers.
  */
-static size_t find_dib_len(FILE * const fp)
+static size_t bmp_stamp(struct BMP_file const * const bmp,
+			unsigned char const *src, unsigned char *dst)
 {
-	unsigned char buf[4];
+	unsigned int const layout = bmp->layout == LAYOUT_V1 ? 0 : bmp->layout;
 
-	if (fseek(fp, 14L, SEEK_SET) < 0) {
-		perror("fseek");
-		clean_exit(fp, NULL, EXIT_FAILURE);
+	memmove(dst, src, bmp->data_off);
+	dst[BMP_LAYOUT_OFF] = (unsigned char) layout;
+	dst[BMP_LAYOUT_OFF + 1] = (unsigned char) (layout >> 8);
+	dst[BMP_FLAGS_OFF] = (unsigned char) bmp->flags;
+	dst[BMP_FLAGS_OFF + 1] = (unsigned char) (bmp->flags >> 8);
+	return bmp->data_off;
+}
+
+/*
+ * Writes the |len| bytes of |buf|, a buffer aligned for O_DIRECT, to the
+ * start of |fd| with O_DIRECT, |tune.direct_chunk| bytes at a time. What
+ * O_DIRECT does not take, like the end after the last whole block, or
+ * everything if the file system refuses it, is written buffered; so is the
+ * rest after an error, which reports it again if it persists.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+static bool write_direct(int const fd, unsigned char const *buf,
+			 size_t const len)
+{
+	int const fl = fcntl(fd, F_GETFL);
+	size_t const whole = len - len % DIRECT_ALIGN;
+	size_t off = 0;
+
+	if (fl >= 0 && fcntl(fd, F_SETFL, fl | O_DIRECT) == 0) {
+		while (off < whole) {
+			size_t const want = whole - off < tune.direct_chunk ?
+			    whole - off : tune.direct_chunk;
+			ssize_t const n = pwrite(fd, buf + off, want,
+						 (off_t) off);
+
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				break;
+			off += (size_t) n;
+
+			if (off % DIRECT_ALIGN)
+				break;
+		}
+		fcntl(fd, F_SETFL, fl);
 	}
 
-	if (fread(buf, 1, 4, fp) != 4 && !feof(fp)) {
-		perror("fread");
-		clean_exit(fp, NULL, EXIT_FAILURE);
+	return pwrite_full(fd, buf + off, len - off, (off_t) off);
+}
+
+/*
+ * Reads a 16-bit little-endian value from |buf|.
+ */
+static uint32_t read_le16(unsigned char const *buf)
+{
+	return (uint32_t) buf[0] | ((uint32_t) buf[1] << 8);
+}
+
+/*
+ * Reads a 32-bit little-endian value from |buf|.
+ */
+static uint32_t read_le32(unsigned char const *buf)
+{
+	return (uint32_t) buf[0] | ((uint32_t) buf[1] << 8) |
+	    ((uint32_t) buf[2] << 16) | ((uint32_t) buf[3] << 24);
+}
+
+/*
+ * Works out where the carrier bytes of |bmp| are in its pixel data. A
+ * |pitch| of 0 means the carrier bytes are evenly spaced through the whole
+ * of it: images from before BMP_FLAG_ROWS, and those whose rows have no
+ * padding, where both mappings are the same.
+ */
+static struct Carrier_map carrier_map(struct BMP_file const * const bmp)
+{
+	struct Carrier_map m;
+	size_t const rowbytes = bmp->width * bmp->pxlen;
+
+	m.step = bmp->layout == LAYOUT_V2 ? 1 : bmp->pxlen;
+	m.run = bmp->layout == LAYOUT_V2 ? rowbytes : bmp->width;
+	m.pitch = bmp->rowlen;
+
+	if (!(bmp->flags & BMP_FLAG_ROWS) || bmp->rowlen == rowbytes)
+		m.pitch = 0;
+
+	return m;
+}
+
+/*
+ * LSB matching of the carrier byte |x| to the LSB of |bit|: if it differs, |x|
+ * goes up by 1 if the LSB of |up| is set and down by 1 otherwise, but up from
+ * 0 and down from 255 whatever |up| is.
+ *
+ * Returns: the new carrier byte.
+ */
+static inline unsigned char match_byte(unsigned int const x,
+				       unsigned int const bit,
+				       unsigned int const up)
+{
+	unsigned int const change = (x ^ bit) & 1;
+	unsigned int const inc = ((up & 1) | (x == 0)) & (x != 255);
+
+	/* Without a branch, which random directions would mispredict */
+	return (unsigned char) (x + 2 * (change & inc) - change);
+}
+
+/*
+ * carrier_put() of the |len| bytes of |s|, by LSB matching in the directions
+ * of the bits of |r| (one for each carrier byte, laid out as those of |s|) if
+ * it is not NULL.
+ */
+static void put_bits(struct BMP_file * const bmp, unsigned int const bits,
+		     size_t const d, unsigned char const *s,
+		     unsigned char const *r, size_t const len)
+{
+	struct Carrier_map const m = carrier_map(bmp);
+	struct Kernel const *k = find_kernel(bits, m.step);
+	unsigned char *px = (unsigned char *) bmp->data;
+	unsigned int const mask = (1U << bits) - 1;
+	size_t const per = 8 / bits;
+	size_t const total = per * len;
+
+	/* Scattered carrier bytes go one at a time */
+	if (bmp->order) {
+		for (size_t c = 0; c < total; c++) {
+			unsigned char * const p = px + bmp->order[d + c];
+			unsigned int const v = s[c / per] >> (c % per * bits);
+
+			*p = r ? match_byte(*p, v, r[c / 8] >> (c % 8)) :
+			    (unsigned char) ((*p & ~mask) | (v & mask));
+		}
+		return;
 	}
 
-	size_t len = (size_t) *((unsigned int *) buf);
-	printf("Found DIB header len: %zu\n", len);
+	/* One run of carrier bytes per row they touch */
+	for (size_t c = 0; c < total;) {
+		size_t const col = m.pitch ? (d + c) % m.run : d + c;
+		size_t n = !m.pitch || total - c < m.run - col ? total - c :
+		    m.run - col;
+		unsigned char *p = px + (m.pitch ? (d + c) / m.run * m.pitch : 0) +
+		    col * m.step;
+
+		/* The bits of a byte split over two rows go one carrier at a time */
+		for (; n > 0 && (c % per != 0 || n < per); n--, c++, p += m.step) {
+			unsigned int const v = s[c / per] >> (c % per * bits);
+
+			*p = r ? match_byte(*p, v, r[c / 8] >> (c % 8)) :
+			    (unsigned char) ((*p & ~mask) | (v & mask));
+		}
 
-	return len;
+		if (r)
+			k->match(p, m.step, s + c / per, r + c / per, n / per);
+		else
+			k->put(p, m.step, s + c / per, n / per);
+		c += n / per * per;
+	}
 }
 
 /*
- * Finds the bits per pixel used in BMP file. It is a 4 byte value
- * that is stored unsigned.
+ * Draws the directions of LSB matching for the 8 * |n| carrier bytes from
+ * carrier byte |c| on into |r|, one bit each, laid out as carrier_put() lays
+ * out the payload. That of carrier byte c is bit c of the keystream of |key|,
+ * so only the blocks of the keystream under the carrier bytes are made.
  */
-static void find_bpp(struct BMP_file * const bmp)
+static void match_bits(void const *key, size_t const c, unsigned char *r,
+		       size_t const n)
 {
-	unsigned char buf[4];
+	unsigned char ks[MATCH_CHUNK + 2 * CHACHA_BLOCK_LEN];
+	size_t const first = c / 8;
+	size_t const off = first % CHACHA_BLOCK_LEN;
+	unsigned int const shift = c % 8;
 
-	/*
-	 * There are two different locations for this value which depend on the
-	 * type of header. If the header type is BITMAPCOREHEADER then it's located
-	 * in the 24th byte, otherwise, it's the 28th byte.
-	 */
-	long check_byte = bmp->type == BITMAPCOREHEADER ? 24L : 28L;
+	chacha20_stream(key, (uint32_t) (first / CHACHA_BLOCK_LEN), ks,
+			off + n + 1);
 
-	if (fseek(bmp->fp, check_byte, SEEK_SET) < 0) {
-		perror("fseek");
-		clean_exit(bmp->fp, NULL, EXIT_FAILURE);
+	for (size_t i = 0; i < n; i++)
+		r[i] = (unsigned char) ((ks[off + i] >> shift) |
+					(ks[off + i + 1] << (8 - shift)));
+}
+
+/*
+ * put_copy() and get_copy() move the |n| bytes of whole, adjacent carrier
+ * bytes from |p| on.
+ */
+static void put_copy(unsigned char *p, size_t const step,
+		     unsigned char const *s, size_t const n)
+{
+	(void) step;
+	memcpy(p, s, n);
+}
+
+static void get_copy(unsigned char const *p, size_t const step,
+		     unsigned char *t, size_t const n)
+{
+	(void) step;
+	memcpy(t, p, n);
+}
+
+/*
+ * Loads 8 bytes at |p| as a little-endian word.
+ */
+static inline uint64_t load_le64(unsigned char const *p)
+{
+	uint64_t w;
+
+	memcpy(&w, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	w = __builtin_bswap64(w);
+#endif
+	return w;
+}
+
+/*
+ * Stores |w| as 8 little-endian bytes at |p|.
+ */
+static inline void store_le64(unsigned char *p, uint64_t w)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	w = __builtin_bswap64(w);
+#endif
+	memcpy(p, &w, 8);
+}
+
+/*
+ * Turns every non-zero byte of |x| into 1, leaving the zero ones 0.
+ */
+static inline uint64_t byte_nonzero(uint64_t const x)
+{
+	return ((((x & 0x7F7F7F7F7F7F7F7FULL) + 0x7F7F7F7F7F7F7F7FULL) | x) >> 7) &
+	    0x0101010101010101ULL;
+}
+
+/*
+ * Spreads the 8 bits of |byte| over the LSBs of the 8 bytes of a word, the
+ * least significant bit going to the lowest byte.
+ */
+static inline uint64_t lsb_spread(unsigned char const byte)
+{
+	uint64_t const lsbs = 0x0101010101010101ULL;
+
+	return byte_nonzero((byte * lsbs) & 0x8040201008040201ULL);
+}
+
+/*
+ * Gathers the LSBs of the 8 bytes of |w| into a byte, the LSB of the lowest
+ * byte becoming the least significant bit. This is the inverse of
+ * lsb_spread().
+ */
+static inline unsigned char lsb_gather(uint64_t const w)
+{
+	return (unsigned char) (((w & 0x0101010101010101ULL) *
+				 0x0102040810204080ULL) >> 56);
+}
+
+/*
+ * put_qword_lsbs() and get_qword_lsbs() hide and extract the |n| bytes in the
+ * LSBs of adjacent carrier bytes, one 64-bit word of them per byte.
+ */
+static void put_qword_lsbs(unsigned char *p, size_t const step,
+			   unsigned char const *s, size_t const n)
+{
+	uint64_t const mask = 0x0101010101010101ULL;
+
+	(void) step;
+	for (size_t i = 0; i < n; i++, p += 8)
+		store_le64(p, (load_le64(p) & ~mask) | lsb_spread(s[i]));
+}
+
+static void get_qword_lsbs(unsigned char const *p, size_t const step,
+			   unsigned char *t, size_t const n)
+{
+	(void) step;
+	for (size_t i = 0; i < n; i++, p += 8)
+		t[i] = lsb_gather(load_le64(p));
+}
+
+/*
+ * put_qword_lsbs() by LSB matching: 1 is added to the bytes of the word which
+ * change and go up, and taken from those which go down. Neither carries into
+ * the next byte, as 255 never goes up and 0 never down.
+ */
+static void match_qword_lsbs(unsigned char *p, size_t const step,
+			     unsigned char const *s, unsigned char const *r,
+			     size_t const n)
+{
+	uint64_t const lsbs = 0x0101010101010101ULL;
+
+	(void) step;
+	for (size_t i = 0; i < n; i++, p += 8) {
+		uint64_t const w = load_le64(p);
+		uint64_t const change = (w ^ lsb_spread(s[i])) & lsbs;
+		uint64_t const zero = byte_nonzero(w) ^ lsbs;
+		uint64_t const full = byte_nonzero(~w) ^ lsbs;
+		uint64_t const up = (lsb_spread(r[i]) | zero) & ~full;
+
+		store_le64(p, w + (change & up) - (change & ~up));
 	}
+}
 
-	if (fread(buf, 1, 4, bmp->fp) != 4 && !feof(bmp->fp)) {
-		perror("fread");
-		clean_exit(bmp->fp, NULL, EXIT_FAILURE);
+/*
+ * BITSTREAM(name, BITS, STEP) defines put_<name>() and get_<name>(), which
+ * hide |n| bytes in, and extract them from, the low BITS bits of every STEP-th
+ * byte from |p| on, least significant bits first. The bits go through a
+ * 64-bit accumulator, 8 bytes of the payload at a time. With constant BITS and
+ * STEP each instance gets a loop of its own with the shifts and the masks
+ * folded in; STEP may also be |step| for any spacing.
+ */
+#define BITSTREAM(name, BITS, STEP)					\
+static void put_##name(unsigned char *p, size_t const step,		\
+		       unsigned char const *s, size_t const n)		\
+{									\
+	unsigned int const mask = (1U << (BITS)) - 1;			\
+	size_t i = 0;							\
+									\
+	(void) step;							\
+	for (; i + 8 <= n; i += 8) {					\
+		uint64_t acc = load_le64(s + i);			\
+									\
+		for (unsigned int j = 0; j < 64 / (BITS); j++) {	\
+			*p = (unsigned char) ((*p & ~mask) |		\
+					      (unsigned int) (acc & mask)); \
+			acc >>= (BITS);					\
+			p += (STEP);					\
+		}							\
+	}								\
+									\
+	for (; i < n; i++) {						\
+		unsigned int b = s[i];					\
+									\
+		for (unsigned int j = 0; j < 8 / (BITS); j++) {		\
+			*p = (unsigned char) ((*p & ~mask) | (b & mask)); \
+			b >>= (BITS);					\
+			p += (STEP);					\
+		}							\
+	}								\
+}									\
+									\
+static void get_##name(unsigned char const *p, size_t const step,	\
+		       unsigned char *t, size_t const n)		\
+{									\
+	unsigned int const mask = (1U << (BITS)) - 1;			\
+	size_t i = 0;							\
+									\
+	/* Whole carrier bytes are better stored one by one */		\
+	(void) step;							\
+	for (; (BITS) < 8 && i + 8 <= n; i += 8) {			\
+		uint64_t acc = 0;					\
+									\
+		for (unsigned int j = 0; j < 64 / (BITS); j++) {	\
+			acc |= (uint64_t) (*p & mask) << (j * (BITS));	\
+			p += (STEP);					\
+		}							\
+		store_le64(t + i, acc);					\
+	}								\
+									\
+	for (; i < n; i++) {						\
+		unsigned int b = 0;					\
+									\
+		for (unsigned int j = 0; j < 8 / (BITS); j++) {		\
+			b |= (*p & mask) << (j * (BITS));		\
+			p += (STEP);					\
+		}							\
+		t[i] = (unsigned char) b;				\
+	}								\
+}
+
+BITSTREAM(bytes3, 8, 3)
+BITSTREAM(bytes4, 8, 4)
+BITSTREAM(bytes, 8, step)
+BITSTREAM(lsbs3, 1, 3)
+BITSTREAM(lsbs4, 1, 4)
+BITSTREAM(lsbs, 1, step)
+
+/*
+ * MATCHSTREAM(name, STEP) defines match_<name>(), put_<name>() for 1 bit by
+ * LSB matching, one carrier byte at a time.
+ */
+#define MATCHSTREAM(name, STEP)						\
+static void match_##name(unsigned char *p, size_t const step,		\
+			 unsigned char const *s, unsigned char const *r, \
+			 size_t const n)				\
+{									\
+	(void) step;							\
+	for (size_t i = 0; i < n; i++) {				\
+		for (unsigned int j = 0; j < 8; j++) {			\
+			*p = match_byte(*p, s[i] >> j, r[i] >> j);	\
+			p += (STEP);					\
+		}							\
+	}								\
+}
+
+MATCHSTREAM(lsbs3, 3)
+MATCHSTREAM(lsbs4, 4)
+MATCHSTREAM(lsbs, step)
+
+#ifdef __SSE2__
+/*
+ * Stores the |n| bytes of |s| in the low (blue) byte of the 32-bit pixels
+ * from |p| on, 16 pixels at a time.
+ */
+static void put_words(unsigned char *p, size_t const step,
+		      unsigned char const *s, size_t n)
+{
+	__m128i const keep = _mm_set1_epi32((int) 0xFFFFFF00U);
+	__m128i const zero = _mm_setzero_si128();
+
+	(void) step;
+	for (; n >= 16; n -= 16, s += 16, p += 64) {
+		__m128i const x = _mm_loadu_si128((__m128i const *) s);
+		__m128i const lo = _mm_unpacklo_epi8(x, zero);
+		__m128i const hi = _mm_unpackhi_epi8(x, zero);
+		__m128i const w[4] = {
+			_mm_unpacklo_epi16(lo, zero),
+			_mm_unpackhi_epi16(lo, zero),
+			_mm_unpacklo_epi16(hi, zero),
+			_mm_unpackhi_epi16(hi, zero)
+		};
+
+		for (unsigned int k = 0; k < 4; k++) {
+			__m128i *q = (__m128i *) (p + 16 * k);
+			__m128i const v = _mm_loadu_si128(q);
+
+			_mm_storeu_si128(q, _mm_or_si128(_mm_and_si128(v, keep),
+							 w[k]));
+		}
 	}
 
-	unsigned int bpp = *((unsigned int *) buf);
-	if (bpp != SUPPORTED_BPP) {
-		fprintf(stderr,
-			"Error: only %u bits per pixel supported, found %u\n",
-			SUPPORTED_BPP, bpp);
-		clean_exit(bmp->fp, NULL, EXIT_FAILURE);
+	for (size_t i = 0; i < n; i++)
+		p[4 * i] = s[i];
+}
+
+/*
+ * Loads the low (blue) byte of the |n| 32-bit pixels from |p| on into |t|,
+ * 16 pixels at a time.
+ */
+static void get_words(unsigned char const *p, size_t const step,
+		      unsigned char *t, size_t n)
+{
+	__m128i const low = _mm_set1_epi32(0xFF);
+
+	(void) step;
+	for (; n >= 16; n -= 16, t += 16, p += 64) {
+		__m128i w[4];
+
+		for (unsigned int k = 0; k < 4; k++)
+			w[k] = _mm_and_si128(_mm_loadu_si128(
+				(__m128i const *) (p + 16 * k)), low);
+
+		/* The values are below 256, so saturation never kicks in */
+		__m128i const lo = _mm_packs_epi32(w[0], w[1]);
+		__m128i const hi = _mm_packs_epi32(w[2], w[3]);
+		_mm_storeu_si128((__m128i *) t, _mm_packus_epi16(lo, hi));
 	}
 
-	printf("Found bits per pixel: %u\n", bpp);
-	bmp->bpp = bpp;
+	for (size_t i = 0; i < n; i++)
+		t[i] = p[4 * i];
+}
+
+/*
+ * put_lsbs4() for 32-bit pixels: each byte of |s| goes to the LSBs of 8
+ * pixels, two vectors of 4.
+ */
+static void put_word_lsbs(unsigned char *p, size_t const step,
+			  unsigned char const *s, size_t const n)
+{
+	__m128i const bit_lo = _mm_set_epi32(8, 4, 2, 1);
+	__m128i const bit_hi = _mm_set_epi32(128, 64, 32, 16);
+	__m128i const one = _mm_set1_epi32(1);
+	__m128i const keep = _mm_set1_epi32(~1);
+
+	(void) step;
+	for (size_t i = 0; i < n; i++, p += 32) {
+		__m128i const x = _mm_set1_epi32(s[i]);
+		__m128i const b0 = _mm_and_si128(_mm_cmpeq_epi32(
+			_mm_and_si128(x, bit_lo), bit_lo), one);
+		__m128i const b1 = _mm_and_si128(_mm_cmpeq_epi32(
+			_mm_and_si128(x, bit_hi), bit_hi), one);
+		__m128i * const q = (__m128i *) p;
+
+		_mm_storeu_si128(q, _mm_or_si128(_mm_and_si128(
+			_mm_loadu_si128(q), keep), b0));
+		_mm_storeu_si128(q + 1, _mm_or_si128(_mm_and_si128(
+			_mm_loadu_si128(q + 1), keep), b1));
+	}
+}
+
+/*
+ * get_lsbs4() for 32-bit pixels: the LSB of each pixel is moved to its sign
+ * bit, and the sign bits of 4 pixels are read at once.
+ */
+static void get_word_lsbs(unsigned char const *p, size_t const step,
+			  unsigned char *t, size_t const n)
+{
+	(void) step;
+	for (size_t i = 0; i < n; i++, p += 32) {
+		__m128i const *q = (__m128i const *) p;
+		int const lo = _mm_movemask_ps(_mm_castsi128_ps(
+			_mm_slli_epi32(_mm_loadu_si128(q), 31)));
+		int const hi = _mm_movemask_ps(_mm_castsi128_ps(
+			_mm_slli_epi32(_mm_loadu_si128(q + 1), 31)));
+
+		t[i] = (unsigned char) (lo | hi << 4);
+	}
+}
+
+/*
+ * LSB matching of the 4 pixels of |v| to the bits of |b|, in the directions of
+ * the bits of |r|, each 0 or 1 in a lane. Only the blue byte of a pixel moves,
+ * since 255 never goes up and 0 never down.
+ */
+static inline __m128i match_word4(__m128i const v, __m128i const b,
+				  __m128i const r)
+{
+	__m128i const one = _mm_set1_epi32(1);
+	__m128i const blue = _mm_and_si128(v, _mm_set1_epi32(0xFF));
+	__m128i const change = _mm_cmpeq_epi32(
+		_mm_and_si128(_mm_xor_si128(v, b), one), one);
+	__m128i const up = _mm_andnot_si128(
+		_mm_cmpeq_epi32(blue, _mm_set1_epi32(0xFF)),
+		_mm_or_si128(_mm_cmpeq_epi32(r, one),
+			     _mm_cmpeq_epi32(blue, _mm_setzero_si128())));
+
+	/* +1 where it goes up, -1 where it goes down */
+	__m128i const delta = _mm_sub_epi32(
+		_mm_and_si128(up, _mm_set1_epi32(2)), one);
+
+	return _mm_add_epi32(v, _mm_and_si128(change, delta));
+}
+
+/*
+ * put_word_lsbs() by LSB matching, see match_word4().
+ */
+static void match_word_lsbs(unsigned char *p, size_t const step,
+			    unsigned char const *s, unsigned char const *r,
+			    size_t const n)
+{
+	__m128i const bit_lo = _mm_set_epi32(8, 4, 2, 1);
+	__m128i const bit_hi = _mm_set_epi32(128, 64, 32, 16);
+	__m128i const one = _mm_set1_epi32(1);
+
+	(void) step;
+	for (size_t i = 0; i < n; i++, p += 32) {
+		__m128i const x = _mm_set1_epi32(s[i]);
+		__m128i const y = _mm_set1_epi32(r[i]);
+		__m128i const b0 = _mm_and_si128(_mm_cmpeq_epi32(
+			_mm_and_si128(x, bit_lo), bit_lo), one);
+		__m128i const b1 = _mm_and_si128(_mm_cmpeq_epi32(
+			_mm_and_si128(x, bit_hi), bit_hi), one);
+		__m128i const r0 = _mm_and_si128(_mm_cmpeq_epi32(
+			_mm_and_si128(y, bit_lo), bit_lo), one);
+		__m128i const r1 = _mm_and_si128(_mm_cmpeq_epi32(
+			_mm_and_si128(y, bit_hi), bit_hi), one);
+		__m128i * const q = (__m128i *) p;
+
+		_mm_storeu_si128(q, match_word4(_mm_loadu_si128(q), b0, r0));
+		_mm_storeu_si128(q + 1, match_word4(_mm_loadu_si128(q + 1),
+						    b1, r1));
+	}
+}
+#endif
+
+#ifdef BMP_AVX2
+/*
+ * put_word_lsbs() with the 8 pixels of a byte in one AVX2 vector.
+ */
+__attribute__((target("avx2")))
+static void put_word_lsbs_avx2(unsigned char *p, size_t const step,
+			       unsigned char const *s, size_t const n)
+{
+	__m256i const shift = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+	__m256i const one = _mm256_set1_epi32(1);
+	__m256i const keep = _mm256_set1_epi32(~1);
+
+	(void) step;
+	for (size_t i = 0; i < n; i++, p += 32) {
+		__m256i const bits = _mm256_and_si256(_mm256_srlv_epi32(
+			_mm256_set1_epi32(s[i]), shift), one);
+		__m256i * const q = (__m256i *) p;
+
+		_mm256_storeu_si256(q, _mm256_or_si256(_mm256_and_si256(
+			_mm256_loadu_si256(q), keep), bits));
+	}
+}
+
+/*
+ * get_word_lsbs() with the 8 pixels of a byte in one AVX2 vector.
+ */
+__attribute__((target("avx2")))
+static void get_word_lsbs_avx2(unsigned char const *p, size_t const step,
+			       unsigned char *t, size_t const n)
+{
+	(void) step;
+	for (size_t i = 0; i < n; i++, p += 32) {
+		__m256i const v = _mm256_loadu_si256((__m256i const *) p);
+
+		t[i] = (unsigned char) _mm256_movemask_ps(
+			_mm256_castsi256_ps(_mm256_slli_epi32(v, 31)));
+	}
+}
+
+/*
+ * match_word_lsbs() with the 8 pixels of a byte in one AVX2 vector.
+ */
+__attribute__((target("avx2")))
+static void match_word_lsbs_avx2(unsigned char *p, size_t const step,
+				 unsigned char const *s,
+				 unsigned char const *r, size_t const n)
+{
+	__m256i const shift = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+	__m256i const one = _mm256_set1_epi32(1);
+	__m256i const two = _mm256_set1_epi32(2);
+	__m256i const low = _mm256_set1_epi32(0xFF);
+	__m256i const zero = _mm256_setzero_si256();
+
+	(void) step;
+	for (size_t i = 0; i < n; i++, p += 32) {
+		__m256i * const q = (__m256i *) p;
+		__m256i const v = _mm256_loadu_si256(q);
+		__m256i const blue = _mm256_and_si256(v, low);
+		__m256i const b = _mm256_srlv_epi32(_mm256_set1_epi32(s[i]),
+						    shift);
+		__m256i const y = _mm256_and_si256(_mm256_srlv_epi32(
+			_mm256_set1_epi32(r[i]), shift), one);
+		__m256i const change = _mm256_cmpeq_epi32(_mm256_and_si256(
+			_mm256_xor_si256(v, b), one), one);
+		__m256i const up = _mm256_andnot_si256(
+			_mm256_cmpeq_epi32(blue, low),
+			_mm256_or_si256(_mm256_cmpeq_epi32(y, one),
+					_mm256_cmpeq_epi32(blue, zero)));
+		__m256i const delta = _mm256_sub_epi32(
+			_mm256_and_si256(up, two), one);
+
+		_mm256_storeu_si256(q, _mm256_add_epi32(v, _mm256_and_si256(
+			change, delta)));
+	}
+}
+#endif
+
+/*
+ * Picks the kernel for runs of carrier bytes |step| bytes apart with |bits|
+ * bits hidden in each. The first match in the table wins, so the vector and
+ * word kernels come before the BITSTREAM() ones, which fit any spacing last.
+ * Vector kernels wider than the tuning profile allows are passed over.
+ *
+ * Returns: the kernel.
+ */
+static struct Kernel const *find_kernel(unsigned int const bits,
+					size_t const step)
+{
+	static struct Kernel const kernels[] = {
+		{ 8, 1, TUNE_SIMD_NONE, put_copy, get_copy, NULL },
+		{ 1, 1, TUNE_SIMD_NONE, put_qword_lsbs, get_qword_lsbs,
+		  match_qword_lsbs },
+#ifdef BMP_AVX2
+		{ 1, 4, TUNE_SIMD_AVX2, put_word_lsbs_avx2, get_word_lsbs_avx2,
+		  match_word_lsbs_avx2 },
+#endif
+#ifdef __SSE2__
+		{ 8, 4, TUNE_SIMD_SSE2, put_words, get_words, NULL },
+		{ 1, 4, TUNE_SIMD_SSE2, put_word_lsbs, get_word_lsbs,
+		  match_word_lsbs },
+#endif
+		{ 8, 3, TUNE_SIMD_NONE, put_bytes3, get_bytes3, NULL },
+		{ 8, 4, TUNE_SIMD_NONE, put_bytes4, get_bytes4, NULL },
+		{ 1, 3, TUNE_SIMD_NONE, put_lsbs3, get_lsbs3, match_lsbs3 },
+		{ 1, 4, TUNE_SIMD_NONE, put_lsbs4, get_lsbs4, match_lsbs4 },
+		{ 8, 0, TUNE_SIMD_NONE, put_bytes, get_bytes, NULL },
+		{ 1, 0, TUNE_SIMD_NONE, put_lsbs, get_lsbs, match_lsbs }
+	};
+	size_t const n = sizeof(kernels) / sizeof(kernels[0]);
+
+	for (size_t i = 0; i < n; i++) {
+		struct Kernel const *k = &kernels[i];
+
+		if (k->bits != bits || (k->step && k->step != step) ||
+		    k->simd > tune.simd)
+			continue;
+#ifdef BMP_AVX2
+		if (k->simd == TUNE_SIMD_AVX2 &&
+		    !__builtin_cpu_supports("avx2"))
+			continue;
+#endif
+		return k;
+	}
+
+	return NULL;
 }
@@ -0,0 +1,520 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../include/cache.h"
+#include "../include/carrier.h"
+#include "../include/helper.h"
+
+/* Hits between two checks for memory pressure */
+#define CACHE_CHECK_INTERVAL 64U
+
+static struct Cover *cache_find(struct Cover_cache * const cache,
+			        struct stat const * const st);
+static struct Cover_load *load_find(struct Cover_cache * const cache,
+				    struct stat const * const st);
+static struct Cover *load_wait(struct Cover_cache * const cache,
+			       struct Cover_load * const ld);
+static void load_done(struct Cover_cache * const cache,
+		      struct Cover_load * const ld, struct Cover * const cv);
+static void cache_insert(struct Cover_cache * const cache,
+			 struct Cover * const cv);
+static struct Cover *cover_load(char const *fname);
+static void cover_free(struct Cover * const cv);
+static void cache_unlink(struct Cover_cache * const cache,
+			 struct Cover * const cv);
+static void cache_shrink(struct Cover_cache * const cache, size_t const need);
+static size_t mem_available(void);
+
+/*
+ * Initializes |cache| to hold at most |limit| bytes of pixel data.
+ */
+void cache_init(struct Cover_cache * const cache, size_t const limit)
+{
+	pthread_mutex_init(&cache->lock, NULL);
+	pthread_cond_init(&cache->loaded, NULL);
+	cache->loads = NULL;
+	cache->head = NULL;
+	cache->tail = NULL;
+	cache->bytes = 0;
+	cache->limit = limit;
+	cache->hits = 0;
+	cache->misses = 0;
+	cache->evictions = 0;
+}
+
+/*
+ * Releases every cover held by |cache|. No cover may still be in use.
+ */
+void cache_destroy(struct Cover_cache * const cache)
+{
+	while (cache->head) {
+		struct Cover * const cv = cache->head;
+
+		cache_unlink(cache, cv);
+		cover_free(cv);
+	}
+
+	pthread_cond_destroy(&cache->loaded);
+	pthread_mutex_destroy(&cache->lock);
+}
+
+/*
+ * Looks up the cover |fname| in |cache|, loading and validating it on a miss.
+ * The cover is keyed by the device, inode, size and modification time of the
+ * file, so a file which changed is loaded again. If another job is already
+ * loading it, this one waits for that load. The returned cover must be given
+ * back with cache_release().
+ *
+ * Returns: the cover, or NULL if it could not be loaded.
+ */
+struct Cover *cache_get(struct Cover_cache * const cache, char const *fname)
+{
+	struct stat st;
+	struct Cover *cv;
+
+	if (stat(fname, &st) != 0) {
+		fprintf(stderr, "Error: could not stat %s: %s\n", fname,
+			strerror(errno));
+		return NULL;
+	}
+
+	pthread_mutex_lock(&cache->lock);
+	if ((cv = cache_find(cache, &st))) {
+		cv->refs++;
+		if (++cache->hits % CACHE_CHECK_INTERVAL == 0)
+			cache_shrink(cache, 0);
+		pthread_mutex_unlock(&cache->lock);
+		return cv;
+	}
+
+	/* Another job is loading the same cover, its load is shared */
+	struct Cover_load *ld = load_find(cache, &st);
+	if (ld) {
+		cache->hits++;
+		cv = load_wait(cache, ld);
+		pthread_mutex_unlock(&cache->lock);
+		return cv;
+	}
+
+	/* Without the record, jobs which miss on it too load it again */
+	cache->misses++;
+	if ((ld = malloc(sizeof(*ld)))) {
+		ld->key = st;
+		ld->cover = NULL;
+		ld->done = false;
+		ld->waiters = 0;
+		ld->next = cache->loads;
+		cache->loads = ld;
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	/* Load without holding the lock, so other jobs can go on */
+	struct Cover *loaded = cover_load(fname);
+	if (!loaded) {
+		pthread_mutex_lock(&cache->lock);
+		load_done(cache, ld, NULL);
+		pthread_mutex_unlock(&cache->lock);
+		return NULL;
+	}
+
+	struct stat const key = {
+		.st_dev = loaded->dev,
+		.st_ino = loaded->ino,
+		.st_size = loaded->size,
+		.st_mtim = loaded->mtime
+	};
+
+	pthread_mutex_lock(&cache->lock);
+
+	/* The file may have changed into one cached in the meantime */
+	if ((cv = cache_find(cache, &key))) {
+		cv->refs++;
+		load_done(cache, ld, cv);
+		pthread_mutex_unlock(&cache->lock);
+		cover_free(loaded);
+		return cv;
+	}
+
+	cache_shrink(cache, loaded->bmp.datalen);
+
+	/* Only keep what fits, the job can use the cover either way */
+	if (cache->bytes + loaded->bmp.datalen <= cache->limit) {
+		cache_insert(cache, loaded);
+		loaded->refs++;
+	}
+	load_done(cache, ld, loaded);
+	pthread_mutex_unlock(&cache->lock);
+
+	return loaded;
+}
+
+/*
+ * Gives back a cover obtained with cache_get().
+ */
+void cache_release(struct Cover_cache * const cache, struct Cover * const cv)
+{
+	pthread_mutex_lock(&cache->lock);
+	bool const last = --cv->refs == 0;
+	pthread_mutex_unlock(&cache->lock);
+
+	if (last)
+		cover_free(cv);
+}
+
+/*
+ * Sets up |bmp| as a private, copy-on-write view of the cover |cv|. Writes to
+ * |bmp->data| only copy the pages they touch. The view must be removed with
+ * cover_unmap().
+ *
+ * Returns: true if successful, false otherwise.
+ */
+bool cover_map(struct Cover const * const cv, struct BMP_file * const bmp)
+{
+	*bmp = cv->bmp;
+
+	if (cv->memfd >= 0) {
+		void *p = mmap(NULL, bmp->datalen, PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE, cv->memfd, 0);
+		if (p == MAP_FAILED) {
+			perror("mmap");
+			return false;
+		}
+
+		bmp->data = p;
+		return true;
+	}
+
+	if (!(bmp->data = malloc(bmp->datalen))) {
+		perror("malloc");
+		return false;
+	}
+
+	memcpy(bmp->data, cv->pixels, bmp->datalen);
+	return true;
+}
+
+/*
+ * Removes a view of |cv| set up by cover_map().
+ */
+void cover_unmap(struct Cover const * const cv, struct BMP_file * const bmp)
+{
+	if (cv->memfd >= 0)
+		munmap(bmp->data, bmp->datalen);
+	else
+		free(bmp->data);
+
+	bmp->data = NULL;
+}
+
+/*
+ * Finds the cover whose key matches |st| in |cache| and moves it to the front
+ * of the LRU list. The lock of |cache| must be held.
+ *
+ * Returns: the cover, or NULL if it is not cached.
+ */
+static struct Cover *cache_find(struct Cover_cache * const cache,
+			        struct stat const * const st)
+{
+	struct Cover *cv;
+
+	for (cv = cache->head; cv; cv = cv->next) {
+		if (cv->dev == st->st_dev && cv->ino == st->st_ino &&
+		    cv->size == st->st_size &&
+		    cv->mtime.tv_sec == st->st_mtim.tv_sec &&
+		    cv->mtime.tv_nsec == st->st_mtim.tv_nsec)
+			break;
+	}
+
+	if (cv && cv != cache->head) {
+		cache_unlink(cache, cv);
+		cache_insert(cache, cv);
+	}
+
+	return cv;
+}
+
+/*
+ * Finds the load of the file whose key matches |st| in |cache|. The lock of
+ * |cache| must be held.
+ *
+ * Returns: the load, or NULL if the file is not being loaded.
+ */
+static struct Cover_load *load_find(struct Cover_cache * const cache,
+				    struct stat const * const st)
+{
+	struct Cover_load *ld;
+
+	for (ld = cache->loads; ld; ld = ld->next) {
+		if (ld->key.st_dev == st->st_dev &&
+		    ld->key.st_ino == st->st_ino &&
+		    ld->key.st_size == st->st_size &&
+		    ld->key.st_mtim.tv_sec == st->st_mtim.tv_sec &&
+		    ld->key.st_mtim.tv_nsec == st->st_mtim.tv_nsec)
+			break;
+	}
+
+	return ld;
+}
+
+/*
+ * Waits for the load |ld| to be over. The last waiter frees |ld|. The lock of
+ * |cache| must be held, and is released while waiting.
+ *
+ * Returns: the cover loaded, with a reference taken for this job, or NULL if
+ * it could not be loaded.
+ */
+static struct Cover *load_wait(struct Cover_cache * const cache,
+			       struct Cover_load * const ld)
+{
+	ld->waiters++;
+	while (!ld->done)
+		pthread_cond_wait(&cache->loaded, &cache->lock);
+
+	struct Cover * const cv = ld->cover;
+	if (--ld->waiters == 0)
+		free(ld);
+
+	return cv;
+}
+
+/*
+ * Ends the load |ld|, which may be NULL, with the cover |cv|, or NULL if it
+ * could not be loaded, and wakes the jobs waiting for it. Each of them gets a
+ * reference to |cv|. |ld| is freed here if no job waits for it. The lock of
+ * |cache| must be held.
+ */
+static void load_done(struct Cover_cache * const cache,
+		      struct Cover_load * const ld, struct Cover * const cv)
+{
+	if (!ld)
+		return;
+
+	struct Cover_load **p = &cache->loads;
+	while (*p != ld)
+		p = &(*p)->next;
+	*p = ld->next;
+
+	if (!ld->waiters) {
+		free(ld);
+		return;
+	}
+
+	if (cv)
+		cv->refs += ld->waiters;
+	ld->cover = cv;
+	ld->done = true;
+	pthread_cond_broadcast(&cache->loaded);
+}
+
+/*
+ * Links |cv| in at the front of the LRU list of |cache|. The lock of |cache|
+ * must be held.
+ */
+static void cache_insert(struct Cover_cache * const cache,
+			 struct Cover * const cv)
+{
+	cv->prev = NULL;
+	cv->next = cache->head;
+	if (cache->head)
+		cache->head->prev = cv;
+	cache->head = cv;
+	if (!cache->tail)
+		cache->tail = cv;
+
+	cv->cached = true;
+	cache->bytes += cv->bmp.datalen;
+}
+
+/*
+ * Validates the image file |fname| with init_bmp() and loads its headers and
+ * pixel data into a new cover, with a single reference.
+ *
+ * Returns: the cover, or NULL if it could not be loaded.
+ */
+static struct Cover *cover_load(char const *fname)
+{
+	struct Cover *cv = calloc(1, sizeof(*cv));
+	struct stat st;
+
+	if (!cv) {
+		perror("calloc");
+		return NULL;
+	}
+
+	cv->memfd = -1;
+	cv->refs = 1;
+
+	if (!(cv->bmp.fp = fopen(fname, "rb"))) {
+		perror("fopen");
+		free(cv);
+		return NULL;
+	}
+
+	int const fd = fileno(cv->bmp.fp);
+	if (fstat(fd, &st) != 0 || !init_bmp(&cv->bmp))
+		goto fail;
+
+	cv->dev = st.st_dev;
+	cv->ino = st.st_ino;
+	cv->size = st.st_size;
+	cv->mtime = st.st_mtim;
+
+	if (!(cv->bmp.header = malloc(cv->bmp.data_off))) {
+		perror("malloc");
+		goto fail;
+	}
+
+	if (!pread_full(fd, cv->bmp.header, cv->bmp.data_off, 0)) {
+		perror("pread");
+		goto fail;
+	}
+
+	/*
+	 * The pixels, decoded if need be, go into a memory file so jobs can map
+	 * them privately. If memory files are not available, jobs get a full
+	 * copy instead.
+	 */
+	char err[128];
+	cv->memfd = memfd_create("steg-cover", MFD_CLOEXEC);
+	if (cv->memfd >= 0) {
+		void *p = MAP_FAILED;
+
+		if (ftruncate(cv->memfd, (off_t) cv->bmp.datalen) != 0 ||
+		    (p = mmap(NULL, cv->bmp.datalen, PROT_READ | PROT_WRITE,
+			      MAP_SHARED, cv->memfd, 0)) == MAP_FAILED) {
+			perror("memfd");
+			goto fail;
+		}
+
+		bool const ok = load_carrier(&cv->bmp, fd, p, cv->bmp.datalen,
+					     err, sizeof(err));
+		munmap(p, cv->bmp.datalen);
+		if (!ok) {
+			fprintf(stderr, "Error: %s\n", err);
+			goto fail;
+		}
+	} else {
+		if (!(cv->pixels = malloc(cv->bmp.datalen))) {
+			perror("malloc");
+			goto fail;
+		}
+
+		if (!load_carrier(&cv->bmp, fd, (unsigned char *) cv->pixels,
+				  cv->bmp.datalen, err, sizeof(err))) {
+			fprintf(stderr, "Error: %s\n", err);
+			goto fail;
+		}
+	}
+
+	fclose(cv->bmp.fp);
+	cv->bmp.fp = NULL;
+	cv->bmp.data = NULL;
+	return cv;
+
+fail:
+	fprintf(stderr, "Error: could not load cover %s\n", fname);
+	cover_free(cv);
+	return NULL;
+}
+
+/*
+ * Frees |cv| and everything it holds.
+ */
+static void cover_free(struct Cover * const cv)
+{
+	if (cv->bmp.fp)
+		fclose(cv->bmp.fp);
+	if (cv->memfd >= 0)
+		close(cv->memfd);
+	free(cv->pixels);
+	free(cv->bmp.header);
+	free(cv);
+}
+
+/*
+ * Removes |cv| from the LRU list of |cache|. The reference held by the cache
+ * is kept. The lock of |cache| must be held.
+ */
+static void cache_unlink(struct Cover_cache * const cache,
+			 struct Cover * const cv)
+{
+	if (cv->prev)
+		cv->prev->next = cv->next;
+	else
+		cache->head = cv->next;
+
+	if (cv->next)
+		cv->next->prev = cv->prev;
+	else
+		cache->tail = cv->prev;
+
+	cv->prev = NULL;
+	cv->next = NULL;
+	cv->cached = false;
+	cache->bytes -= cv->bmp.datalen;
+}
+
+/*
+ * Evicts the least recently used covers until |need| more bytes fit within
+ * the limit of |cache| and the system is not short of memory. Covers which
+ * are still in use are freed by the last job releasing them. The lock of
+ * |cache| must be held.
+ */
+static void cache_shrink(struct Cover_cache * const cache, size_t const need)
+{
+	while (cache->tail) {
+		if (cache->bytes + need <= cache->limit &&
+		    mem_available() >= CACHE_LOW_MEMORY + need)
+			break;
+
+		struct Cover * const cv = cache->tail;
+
+		cache_unlink(cache, cv);
+		cache->evictions++;
+		if (--cv->refs == 0)
+			cover_free(cv);
+	}
+}
+
+/*
+ * Estimates how much memory the system can still hand out, in bytes.
+ *
+ * Returns: MemAvailable from /proc/meminfo, or the free RAM reported by
+ * sysinfo() if that is not available.
+ */
+static size_t mem_available(void)
+{
+	FILE *fp = fopen("/proc/meminfo", "r");
+	char line[128];
+	unsigned long kb;
+
+	if (fp) {
+		while (fgets(line, sizeof(line), fp)) {
+			if (sscanf(line, "MemAvailable: %lu kB", &kb) == 1) {
+				fclose(fp);
+				return (size_t) kb * 1024;
+			}
+		}
+		fclose(fp);
+	}
+
+	struct sysinfo si;
+	if (sysinfo(&si) != 0)
+		return SIZE_MAX;
+
+	return (size_t) (si.freeram + si.bufferram) * si.mem_unit;
+}
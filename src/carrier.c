@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../include/carrier.h"
+#include "../include/helper.h"
+#include "../include/png.h"
+#include "../include/pnm.h"
+#include "../include/tga.h"
+
+/*
+ * The formats, in the order they are tried. TGA has no magic number, so it
+ * comes last.
+ */
+static struct Carrier_format const *const formats[] = {
+	&bmp_format,
+	&png_format,
+	&pnm_format,
+	&tga_format
+};
+
+/*
+ * Finds the format of the file whose first |len| bytes are |hdr| and parses
+ * its headers into |bmp| with it, setting |bmp->fmt| and the length of the
+ * pixels, |bmp->datalen|. |bmp->tot_size| must hold the size of the file.
+ * Nothing is printed; on failure a description of the problem is stored in
+ * |err|.
+ *
+ * Returns: true if file is supported; false otherwise.
+ */
+bool probe_carrier(unsigned char const *hdr, size_t const len,
+		   struct BMP_file * const bmp, char *err, size_t const errlen)
+{
+	for (size_t i = 0; i < sizeof(formats) / sizeof(*formats); i++) {
+		if (!formats[i]->match(hdr, len))
+			continue;
+
+		bmp->fmt = formats[i];
+		if (!formats[i]->probe(hdr, len, bmp, err, errlen))
+			return false;
+		if (!formats[i]->decode)
+			bmp->datalen = bmp->tot_size - bmp->data_off;
+		return true;
+	}
+
+	snprintf(err, errlen, "unknown file format");
+	return false;
+}
+
+/*
+ * Reads the first |len| bytes of the pixels of |bmp| from its file, |fd|,
+ * into |dst|, decoding them if the format compresses them. On failure a
+ * description of the problem is stored in |err|.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+bool load_carrier(struct BMP_file const * const bmp, int const fd,
+		  unsigned char *dst, size_t const len, char *err,
+		  size_t const errlen)
+{
+	errno = 0;
+	if (!bmp->fmt->decode) {
+		if (pread_full(fd, dst, len, (off_t) bmp->data_off))
+			return true;
+		snprintf(err, errlen, "%s", errno ? strerror(errno) :
+			 "file is cut short");
+		return false;
+	}
+
+	/* The decoder sees the whole file, mapped or else read */
+	unsigned char *file = mmap(NULL, bmp->tot_size, PROT_READ, MAP_PRIVATE,
+				   fd, 0);
+	bool const mapped = file != MAP_FAILED;
+	if (!mapped) {
+		if (!(file = malloc(bmp->tot_size))) {
+			snprintf(err, errlen, "out of memory");
+			return false;
+		}
+		if (!pread_full(fd, file, bmp->tot_size, 0)) {
+			snprintf(err, errlen, "%s", errno ? strerror(errno) :
+				 "file is cut short");
+			free(file);
+			return false;
+		}
+	}
+
+	bool const ok = bmp->fmt->decode(bmp, file, dst, len, err, errlen);
+
+	if (mapped)
+		munmap(file, bmp->tot_size);
+	else
+		free(file);
+	return ok;
+}
+
+/*
+ * Writes the stego image |bmp| to the start of |fd|: the headers of its cover,
+ * the |bmp->data_off| bytes of |src|, stamped, followed by its pixels, or
+ * for a format which compresses them, the file encoded from them.
+ *
+ * Returns: true if successful, false otherwise, with |errno| set.
+ */
+bool write_carrier(struct BMP_file const * const bmp,
+		   unsigned char const *src, int const fd)
+{
+	if (bmp->fmt->encode)
+		return bmp->fmt->encode(bmp, src, fd);
+
+	unsigned char *header = malloc(bmp->data_off + CARRIER_STAMP_GROW);
+	if (!header)
+		return false;
+
+	size_t const hlen = stamp_carrier(bmp, src, header);
+	bool const ok = pwrite_full(fd, header, hlen, 0) &&
+	    pwrite_full(fd, bmp->data, bmp->datalen, (off_t) hlen);
+	int const err = errno;
+
+	free(header);
+	errno = err;
+	return ok;
+}
+
+/*
+ * Writes the headers of the stego image |bmp| to |dst|, which has room for
+ * |bmp->data_off| + CARRIER_STAMP_GROW bytes: the |bmp->data_off| bytes of
+ * the headers of its cover, |src|, with the layout and flags of |bmp|
+ * recorded in them. |src| and |dst| may be the same if the format has
+ * |fixed_header|.
+ *
+ * Returns: the length of the headers written.
+ */
+size_t stamp_carrier(struct BMP_file const * const bmp,
+		     unsigned char const *src, unsigned char *dst)
+{
+	return bmp->fmt->stamp(bmp, src, dst);
+}
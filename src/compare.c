@@ -0,0 +1,423 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../include/compare.h"
+
+#define SSIM_C1 6.5025  /* (0.01 * 255)^2, keeps dark tiles stable */
+#define SSIM_C2 58.5225 /* (0.03 * 255)^2, keeps flat tiles stable */
+
+/* State shared between the worker threads of compare() */
+struct Compare_pool {
+	struct Args const *args;
+	size_t next;    /* Index of the next pair to compare */
+	bool   failed;  /* Set if any pair could not be compared */
+};
+
+/*
+ * Sums over the rows of one strip of COMPARE_TILE rows, for every byte
+ * position of a row. Sums of samples fit in 16 bits and sums of products in
+ * 32 bits, whatever the values.
+ */
+struct Columns {
+	uint16_t      *x;       /* Samples of the first image */
+	uint16_t      *y;       /* Samples of the second image */
+	uint32_t      *xx;      /* Squares of the samples of the first image */
+	uint32_t      *yy;      /* Squares of the samples of the second image */
+	uint32_t      *xy;      /* Products of the two samples */
+	unsigned char *maxerr;  /* Largest absolute error */
+	unsigned char *changed; /* Samples which differ */
+};
+
+static void *compare_worker(void *arg);
+static bool compare_files(char const *aname, char const *bname, char *line,
+			  size_t const linelen);
+static bool load_image(char const *fname, struct BMP_file * const bmp);
+static void compare_row(unsigned char const *a, unsigned char const *b,
+			size_t const n, struct Columns * const col);
+static void compare_strip(struct Columns const * const col, size_t const width,
+			  unsigned int const pxlen, size_t const rows,
+			  struct Distortion res[COMPARE_CHANS]);
+
+/*
+ * This function is the public interface of the 'compare' mode. The images in
+ * |args->files| are taken in pairs of a cover and a stego image, which are
+ * compared on a pool of worker threads. The distortion of every pair is
+ * printed to stdout.
+ *
+ * Returns: true if every pair could be compared, false otherwise.
+ */
+bool compare(struct Args const * const args)
+{
+	struct Compare_pool pool = {
+		.args = args,
+		.next = 0,
+		.failed = false
+	};
+
+	size_t nthreads = args->nthreads ? args->nthreads : tune_threads();
+	if (nthreads > args->nfiles / 2)
+		nthreads = args->nfiles / 2;
+
+	pthread_t *tids = malloc(nthreads * sizeof(*tids));
+	if (!tids) {
+		perror("malloc");
+		return false;
+	}
+
+	/* Progress messages of init_bmp() and read_bmp() would interleave */
+	quiet = true;
+
+	size_t started = 0;
+	for (; started < nthreads; started++) {
+		if (pthread_create(&tids[started], NULL, compare_worker,
+				   &pool) != 0) {
+			perror("pthread_create");
+			break;
+		}
+	}
+
+	/* If no thread could be started, do the work on this one */
+	if (started == 0)
+		compare_worker(&pool);
+
+	for (size_t i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+
+	free(tids);
+	return !pool.failed;
+}
+
+/*
+ * Measures the distortion of each channel of the pixels of |b| against those
+ * of |a|, which must have the same dimensions and pixel length. The results
+ * are stored in |res|, indexed by channel (0 = blue, 1 = green, 2 = red,
+ * 3 = alpha in a BMP file, see |a->chans|).
+ *
+ * Returns: true if successful, false otherwise.
+ */
+bool compare_images(struct BMP_file const * const a,
+		    struct BMP_file const * const b,
+		    struct Distortion res[COMPARE_CHANS])
+{
+	size_t const rowbytes = a->width * a->pxlen;
+	struct Columns col;
+
+	memset(res, 0, COMPARE_CHANS * sizeof(*res));
+
+	/* All the sums of a strip are in one block, cleared between strips */
+	size_t const blocklen = rowbytes * (2 * sizeof(*col.x) +
+					    3 * sizeof(*col.xx) + 2);
+	unsigned char *block = malloc(blocklen ? blocklen : 1);
+	if (!block) {
+		perror("malloc");
+		return false;
+	}
+
+	col.xx = (uint32_t *) block;
+	col.yy = col.xx + rowbytes;
+	col.xy = col.yy + rowbytes;
+	col.x = (uint16_t *) (col.xy + rowbytes);
+	col.y = col.x + rowbytes;
+	col.maxerr = (unsigned char *) (col.y + rowbytes);
+	col.changed = col.maxerr + rowbytes;
+
+	unsigned char const *pa = (unsigned char const *) a->data;
+	unsigned char const *pb = (unsigned char const *) b->data;
+
+	/*
+	 * Rows are taken from the top of the picture, whichever way the files
+	 * store them, so that the tiles do not depend on it.
+	 */
+	for (size_t y0 = 0; y0 < a->height; y0 += COMPARE_TILE) {
+		size_t const rows = a->height - y0 < COMPARE_TILE ?
+		    a->height - y0 : COMPARE_TILE;
+
+		memset(block, 0, blocklen);
+		for (size_t y = y0; y < y0 + rows; y++) {
+			size_t const ya = a->topdown ? y : a->height - 1 - y;
+			size_t const yb = b->topdown ? y : b->height - 1 - y;
+
+			compare_row(pa + ya * a->rowlen, pb + yb * b->rowlen,
+				    rowbytes, &col);
+		}
+
+		compare_strip(&col, a->width, a->pxlen, rows, res);
+	}
+
+	free(block);
+	return true;
+}
+
+/*
+ * Worker thread of compare(). Takes pairs of images off the shared pool until
+ * none are left and prints one line of results per pair.
+ */
+static void *compare_worker(void *arg)
+{
+	struct Compare_pool * const pool = arg;
+	char line[2 * PATH_MAX + 512];
+
+	for (;;) {
+		size_t const i = __atomic_fetch_add(&pool->next, 1,
+						    __ATOMIC_RELAXED);
+		if (i >= pool->args->nfiles / 2)
+			break;
+
+		char const *aname = pool->args->files[2 * i];
+		char const *bname = pool->args->files[2 * i + 1];
+
+		if (compare_files(aname, bname, line, sizeof(line))) {
+			/* A single call keeps lines of different threads apart */
+			printf("%s\n", line);
+		} else {
+			fprintf(stderr, "Error: could not compare %s with %s\n",
+				aname, bname);
+			__atomic_store_n(&pool->failed, true, __ATOMIC_RELAXED);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Loads the images |aname| and |bname| and formats the distortion of every
+ * channel of |bname| against |aname| into |line|.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+static bool compare_files(char const *aname, char const *bname, char *line,
+			  size_t const linelen)
+{
+	struct Distortion res[COMPARE_CHANS];
+	struct BMP_file a, b;
+	bool ok = false;
+
+	if (!load_image(aname, &a))
+		return false;
+	if (!load_image(bname, &b)) {
+		free(a.data);
+		fclose(a.fp);
+		return false;
+	}
+
+	if (a.width != b.width || a.height != b.height ||
+	    strcmp(a.chans, b.chans) != 0) {
+		fprintf(stderr, "Error: %s is %zux%zu %s, %s is %zux%zu %s\n",
+			aname, a.width, a.height, a.chans, bname, b.width,
+			b.height, b.chans);
+		goto out;
+	}
+
+	if (!compare_images(&a, &b, res))
+		goto out;
+
+	size_t off = (size_t) snprintf(line, linelen, "%s\t%s", aname, bname);
+	uint64_t sse = 0;
+	size_t n = 0;
+
+	for (unsigned int c = 0; c < a.pxlen; c++) {
+		double const mse = res[c].n ? (double) res[c].sse / res[c].n : 0.0;
+		double const psnr = mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) :
+		    INFINITY;
+		double const ssim = res[c].ntiles ? res[c].ssim / res[c].ntiles :
+		    1.0;
+
+		sse += res[c].sse;
+		n += res[c].n;
+
+		if (off < linelen)
+			off += (size_t) snprintf(line + off, linelen - off,
+			    "\t%c: mse=%.6f psnr=%.2f max=%u changed=%zu "
+			    "ssim=%.6f", a.chans[c], mse, psnr, res[c].maxerr,
+			    res[c].changed, ssim);
+	}
+
+	double const mse = n ? (double) sse / n : 0.0;
+	if (off < linelen)
+		snprintf(line + off, linelen - off, "\tpsnr=%.2f",
+			 mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) :
+			 INFINITY);
+	ok = true;
+
+out:
+	free(a.data);
+	fclose(a.fp);
+	free(b.data);
+	fclose(b.fp);
+	return ok;
+}
+
+/*
+ * Opens and reads the image |fname| into |bmp|, whose pixel data the caller
+ * must free and whose file the caller must close.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+static bool load_image(char const *fname, struct BMP_file * const bmp)
+{
+	memset(bmp, 0, sizeof(*bmp));
+
+	if (!(bmp->fp = fopen(fname, "rb"))) {
+		perror("fopen");
+		return false;
+	}
+
+	if (!init_bmp(bmp)) {
+		fclose(bmp->fp);
+		return false;
+	}
+
+	read_bmp(bmp);
+
+	/* Every row must be there, the padding of the last one aside */
+	if (bmp->height && bmp->datalen < (bmp->height - 1) * bmp->rowlen +
+	    bmp->width * bmp->pxlen) {
+		fprintf(stderr, "Error: %s is missing pixel data; possibly "
+			"corrupt\n", fname);
+		free(bmp->data);
+		fclose(bmp->fp);
+		return false;
+	}
+
+	return true;
+}
+
+#ifdef __SSE2__
+/* Adds the 16-bit lanes of |v| to the 8 sums at |p| */
+static inline void add_u16(uint16_t *p, __m128i const v)
+{
+	__m128i * const q = (__m128i *) p;
+
+	_mm_storeu_si128(q, _mm_add_epi16(_mm_loadu_si128(q), v));
+}
+
+/* Adds the 16-bit lanes of |v|, widened, to the 8 sums at |p| */
+static inline void add_u32(uint32_t *p, __m128i const v)
+{
+	__m128i const zero = _mm_setzero_si128();
+	__m128i * const q = (__m128i *) p;
+
+	_mm_storeu_si128(q, _mm_add_epi32(_mm_loadu_si128(q),
+					  _mm_unpacklo_epi16(v, zero)));
+	_mm_storeu_si128(q + 1, _mm_add_epi32(_mm_loadu_si128(q + 1),
+					      _mm_unpackhi_epi16(v, zero)));
+}
+#endif
+
+/*
+ * Adds the |n| bytes of the rows |a| and |b| to the sums of their positions
+ * in |col|. A square of a byte fits in 16 bits, so the products are taken 8
+ * at a time before they are widened.
+ */
+static void compare_row(unsigned char const *a, unsigned char const *b,
+			size_t const n, struct Columns * const col)
+{
+	size_t i = 0;
+
+#ifdef __SSE2__
+	__m128i const zero = _mm_setzero_si128();
+	__m128i const one = _mm_set1_epi8(1);
+
+	for (; i + 16 <= n; i += 16) {
+		__m128i const x = _mm_loadu_si128((__m128i const *) (a + i));
+		__m128i const y = _mm_loadu_si128((__m128i const *) (b + i));
+		__m128i const d = _mm_or_si128(_mm_subs_epu8(x, y),
+					       _mm_subs_epu8(y, x));
+		__m128i * const pm = (__m128i *) (col->maxerr + i);
+		__m128i * const pc = (__m128i *) (col->changed + i);
+
+		_mm_storeu_si128(pm, _mm_max_epu8(_mm_loadu_si128(pm), d));
+		_mm_storeu_si128(pc, _mm_add_epi8(_mm_loadu_si128(pc),
+		    _mm_andnot_si128(_mm_cmpeq_epi8(d, zero), one)));
+
+		for (size_t h = 0; h < 2; h++) {
+			__m128i const xw = h ? _mm_unpackhi_epi8(x, zero) :
+			    _mm_unpacklo_epi8(x, zero);
+			__m128i const yw = h ? _mm_unpackhi_epi8(y, zero) :
+			    _mm_unpacklo_epi8(y, zero);
+			size_t const j = i + 8 * h;
+
+			add_u16(col->x + j, xw);
+			add_u16(col->y + j, yw);
+			add_u32(col->xx + j, _mm_mullo_epi16(xw, xw));
+			add_u32(col->yy + j, _mm_mullo_epi16(yw, yw));
+			add_u32(col->xy + j, _mm_mullo_epi16(xw, yw));
+		}
+	}
+#endif
+
+	for (; i < n; i++) {
+		unsigned int const x = a[i];
+		unsigned int const y = b[i];
+		unsigned int const d = x > y ? x - y : y - x;
+
+		if (d > col->maxerr[i])
+			col->maxerr[i] = (unsigned char) d;
+		col->changed[i] += d != 0;
+		col->x[i] += (uint16_t) x;
+		col->y[i] += (uint16_t) y;
+		col->xx[i] += x * x;
+		col->yy[i] += y * y;
+		col->xy[i] += x * y;
+	}
+}
+
+/*
+ * Adds the sums in |col| of a strip of |rows| rows of |width| pixels to
+ * |res|: the squared errors, since (x - y)^2 = x^2 + y^2 - 2xy, and the SSIM
+ * of each tile of COMPARE_TILE pixels across.
+ */
+static void compare_strip(struct Columns const * const col, size_t const width,
+			  unsigned int const pxlen, size_t const rows,
+			  struct Distortion res[COMPARE_CHANS])
+{
+	for (size_t t = 0; t < width; t += COMPARE_TILE) {
+		size_t const w = width - t < COMPARE_TILE ? width - t :
+		    COMPARE_TILE;
+		double const cnt = (double) (w * rows);
+
+		for (unsigned int c = 0; c < pxlen; c++) {
+			uint32_t sx = 0, sy = 0, sxx = 0, syy = 0, sxy = 0;
+
+			for (size_t p = t * pxlen + c; p < (t + w) * pxlen;
+			     p += pxlen) {
+				sx += col->x[p];
+				sy += col->y[p];
+				sxx += col->xx[p];
+				syy += col->yy[p];
+				sxy += col->xy[p];
+				res[c].changed += col->changed[p];
+				if (col->maxerr[p] > res[c].maxerr)
+					res[c].maxerr = col->maxerr[p];
+			}
+
+			res[c].sse += (uint64_t) sxx + syy - 2 * (uint64_t) sxy;
+			res[c].n += w * rows;
+
+			double const mx = sx / cnt;
+			double const my = sy / cnt;
+			double const vx = sxx / cnt - mx * mx;
+			double const vy = syy / cnt - my * my;
+			double const cxy = sxy / cnt - mx * my;
+
+			res[c].ssim += (2.0 * mx * my + SSIM_C1) *
+			    (2.0 * cxy + SSIM_C2) /
+			    ((mx * mx + my * my + SSIM_C1) * (vx + vy + SSIM_C2));
+			res[c].ntiles++;
+		}
+	}
+}
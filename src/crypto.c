@@ -0,0 +1,969 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../include/crypto.h"
+#include "../include/tune.h"
+
+#define ROTL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+/* One ChaCha20 quarter round on the words |a|, |b|, |c| and |d| */
+#define QUARTERROUND(a, b, c, d) do {                  \
+	a += b; d ^= a; d = ROTL32(d, 16);             \
+	c += d; b ^= c; b = ROTL32(b, 12);             \
+	a += b; d ^= a; d = ROTL32(d, 8);              \
+	c += d; b ^= c; b = ROTL32(b, 7);              \
+} while (0)
+
+#define POLY_MASK44 0xFFFFFFFFFFFULL
+#define POLY_MASK42 0x3FFFFFFFFFFULL
+
+/* Products of the 44-bit limbs of Poly1305 need 128 bits */
+__extension__ typedef unsigned __int128 uint128;
+
+static void chacha20_init(struct Chacha20 * const ctx,
+			  unsigned char const *key,
+			  unsigned char const *nonce, uint32_t const counter);
+static void chacha20_block(struct Chacha20 * const ctx, unsigned char *out);
+static void chacha20_xor(struct Chacha20 * const ctx, unsigned char *buf,
+			 size_t len);
+#ifdef __SSE2__
+static void chacha20_xor4(struct Chacha20 * const ctx, unsigned char *buf);
+#endif
+#ifdef CHACHA_AVX2
+static void chacha20_xor8(struct Chacha20 * const ctx, unsigned char *buf)
+	__attribute__((target("avx2")));
+#endif
+static void poly1305_init(struct Poly1305 * const ctx,
+			  unsigned char const *key);
+static void poly1305_blocks(struct Poly1305 * const ctx,
+			    unsigned char const *m, size_t len,
+			    uint64_t const hibit);
+static void poly1305_update(struct Poly1305 * const ctx,
+			    unsigned char const *m, size_t len);
+static void poly1305_finish(struct Poly1305 * const ctx, unsigned char *tag);
+static void sha256_init(struct Sha256 * const ctx);
+static void sha256_compress(struct Sha256 * const ctx,
+			    unsigned char const *block);
+static void sha256_update(struct Sha256 * const ctx, void const *data,
+			  size_t len);
+static void sha256_final(struct Sha256 * const ctx, unsigned char *out);
+static bool read_passphrase(char *buf, size_t const len, char const *prompt);
+static inline uint32_t load_le32(unsigned char const *p);
+static inline void store_le32(unsigned char *p, uint32_t const v);
+static inline uint64_t load_le64(unsigned char const *p);
+static inline void store_le64(unsigned char *p, uint64_t const v);
+
+static uint32_t const sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+	0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+	0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+	0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+	0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+	0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/*
+ * Starts sealing or opening a payload with |key| and |nonce|.
+ */
+void aead_init(struct Aead * const ctx, unsigned char const *key,
+	       unsigned char const *nonce)
+{
+	unsigned char block[CHACHA_BLOCK_LEN];
+
+	/* The one-time Poly1305 key is the start of keystream block 0 */
+	chacha20_init(&ctx->cipher, key, nonce, 0);
+	chacha20_block(&ctx->cipher, block);
+	poly1305_init(&ctx->mac, block);
+	ctx->len = 0;
+
+	memset(block, 0, sizeof(block));
+}
+
+/*
+ * Encrypts the |len| bytes of |buf| in place and authenticates them. Every
+ * call but the last must pass a multiple of CHACHA_BLOCK_LEN bytes.
+ */
+void aead_encrypt(struct Aead * const ctx, unsigned char *buf,
+		  size_t const len)
+{
+	chacha20_xor(&ctx->cipher, buf, len);
+	poly1305_update(&ctx->mac, buf, len);
+	ctx->len += len;
+}
+
+/*
+ * Authenticates the |len| bytes of |buf| and decrypts them in place. Every
+ * call but the last must pass a multiple of CHACHA_BLOCK_LEN bytes.
+ */
+void aead_decrypt(struct Aead * const ctx, unsigned char *buf,
+		  size_t const len)
+{
+	poly1305_update(&ctx->mac, buf, len);
+	chacha20_xor(&ctx->cipher, buf, len);
+	ctx->len += len;
+}
+
+/*
+ * Computes the tag of everything encrypted or decrypted with |ctx| into |tag|.
+ */
+void aead_final(struct Aead * const ctx, unsigned char *tag)
+{
+	unsigned char const zeros[16] = { 0 };
+	unsigned char lens[16];
+
+	/* Pad the ciphertext, then the lengths of the (empty) AAD and of it */
+	if (ctx->len % 16)
+		poly1305_update(&ctx->mac, zeros, 16 - ctx->len % 16);
+
+	store_le64(lens, 0);
+	store_le64(lens + 8, ctx->len);
+	poly1305_update(&ctx->mac, lens, sizeof(lens));
+	poly1305_finish(&ctx->mac, tag);
+
+	memset(ctx, 0, sizeof(*ctx));
+}
+
+/*
+ * Compares the tags |a| and |b| in constant time.
+ *
+ * Returns: true if they are equal, false otherwise.
+ */
+bool aead_tag_equal(unsigned char const *a, unsigned char const *b)
+{
+	unsigned char d = 0;
+
+	for (size_t i = 0; i < POLY1305_TAG_LEN; i++)
+		d |= a[i] ^ b[i];
+
+	return d == 0;
+}
+
+/*
+ * Fills |buf| with the |len| bytes of the ChaCha20 keystream of |key|, under
+ * an all-zero nonce, from block |counter| on. Any stretch of it can be made
+ * without the blocks before, so it serves as a keyed, counter-based random
+ * number generator.
+ */
+void chacha20_stream(unsigned char const *key, uint32_t const counter,
+		     unsigned char *buf, size_t const len)
+{
+	unsigned char const nonce[CHACHA_NONCE_LEN] = { 0 };
+	struct Chacha20 ctx;
+
+	chacha20_init(&ctx, key, nonce, counter);
+	memset(buf, 0, len);
+	chacha20_xor(&ctx, buf, len);
+
+	memset(&ctx, 0, sizeof(ctx));
+}
+
+/*
+ * Fills |buf| with |len| bytes from the system random number generator.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+bool random_bytes(void *buf, size_t len)
+{
+	unsigned char *p = buf;
+
+	while (len > 0) {
+		ssize_t const n = getrandom(p, len, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+
+		p += n;
+		len -= (size_t) n;
+	}
+
+	return true;
+}
+
+/*
+ * Derives |dklen| bytes into |dk| from |pass| and |salt| with
+ * PBKDF2-HMAC-SHA256 and |iter| iterations.
+ */
+void pbkdf2_sha256(unsigned char const *pass, size_t const passlen,
+		   unsigned char const *salt, size_t const saltlen,
+		   uint32_t const iter, unsigned char *dk, size_t const dklen)
+{
+	unsigned char key[SHA256_BLOCK_LEN] = { 0 };
+	unsigned char pad[SHA256_BLOCK_LEN];
+	struct Sha256 inner, outer, ctx;
+
+	/* Keys longer than a block are hashed first */
+	if (passlen > SHA256_BLOCK_LEN) {
+		sha256_init(&ctx);
+		sha256_update(&ctx, pass, passlen);
+		sha256_final(&ctx, key);
+	} else {
+		memcpy(key, pass, passlen);
+	}
+
+	/* The HMAC states after the padded key are the same for every block */
+	for (size_t i = 0; i < SHA256_BLOCK_LEN; i++)
+		pad[i] = key[i] ^ 0x36;
+	sha256_init(&inner);
+	sha256_update(&inner, pad, sizeof(pad));
+
+	for (size_t i = 0; i < SHA256_BLOCK_LEN; i++)
+		pad[i] = key[i] ^ 0x5c;
+	sha256_init(&outer);
+	sha256_update(&outer, pad, sizeof(pad));
+
+	for (uint32_t blk = 1; (size_t) (blk - 1) * SHA256_LEN < dklen; blk++) {
+		unsigned char u[SHA256_LEN];
+		unsigned char t[SHA256_LEN];
+		unsigned char be[4] = {
+			(unsigned char) (blk >> 24), (unsigned char) (blk >> 16),
+			(unsigned char) (blk >> 8), (unsigned char) blk
+		};
+
+		/* U_1 = HMAC(pass, salt || INT(blk)) */
+		ctx = inner;
+		sha256_update(&ctx, salt, saltlen);
+		sha256_update(&ctx, be, sizeof(be));
+		sha256_final(&ctx, u);
+		ctx = outer;
+		sha256_update(&ctx, u, sizeof(u));
+		sha256_final(&ctx, u);
+		memcpy(t, u, sizeof(t));
+
+		/* U_j = HMAC(pass, U_(j-1)) */
+		for (uint32_t j = 1; j < iter; j++) {
+			ctx = inner;
+			sha256_update(&ctx, u, sizeof(u));
+			sha256_final(&ctx, u);
+			ctx = outer;
+			sha256_update(&ctx, u, sizeof(u));
+			sha256_final(&ctx, u);
+
+			for (size_t k = 0; k < SHA256_LEN; k++)
+				t[k] ^= u[k];
+		}
+
+		size_t const off = (size_t) (blk - 1) * SHA256_LEN;
+		size_t const n = dklen - off < SHA256_LEN ? dklen - off :
+		    SHA256_LEN;
+		memcpy(dk + off, t, n);
+	}
+
+	memset(key, 0, sizeof(key));
+	memset(pad, 0, sizeof(pad));
+	memset(&inner, 0, sizeof(inner));
+	memset(&outer, 0, sizeof(outer));
+	memset(&ctx, 0, sizeof(ctx));
+}
+
+/*
+ * Loads the key held by the key file |fname| into |key|.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+bool read_key(char const *fname, unsigned char *key)
+{
+	unsigned char buf[KEYFILE_LEN + 1];
+	FILE *fp = fopen(fname, "rb");
+
+	if (!fp) {
+		perror("fopen");
+		return false;
+	}
+
+	size_t const got = fread(buf, 1, sizeof(buf), fp);
+	fclose(fp);
+
+	if (got != KEYFILE_LEN ||
+	    memcmp(buf, KEYFILE_MAGIC, sizeof(KEYFILE_MAGIC) - 1) != 0) {
+		fprintf(stderr, "Error: %s is not a key file\n", fname);
+		return false;
+	}
+
+	memcpy(key, buf + KEYFILE_LEN - CHACHA_KEY_LEN, CHACHA_KEY_LEN);
+	memset(buf, 0, sizeof(buf));
+	return true;
+}
+
+/*
+ * This function is the public interface of the 'keygen' mode. A passphrase is
+ * read from the terminal (or from the first line of stdin) and stretched with
+ * PBKDF2-HMAC-SHA256 and a random salt into a new key file |args->files[0]|.
+ *
+ * Returns: true if the key file was written, false otherwise.
+ */
+bool keygen(struct Args const * const args)
+{
+	uint32_t const iter = args->iterations ? args->iterations :
+	    KEYFILE_ITER;
+	unsigned char buf[KEYFILE_LEN];
+	char pass[1024];
+	char again[1024];
+	bool ok = false;
+
+	if (!read_passphrase(pass, sizeof(pass), "Passphrase: "))
+		return false;
+
+	if (isatty(STDIN_FILENO)) {
+		if (!read_passphrase(again, sizeof(again), "Again: "))
+			goto out;
+		if (strcmp(pass, again) != 0) {
+			fprintf(stderr, "Error: passphrases do not match\n");
+			goto out;
+		}
+	}
+
+	if (pass[0] == '\0') {
+		fprintf(stderr, "Error: empty passphrase\n");
+		goto out;
+	}
+
+	unsigned char * const salt = buf + sizeof(KEYFILE_MAGIC) - 1 + 4;
+	memcpy(buf, KEYFILE_MAGIC, sizeof(KEYFILE_MAGIC) - 1);
+	store_le32(buf + sizeof(KEYFILE_MAGIC) - 1, iter);
+	if (!random_bytes(salt, KEYFILE_SALT_LEN)) {
+		perror("getrandom");
+		goto out;
+	}
+
+	pbkdf2_sha256((unsigned char const *) pass, strlen(pass), salt,
+		      KEYFILE_SALT_LEN, iter, salt + KEYFILE_SALT_LEN,
+		      CHACHA_KEY_LEN);
+
+	/* Never replace an existing key, payloads sealed with it would be lost */
+	int const fd = open(args->files[0], O_WRONLY | O_CREAT | O_EXCL |
+			    O_CLOEXEC, 0600);
+	if (fd < 0) {
+		perror("open");
+		goto out;
+	}
+
+	if (!pwrite_full(fd, buf, sizeof(buf), 0)) {
+		perror("write");
+		close(fd);
+		unlink(args->files[0]);
+		goto out;
+	}
+
+	close(fd);
+	info("Created key file: %s\n", args->files[0]);
+	ok = true;
+
+out:
+	memset(pass, 0, sizeof(pass));
+	memset(again, 0, sizeof(again));
+	memset(buf, 0, sizeof(buf));
+	return ok;
+}
+
+/*
+ * Reads a line into |buf|, without echo if stdin is a terminal, in which case
+ * |prompt| is printed first.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+static bool read_passphrase(char *buf, size_t const len, char const *prompt)
+{
+	bool const tty = isatty(STDIN_FILENO);
+	struct termios old, raw;
+	bool ok;
+
+	if (tty) {
+		fputs(prompt, stderr);
+		if (tcgetattr(STDIN_FILENO, &old) != 0) {
+			perror("tcgetattr");
+			return false;
+		}
+		raw = old;
+		raw.c_lflag &= ~(tcflag_t) ECHO;
+		tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+	}
+
+	ok = fgets(buf, (int) len, stdin) != NULL;
+
+	if (tty) {
+		tcsetattr(STDIN_FILENO, TCSAFLUSH, &old);
+		fputc('\n', stderr);
+	}
+
+	if (!ok) {
+		fprintf(stderr, "Error: could not read passphrase\n");
+		return false;
+	}
+
+	buf[strcspn(buf, "\r\n")] = '\0';
+	return true;
+}
+
+/*
+ * Sets up |ctx| to produce the keystream of |key| and |nonce| from block
+ * |counter| on.
+ */
+static void chacha20_init(struct Chacha20 * const ctx,
+			  unsigned char const *key,
+			  unsigned char const *nonce, uint32_t const counter)
+{
+	/* "expand 32-byte k" */
+	ctx->s[0] = 0x61707865;
+	ctx->s[1] = 0x3320646e;
+	ctx->s[2] = 0x79622d32;
+	ctx->s[3] = 0x6b206574;
+
+	for (size_t i = 0; i < 8; i++)
+		ctx->s[4 + i] = load_le32(key + 4 * i);
+
+	ctx->s[12] = counter;
+	for (size_t i = 0; i < 3; i++)
+		ctx->s[13 + i] = load_le32(nonce + 4 * i);
+}
+
+/*
+ * Computes the next keystream block of |ctx| into |out|.
+ */
+static void chacha20_block(struct Chacha20 * const ctx, unsigned char *out)
+{
+	uint32_t x[16];
+
+	memcpy(x, ctx->s, sizeof(x));
+
+	for (size_t i = 0; i < 10; i++) {
+		QUARTERROUND(x[0], x[4], x[8], x[12]);
+		QUARTERROUND(x[1], x[5], x[9], x[13]);
+		QUARTERROUND(x[2], x[6], x[10], x[14]);
+		QUARTERROUND(x[3], x[7], x[11], x[15]);
+		QUARTERROUND(x[0], x[5], x[10], x[15]);
+		QUARTERROUND(x[1], x[6], x[11], x[12]);
+		QUARTERROUND(x[2], x[7], x[8], x[13]);
+		QUARTERROUND(x[3], x[4], x[9], x[14]);
+	}
+
+	for (size_t i = 0; i < 16; i++)
+		store_le32(out + 4 * i, x[i] + ctx->s[i]);
+
+	ctx->s[12]++;
+}
+
+/*
+ * XORs the |len| bytes of |buf| with the keystream of |ctx|. Runs of 8 or 4
+ * blocks are computed in parallel when the CPU has AVX2, or the build SSE2,
+ * and the tuning profile allows them. A partial block at the end discards the
+ * rest of its keystream.
+ */
+static void chacha20_xor(struct Chacha20 * const ctx, unsigned char *buf,
+			 size_t len)
+{
+	unsigned char ks[CHACHA_BLOCK_LEN];
+
+#ifdef CHACHA_AVX2
+	if (tune.simd >= TUNE_SIMD_AVX2 && __builtin_cpu_supports("avx2")) {
+		for (; len >= 8 * CHACHA_BLOCK_LEN;
+		     len -= 8 * CHACHA_BLOCK_LEN) {
+			chacha20_xor8(ctx, buf);
+			buf += 8 * CHACHA_BLOCK_LEN;
+		}
+	}
+#endif
+#ifdef __SSE2__
+	for (; tune.simd >= TUNE_SIMD_SSE2 && len >= 4 * CHACHA_BLOCK_LEN;
+	     len -= 4 * CHACHA_BLOCK_LEN) {
+		chacha20_xor4(ctx, buf);
+		buf += 4 * CHACHA_BLOCK_LEN;
+	}
+#endif
+
+	while (len > 0) {
+		size_t const n = len < CHACHA_BLOCK_LEN ? len : CHACHA_BLOCK_LEN;
+
+		chacha20_block(ctx, ks);
+		for (size_t i = 0; i < n; i++)
+			buf[i] ^= ks[i];
+
+		buf += n;
+		len -= n;
+	}
+
+	memset(ks, 0, sizeof(ks));
+}
+
+#ifdef __SSE2__
+/* Rotates the 32-bit lanes of |x| left by |n| bits */
+#define ROTL128(x, n) \
+	_mm_or_si128(_mm_slli_epi32((x), (n)), _mm_srli_epi32((x), 32 - (n)))
+
+/* Rotating by 16 swaps the 16-bit halves, which takes one op less */
+#define ROTL128_16(x) \
+	_mm_shufflehi_epi16(_mm_shufflelo_epi16((x), 0xB1), 0xB1)
+
+#define QUARTERROUND128(a, b, c, d) do {                                   \
+	a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = ROTL128_16(d);  \
+	c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = ROTL128(b, 12); \
+	a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = ROTL128(d, 8);  \
+	c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = ROTL128(b, 7);  \
+} while (0)
+
+/*
+ * XORs the 4 blocks at |buf| with the next 4 keystream blocks of |ctx|. Lane
+ * j of x[i] holds word i of block j, so the rounds run on all 4 at once.
+ */
+static void chacha20_xor4(struct Chacha20 * const ctx, unsigned char *buf)
+{
+	__m128i x[16], in[16];
+
+	for (size_t i = 0; i < 16; i++)
+		in[i] = _mm_set1_epi32((int) ctx->s[i]);
+	in[12] = _mm_add_epi32(in[12], _mm_set_epi32(3, 2, 1, 0));
+
+	memcpy(x, in, sizeof(x));
+
+	for (size_t i = 0; i < 10; i++) {
+		QUARTERROUND128(x[0], x[4], x[8], x[12]);
+		QUARTERROUND128(x[1], x[5], x[9], x[13]);
+		QUARTERROUND128(x[2], x[6], x[10], x[14]);
+		QUARTERROUND128(x[3], x[7], x[11], x[15]);
+		QUARTERROUND128(x[0], x[5], x[10], x[15]);
+		QUARTERROUND128(x[1], x[6], x[11], x[12]);
+		QUARTERROUND128(x[2], x[7], x[8], x[13]);
+		QUARTERROUND128(x[3], x[4], x[9], x[14]);
+	}
+
+	for (size_t i = 0; i < 16; i++)
+		x[i] = _mm_add_epi32(x[i], in[i]);
+
+	/* Transpose each group of 4 words back into the 4 blocks */
+	for (size_t i = 0; i < 16; i += 4) {
+		__m128i const t0 = _mm_unpacklo_epi32(x[i], x[i + 1]);
+		__m128i const t1 = _mm_unpacklo_epi32(x[i + 2], x[i + 3]);
+		__m128i const t2 = _mm_unpackhi_epi32(x[i], x[i + 1]);
+		__m128i const t3 = _mm_unpackhi_epi32(x[i + 2], x[i + 3]);
+		__m128i const b[4] = {
+			_mm_unpacklo_epi64(t0, t1), _mm_unpackhi_epi64(t0, t1),
+			_mm_unpacklo_epi64(t2, t3), _mm_unpackhi_epi64(t2, t3)
+		};
+
+		for (size_t j = 0; j < 4; j++) {
+			__m128i *p = (__m128i *) (buf + j * CHACHA_BLOCK_LEN +
+						  i * 4);
+			_mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p),
+							  b[j]));
+		}
+	}
+
+	ctx->s[12] += 4;
+}
+#endif
+
+#ifdef CHACHA_AVX2
+#define ROTL256(x, n) \
+	_mm256_or_si256(_mm256_slli_epi32((x), (n)), \
+			_mm256_srli_epi32((x), 32 - (n)))
+
+/* Rotations by whole bytes are byte shuffles, with |rot16| and |rot8| */
+#define QUARTERROUND256(a, b, c, d) do {                                      \
+	a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a);               \
+	d = _mm256_shuffle_epi8(d, rot16);                                    \
+	c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c);               \
+	b = ROTL256(b, 12);                                                   \
+	a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a);               \
+	d = _mm256_shuffle_epi8(d, rot8);                                     \
+	c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c);               \
+	b = ROTL256(b, 7);                                                    \
+} while (0)
+
+/*
+ * XORs the 8 blocks at |buf| with the next 8 keystream blocks of |ctx|, as
+ * chacha20_xor4() does for 4.
+ */
+static void chacha20_xor8(struct Chacha20 * const ctx, unsigned char *buf)
+{
+	__m256i const rot16 = _mm256_setr_epi8(
+		2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+		2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+	__m256i const rot8 = _mm256_setr_epi8(
+		3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+		3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+	__m256i x[16], in[16];
+
+	for (size_t i = 0; i < 16; i++)
+		in[i] = _mm256_set1_epi32((int) ctx->s[i]);
+	in[12] = _mm256_add_epi32(in[12],
+				  _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+
+	memcpy(x, in, sizeof(x));
+
+	for (size_t i = 0; i < 10; i++) {
+		QUARTERROUND256(x[0], x[4], x[8], x[12]);
+		QUARTERROUND256(x[1], x[5], x[9], x[13]);
+		QUARTERROUND256(x[2], x[6], x[10], x[14]);
+		QUARTERROUND256(x[3], x[7], x[11], x[15]);
+		QUARTERROUND256(x[0], x[5], x[10], x[15]);
+		QUARTERROUND256(x[1], x[6], x[11], x[12]);
+		QUARTERROUND256(x[2], x[7], x[8], x[13]);
+		QUARTERROUND256(x[3], x[4], x[9], x[14]);
+	}
+
+	for (size_t i = 0; i < 16; i++)
+		x[i] = _mm256_add_epi32(x[i], in[i]);
+
+	/*
+	 * The unpacks work within each 128-bit lane, which leaves blocks 0-3
+	 * in the low lanes and blocks 4-7 in the high lanes.
+	 */
+	for (size_t i = 0; i < 16; i += 4) {
+		__m256i const t0 = _mm256_unpacklo_epi32(x[i], x[i + 1]);
+		__m256i const t1 = _mm256_unpacklo_epi32(x[i + 2], x[i + 3]);
+		__m256i const t2 = _mm256_unpackhi_epi32(x[i], x[i + 1]);
+		__m256i const t3 = _mm256_unpackhi_epi32(x[i + 2], x[i + 3]);
+		__m256i const b[4] = {
+			_mm256_unpacklo_epi64(t0, t1),
+			_mm256_unpackhi_epi64(t0, t1),
+			_mm256_unpacklo_epi64(t2, t3),
+			_mm256_unpackhi_epi64(t2, t3)
+		};
+
+		for (size_t j = 0; j < 4; j++) {
+			__m128i *lo = (__m128i *) (buf + j * CHACHA_BLOCK_LEN +
+						   i * 4);
+			__m128i *hi = (__m128i *) (buf + (j + 4) *
+						   CHACHA_BLOCK_LEN + i * 4);
+
+			_mm_storeu_si128(lo, _mm_xor_si128(
+				_mm_loadu_si128(lo),
+				_mm256_castsi256_si128(b[j])));
+			_mm_storeu_si128(hi, _mm_xor_si128(
+				_mm_loadu_si128(hi),
+				_mm256_extracti128_si256(b[j], 1)));
+		}
+	}
+
+	ctx->s[12] += 8;
+}
+#endif
+
+/*
+ * Sets up |ctx| with the one-time key |key| (r and s, 32 bytes).
+ */
+static void poly1305_init(struct Poly1305 * const ctx,
+			  unsigned char const *key)
+{
+	uint64_t const t0 = load_le64(key);
+	uint64_t const t1 = load_le64(key + 8);
+
+	/* Clamp r and split it into 44, 44 and 42 bits */
+	ctx->r[0] = t0 & 0xFFC0FFFFFFFULL;
+	ctx->r[1] = ((t0 >> 44) | (t1 << 20)) & 0xFFFFFC0FFFFULL;
+	ctx->r[2] = (t1 >> 24) & 0x00FFFFFFC0FULL;
+
+	ctx->h[0] = 0;
+	ctx->h[1] = 0;
+	ctx->h[2] = 0;
+
+	ctx->pad[0] = load_le64(key + 16);
+	ctx->pad[1] = load_le64(key + 24);
+	ctx->buflen = 0;
+}
+
+/*
+ * Absorbs the whole 16-byte blocks of the |len| bytes at |m|. |hibit| is the
+ * bit set above each block, 2^128 in radix 2^44 for full blocks.
+ */
+static void poly1305_blocks(struct Poly1305 * const ctx,
+			    unsigned char const *m, size_t len,
+			    uint64_t const hibit)
+{
+	uint64_t const r0 = ctx->r[0];
+	uint64_t const r1 = ctx->r[1];
+	uint64_t const r2 = ctx->r[2];
+	uint64_t const s1 = r1 * (5 << 2);
+	uint64_t const s2 = r2 * (5 << 2);
+	uint64_t h0 = ctx->h[0];
+	uint64_t h1 = ctx->h[1];
+	uint64_t h2 = ctx->h[2];
+
+	for (; len >= 16; len -= 16, m += 16) {
+		uint64_t const t0 = load_le64(m);
+		uint64_t const t1 = load_le64(m + 8);
+		uint128 d0, d1, d2;
+		uint64_t c;
+
+		h0 += t0 & POLY_MASK44;
+		h1 += ((t0 >> 44) | (t1 << 20)) & POLY_MASK44;
+		h2 += ((t1 >> 24) & POLY_MASK42) | hibit;
+
+		/* h *= r, modulo 2^130 - 5 */
+		d0 = (uint128) h0 * r0 + (uint128) h1 * s2 + (uint128) h2 * s1;
+		d1 = (uint128) h0 * r1 + (uint128) h1 * r0 + (uint128) h2 * s2;
+		d2 = (uint128) h0 * r2 + (uint128) h1 * r1 + (uint128) h2 * r0;
+
+		c = (uint64_t) (d0 >> 44);
+		h0 = (uint64_t) d0 & POLY_MASK44;
+		d1 += c;
+		c = (uint64_t) (d1 >> 44);
+		h1 = (uint64_t) d1 & POLY_MASK44;
+		d2 += c;
+		c = (uint64_t) (d2 >> 42);
+		h2 = (uint64_t) d2 & POLY_MASK42;
+		h0 += c * 5;
+		c = h0 >> 44;
+		h0 &= POLY_MASK44;
+		h1 += c;
+	}
+
+	ctx->h[0] = h0;
+	ctx->h[1] = h1;
+	ctx->h[2] = h2;
+}
+
+/*
+ * Absorbs the |len| bytes at |m|, keeping a partial block for later.
+ */
+static void poly1305_update(struct Poly1305 * const ctx,
+			    unsigned char const *m, size_t len)
+{
+	uint64_t const hibit = 1ULL << 40;
+
+	if (ctx->buflen) {
+		size_t n = 16 - ctx->buflen;
+		if (n > len)
+			n = len;
+
+		memcpy(ctx->buf + ctx->buflen, m, n);
+		ctx->buflen += n;
+		m += n;
+		len -= n;
+
+		if (ctx->buflen < 16)
+			return;
+
+		poly1305_blocks(ctx, ctx->buf, 16, hibit);
+		ctx->buflen = 0;
+	}
+
+	size_t const whole = len & ~(size_t) 15;
+	poly1305_blocks(ctx, m, whole, hibit);
+
+	memcpy(ctx->buf, m + whole, len - whole);
+	ctx->buflen = len - whole;
+}
+
+/*
+ * Computes the tag of everything absorbed by |ctx| into |tag|.
+ */
+static void poly1305_finish(struct Poly1305 * const ctx, unsigned char *tag)
+{
+	uint64_t h0, h1, h2, g0, g1, g2, c, t0, t1;
+
+	/* A final partial block is padded with a 1 byte, without the 2^128 bit */
+	if (ctx->buflen) {
+		ctx->buf[ctx->buflen] = 1;
+		memset(ctx->buf + ctx->buflen + 1, 0, 15 - ctx->buflen);
+		poly1305_blocks(ctx, ctx->buf, 16, 0);
+	}
+
+	h0 = ctx->h[0];
+	h1 = ctx->h[1];
+	h2 = ctx->h[2];
+
+	/* Carry h fully */
+	c = h1 >> 44; h1 &= POLY_MASK44;
+	h2 += c; c = h2 >> 42; h2 &= POLY_MASK42;
+	h0 += c * 5; c = h0 >> 44; h0 &= POLY_MASK44;
+	h1 += c; c = h1 >> 44; h1 &= POLY_MASK44;
+	h2 += c; c = h2 >> 42; h2 &= POLY_MASK42;
+	h0 += c * 5; c = h0 >> 44; h0 &= POLY_MASK44;
+	h1 += c;
+
+	/* g = h + 5 - 2^130, and pick g if it did not underflow */
+	g0 = h0 + 5; c = g0 >> 44; g0 &= POLY_MASK44;
+	g1 = h1 + c; c = g1 >> 44; g1 &= POLY_MASK44;
+	g2 = h2 + c - (1ULL << 42);
+
+	c = (g2 >> 63) - 1;
+	g0 &= c;
+	g1 &= c;
+	g2 &= c;
+	c = ~c;
+	h0 = (h0 & c) | g0;
+	h1 = (h1 & c) | g1;
+	h2 = (h2 & c) | g2;
+
+	/* tag = (h + s) mod 2^128 */
+	t0 = ctx->pad[0];
+	t1 = ctx->pad[1];
+	h0 += t0 & POLY_MASK44; c = h0 >> 44; h0 &= POLY_MASK44;
+	h1 += (((t0 >> 44) | (t1 << 20)) & POLY_MASK44) + c;
+	c = h1 >> 44; h1 &= POLY_MASK44;
+	h2 += ((t1 >> 24) & POLY_MASK42) + c;
+	h2 &= POLY_MASK42;
+
+	store_le64(tag, h0 | (h1 << 44));
+	store_le64(tag + 8, (h1 >> 20) | (h2 << 24));
+
+	memset(ctx, 0, sizeof(*ctx));
+}
+
+static void sha256_init(struct Sha256 * const ctx)
+{
+	static uint32_t const iv[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+
+	memcpy(ctx->h, iv, sizeof(iv));
+	ctx->len = 0;
+	ctx->buflen = 0;
+}
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/*
+ * Runs the SHA-256 compression function of |ctx| on one 64-byte |block|.
+ */
+static void sha256_compress(struct Sha256 * const ctx,
+			    unsigned char const *block)
+{
+	uint32_t w[64];
+	uint32_t a = ctx->h[0], b = ctx->h[1], c = ctx->h[2], d = ctx->h[3];
+	uint32_t e = ctx->h[4], f = ctx->h[5], g = ctx->h[6], h = ctx->h[7];
+
+	for (size_t i = 0; i < 16; i++) {
+		w[i] = (uint32_t) block[4 * i] << 24 |
+		    (uint32_t) block[4 * i + 1] << 16 |
+		    (uint32_t) block[4 * i + 2] << 8 |
+		    (uint32_t) block[4 * i + 3];
+	}
+
+	for (size_t i = 16; i < 64; i++) {
+		uint32_t const s0 = ROTR32(w[i - 15], 7) ^
+		    ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t const s1 = ROTR32(w[i - 2], 17) ^
+		    ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	for (size_t i = 0; i < 64; i++) {
+		uint32_t const s1 = ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25);
+		uint32_t const ch = (e & f) ^ (~e & g);
+		uint32_t const t1 = h + s1 + ch + sha256_k[i] + w[i];
+		uint32_t const s0 = ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22);
+		uint32_t const maj = (a & b) ^ (a & c) ^ (b & c);
+		uint32_t const t2 = s0 + maj;
+
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	ctx->h[0] += a;
+	ctx->h[1] += b;
+	ctx->h[2] += c;
+	ctx->h[3] += d;
+	ctx->h[4] += e;
+	ctx->h[5] += f;
+	ctx->h[6] += g;
+	ctx->h[7] += h;
+}
+
+static void sha256_update(struct Sha256 * const ctx, void const *data,
+			  size_t len)
+{
+	unsigned char const *p = data;
+
+	ctx->len += len;
+
+	if (ctx->buflen) {
+		size_t n = SHA256_BLOCK_LEN - ctx->buflen;
+		if (n > len)
+			n = len;
+
+		memcpy(ctx->buf + ctx->buflen, p, n);
+		ctx->buflen += n;
+		p += n;
+		len -= n;
+
+		if (ctx->buflen < SHA256_BLOCK_LEN)
+			return;
+
+		sha256_compress(ctx, ctx->buf);
+		ctx->buflen = 0;
+	}
+
+	for (; len >= SHA256_BLOCK_LEN; len -= SHA256_BLOCK_LEN) {
+		sha256_compress(ctx, p);
+		p += SHA256_BLOCK_LEN;
+	}
+
+	memcpy(ctx->buf, p, len);
+	ctx->buflen = len;
+}
+
+static void sha256_final(struct Sha256 * const ctx, unsigned char *out)
+{
+	uint64_t const bits = ctx->len * 8;
+	unsigned char pad[SHA256_BLOCK_LEN + 8] = { 0x80 };
+	unsigned char be[8];
+
+	size_t const padlen = ctx->buflen < 56 ? 56 - ctx->buflen :
+	    120 - ctx->buflen;
+	for (size_t i = 0; i < 8; i++)
+		be[i] = (unsigned char) (bits >> (56 - 8 * i));
+
+	sha256_update(ctx, pad, padlen);
+	sha256_update(ctx, be, sizeof(be));
+
+	for (size_t i = 0; i < 8; i++) {
+		out[4 * i] = (unsigned char) (ctx->h[i] >> 24);
+		out[4 * i + 1] = (unsigned char) (ctx->h[i] >> 16);
+		out[4 * i + 2] = (unsigned char) (ctx->h[i] >> 8);
+		out[4 * i + 3] = (unsigned char) ctx->h[i];
+	}
+}
+
+static inline uint32_t load_le32(unsigned char const *p)
+{
+	return (uint32_t) p[0] | (uint32_t) p[1] << 8 |
+	    (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static inline void store_le32(unsigned char *p, uint32_t const v)
+{
+	p[0] = (unsigned char) v;
+	p[1] = (unsigned char) (v >> 8);
+	p[2] = (unsigned char) (v >> 16);
+	p[3] = (unsigned char) (v >> 24);
+}
+
+static inline uint64_t load_le64(unsigned char const *p)
+{
+	return (uint64_t) load_le32(p) | (uint64_t) load_le32(p + 4) << 32;
+}
+
+static inline void store_le64(unsigned char *p, uint64_t const v)
+{
+	store_le32(p, (uint32_t) v);
+	store_le32(p + 4, (uint32_t) (v >> 32));
+}
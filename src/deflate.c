@@ -0,0 +1,1247 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../include/deflate.h"
+
+#define ADLER_BASE  65521U
+#define ADLER_NMAX  5552U  /* Most bytes summed before the sums overflow */
+#define HASH_BITS   15U
+#define HASH_SIZE   (1U << HASH_BITS)
+#define WINDOW_MASK (DEFLATE_WINDOW - 1)
+#define FAST_BITS   10U    /* Codes decoded with a single table lookup */
+#define MAX_BITS    15U    /* Longest code of literals, lengths, distances */
+#define CLEN_BITS   7U     /* Longest code of code lengths */
+#define NLIT        286U   /* Literal/length codes used, 0 to 285 */
+#define NLIT_FIXED  288U   /* Those of the fixed code, which has 2 more */
+#define NDIST       30U    /* Distance codes used, 0 to 29 */
+#define NCLEN       19U    /* Code length codes */
+#define TOO_FAR     4096U  /* Farthest worth reaching for a 3-byte match */
+#define STORED_MAX  65535U /* Longest stored block */
+
+/* Decoding table of a Huffman code, see huff_build() */
+struct Huffman {
+	uint16_t fast[1U << FAST_BITS]; /* Symbol << 4 | length, 0 if longer */
+	uint16_t count[MAX_BITS + 1];   /* Codes of each length */
+	uint16_t symbol[NLIT_FIXED];    /* Symbols in canonical order */
+};
+
+/* State of inflate_buf() */
+struct Inflate {
+	unsigned char const *in;
+	size_t              inlen;
+	size_t              pos;   /* Next byte of |in| to load into |bits| */
+	size_t              pad;   /* Zero bytes loaded past the end of |in| */
+	uint64_t            bits;  /* Bits loaded, the next one lowest */
+	unsigned int        nbits;
+};
+
+/* State of deflate_buf() */
+struct Deflate {
+	unsigned char const *src;
+	size_t              len;
+	unsigned char       *out;
+	size_t              olen;
+	uint64_t            bits;   /* Bits not yet written, the first lowest */
+	unsigned int        nbits;
+	uint32_t            *head;  /* Last position + 1 of each hash, or 0 */
+	uint32_t            *prev;  /* Previous position + 1 of the same hash */
+	uint16_t            *slen;  /* Literal byte, or length of a match */
+	uint16_t            *sdist; /* Distance of a match, 0 for a literal */
+	size_t              nsyms;
+	size_t              start;  /* First byte of |src| in the block */
+	size_t              done;   /* Bytes of |src| in the symbols so far */
+};
+
+/* Match search effort of each compression level, as in zlib */
+struct Level {
+	unsigned int chain; /* Candidates tried for each match */
+	size_t       nice;  /* Length good enough to stop looking */
+	bool         lazy;  /* Check for a longer match one byte on */
+};
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static uint16_t const len_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51,
+	59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static unsigned char const len_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4,
+	5, 5, 5, 5, 0
+};
+static uint16_t const dist_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+	513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385,
+	24577
+};
+static unsigned char const dist_extra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10,
+	10, 11, 11, 12, 12, 13, 13
+};
+static unsigned char const clen_order[NCLEN] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+static struct Level const levels[DEFLATE_MAX_LEVEL + 1] = {
+	{ 0, 0, false }, /* Stored */
+	{ 4, 8, false }, { 8, 16, false }, { 16, 32, false },
+	{ 16, 32, true }, { 32, 64, true }, { 128, 128, true },
+	{ 256, 258, true }, { 1024, 258, true }, { 4096, 258, true }
+};
+
+static void crc_init(void);
+static inline uint64_t load_le64(unsigned char const *p);
+static inline uint32_t reverse_bits(uint32_t code, unsigned int const len);
+static bool huff_build(struct Huffman * const h, unsigned char const *lens,
+		       unsigned int const n);
+static inline void refill(struct Inflate * const s);
+static inline uint32_t take(struct Inflate * const s, unsigned int const n);
+static inline int huff_decode(struct Inflate * const s,
+			      struct Huffman const * const h);
+static int huff_slow(struct Inflate * const s, struct Huffman const * const h);
+static int inflate_stored(struct Inflate * const s, unsigned char *dst,
+			  size_t const dstlen, size_t *out);
+static bool inflate_tables(struct Inflate * const s, struct Huffman * const lit,
+			   struct Huffman * const dist);
+static int inflate_codes(struct Inflate * const s,
+			 struct Huffman const * const lit,
+			 struct Huffman const * const dist, unsigned char *dst,
+			 size_t const dstlen, size_t *out);
+static inline unsigned int len_sym(size_t const len);
+static inline unsigned int dist_sym(size_t const dist);
+static inline uint32_t hash3(unsigned char const *p);
+static inline void insert(struct Deflate * const z, size_t const pos);
+static size_t longest(struct Deflate const * const z, size_t const pos,
+		      struct Level const * const lv, size_t *dist);
+static inline void put_bits(struct Deflate * const z, uint32_t const v,
+			    unsigned int const n);
+static void align_bits(struct Deflate * const z);
+static void put_stored(struct Deflate * const z, unsigned char const *p,
+		       size_t len);
+static inline void emit(struct Deflate * const z, size_t const len,
+			size_t const dist, unsigned int const ch);
+static void flush_block(struct Deflate * const z);
+static void two_codes(uint32_t *freq, unsigned int const n);
+static void huff_lengths(uint32_t const *freq, unsigned int const n,
+			 unsigned int const limit, unsigned char *lens);
+static void huff_codes(unsigned char const *lens, unsigned int const n,
+		       uint16_t *codes);
+static int cmp_freq(void const *a, void const *b);
+
+/*
+ * Updates the Adler-32 checksum |adler| (1 to start with) with the |len|
+ * bytes of |buf|.
+ *
+ * Returns: the new checksum.
+ */
+uint32_t adler32_buf(uint32_t adler, void const *buf, size_t len)
+{
+	unsigned char const *p = buf;
+	uint32_t a = adler & 0xFFFFU, b = adler >> 16;
+
+	while (len > 0) {
+		size_t n = len < ADLER_NMAX ? len : ADLER_NMAX;
+
+		len -= n;
+		while (n--) {
+			a += *p++;
+			b += a;
+		}
+		a %= ADLER_BASE;
+		b %= ADLER_BASE;
+	}
+
+	return b << 16 | a;
+}
+
+/*
+ * Combines the Adler-32 checksums |a| of a piece of data and |b| of the
+ * |blen| bytes following it.
+ *
+ * Returns: the checksum of both pieces together.
+ */
+uint32_t adler32_combine(uint32_t const a, uint32_t const b,
+			 size_t const blen)
+{
+	/* The sums of |b| are shifted by what |a| adds to every byte */
+	uint32_t const rem = (uint32_t) (blen % ADLER_BASE);
+	uint32_t s1 = a & 0xFFFFU;
+	uint32_t s2 = (uint32_t) ((uint64_t) rem * s1 % ADLER_BASE);
+
+	s1 += (b & 0xFFFFU) + ADLER_BASE - 1;
+	s2 += (a >> 16) + (b >> 16) + ADLER_BASE - rem;
+	if (s1 >= ADLER_BASE)
+		s1 -= ADLER_BASE;
+	if (s1 >= ADLER_BASE)
+		s1 -= ADLER_BASE;
+	if (s2 >= 2 * ADLER_BASE)
+		s2 -= 2 * ADLER_BASE;
+	if (s2 >= ADLER_BASE)
+		s2 -= ADLER_BASE;
+
+	return s2 << 16 | s1;
+}
+
+/*
+ * Updates the CRC-32 (ISO 3309, as used by PNG and gzip) |crc| (0 to start
+ * with) with the |len| bytes of |buf|.
+ *
+ * Returns: the new CRC.
+ */
+uint32_t crc32_buf(uint32_t crc, void const *buf, size_t len)
+{
+	unsigned char const *p = buf;
+
+	pthread_once(&crc_once, crc_init);
+
+	crc = ~crc;
+	while (len--)
+		crc = crc_table[(crc ^ *p++) & 0xFFU] ^ (crc >> 8);
+	return ~crc;
+}
+
+/*
+ * Decodes the raw DEFLATE stream in the |srclen| bytes of |src| into |dst|,
+ * until its last block ends or more comes than the |dstlen| bytes of |dst|
+ * hold, whichever is first. The number of bytes produced is stored in
+ * |outlen| and the number of bytes of |src| taken, up to the end of the last
+ * block, in |inlen|.
+ *
+ * Returns: true if successful, false if the stream is corrupt or ends early.
+ */
+bool inflate_buf(unsigned char const *src, size_t const srclen,
+		 unsigned char *dst, size_t const dstlen, size_t *outlen,
+		 size_t *inlen)
+{
+	struct Inflate s = { .in = src, .inlen = srclen };
+	struct Huffman lit, dist;
+	bool fixed = false; /* Whether |lit| and |dist| hold the fixed codes */
+	bool last;
+	size_t out = 0;
+	int r = 0;
+
+	do {
+		refill(&s);
+		last = take(&s, 1);
+
+		switch (take(&s, 2)) {
+		case 0:
+			r = inflate_stored(&s, dst, dstlen, &out);
+			break;
+		case 1:
+			if (!fixed) {
+				unsigned char lens[NLIT_FIXED];
+
+				memset(lens, 8, 144);
+				memset(lens + 144, 9, 112);
+				memset(lens + 256, 7, 24);
+				memset(lens + 280, 8, 8);
+				huff_build(&lit, lens, NLIT_FIXED);
+				memset(lens, 5, NDIST);
+				huff_build(&dist, lens, NDIST);
+				fixed = true;
+			}
+			r = inflate_codes(&s, &lit, &dist, dst, dstlen, &out);
+			break;
+		case 2:
+			fixed = false;
+			if (!inflate_tables(&s, &lit, &dist))
+				return false;
+			r = inflate_codes(&s, &lit, &dist, dst, dstlen, &out);
+			break;
+		default:
+			return false;
+		}
+
+		/* Reading past the end of |src| means it was cut short */
+		if (r < 0 || s.pad * 8 > s.nbits)
+			return false;
+	} while (!last && r == 0);
+
+	*outlen = out;
+	*inlen = s.pos + s.pad - s.nbits / 8;
+	return true;
+}
+
+/*
+ * Compresses the |len| bytes of |src| into raw DEFLATE blocks at |level|, 0
+ * (stored, fastest) to DEFLATE_MAX_LEVEL (smallest), and writes them to
+ * |dst|, which has room for DEFLATE_BOUND(|len|) bytes. Matches only reach
+ * back into |src| itself and no block is marked last; the output ends with
+ * an empty stored block, on a byte boundary. So the outputs for consecutive
+ * pieces of data can be compressed independently, in parallel, and simply
+ * concatenated, which a final empty block then ends.
+ *
+ * Returns: the number of bytes written, or 0 if out of memory.
+ */
+size_t deflate_buf(unsigned char const *src, size_t const len,
+		   unsigned int const level, unsigned char *dst)
+{
+	struct Level const *lv = &levels[level < DEFLATE_MAX_LEVEL ? level :
+					 DEFLATE_MAX_LEVEL];
+	struct Deflate z = { .src = src, .len = len, .out = dst };
+	size_t pos = 0;
+
+	if (lv->chain == 0) {
+		put_stored(&z, src, len);
+		put_stored(&z, src, 0);
+		return z.olen;
+	}
+
+	z.head = calloc(HASH_SIZE, sizeof(*z.head));
+	z.prev = malloc(DEFLATE_WINDOW * sizeof(*z.prev));
+	z.slen = malloc(DEFLATE_BLOCK_SYMS * sizeof(*z.slen));
+	z.sdist = malloc(DEFLATE_BLOCK_SYMS * sizeof(*z.sdist));
+	if (!z.head || !z.prev || !z.slen || !z.sdist) {
+		z.olen = 0;
+		goto out;
+	}
+
+	/* A match found at |pos| - 1, emitted unless |pos| has a longer one */
+	size_t plen = 0, pdist = 0;
+
+	while (pos < len) {
+		size_t mlen = 0, mdist = 0;
+
+		if (lv->lazy && plen >= lv->nice) {
+			/* Long enough already, not worth another search */
+			if (len - pos >= DEFLATE_MIN_MATCH)
+				insert(&z, pos);
+		} else if (len - pos >= DEFLATE_MIN_MATCH) {
+			mlen = longest(&z, pos, lv, &mdist);
+			insert(&z, pos);
+		}
+
+		if (!lv->lazy) {
+			if (mlen) {
+				emit(&z, mlen, mdist, 0);
+				for (size_t i = 1; i < mlen; i++)
+					if (len - (pos + i) >= DEFLATE_MIN_MATCH)
+						insert(&z, pos + i);
+				pos += mlen;
+			} else {
+				emit(&z, 0, 0, src[pos++]);
+			}
+			continue;
+		}
+
+		if (plen && plen >= mlen) {
+			/* The match of |pos| - 1 covers |pos|, inserted above */
+			emit(&z, plen, pdist, 0);
+			for (size_t i = pos + 1; i < pos - 1 + plen; i++)
+				if (len - i >= DEFLATE_MIN_MATCH)
+					insert(&z, i);
+			pos += plen - 1;
+			plen = 0;
+			continue;
+		}
+
+		if (plen)
+			emit(&z, 0, 0, src[pos - 1]);
+		plen = mlen;
+		pdist = mdist;
+		if (!mlen)
+			emit(&z, 0, 0, src[pos]);
+		pos++;
+	}
+
+	/* A match at the last byte cannot be, see longest() */
+	if (plen)
+		emit(&z, plen, pdist, 0);
+	if (z.nsyms)
+		flush_block(&z);
+	put_stored(&z, src, 0);
+
+out:
+	free(z.head);
+	free(z.prev);
+	free(z.slen);
+	free(z.sdist);
+	return z.olen;
+}
+
+/*
+ * Fills the table of crc32_buf(), for the reflected polynomial 0xEDB88320.
+ */
+static void crc_init(void)
+{
+	for (uint32_t n = 0; n < 256; n++) {
+		uint32_t c = n;
+
+		for (unsigned int k = 0; k < 8; k++)
+			c = c & 1 ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+		crc_table[n] = c;
+	}
+}
+
+/*
+ * Returns: the 8 bytes at |p| as a little-endian number.
+ */
+static inline uint64_t load_le64(unsigned char const *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+
+/*
+ * Returns: the |len| low bits of |code| in reverse order. Huffman codes are
+ * packed starting with their most significant bit, the rest of DEFLATE with
+ * the least significant.
+ */
+static inline uint32_t reverse_bits(uint32_t code, unsigned int const len)
+{
+	uint32_t r = 0;
+
+	for (unsigned int i = 0; i < len; i++, code >>= 1)
+		r = r << 1 | (code & 1);
+	return r;
+}
+
+/*
+ * Builds the decoding table |h| of the canonical Huffman code whose |n|
+ * symbols have the code lengths |lens| (0 for unused). Codes of up to
+ * FAST_BITS bits are decoded with a single lookup of the next bits of the
+ * stream, longer ones symbol by symbol, see huff_slow(). An incomplete code
+ * is accepted; the bit strings it leaves out fail to decode.
+ *
+ * Returns: true if successful, false if the lengths are over-subscribed.
+ */
+static bool huff_build(struct Huffman * const h, unsigned char const *lens,
+		       unsigned int const n)
+{
+	uint16_t offs[MAX_BITS + 2];
+	uint32_t next[MAX_BITS + 1];
+	int left = 1;
+
+	memset(h->count, 0, sizeof(h->count));
+	for (unsigned int i = 0; i < n; i++)
+		h->count[lens[i]]++;
+	h->count[0] = 0;
+
+	for (unsigned int len = 1; len <= MAX_BITS; len++) {
+		left = left * 2 - h->count[len];
+		if (left < 0)
+			return false;
+	}
+
+	offs[1] = 0;
+	next[1] = 0;
+	for (unsigned int len = 1; len < MAX_BITS; len++) {
+		offs[len + 1] = offs[len] + h->count[len];
+		next[len + 1] = (next[len] + h->count[len]) << 1;
+	}
+
+	memset(h->fast, 0, sizeof(h->fast));
+	for (unsigned int i = 0; i < n; i++) {
+		unsigned int const len = lens[i];
+
+		if (!len)
+			continue;
+
+		h->symbol[offs[len]++] = (uint16_t) i;
+		uint32_t const code = next[len]++;
+		if (len > FAST_BITS)
+			continue;
+
+		for (uint32_t k = reverse_bits(code, len); k < (1U << FAST_BITS);
+		     k += 1U << len)
+			h->fast[k] = (uint16_t) (i << 4 | len);
+	}
+
+	return true;
+}
+
+/*
+ * Loads |s->bits| with at least 56 bits, past the end of the input with
+ * zeros, which are counted in |s->pad|.
+ */
+static inline void refill(struct Inflate * const s)
+{
+	if (s->inlen - s->pos >= 8) {
+		/*
+		 * The bytes above the whole ones taken are loaded again by the
+		 * next refill, at the same place, so they may be left there.
+		 */
+		s->bits |= load_le64(s->in + s->pos) << s->nbits;
+		s->pos += (63 - s->nbits) >> 3;
+		s->nbits |= 56;
+		return;
+	}
+
+	while (s->nbits <= 56) {
+		if (s->pos < s->inlen)
+			s->bits |= (uint64_t) s->in[s->pos++] << s->nbits;
+		else
+			s->pad++;
+		s->nbits += 8;
+	}
+}
+
+/*
+ * Returns: the next |n| bits of |s|, which must be loaded, see refill().
+ */
+static inline uint32_t take(struct Inflate * const s, unsigned int const n)
+{
+	uint32_t const v = (uint32_t) (s->bits & ((1ULL << n) - 1));
+
+	s->bits >>= n;
+	s->nbits -= n;
+	return v;
+}
+
+/*
+ * Returns: the next symbol of the Huffman code |h| from |s|, whose bits must
+ * be loaded, or -1 if they are no code.
+ */
+static inline int huff_decode(struct Inflate * const s,
+			      struct Huffman const * const h)
+{
+	uint16_t const e = h->fast[s->bits & ((1U << FAST_BITS) - 1)];
+
+	if (!e)
+		return huff_slow(s, h);
+
+	s->bits >>= e & 15;
+	s->nbits -= e & 15;
+	return e >> 4;
+}
+
+/*
+ * Like huff_decode(), for codes longer than FAST_BITS: the code is read bit
+ * by bit and compared to the first code of each length in turn.
+ */
+static int huff_slow(struct Inflate * const s, struct Huffman const * const h)
+{
+	uint64_t b = s->bits;
+	int code = 0, first = 0, index = 0;
+
+	for (unsigned int len = 1; len <= MAX_BITS; len++) {
+		int const count = h->count[len];
+
+		code |= (int) (b & 1);
+		b >>= 1;
+		if (code - count < first) {
+			s->bits >>= len;
+			s->nbits -= len;
+			return h->symbol[index + (code - first)];
+		}
+
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
+	}
+
+	return -1;
+}
+
+/*
+ * Copies the stored block which follows in |s| to |dst| at |*out|, as much
+ * of it as fits in |dstlen|.
+ *
+ * Returns: 0 once the block is copied, 1 if |dst| is full before its end, -1
+ * if the block is corrupt or cut short.
+ */
+static int inflate_stored(struct Inflate * const s, unsigned char *dst,
+			  size_t const dstlen, size_t *out)
+{
+	/* The block starts at the next byte; give back the bytes loaded */
+	size_t back = s->nbits / 8;
+
+	if (back <= s->pad) {
+		s->pad -= back;
+	} else {
+		s->pos -= back - s->pad;
+		s->pad = 0;
+	}
+	s->bits = 0;
+	s->nbits = 0;
+
+	if (s->pad || s->inlen - s->pos < 4)
+		return -1;
+
+	unsigned char const *p = s->in + s->pos;
+	size_t const len = (size_t) p[0] | (size_t) p[1] << 8;
+	if ((p[2] ^ p[0]) != 0xFF || (p[3] ^ p[1]) != 0xFF ||
+	    s->inlen - s->pos - 4 < len)
+		return -1;
+
+	size_t const n = len < dstlen - *out ? len : dstlen - *out;
+	memcpy(dst + *out, p + 4, n);
+	*out += n;
+	s->pos += 4 + len;
+	return n < len;
+}
+
+/*
+ * Reads the code lengths of a dynamic block from |s| and builds the codes of
+ * its literals and lengths, |lit|, and of its distances, |dist|.
+ *
+ * Returns: true if successful, false if they are corrupt.
+ */
+static bool inflate_tables(struct Inflate * const s, struct Huffman * const lit,
+			   struct Huffman * const dist)
+{
+	unsigned char lens[NLIT + NDIST + 4];
+	unsigned char clens[NCLEN] = { 0 };
+	struct Huffman clen;
+
+	refill(s);
+	unsigned int const nlit = take(s, 5) + 257;
+	unsigned int const ndist = take(s, 5) + 1;
+	unsigned int const nclen = take(s, 4) + 4;
+
+	if (nlit > NLIT || ndist > NDIST)
+		return false;
+
+	for (unsigned int i = 0; i < nclen; i++) {
+		if (s->nbits < 3)
+			refill(s);
+		clens[clen_order[i]] = (unsigned char) take(s, 3);
+	}
+
+	if (!huff_build(&clen, clens, NCLEN))
+		return false;
+
+	for (unsigned int i = 0; i < nlit + ndist;) {
+		refill(s);
+		int const sym = huff_decode(s, &clen);
+		unsigned int rep;
+		unsigned char val = 0;
+
+		if (sym < 0)
+			return false;
+
+		if (sym < 16) {
+			lens[i++] = (unsigned char) sym;
+			continue;
+		} else if (sym == 16) {
+			if (i == 0)
+				return false;
+			val = lens[i - 1];
+			rep = 3 + take(s, 2);
+		} else if (sym == 17) {
+			rep = 3 + take(s, 3);
+		} else {
+			rep = 11 + take(s, 7);
+		}
+
+		if (i + rep > nlit + ndist)
+			return false;
+		memset(lens + i, val, rep);
+		i += rep;
+	}
+
+	/* A block without the end-of-block code could not end */
+	return lens[256] != 0 && huff_build(lit, lens, nlit) &&
+	    huff_build(dist, lens + nlit, ndist);
+}
+
+/*
+ * Decodes the literals and matches of a block from |s| into |dst| at |*out|,
+ * with the codes |lit| and |dist|, up to the end of the block or until
+ * |dstlen| bytes are there.
+ *
+ * Returns: 0 at the end of the block, 1 once |dst| is full, -1 if the block
+ * is corrupt.
+ */
+static int inflate_codes(struct Inflate * const s,
+			 struct Huffman const * const lit,
+			 struct Huffman const * const dist, unsigned char *dst,
+			 size_t const dstlen, size_t *out)
+{
+	size_t o = *out;
+	int r = -1;
+
+	for (;;) {
+		/* Enough for the longest length and distance with extra bits */
+		refill(s);
+
+		int sym = huff_decode(s, lit);
+		if (sym < 256) {
+			if (sym < 0)
+				break;
+			if (o == dstlen) {
+				r = 1;
+				break;
+			}
+			dst[o++] = (unsigned char) sym;
+			continue;
+		}
+
+		if (sym == 256) {
+			r = 0;
+			break;
+		}
+
+		sym -= 257;
+		if (sym >= 29)
+			break;
+		size_t len = len_base[sym] + take(s, len_extra[sym]);
+
+		int const dsym = huff_decode(s, dist);
+		if (dsym < 0 || dsym >= (int) NDIST)
+			break;
+		size_t const d = dist_base[dsym] + take(s, dist_extra[dsym]);
+		if (d > o)
+			break;
+
+		bool const full = len > dstlen - o;
+		if (full)
+			len = dstlen - o;
+
+		unsigned char *p = dst + o;
+		unsigned char const *q = p - d;
+		if (d >= len) {
+			memcpy(p, q, len);
+		} else {
+			/* The match repeats the |d| bytes before it */
+			for (size_t i = 0; i < len; i++)
+				p[i] = q[i];
+		}
+		o += len;
+
+		if (full) {
+			r = 1;
+			break;
+		}
+	}
+
+	*out = o;
+	return r;
+}
+
+/*
+ * Returns: the code, less 257, of the match length |len|.
+ */
+static inline unsigned int len_sym(size_t const len)
+{
+	if (len < 11)
+		return (unsigned int) len - 3;
+	if (len == DEFLATE_MAX_MATCH)
+		return 28;
+
+	/* Four codes for each number of extra bits from 1 on */
+	unsigned int const l = (unsigned int) len - 3;
+	unsigned int const nb = 31 - (unsigned int) __builtin_clz(l);
+	return 4 * (nb - 1) + ((l >> (nb - 2)) & 3);
+}
+
+/*
+ * Returns: the code of the match distance |dist|.
+ */
+static inline unsigned int dist_sym(size_t const dist)
+{
+	if (dist < 5)
+		return (unsigned int) dist - 1;
+
+	/* Two codes for each number of extra bits from 1 on */
+	unsigned int const d = (unsigned int) dist - 1;
+	unsigned int const nb = 31 - (unsigned int) __builtin_clz(d);
+	return 2 * nb + ((d >> (nb - 1)) & 1);
+}
+
+/*
+ * Returns: the hash of the DEFLATE_MIN_MATCH bytes at |p|.
+ */
+static inline uint32_t hash3(unsigned char const *p)
+{
+	uint32_t const v = (uint32_t) p[0] | (uint32_t) p[1] << 8 |
+	    (uint32_t) p[2] << 16;
+
+	return (v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+/*
+ * Adds the position |pos| of the source of |z| to its hash chain.
+ */
+static inline void insert(struct Deflate * const z, size_t const pos)
+{
+	uint32_t const h = hash3(z->src + pos);
+
+	z->prev[pos & WINDOW_MASK] = z->head[h];
+	z->head[h] = (uint32_t) pos + 1;
+}
+
+/*
+ * Looks for the longest match of the bytes at |pos| among the earlier
+ * positions of the same hash, trying as many as |lv| allows.
+ *
+ * Returns: the length of the match, with its distance stored in |dist|, or 0
+ * if there is none worth having.
+ */
+static size_t longest(struct Deflate const * const z, size_t const pos,
+		      struct Level const * const lv, size_t *dist)
+{
+	unsigned char const *a = z->src + pos;
+	size_t const max = z->len - pos < DEFLATE_MAX_MATCH ? z->len - pos :
+	    DEFLATE_MAX_MATCH;
+	size_t const nice = lv->nice < max ? lv->nice : max;
+	size_t best = DEFLATE_MIN_MATCH - 1;
+	uint32_t cand = z->head[hash3(a)];
+
+	for (unsigned int chain = lv->chain; cand && chain; chain--) {
+		size_t const c = cand - 1;
+		unsigned char const *b = z->src + c;
+
+		if (pos - c > DEFLATE_WINDOW)
+			break;
+
+		/* Only a match longer than the best so far is of use */
+		if (b[best] == a[best] && b[0] == a[0] && b[1] == a[1]) {
+			size_t l = 0;
+
+			while (l + 8 <= max) {
+				uint64_t const x = load_le64(a + l) ^
+				    load_le64(b + l);
+
+				if (x) {
+					l += (size_t) __builtin_ctzll(x) / 8;
+					goto found;
+				}
+				l += 8;
+			}
+			while (l < max && a[l] == b[l])
+				l++;
+found:
+			if (l > best) {
+				best = l;
+				*dist = pos - c;
+				if (l >= nice)
+					break;
+			}
+		}
+
+		/* An older entry overwritten by a newer one ends the chain */
+		cand = z->prev[c & WINDOW_MASK];
+		if (cand > c)
+			break;
+	}
+
+	if (best < DEFLATE_MIN_MATCH ||
+	    (best == DEFLATE_MIN_MATCH && *dist > TOO_FAR))
+		return 0;
+	return best;
+}
+
+/*
+ * Writes the |n| low bits of |v|, at most 32, to the output of |z|.
+ */
+static inline void put_bits(struct Deflate * const z, uint32_t const v,
+			    unsigned int const n)
+{
+	z->bits |= (uint64_t) v << z->nbits;
+	z->nbits += n;
+	if (z->nbits >= 32) {
+		unsigned char *p = z->out + z->olen;
+
+		p[0] = (unsigned char) z->bits;
+		p[1] = (unsigned char) (z->bits >> 8);
+		p[2] = (unsigned char) (z->bits >> 16);
+		p[3] = (unsigned char) (z->bits >> 24);
+		z->olen += 4;
+		z->bits >>= 32;
+		z->nbits -= 32;
+	}
+}
+
+/*
+ * Pads the output of |z| with zero bits to a byte boundary and writes out
+ * all pending bits.
+ */
+static void align_bits(struct Deflate * const z)
+{
+	while (z->nbits > 0) {
+		z->out[z->olen++] = (unsigned char) z->bits;
+		z->bits >>= 8;
+		z->nbits = z->nbits > 8 ? z->nbits - 8 : 0;
+	}
+	z->bits = 0;
+}
+
+/*
+ * Writes the |len| bytes at |p| to the output of |z| as stored blocks, or
+ * an empty one if |len| is 0.
+ */
+static void put_stored(struct Deflate * const z, unsigned char const *p,
+		       size_t len)
+{
+	do {
+		size_t const n = len < STORED_MAX ? len : STORED_MAX;
+		unsigned char *o;
+
+		put_bits(z, 0, 3);
+		align_bits(z);
+		o = z->out + z->olen;
+		o[0] = (unsigned char) n;
+		o[1] = (unsigned char) (n >> 8);
+		o[2] = (unsigned char) ~n;
+		o[3] = (unsigned char) (~n >> 8);
+		memcpy(o + 4, p, n);
+		z->olen += 4 + n;
+		p += n;
+		len -= n;
+	} while (len > 0);
+}
+
+/*
+ * Adds a match of |len| bytes at |dist| back, or if |len| is 0 the literal
+ * |ch|, to the block of |z|, writing out the block once it is full.
+ */
+static inline void emit(struct Deflate * const z, size_t const len,
+			size_t const dist, unsigned int const ch)
+{
+	z->slen[z->nsyms] = (uint16_t) (len ? len : ch);
+	z->sdist[z->nsyms] = (uint16_t) dist;
+	z->done += len ? len : 1;
+	if (++z->nsyms == DEFLATE_BLOCK_SYMS)
+		flush_block(z);
+}
+
+/*
+ * Writes out the symbols of the block of |z| in whichever block type, stored,
+ * with fixed codes or with dynamic codes, comes out shortest.
+ */
+static void flush_block(struct Deflate * const z)
+{
+	uint32_t lfreq[NLIT] = { 0 }, dfreq[NDIST] = { 0 };
+	uint32_t lbuild[NLIT], dbuild[NDIST], cfreq[NCLEN] = { 0 };
+	unsigned char llens[NLIT_FIXED] = { 0 }, dlens[NDIST], clens[NCLEN];
+	unsigned char all[NLIT + NDIST], rsym[NLIT + NDIST], rext[NLIT + NDIST];
+	uint16_t lcodes[NLIT_FIXED], dcodes[NDIST], ccodes[NCLEN];
+	unsigned int nlit = NLIT, ndist = NDIST, nclen = NCLEN, nrle = 0;
+	uint64_t extra = 0, dyn, fix, stored = 0;
+	size_t const raw = z->done - z->start;
+
+	lfreq[256] = 1;
+	for (size_t i = 0; i < z->nsyms; i++) {
+		if (!z->sdist[i]) {
+			lfreq[z->slen[i]]++;
+			continue;
+		}
+
+		unsigned int const ls = len_sym(z->slen[i]);
+		unsigned int const ds = dist_sym(z->sdist[i]);
+		lfreq[257 + ls]++;
+		dfreq[ds]++;
+		extra += len_extra[ls] + dist_extra[ds];
+	}
+
+	memcpy(lbuild, lfreq, sizeof(lbuild));
+	memcpy(dbuild, dfreq, sizeof(dbuild));
+	two_codes(lbuild, NLIT);
+	two_codes(dbuild, NDIST);
+	huff_lengths(lbuild, NLIT, MAX_BITS, llens);
+	huff_lengths(dbuild, NDIST, MAX_BITS, dlens);
+
+	while (nlit > 257 && !llens[nlit - 1])
+		nlit--;
+	while (ndist > 1 && !dlens[ndist - 1])
+		ndist--;
+
+	/* Run-length code the code lengths */
+	memcpy(all, llens, nlit);
+	memcpy(all + nlit, dlens, ndist);
+	for (unsigned int i = 0; i < nlit + ndist;) {
+		unsigned char const cur = all[i];
+		unsigned int run = 1, left;
+
+		while (i + run < nlit + ndist && all[i + run] == cur)
+			run++;
+		i += run;
+		left = run;
+
+		if (cur == 0) {
+			while (left >= 11) {
+				unsigned int const r = left < 138 ? left : 138;
+
+				rsym[nrle] = 18;
+				rext[nrle++] = (unsigned char) (r - 11);
+				left -= r;
+			}
+			if (left >= 3) {
+				rsym[nrle] = 17;
+				rext[nrle++] = (unsigned char) (left - 3);
+				left = 0;
+			}
+		} else {
+			rsym[nrle] = cur;
+			rext[nrle++] = 0;
+			left--;
+			while (left >= 3) {
+				unsigned int const r = left < 6 ? left : 6;
+
+				rsym[nrle] = 16;
+				rext[nrle++] = (unsigned char) (r - 3);
+				left -= r;
+			}
+		}
+
+		while (left--) {
+			rsym[nrle] = cur;
+			rext[nrle++] = 0;
+		}
+	}
+
+	for (unsigned int i = 0; i < nrle; i++)
+		cfreq[rsym[i]]++;
+	uint32_t cbuild[NCLEN];
+	memcpy(cbuild, cfreq, sizeof(cbuild));
+	two_codes(cbuild, NCLEN);
+	huff_lengths(cbuild, NCLEN, CLEN_BITS, clens);
+	while (nclen > 4 && !clens[clen_order[nclen - 1]])
+		nclen--;
+
+	/* Sizes in bits of the block in each form */
+	dyn = 3 + 14 + 3 * nclen + extra;
+	fix = 3 + extra;
+	for (unsigned int i = 0; i < NCLEN; i++)
+		dyn += (uint64_t) cfreq[i] * clens[i];
+	dyn += 2 * (uint64_t) cfreq[16] + 3 * (uint64_t) cfreq[17] +
+	    7 * (uint64_t) cfreq[18];
+	for (unsigned int i = 0; i < NLIT; i++) {
+		dyn += (uint64_t) lfreq[i] * llens[i];
+		fix += (uint64_t) lfreq[i] * (i < 144 ? 8 : i < 256 ? 9 :
+					      i < 280 ? 7 : 8);
+	}
+	for (unsigned int i = 0; i < NDIST; i++) {
+		dyn += (uint64_t) dfreq[i] * dlens[i];
+		fix += (uint64_t) dfreq[i] * 5;
+	}
+	for (size_t left = raw; left > 0 || stored == 0;) {
+		size_t const n = left < STORED_MAX ? left : STORED_MAX;
+
+		stored += 3 + 7 + 32 + 8 * (uint64_t) n;
+		left -= n;
+	}
+
+	if (stored <= dyn && stored <= fix) {
+		put_stored(z, z->src + z->start, raw);
+		goto out;
+	}
+
+	/*
+	 * The fixed code has lengths for 286 and 287 as well, which are never
+	 * written but take their place in the canonical order all the same
+	 */
+	if (fix <= dyn) {
+		for (unsigned int i = 0; i < NLIT_FIXED; i++)
+			llens[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+		memset(dlens, 5, NDIST);
+		put_bits(z, 1 << 1, 3);
+	} else {
+		put_bits(z, 2 << 1, 3);
+		put_bits(z, nlit - 257, 5);
+		put_bits(z, ndist - 1, 5);
+		put_bits(z, nclen - 4, 4);
+		for (unsigned int i = 0; i < nclen; i++)
+			put_bits(z, clens[clen_order[i]], 3);
+
+		huff_codes(clens, NCLEN, ccodes);
+		for (unsigned int i = 0; i < nrle; i++) {
+			unsigned int const s = rsym[i];
+
+			put_bits(z, ccodes[s], clens[s]);
+			if (s >= 16)
+				put_bits(z, rext[i], s == 16 ? 2 : s == 17 ? 3 : 7);
+		}
+	}
+
+	huff_codes(llens, NLIT_FIXED, lcodes);
+	huff_codes(dlens, NDIST, dcodes);
+	for (size_t i = 0; i < z->nsyms; i++) {
+		unsigned int const len = z->slen[i];
+		unsigned int const dist = z->sdist[i];
+
+		if (!dist) {
+			put_bits(z, lcodes[len], llens[len]);
+			continue;
+		}
+
+		unsigned int const ls = len_sym(len);
+		unsigned int const ds = dist_sym(dist);
+		put_bits(z, lcodes[257 + ls], llens[257 + ls]);
+		put_bits(z, len - len_base[ls], len_extra[ls]);
+		put_bits(z, dcodes[ds], dlens[ds]);
+		put_bits(z, dist - dist_base[ds], dist_extra[ds]);
+	}
+	put_bits(z, lcodes[256], llens[256]);
+
+out:
+	z->nsyms = 0;
+	z->start = z->done;
+}
+
+/*
+ * Gives the first unused of the |n| symbols of frequencies |freq| a count of
+ * 1 until two are used: a code of fewer symbols trips up some decoders, and
+ * one of none cannot be written.
+ */
+static void two_codes(uint32_t *freq, unsigned int const n)
+{
+	unsigned int used = 0;
+
+	for (unsigned int i = 0; i < n; i++)
+		used += freq[i] != 0;
+	for (unsigned int i = 0; i < n && used < 2; i++)
+		if (!freq[i]) {
+			freq[i] = 1;
+			used++;
+		}
+}
+
+/*
+ * Computes the lengths |lens| of an optimal prefix code for the |n| symbols
+ * of frequencies |freq| (0 for unused), none longer than |limit| bits, as in
+ * miniz: minimum-redundancy lengths computed in place (Moffat and Katajainen)
+ * and then, if need be, the longest shortened as little as the Kraft
+ * inequality allows.
+ */
+static void huff_lengths(uint32_t const *freq, unsigned int const n,
+			 unsigned int const limit, unsigned char *lens)
+{
+	uint32_t list[NLIT][2]; /* Frequency and symbol of those in use */
+	uint32_t a[NLIT];
+	unsigned int num[33] = { 0 };
+	unsigned int m = 0;
+
+	memset(lens, 0, n);
+	for (unsigned int i = 0; i < n; i++)
+		if (freq[i]) {
+			list[m][0] = freq[i];
+			list[m++][1] = i;
+		}
+
+	if (m == 0)
+		return;
+	if (m == 1) {
+		lens[list[0][1]] = 1;
+		return;
+	}
+
+	qsort(list, m, sizeof(list[0]), cmp_freq);
+	for (unsigned int i = 0; i < m; i++)
+		a[i] = list[i][0];
+
+	/* Phase 1: parent pointers of the internal nodes, in place */
+	int root = 0, leaf = 2, next, avbl, used, dpth;
+	int const nm = (int) m;
+	a[0] += a[1];
+	for (next = 1; next < nm - 1; next++) {
+		if (leaf >= nm || a[root] < a[leaf]) {
+			a[next] = a[root];
+			a[root++] = (uint32_t) next;
+		} else {
+			a[next] = a[leaf++];
+		}
+		if (leaf >= nm || (root < next && a[root] < a[leaf])) {
+			a[next] += a[root];
+			a[root++] = (uint32_t) next;
+		} else {
+			a[next] += a[leaf++];
+		}
+	}
+
+	/* Phase 2: depths of the internal nodes */
+	a[nm - 2] = 0;
+	for (next = nm - 3; next >= 0; next--)
+		a[next] = a[a[next]] + 1;
+
+	/* Phase 3: depths of the leaves */
+	avbl = 1;
+	used = dpth = 0;
+	root = nm - 2;
+	next = nm - 1;
+	while (avbl > 0) {
+		while (root >= 0 && a[root] == (uint32_t) dpth) {
+			used++;
+			root--;
+		}
+		while (avbl > used) {
+			a[next--] = (uint32_t) dpth;
+			avbl--;
+		}
+		avbl = 2 * used;
+		dpth++;
+		used = 0;
+	}
+
+	for (unsigned int i = 0; i < m; i++)
+		num[a[i] < 32 ? a[i] : 32]++;
+
+	/* Fold codes longer than |limit| into it and restore the sum */
+	for (unsigned int i = limit + 1; i <= 32; i++)
+		num[limit] += num[i];
+	uint32_t total = 0;
+	for (unsigned int i = limit; i > 0; i--)
+		total += num[i] << (limit - i);
+	while (total != 1U << limit) {
+		num[limit]--;
+		for (unsigned int i = limit - 1; i > 0; i--)
+			if (num[i]) {
+				num[i]--;
+				num[i + 1] += 2;
+				break;
+			}
+		total--;
+	}
+
+	/* The rarest symbols get the longest codes */
+	unsigned int k = 0;
+	for (unsigned int len = limit; len > 0; len--)
+		for (unsigned int j = num[len]; j > 0; j--)
+			lens[list[k++][1]] = (unsigned char) len;
+}
+
+/*
+ * Assigns the canonical Huffman codes |codes|, bit reversed to be written
+ * with put_bits(), to the |n| symbols of code lengths |lens|.
+ */
+static void huff_codes(unsigned char const *lens, unsigned int const n,
+		       uint16_t *codes)
+{
+	uint32_t count[MAX_BITS + 1] = { 0 }, next[MAX_BITS + 1];
+
+	for (unsigned int i = 0; i < n; i++)
+		count[lens[i]]++;
+	count[0] = 0;
+
+	next[0] = 0;
+	for (unsigned int len = 1; len <= MAX_BITS; len++)
+		next[len] = (next[len - 1] + count[len - 1]) << 1;
+
+	for (unsigned int i = 0; i < n; i++)
+		if (lens[i])
+			codes[i] = (uint16_t) reverse_bits(next[lens[i]]++,
+							   lens[i]);
+}
+
+/*
+ * Orders the entries of huff_lengths() by frequency, then symbol.
+ */
+static int cmp_freq(void const *a, void const *b)
+{
+	uint32_t const *x = a, *y = b;
+
+	if (x[0] != y[0])
+		return x[0] < y[0] ? -1 : 1;
+	return x[1] < y[1] ? -1 : x[1] > y[1];
+}
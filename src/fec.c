@@ -0,0 +1,681 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../include/fec.h"
+#include "../include/tune.h"
+
+/* Primitive polynomial of GF(2^8), x^8 + x^4 + x^3 + x^2 + 1 */
+#define GF_POLY 0x11DU
+
+/* Most errors a codeword can have and still be corrected */
+#define FEC_MAX_ERRORS (FEC_PARITY / 2)
+
+/*
+ * Distance in bytes at which the kernels prefetch the rows of the data. The
+ * rows of a codeword are far apart, too many streams for the prefetcher.
+ */
+#define FEC_PREFETCH 128
+
+static unsigned char gf_exp[2 * 256];
+static unsigned char gf_log[256];
+
+/*
+ * Products of each nibble with a constant, for the low and for the high
+ * nibble of the other factor: a product is then two table lookups, which
+ * PSHUFB does for 16 (or 32) bytes at once. |gen_tab[k]| is for the generator
+ * coefficient used by step |k| of the encoder.
+ */
+static unsigned char gen_tab[FEC_PARITY][2][16] __attribute__((aligned(16)));
+
+static pthread_once_t fec_once = PTHREAD_ONCE_INIT;
+
+static void fec_init(void);
+static inline unsigned char gf_mul(unsigned char const a,
+				   unsigned char const b);
+static void encode1(unsigned char const *data, size_t const len,
+		    size_t const ncw, unsigned char *parity, size_t const i);
+static int decode1(unsigned char *data, size_t const len, size_t const ncw,
+		   unsigned char *parity, size_t const i);
+static int correct(unsigned char *cw, size_t const n,
+		   unsigned char const *s);
+
+#ifdef FEC_SIMD
+static void encode16(unsigned char const *data, size_t const len,
+		     size_t const ncw, unsigned char *parity, size_t const i0)
+	__attribute__((target("ssse3")));
+static bool check16(unsigned char const *data, size_t const len,
+		    size_t const ncw, unsigned char const *parity,
+		    size_t const i0, unsigned int *bad)
+	__attribute__((target("ssse3")));
+static void encode32(unsigned char const *data, size_t const len,
+		     size_t const ncw, unsigned char *parity, size_t const i0)
+	__attribute__((target("avx2")));
+static bool check32(unsigned char const *data, size_t const len,
+		    size_t const ncw, unsigned char const *parity,
+		    size_t const i0, unsigned int *bad)
+	__attribute__((target("avx2")));
+#endif
+
+/*
+ * Computes the number of codewords used for |len| bytes of data.
+ *
+ * Returns: the number of codewords.
+ */
+size_t fec_codewords(size_t const len)
+{
+	return len / FEC_K + (len % FEC_K != 0);
+}
+
+/*
+ * Computes the number of parity bytes fec_encode() adds to |len| bytes of
+ * data.
+ *
+ * Returns: the number of parity bytes.
+ */
+size_t fec_parity_len(size_t const len)
+{
+	return fec_codewords(len) * FEC_PARITY;
+}
+
+/*
+ * Computes the largest amount of data which fits in |room| bytes together
+ * with its parity.
+ *
+ * Returns: the length of the data in bytes.
+ */
+size_t fec_data_len(size_t const room)
+{
+	size_t const rem = room % FEC_N;
+
+	return room / FEC_N * FEC_K + (rem > FEC_PARITY ? rem - FEC_PARITY : 0);
+}
+
+/*
+ * Computes the fec_parity_len(|len|) parity bytes of the |len| bytes of
+ * |data| into |parity|.
+ */
+void fec_encode(unsigned char const *data, size_t const len,
+		unsigned char *parity)
+{
+	size_t const ncw = fec_codewords(len);
+	size_t i = 0;
+
+	pthread_once(&fec_once, fec_init);
+
+#ifdef FEC_SIMD
+	if (tune.simd >= TUNE_SIMD_AVX2 && __builtin_cpu_supports("avx2")) {
+		for (; i + 32 <= ncw; i += 32)
+			encode32(data, len, ncw, parity, i);
+	}
+	if (tune.simd >= TUNE_SIMD_SSE2 && __builtin_cpu_supports("ssse3")) {
+		for (; i + 16 <= ncw; i += 16)
+			encode16(data, len, ncw, parity, i);
+	}
+#endif
+
+	for (; i < ncw; i++)
+		encode1(data, len, ncw, parity, i);
+}
+
+/*
+ * Checks the |len| bytes of |data| against their |parity|, made by
+ * fec_encode(), and corrects the errors found in either in place. The number
+ * of bytes corrected is stored in |fixed|.
+ *
+ * Returns: true if |data| is now intact, false if some codeword had more
+ * errors than can be corrected.
+ */
+bool fec_decode(unsigned char *data, size_t const len, unsigned char *parity,
+		size_t *fixed)
+{
+	size_t const ncw = fec_codewords(len);
+	size_t i = 0;
+	bool ok = true;
+
+	pthread_once(&fec_once, fec_init);
+	*fixed = 0;
+
+	/*
+	 * The kernels only encode the data again and compare the parity.
+	 * Codewords with errors are rare, and are decoded one at a time.
+	 */
+#ifdef FEC_SIMD
+	unsigned int bad;
+
+	if (tune.simd >= TUNE_SIMD_AVX2 && __builtin_cpu_supports("avx2")) {
+		for (; i + 32 <= ncw; i += 32) {
+			if (check32(data, len, ncw, parity, i, &bad))
+				continue;
+
+			for (; bad; bad &= bad - 1) {
+				int const n = decode1(data, len, ncw, parity,
+						      i + (size_t) __builtin_ctz(bad));
+				if (n < 0)
+					ok = false;
+				else
+					*fixed += (size_t) n;
+			}
+		}
+	}
+	if (tune.simd >= TUNE_SIMD_SSE2 && __builtin_cpu_supports("ssse3")) {
+		for (; i + 16 <= ncw; i += 16) {
+			if (check16(data, len, ncw, parity, i, &bad))
+				continue;
+
+			for (; bad; bad &= bad - 1) {
+				int const n = decode1(data, len, ncw, parity,
+						      i + (size_t) __builtin_ctz(bad));
+				if (n < 0)
+					ok = false;
+				else
+					*fixed += (size_t) n;
+			}
+		}
+	}
+#endif
+
+	for (; i < ncw; i++) {
+		int const n = decode1(data, len, ncw, parity, i);
+		if (n < 0)
+			ok = false;
+		else
+			*fixed += (size_t) n;
+	}
+
+	return ok;
+}
+
+/*
+ * Fills the tables of GF(2^8) and of the generator polynomial
+ * (x - alpha^0)(x - alpha^1)...(x - alpha^31).
+ */
+static void fec_init(void)
+{
+	unsigned char gen[FEC_PARITY + 1] = { 1 };
+	unsigned int x = 1;
+
+	for (unsigned int i = 0; i < 255; i++) {
+		gf_exp[i] = (unsigned char) x;
+		gf_log[x] = (unsigned char) i;
+		x <<= 1;
+		if (x & 0x100U)
+			x ^= GF_POLY;
+	}
+	for (unsigned int i = 255; i < sizeof(gf_exp); i++)
+		gf_exp[i] = gf_exp[i - 255];
+
+	/* |gen[i]| is the coefficient of x^i */
+	for (unsigned int m = 0; m < FEC_PARITY; m++) {
+		for (unsigned int i = m + 1; i > 0; i--)
+			gen[i] = gen[i - 1] ^ gf_mul(gen[i], gf_exp[m]);
+		gen[0] = gf_mul(gen[0], gf_exp[m]);
+	}
+
+	for (unsigned int k = 0; k < FEC_PARITY; k++) {
+		unsigned char const g = gen[FEC_PARITY - 1 - k];
+
+		for (unsigned int v = 0; v < 16; v++) {
+			gen_tab[k][0][v] = gf_mul(g, (unsigned char) v);
+			gen_tab[k][1][v] = gf_mul(g, (unsigned char) (v << 4));
+		}
+	}
+}
+
+/*
+ * Multiplies |a| and |b| in GF(2^8).
+ */
+static inline unsigned char gf_mul(unsigned char const a,
+				   unsigned char const b)
+{
+	if (a == 0 || b == 0)
+		return 0;
+	return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+/*
+ * Computes the parity of codeword |i| of the |len| bytes of |data|, split
+ * over |ncw| codewords, one byte at a time.
+ */
+static void encode1(unsigned char const *data, size_t const len,
+		    size_t const ncw, unsigned char *parity, size_t const i)
+{
+	unsigned char p[FEC_PARITY] = { 0 };
+
+	/*
+	 * The parity is the remainder of the data times x^32 divided by the
+	 * generator, highest degree first.
+	 */
+	for (size_t j = i; j < len; j += ncw) {
+		unsigned char const fb = data[j] ^ p[0];
+
+		for (unsigned int k = 0; k < FEC_PARITY - 1; k++)
+			p[k] = p[k + 1] ^ (gen_tab[k][0][fb & 0xF] ^
+					   gen_tab[k][1][fb >> 4]);
+		p[FEC_PARITY - 1] = gen_tab[FEC_PARITY - 1][0][fb & 0xF] ^
+		    gen_tab[FEC_PARITY - 1][1][fb >> 4];
+	}
+
+	for (unsigned int k = 0; k < FEC_PARITY; k++)
+		parity[k * ncw + i] = p[k];
+}
+
+/*
+ * Checks codeword |i| of the |len| bytes of |data|, split over |ncw|
+ * codewords, against its parity and corrects it in place.
+ *
+ * Returns: the number of bytes corrected, or -1 if there are too many errors.
+ */
+static int decode1(unsigned char *data, size_t const len, size_t const ncw,
+		   unsigned char *parity, size_t const i)
+{
+	unsigned char cw[FEC_N];
+	unsigned char s[FEC_PARITY] = { 0 };
+	size_t n = 0;
+
+	for (size_t j = i; j < len; j += ncw)
+		cw[n++] = data[j];
+	size_t const k = n;
+	for (unsigned int j = 0; j < FEC_PARITY; j++)
+		cw[n++] = parity[j * ncw + i];
+
+	/* Syndrome |m| is the codeword evaluated at alpha^|m| */
+	unsigned char any = 0;
+	for (unsigned int m = 0; m < FEC_PARITY; m++) {
+		unsigned char v = 0;
+
+		for (size_t t = 0; t < n; t++)
+			v = gf_mul(v, gf_exp[m]) ^ cw[t];
+		s[m] = v;
+		any |= v;
+	}
+
+	if (!any)
+		return 0;
+
+	int const nerr = correct(cw, n, s);
+	if (nerr < 0)
+		return -1;
+
+	for (size_t t = 0, j = i; t < k; t++, j += ncw)
+		data[j] = cw[t];
+	for (unsigned int j = 0; j < FEC_PARITY; j++)
+		parity[j * ncw + i] = cw[k + j];
+
+	return nerr;
+}
+
+/*
+ * Corrects the codeword |cw| of |n| bytes, the first one of highest degree,
+ * whose syndromes are |s|. The error locator is found with Berlekamp-Massey,
+ * its roots with a Chien search and the error values with Forney's formula.
+ *
+ * Returns: the number of bytes corrected, or -1 if there are too many errors.
+ */
+static int correct(unsigned char *cw, size_t const n,
+		   unsigned char const *s)
+{
+	unsigned char lambda[FEC_PARITY + 1] = { 1 };
+	unsigned char prev[FEC_PARITY + 1] = { 1 };
+	unsigned char omega[FEC_PARITY];
+	unsigned char b = 1;
+	unsigned int deg = 0;
+	unsigned int shift = 1;
+
+	for (unsigned int r = 0; r < FEC_PARITY; r++) {
+		unsigned char d = s[r];
+
+		for (unsigned int i = 1; i <= deg; i++)
+			d ^= gf_mul(lambda[i], s[r - i]);
+
+		if (d == 0) {
+			shift++;
+			continue;
+		}
+
+		/* lambda -= d / b * x^shift * prev */
+		unsigned char const coef = gf_exp[gf_log[d] + 255 - gf_log[b]];
+		unsigned char tmp[FEC_PARITY + 1];
+
+		memcpy(tmp, lambda, sizeof(tmp));
+		for (unsigned int i = shift; i <= FEC_PARITY; i++)
+			lambda[i] ^= gf_mul(coef, prev[i - shift]);
+
+		if (2 * deg <= r) {
+			deg = r + 1 - deg;
+			memcpy(prev, tmp, sizeof(prev));
+			b = d;
+			shift = 1;
+		} else {
+			shift++;
+		}
+	}
+
+	if (deg > FEC_MAX_ERRORS)
+		return -1;
+
+	/* omega = s * lambda mod x^32 */
+	for (unsigned int i = 0; i < FEC_PARITY; i++) {
+		unsigned char v = 0;
+
+		for (unsigned int j = 0; j <= i && j <= deg; j++)
+			v ^= gf_mul(lambda[j], s[i - j]);
+		omega[i] = v;
+	}
+
+	size_t pos[FEC_MAX_ERRORS];
+	unsigned char mag[FEC_MAX_ERRORS];
+	unsigned int found = 0;
+
+	/* The byte at |t| has degree |e|; it is wrong if lambda(alpha^-e) == 0 */
+	for (size_t t = 0; t < n; t++) {
+		unsigned int const e = (unsigned int) (n - 1 - t);
+		unsigned int const xinv = (255 - e) % 255;
+		unsigned char v = 0;
+
+		for (unsigned int i = 0; i <= deg; i++)
+			v ^= gf_mul(lambda[i], gf_exp[(xinv * i) % 255]);
+		if (v != 0)
+			continue;
+
+		if (found == deg)
+			return -1;
+
+		/* Forney: X * omega(X^-1) / lambda'(X^-1) */
+		unsigned char num = 0;
+		unsigned char den = 0;
+
+		for (unsigned int i = 0; i < FEC_PARITY; i++)
+			num ^= gf_mul(omega[i], gf_exp[(xinv * i) % 255]);
+		for (unsigned int i = 1; i <= deg; i += 2)
+			den ^= gf_mul(lambda[i], gf_exp[(xinv * (i - 1)) % 255]);
+
+		if (den == 0)
+			return -1;
+
+		pos[found] = t;
+		mag[found] = num == 0 ? 0 :
+		    gf_exp[(e + gf_log[num] + 255 - gf_log[den]) % 255];
+		found++;
+	}
+
+	/* Fewer roots than the degree of lambda: not a correctable pattern */
+	if (found != deg)
+		return -1;
+
+	for (unsigned int i = 0; i < found; i++)
+		cw[pos[i]] ^= mag[i];
+
+	return (int) found;
+}
+
+#ifdef FEC_SIMD
+/*
+ * Multiplies 16 bytes, given as their low nibbles |lo| and high nibbles |hi|,
+ * by the constant whose nibble products are the 32 bytes at |tab|.
+ */
+__attribute__((target("ssse3")))
+static inline __m128i gf_mul16(__m128i const lo, __m128i const hi,
+			       unsigned char const *tab)
+{
+	__m128i const tlo = _mm_load_si128((__m128i const *) tab);
+	__m128i const thi = _mm_load_si128((__m128i const *) (tab + 16));
+
+	return _mm_xor_si128(_mm_shuffle_epi8(tlo, lo),
+			     _mm_shuffle_epi8(thi, hi));
+}
+
+/*
+ * Loads the bytes of row |j| of the data for the |w| codewords from |i0| on.
+ * The last row may be short; the missing bytes are loaded as zero and
+ * |has| gets the codewords which do have a byte in the row.
+ */
+static inline unsigned char const *row_bytes(unsigned char const *data,
+					     size_t const len, size_t const ncw,
+					     size_t const j, size_t const i0,
+					     size_t const w, unsigned char *tmp,
+					     size_t *have)
+{
+	size_t const off = j * ncw + i0;
+
+	if (off + w <= len) {
+		*have = w;
+		return data + off;
+	}
+
+	*have = len - off;
+	memset(tmp, 0, w);
+	memcpy(tmp, data + off, *have);
+	return tmp;
+}
+
+/*
+ * Advances the encoder of 16 codewords, whose state is |p|, by the data
+ * bytes |d|.
+ */
+__attribute__((target("ssse3")))
+static inline void step16(__m128i *p, __m128i const d)
+{
+	__m128i const nib = _mm_set1_epi8(0x0F);
+	__m128i const fb = _mm_xor_si128(d, p[0]);
+	__m128i const lo = _mm_and_si128(fb, nib);
+	__m128i const hi = _mm_and_si128(_mm_srli_epi16(fb, 4), nib);
+
+	/* Unrolled, so the table addresses are constants */
+#pragma GCC unroll 32
+	for (unsigned int k = 0; k < FEC_PARITY - 1; k++)
+		p[k] = _mm_xor_si128(p[k + 1], gf_mul16(lo, hi, gen_tab[k][0]));
+	p[FEC_PARITY - 1] = gf_mul16(lo, hi, gen_tab[FEC_PARITY - 1][0]);
+}
+
+/*
+ * Runs the encoder of the 16 codewords from |i0| on over their data, leaving
+ * their parity in |p|.
+ */
+__attribute__((target("ssse3")))
+static inline void parity16(unsigned char const *data, size_t const len,
+			    size_t const ncw, size_t const i0, __m128i *p)
+{
+	size_t const full = len / ncw;
+
+	for (unsigned int k = 0; k < FEC_PARITY; k++)
+		p[k] = _mm_setzero_si128();
+
+	for (size_t j = 0; j < full; j++) {
+		unsigned char const *d = data + j * ncw + i0;
+
+		_mm_prefetch((char const *) d + FEC_PREFETCH, _MM_HINT_T0);
+		step16(p, _mm_loadu_si128((__m128i const *) d));
+	}
+
+	/* In the last, short row only some codewords take a step */
+	if (full * ncw + i0 < len) {
+		unsigned char tmp[16];
+		size_t have;
+		unsigned char const *d = row_bytes(data, len, ncw, full, i0,
+						   16, tmp, &have);
+		__m128i const has = _mm_cmpgt_epi8(
+			_mm_set1_epi8((char) have),
+			_mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12,
+				      13, 14, 15));
+		__m128i q[FEC_PARITY];
+
+		memcpy(q, p, sizeof(q));
+		step16(q, _mm_loadu_si128((__m128i const *) d));
+		for (unsigned int k = 0; k < FEC_PARITY; k++)
+			p[k] = _mm_or_si128(_mm_and_si128(has, q[k]),
+					    _mm_andnot_si128(has, p[k]));
+	}
+}
+
+/*
+ * Does the work of encode1() for the 16 codewords from |i0| on.
+ */
+static void encode16(unsigned char const *data, size_t const len,
+		     size_t const ncw, unsigned char *parity, size_t const i0)
+{
+	__m128i p[FEC_PARITY];
+
+	parity16(data, len, ncw, i0, p);
+	for (unsigned int k = 0; k < FEC_PARITY; k++)
+		_mm_storeu_si128((__m128i *) (parity + k * ncw + i0), p[k]);
+}
+
+/*
+ * Checks the 16 codewords from |i0| on by encoding their data again and
+ * comparing the result with their |parity|. The codewords which differ are
+ * stored as a bit mask in |bad|.
+ *
+ * Returns: true if all of the codewords are intact, false otherwise.
+ */
+static bool check16(unsigned char const *data, size_t const len,
+		    size_t const ncw, unsigned char const *parity,
+		    size_t const i0, unsigned int *bad)
+{
+	__m128i p[FEC_PARITY];
+	__m128i diff = _mm_setzero_si128();
+
+	parity16(data, len, ncw, i0, p);
+	for (unsigned int k = 0; k < FEC_PARITY; k++) {
+		__m128i const x = _mm_loadu_si128((__m128i const *)
+						  (parity + k * ncw + i0));
+
+		diff = _mm_or_si128(diff, _mm_xor_si128(x, p[k]));
+	}
+
+	*bad = ~(unsigned int) _mm_movemask_epi8(
+		_mm_cmpeq_epi8(diff, _mm_setzero_si128())) & 0xFFFFU;
+	return *bad == 0;
+}
+
+/*
+ * Like gf_mul16(), for 32 bytes.
+ */
+__attribute__((target("avx2")))
+static inline __m256i gf_mul32(__m256i const lo, __m256i const hi,
+			       unsigned char const *tab)
+{
+	__m256i const tlo = _mm256_broadcastsi128_si256(
+		_mm_load_si128((__m128i const *) tab));
+	__m256i const thi = _mm256_broadcastsi128_si256(
+		_mm_load_si128((__m128i const *) (tab + 16)));
+
+	return _mm256_xor_si256(_mm256_shuffle_epi8(tlo, lo),
+				_mm256_shuffle_epi8(thi, hi));
+}
+
+/*
+ * Like step16(), for 32 codewords.
+ */
+__attribute__((target("avx2")))
+static inline void step32(__m256i *p, __m256i const d)
+{
+	__m256i const nib = _mm256_set1_epi8(0x0F);
+	__m256i const fb = _mm256_xor_si256(d, p[0]);
+	__m256i const lo = _mm256_and_si256(fb, nib);
+	__m256i const hi = _mm256_and_si256(_mm256_srli_epi16(fb, 4), nib);
+
+	/* Unrolled, so the table addresses are constants */
+#pragma GCC unroll 32
+	for (unsigned int k = 0; k < FEC_PARITY - 1; k++)
+		p[k] = _mm256_xor_si256(p[k + 1], gf_mul32(lo, hi, gen_tab[k][0]));
+	p[FEC_PARITY - 1] = gf_mul32(lo, hi, gen_tab[FEC_PARITY - 1][0]);
+}
+
+/*
+ * Mask of the first |have| of 32 bytes.
+ */
+__attribute__((target("avx2")))
+static inline __m256i lanes32(size_t const have)
+{
+	return _mm256_cmpgt_epi8(_mm256_set1_epi8((char) have),
+				 _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9,
+						  10, 11, 12, 13, 14, 15, 16,
+						  17, 18, 19, 20, 21, 22, 23,
+						  24, 25, 26, 27, 28, 29, 30,
+						  31));
+}
+
+/*
+ * Like parity16(), for the 32 codewords from |i0| on.
+ */
+__attribute__((target("avx2")))
+static inline void parity32(unsigned char const *data, size_t const len,
+			    size_t const ncw, size_t const i0, __m256i *p)
+{
+	size_t const full = len / ncw;
+
+	for (unsigned int k = 0; k < FEC_PARITY; k++)
+		p[k] = _mm256_setzero_si256();
+
+	for (size_t j = 0; j < full; j++) {
+		unsigned char const *d = data + j * ncw + i0;
+
+		_mm_prefetch((char const *) d + FEC_PREFETCH, _MM_HINT_T0);
+		step32(p, _mm256_loadu_si256((__m256i const *) d));
+	}
+
+	if (full * ncw + i0 < len) {
+		unsigned char tmp[32];
+		size_t have;
+		unsigned char const *d = row_bytes(data, len, ncw, full, i0,
+						   32, tmp, &have);
+		__m256i const has = lanes32(have);
+		__m256i q[FEC_PARITY];
+
+		memcpy(q, p, sizeof(q));
+		step32(q, _mm256_loadu_si256((__m256i const *) d));
+		for (unsigned int k = 0; k < FEC_PARITY; k++)
+			p[k] = _mm256_blendv_epi8(p[k], q[k], has);
+	}
+}
+
+/*
+ * Does the work of encode1() for the 32 codewords from |i0| on.
+ */
+static void encode32(unsigned char const *data, size_t const len,
+		     size_t const ncw, unsigned char *parity, size_t const i0)
+{
+	__m256i p[FEC_PARITY];
+
+	parity32(data, len, ncw, i0, p);
+	for (unsigned int k = 0; k < FEC_PARITY; k++)
+		_mm256_storeu_si256((__m256i *) (parity + k * ncw + i0), p[k]);
+}
+
+/*
+ * Like check16(), for the 32 codewords from |i0| on.
+ */
+static bool check32(unsigned char const *data, size_t const len,
+		    size_t const ncw, unsigned char const *parity,
+		    size_t const i0, unsigned int *bad)
+{
+	__m256i p[FEC_PARITY];
+	__m256i diff = _mm256_setzero_si256();
+
+	parity32(data, len, ncw, i0, p);
+	for (unsigned int k = 0; k < FEC_PARITY; k++) {
+		__m256i const x = _mm256_loadu_si256((__m256i const *)
+						     (parity + k * ncw + i0));
+
+		diff = _mm256_or_si256(diff, _mm256_xor_si256(x, p[k]));
+	}
+
+	*bad = ~(unsigned int) _mm256_movemask_epi8(
+		_mm256_cmpeq_epi8(diff, _mm256_setzero_si256()));
+	return *bad == 0;
+}
+#endif
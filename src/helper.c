@@ -17,15 +17,42 @@
 
 #include "../include/helper.h"
 
+bool quiet = false;
+
+/* The umask of the process, see read_umask() */
+static mode_t out_umask = 022;
+
+static void dir_of(char const *path, char *dir);
+static void read_umask(void) __attribute__((constructor));
+
 void clean_exit(FILE *fp, struct RGB *rgbs, int const code)
 {
 	if (fp)
 		fclose(fp);
-	if (rgbs)
-		free(rgbs);
+
+	/*
+	 * |rgbs| may be mapped rather than allocated (see map_bmp()), and
+	 * exit() gives back either, so it is left alone.
+	 */
+	(void) rgbs;
 	exit(code);
 }
 
+/*
+ * Prints an informational (progress) message to stdout unless |quiet| is set.
+ */
+void info(char const *fmt, ...)
+{
+	va_list ap;
+
+	if (quiet)
+		return;
+
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+}
+
 /*
  * Helper function to get the size of the file pointed to by |fp|.
  * The size of the file is passed by reference to |sz|.
@@ -77,6 +104,349 @@ unsigned char *read_file(FILE * const hfp, size_t const len)
 	return hdata;
 }
 
+/*
+ * Helper function to read |fp| up to its end, STREAM_BLOCK_LEN bytes at a
+ * time, into a buffer which the caller must free. Reading stops as soon as
+ * more than |max| bytes came in, so an oversized stream is not kept. The
+ * length of the data is stored in |len|.
+ *
+ * Returns: pointer to the data, or NULL on error; |errno| is EFBIG if the
+ * stream is longer than |max|.
+ */
+unsigned char *read_stream(FILE * const fp, size_t const max, size_t *len)
+{
+	unsigned char *buf = NULL;
+	size_t cap = 0;
+	size_t n = 0;
+
+	for (;;) {
+		if (cap - n < STREAM_BLOCK_LEN) {
+			size_t const ncap = cap ? cap * 2 : STREAM_BLOCK_LEN;
+			unsigned char *p = realloc(buf, ncap);
+
+			if (!p) {
+				free(buf);
+				return NULL;
+			}
+			buf = p;
+			cap = ncap;
+		}
+
+		size_t const got = fread(buf + n, 1, cap - n, fp);
+		n += got;
+
+		if (n > max) {
+			free(buf);
+			errno = EFBIG;
+			return NULL;
+		}
+
+		if (got == 0) {
+			if (ferror(fp)) {
+				free(buf);
+				return NULL;
+			}
+			break;
+		}
+	}
+
+	*len = n;
+	return buf;
+}
+
+/*
+ * Helper function to read exactly |len| bytes at offset |off| of |fd| into
+ * |buf|, retrying on short reads.
+ *
+ * Returns: true if successful, false otherwise (including early end of file).
+ */
+bool pread_full(int const fd, void *buf, size_t len, off_t off)
+{
+	unsigned char *p = buf;
+
+	while (len > 0) {
+		ssize_t const n = pread(fd, p, len, off);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+
+		p += n;
+		off += n;
+		len -= (size_t) n;
+	}
+
+	return true;
+}
+
+/*
+ * Helper function to write exactly |len| bytes of |buf| at offset |off| of
+ * |fd|, retrying on short writes.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+bool pwrite_full(int const fd, void const *buf, size_t len, off_t off)
+{
+	unsigned char const *p = buf;
+
+	while (len > 0) {
+		ssize_t const n = pwrite(fd, p, len, off);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+
+		p += n;
+		off += n;
+		len -= (size_t) n;
+	}
+
+	return true;
+}
+
+/*
+ * Helper function to read |len| bytes of |fd| into |buf|, retrying on short
+ * reads, for pipes and other streams.
+ *
+ * Returns: the number of bytes read, less than |len| only at the end of the
+ * stream, or -1 on error.
+ */
+ssize_t read_full(int const fd, void *buf, size_t len)
+{
+	unsigned char *p = buf;
+	size_t got = 0;
+
+	while (got < len) {
+		ssize_t const n = read(fd, p + got, len - got);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -1;
+		if (n == 0)
+			break;
+
+		got += (size_t) n;
+	}
+
+	return (ssize_t) got;
+}
+
+/*
+ * Helper function to write the |len| bytes of |buf| to |fd|, retrying on
+ * short writes, for pipes and other streams.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+bool write_full(int const fd, void const *buf, size_t len)
+{
+	unsigned char const *p = buf;
+
+	while (len > 0) {
+		ssize_t const n = write(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+
+		p += n;
+		len -= (size_t) n;
+	}
+
+	return true;
+}
+
+/*
+ * Creates an output file to be published as |path| by out_publish(), in the
+ * same directory so that publishing it is atomic. It has no name at all where
+ * the file system supports O_TMPFILE, and a temporary one next to |path|
+ * otherwise.
+ *
+ * Returns: true if successful, false otherwise, with |errno| set.
+ */
+bool out_open(struct Out_file * const out, char const *path)
+{
+	char dir[PATH_MAX];
+	size_t const len = strlen(path);
+
+	/* Room for the suffix of a temporary name */
+	if (len == 0 || len + 16 >= PATH_MAX) {
+		errno = len ? ENAMETOOLONG : ENOENT;
+		return false;
+	}
+
+	memcpy(out->path, path, len + 1);
+	out->tmp[0] = '\0';
+	dir_of(path, dir);
+
+#ifdef O_TMPFILE
+	out->fd = open(dir, O_TMPFILE | O_WRONLY | O_CLOEXEC, 0666);
+	if (out->fd >= 0)
+		return true;
+	if (errno != EOPNOTSUPP && errno != EISDIR && errno != EINVAL)
+		return false;
+#endif
+
+	/* A named temporary file, with the permissions open() would give */
+	snprintf(out->tmp, sizeof(out->tmp), "%s.XXXXXX", path);
+	out->fd = mkstemp(out->tmp);
+	if (out->fd < 0) {
+		out->tmp[0] = '\0';
+		return false;
+	}
+
+	if (fchmod(out->fd, 0666 & ~out_umask) != 0) {
+		out_abort(out);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Makes the written |out| as durable as |sync| asks and gives it its name,
+ * replacing any file of that name at once. |out->fd| stays open.
+ *
+ * Returns: true if successful, false otherwise, with |errno| set.
+ */
+bool out_publish(struct Out_file * const out, enum Sync const sync)
+{
+	if (!sync_fd(out->fd, sync))
+		return false;
+
+	/*
+	 * An O_TMPFILE is linked in through /proc, which needs no privileges.
+	 * linkat() does not replace a file, so an existing one is replaced by
+	 * linking under a temporary name first and renaming that.
+	 */
+	if (!out->tmp[0]) {
+		char proc[32];
+
+		snprintf(proc, sizeof(proc), "/proc/self/fd/%d", out->fd);
+		if (linkat(AT_FDCWD, proc, AT_FDCWD, out->path,
+			   AT_SYMLINK_FOLLOW) == 0)
+			goto named;
+		if (errno != EEXIST)
+			return false;
+
+		for (unsigned int i = 0;; i++) {
+			int const n = snprintf(out->tmp, sizeof(out->tmp),
+					       "%s.%ld.%u", out->path,
+					       (long) getpid(), i);
+
+			if (n < 0 || (size_t) n >= sizeof(out->tmp)) {
+				out->tmp[0] = '\0';
+				errno = ENAMETOOLONG;
+				return false;
+			}
+			if (linkat(AT_FDCWD, proc, AT_FDCWD, out->tmp,
+				   AT_SYMLINK_FOLLOW) == 0)
+				break;
+			if (errno != EEXIST || i == 100) {
+				out->tmp[0] = '\0';
+				return false;
+			}
+		}
+	}
+
+	if (renameat(AT_FDCWD, out->tmp, AT_FDCWD, out->path) != 0) {
+		int const err = errno;
+
+		unlink(out->tmp);
+		out->tmp[0] = '\0';
+		errno = err;
+		return false;
+	}
+	out->tmp[0] = '\0';
+
+named:
+	return sync != SYNC_FULL || sync_dir(out->path);
+}
+
+/*
+ * Throws away |out|, which was not published, and closes it.
+ */
+void out_abort(struct Out_file * const out)
+{
+	if (out->tmp[0])
+		unlink(out->tmp);
+	out->tmp[0] = '\0';
+	close(out->fd);
+	out->fd = -1;
+}
+
+/*
+ * Flushes the data (SYNC_DATA) or the data and the metadata (SYNC_FULL) of
+ * |fd| to the disk.
+ *
+ * Returns: true if successful, false otherwise, with |errno| set.
+ */
+bool sync_fd(int const fd, enum Sync const sync)
+{
+	if (sync == SYNC_DATA)
+		return fdatasync(fd) == 0;
+	if (sync == SYNC_FULL)
+		return fsync(fd) == 0;
+	return true;
+}
+
+/*
+ * Flushes the directory which holds |path| to the disk, so that a name given
+ * to a file in it lasts.
+ *
+ * Returns: true if successful, false otherwise, with |errno| set.
+ */
+bool sync_dir(char const *path)
+{
+	char dir[PATH_MAX];
+
+	if (strlen(path) >= PATH_MAX) {
+		errno = ENAMETOOLONG;
+		return false;
+	}
+
+	dir_of(path, dir);
+	int const fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	bool const ok = fsync(fd) == 0;
+	int const err = errno;
+	close(fd);
+	errno = err;
+	return ok;
+}
+
+/*
+ * Stores the directory part of |path|, which is shorter than PATH_MAX, in
+ * |dir|: "." for a bare file name.
+ */
+static void dir_of(char const *path, char *dir)
+{
+	char const *slash = strrchr(path, '/');
+
+	if (!slash) {
+		strcpy(dir, ".");
+		return;
+	}
+
+	/* The root keeps its slash */
+	size_t const n = slash == path ? 1 : (size_t) (slash - path);
+	memcpy(dir, path, n);
+	dir[n] = '\0';
+}
+
+/*
+ * Reads the umask into |out_umask| before main() runs. umask() can only read
+ * it by setting it, which must not happen once threads may be creating files
+ * (out_open() is called from worker threads), so this is done only here,
+ * while the process is still single-threaded, and never changes it for good.
+ */
+static void read_umask(void)
+{
+	out_umask = umask(022);
+	umask(out_umask);
+}
+
 /*
  * Helper function to perform safe subtraction on unsigned values. The result
  * is stored inside of |r|.
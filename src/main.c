@@ -15,42 +15,95 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "../include/analyze.h" /* analyze() */
 #include "../include/args.h"   /* struct Args, parse_args() */
+#include "../include/batch.h"  /* batch() */
 #include "../include/bmp.h"    /* For manipulating BMP images */
+#include "../include/compare.h" /* compare() */
+#include "../include/crypto.h" /* keygen() */
 #include "../include/helper.h" /* Helpers, clean_exit(), struct Args */
+#include "../include/plan.h"   /* plan() */
+#include "../include/scan.h"   /* scan() */
+#include "../include/serve.h"  /* serve(), client() */
 #include "../include/stegan.h" /* hide(), reveal() */
+#include "../include/tune.h"   /* calibrate(), tune_load() */
+#include "../include/video.h"  /* video() */
+#include "../include/watch.h"  /* watch() */
 
 int main(int argc, char **argv)
 {
 	struct Args args = {
+		.mode = MODE_STEG,
 		.mflag = false,
 		.tflag = false,
 		.dflag = false,
-		.eflag = false
+		.eflag = false,
+		.uflag = false,
+		.layout = LAYOUT_V1,
+		.level = DEFLATE_DEF_LEVEL
 	};
 
 	if (!parse_args(argc, argv, &args))
 		clean_exit(NULL, NULL, EXIT_FAILURE);
 
-	FILE * const fp = fopen(args.bmpfname, "rb");
+	/* Measured from the defaults, not from the profile it replaces */
+	if (args.mode == MODE_CALIBRATE)
+		return calibrate(&args) ? EXIT_SUCCESS : EXIT_FAILURE;
+	if (!tune_load(args.tunespec))
+		clean_exit(NULL, NULL, EXIT_FAILURE);
+
+	if (args.mode == MODE_ANALYZE)
+		return analyze(&args) ? EXIT_SUCCESS : EXIT_FAILURE;
+	if (args.mode == MODE_SCAN)
+		return scan(&args) ? EXIT_SUCCESS : EXIT_FAILURE;
+	if (args.mode == MODE_BATCH)
+		return batch(&args) ? EXIT_SUCCESS : EXIT_FAILURE;
+	if (args.mode == MODE_PLAN)
+		return plan(&args) ? EXIT_SUCCESS : EXIT_FAILURE;
+	if (args.mode == MODE_KEYGEN)
+		return keygen(&args) ? EXIT_SUCCESS : EXIT_FAILURE;
+	if (args.mode == MODE_SERVE)
+		return serve(&args) ? EXIT_SUCCESS : EXIT_FAILURE;
+	if (args.mode == MODE_CLIENT)
+		return client(&args) ? EXIT_SUCCESS : EXIT_FAILURE;
+	if (args.mode == MODE_VIDEO)
+		return video(&args) ? EXIT_SUCCESS : EXIT_FAILURE;
+	if (args.mode == MODE_COMPARE)
+		return compare(&args) ? EXIT_SUCCESS : EXIT_FAILURE;
+	if (args.mode == MODE_WATCH)
+		return watch(&args) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	/* An update writes the changed pixels straight back to the file */
+	FILE * const fp = fopen(args.bmpfname, args.uflag ? "r+b" : "rb");
 	if (!fp) {
 		perror("fopen");
 		clean_exit(fp, NULL, EXIT_FAILURE);
 	}
 
-	struct BMP_file bmp;
-	bmp.fp = fp;
+	struct BMP_file bmp = {
+		.fp = fp,
+		.header = NULL
+	};
 	if (!init_bmp(&bmp))
 		clean_exit(bmp.fp, NULL, EXIT_FAILURE);
 
-	read_bmp(&bmp);
+	if (args.uflag) {
+		update(&bmp, &args);
+		fclose(bmp.fp);
+		return EXIT_SUCCESS;
+	}
+
+	if (args.direct || tune.direct)
+		read_direct(&bmp);
+	else
+		map_bmp(&bmp);
 
 	if (args.eflag)
 		hide(&bmp, &args);
 	else if (args.dflag)
 		reveal(&bmp, &args);
 
-	free(bmp.data);
+	free_bmp(&bmp);
 	fclose(bmp.fp);
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,460 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../include/plan.h"
+
+/* A cover or a payload, one line of a list given to plan() */
+struct Plan_item {
+	char   *name; /* Cover, payload file name or message */
+	size_t size;  /* Capacity of a cover or length of a payload */
+	bool   ok;    /* Whether |size| could be determined */
+};
+
+/* State shared between the worker threads of plan() */
+struct Plan_pool {
+	struct Args const *args;
+	struct Plan_item  *covers;
+	size_t            ncovers;
+	struct Plan_item  *payloads;
+	size_t            npayloads;
+	size_t            next; /* Index of the next item to measure */
+};
+
+static bool read_list(char const *fname, struct Plan_item **items,
+		      size_t *n);
+static void free_list(struct Plan_item *items, size_t const n);
+static void *plan_worker(void *arg);
+static void measure_cover(struct Args const * const args,
+			  struct Plan_item * const item);
+static void measure_payload(struct Args const * const args,
+			    struct Plan_item * const item);
+static size_t compact(struct Plan_item *items, size_t const n);
+static int cmp_size(void const *a, void const *b);
+static size_t lower_bound(struct Plan_item const *items, size_t const n,
+			  size_t const size);
+static size_t next_free(size_t *parent, size_t i);
+
+/*
+ * This function is the public interface of the 'plan' mode. The covers listed
+ * in |args->files[0]| and the payloads listed in |args->files[1]| ("-" for
+ * stdin, one per line) are measured by a pool of worker threads, reading only
+ * the headers of the covers. Every cover takes a single payload, so each
+ * payload, largest first, goes to the smallest free cover it fits in. This
+ * places as many payloads as possible and keeps the larger covers free.
+ *
+ * The assignment is printed to stdout as a job list for batch(), or run
+ * directly if |args->xflag| is set.
+ *
+ * Returns: true if every payload was placed (and its job succeeded), false
+ * otherwise.
+ */
+bool plan(struct Args const * const args)
+{
+	struct Plan_pool pool = { .args = args, .next = 0 };
+	struct Batch_job *jobs = NULL;
+	size_t *parent = NULL;
+	size_t njobs = 0;
+	bool ok = false;
+
+	if (strcmp(args->files[0], "-") == 0 &&
+	    strcmp(args->files[1], "-") == 0) {
+		fprintf(stderr, "Error: only one list can be read from stdin\n");
+		return false;
+	}
+
+	pool.covers = NULL;
+	pool.payloads = NULL;
+	if (!read_list(args->files[0], &pool.covers, &pool.ncovers) ||
+	    !read_list(args->files[1], &pool.payloads, &pool.npayloads))
+		goto out;
+
+	/* Workers mostly wait on metadata I/O, so use more than one per CPU */
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t nthreads = args->nthreads ? args->nthreads :
+	    (ncpu > 0 ? (size_t) ncpu * 4 : 4);
+	size_t const nitems = pool.ncovers + pool.npayloads;
+	if (nthreads > nitems)
+		nthreads = nitems;
+
+	pthread_t *tids = malloc((nthreads ? nthreads : 1) * sizeof(*tids));
+	if (!tids) {
+		perror("malloc");
+		goto out;
+	}
+
+	size_t started = 0;
+	for (; started < nthreads; started++) {
+		if (pthread_create(&tids[started], NULL, plan_worker,
+				   &pool) != 0) {
+			perror("pthread_create");
+			break;
+		}
+	}
+
+	/* If no thread could be started, do the work on this one */
+	if (started == 0)
+		plan_worker(&pool);
+
+	for (size_t i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+	free(tids);
+
+	/*
+	 * Covers by increasing capacity, payloads by decreasing size. Unusable
+	 * items are moved out of the way first.
+	 */
+	size_t const ncovers = compact(pool.covers, pool.ncovers);
+	size_t const npayloads = compact(pool.payloads, pool.npayloads);
+	qsort(pool.covers, ncovers, sizeof(*pool.covers), cmp_size);
+	qsort(pool.payloads, npayloads, sizeof(*pool.payloads), cmp_size);
+
+	/* |parent| links every used cover to the next larger one */
+	jobs = malloc((npayloads ? npayloads : 1) * sizeof(*jobs));
+	parent = malloc((ncovers + 1) * sizeof(*parent));
+	if (!jobs || !parent) {
+		perror("malloc");
+		goto out;
+	}
+
+	for (size_t i = 0; i <= ncovers; i++)
+		parent[i] = i;
+
+	size_t placed = 0;
+	size_t capsum = 0;
+	ok = npayloads == pool.npayloads;
+
+	for (size_t i = npayloads; i-- > 0;) {
+		struct Plan_item const * const p = &pool.payloads[i];
+		size_t const c = next_free(parent,
+					   lower_bound(pool.covers, ncovers,
+						       p->size));
+
+		if (c == ncovers) {
+			fprintf(stderr, "Error: no free cover can hold %s "
+				"(%zu bytes)\n", p->name, p->size);
+			ok = false;
+			continue;
+		}
+
+		parent[c] = c + 1;
+		jobs[njobs].cover = pool.covers[c].name;
+		jobs[njobs].payload = p->name;
+		njobs++;
+		placed += p->size;
+		capsum += pool.covers[c].size;
+	}
+
+	fprintf(stderr, "Planned %zu of %zu payloads (%zu bytes) on covers "
+		"holding %zu bytes\n", njobs, pool.npayloads, placed, capsum);
+
+	if (args->xflag) {
+		if (!run_batch(args, jobs, njobs))
+			ok = false;
+	} else {
+		for (size_t i = 0; i < njobs; i++)
+			printf("%s\t%s\n", jobs[i].cover, jobs[i].payload);
+	}
+
+out:
+	free(parent);
+	free(jobs);
+	free_list(pool.covers, pool.ncovers);
+	free_list(pool.payloads, pool.npayloads);
+	return ok;
+}
+
+/*
+ * Reads the list |fname| ("-" for stdin), one name per line, into a new array
+ * |items| of |n| entries. Empty lines are skipped.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+static bool read_list(char const *fname, struct Plan_item **items,
+		      size_t *n)
+{
+	bool const in = strcmp(fname, "-") == 0;
+	FILE *fp = in ? stdin : fopen(fname, "r");
+	size_t cap = 0;
+	size_t lineno = 0;
+	char *line = NULL;
+	size_t linecap = 0;
+	ssize_t len;
+	bool ok = true;
+
+	*items = NULL;
+	*n = 0;
+
+	if (!fp) {
+		perror("fopen");
+		return false;
+	}
+
+	while ((len = getline(&line, &linecap, fp)) >= 0) {
+		lineno++;
+
+		while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+			line[--len] = '\0';
+		if (len == 0)
+			continue;
+
+		/* Names end up in a tab separated job list */
+		if (strchr(line, '\t')) {
+			fprintf(stderr, "Error: %s:%zu: name contains a tab\n",
+				fname, lineno);
+			ok = false;
+			break;
+		}
+
+		if (*n == cap) {
+			size_t const ncap = cap ? cap * 2 : 64;
+			struct Plan_item *tmp = realloc(*items,
+							ncap * sizeof(*tmp));
+			if (!tmp) {
+				perror("realloc");
+				ok = false;
+				break;
+			}
+			*items = tmp;
+			cap = ncap;
+		}
+
+		(*items)[*n].name = line;
+		(*items)[*n].size = 0;
+		(*items)[*n].ok = false;
+		(*n)++;
+		line = NULL;
+		linecap = 0;
+	}
+
+	if (ferror(fp)) {
+		perror("getline");
+		ok = false;
+	}
+
+	free(line);
+	if (!in)
+		fclose(fp);
+
+	if (!ok) {
+		free_list(*items, *n);
+		*items = NULL;
+		*n = 0;
+	}
+
+	return ok;
+}
+
+/*
+ * Frees the |n| entries of |items| and the array itself.
+ */
+static void free_list(struct Plan_item *items, size_t const n)
+{
+	for (size_t i = 0; i < n; i++)
+		free(items[i].name);
+	free(items);
+}
+
+/*
+ * Worker thread of plan(). Measures covers, then payloads, until none are
+ * left.
+ */
+static void *plan_worker(void *arg)
+{
+	struct Plan_pool * const pool = arg;
+
+	for (;;) {
+		size_t const i = __atomic_fetch_add(&pool->next, 1,
+						    __ATOMIC_RELAXED);
+		if (i < pool->ncovers)
+			measure_cover(pool->args, &pool->covers[i]);
+		else if (i - pool->ncovers < pool->npayloads)
+			measure_payload(pool->args,
+					&pool->payloads[i - pool->ncovers]);
+		else
+			break;
+	}
+
+	return NULL;
+}
+
+/*
+ * Measures the capacity of the cover |fname| for the method, type and options
+ * in |args| from the headers of the file, which is all that is read. A cover
+ * which is not supported is reported.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+bool cover_capacity(struct Args const * const args, char const *fname,
+		    size_t *cap)
+{
+	unsigned char buf[CARRIER_PROBE_LEN];
+	struct BMP_file bmp = {
+		.fp = NULL,
+		.order = NULL, /* capacity() reads what the probe leaves alone */
+		.match = NULL
+	};
+	struct stat st;
+	char err[128] = "not a regular file";
+
+	int const fd = open(fname, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "Warning: skipping cover %s: %s\n", fname,
+			strerror(errno));
+		return false;
+	}
+
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+		goto fail;
+
+	if (st.st_size < CARRIER_MIN_FILE_SIZE ||
+	    st.st_size > CARRIER_MAX_FILE_SIZE) {
+		snprintf(err, sizeof(err), "unsupported file size");
+		goto fail;
+	}
+
+	/* Only the headers are needed; don't let readahead fetch more */
+	posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+
+	ssize_t const got = pread(fd, buf, sizeof(buf), 0);
+	if (got < 0) {
+		snprintf(err, sizeof(err), "%s", strerror(errno));
+		goto fail;
+	}
+
+	bmp.tot_size = (size_t) st.st_size;
+	if (!probe_carrier(buf, (size_t) got, &bmp, err, sizeof(err)))
+		goto fail;
+
+	close(fd);
+	*cap = capacity(&bmp, args);
+	return true;
+
+fail:
+	fprintf(stderr, "Warning: skipping cover %s: %s\n", fname, err);
+	close(fd);
+	return false;
+}
+
+/*
+ * Sets the capacity of the cover |item| for the method and type in |args|.
+ * Covers which are not supported are reported and left out.
+ */
+static void measure_cover(struct Args const * const args,
+			  struct Plan_item * const item)
+{
+	item->ok = cover_capacity(args, item->name, &item->size);
+}
+
+/*
+ * Sets the length of the payload |item|: the size of the file, or the length
+ * of the message, depending on the type in |args|.
+ */
+static void measure_payload(struct Args const * const args,
+			    struct Plan_item * const item)
+{
+	struct stat st;
+
+	if (strncmp(args->ttyp, "file", 4) != 0) {
+		item->size = strlen(item->name);
+		item->ok = true;
+		return;
+	}
+
+	if (stat(item->name, &st) != 0 || !S_ISREG(st.st_mode)) {
+		fprintf(stderr, "Error: %s: not a regular file\n", item->name);
+		return;
+	}
+
+	item->size = (size_t) st.st_size;
+	item->ok = true;
+}
+
+/*
+ * Moves the entries of |items| which could be measured to the front, keeping
+ * their order. The other entries end up after them.
+ *
+ * Returns: the number of entries which could be measured.
+ */
+static size_t compact(struct Plan_item *items, size_t const n)
+{
+	size_t k = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		if (!items[i].ok)
+			continue;
+
+		struct Plan_item const tmp = items[k];
+		items[k++] = items[i];
+		items[i] = tmp;
+	}
+
+	return k;
+}
+
+/*
+ * Orders two items by increasing size. Ties are broken by name so that the
+ * plan does not depend on the order of the lists.
+ */
+static int cmp_size(void const *a, void const *b)
+{
+	struct Plan_item const *x = a;
+	struct Plan_item const *y = b;
+
+	if (x->size != y->size)
+		return x->size < y->size ? -1 : 1;
+
+	return strcmp(x->name, y->name);
+}
+
+/*
+ * Returns: the index of the first of the |n| sorted |items| whose size is at
+ * least |size|, or |n| if there is none.
+ */
+static size_t lower_bound(struct Plan_item const *items, size_t const n,
+			  size_t const size)
+{
+	size_t lo = 0;
+	size_t hi = n;
+
+	while (lo < hi) {
+		size_t const mid = lo + (hi - lo) / 2;
+
+		if (items[mid].size < size)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/*
+ * Follows the links in |parent| from |i| to the first free cover, halving the
+ * paths on the way so later lookups are close to constant time.
+ *
+ * Returns: the index of the free cover, or the number of covers if none is
+ * left.
+ */
+static size_t next_free(size_t *parent, size_t i)
+{
+	while (parent[i] != i) {
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+
+	return i;
+}
@@ -0,0 +1,663 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../include/deflate.h"
+#include "../include/helper.h"
+#include "../include/png.h"
+
+/* A segment of the image data compressed by png_encode() */
+struct Png_segment {
+	size_t        row;    /* First row */
+	size_t        nrows;
+	unsigned char *buf;   /* IDAT chunk of the compressed segment */
+	size_t        len;    /* Length of the chunk */
+	uint32_t      adler;  /* Adler-32 of the filtered rows */
+	size_t        rawlen; /* Length of the filtered rows */
+};
+
+/* Shared by the threads of png_encode() */
+struct Png_pool {
+	struct BMP_file const *bmp;
+	struct Png_segment    *segs;
+	size_t                nsegs;
+	size_t                next;   /* Next segment to compress */
+	bool                  failed; /* Whether a segment ran out of memory */
+};
+
+static bool png_match(unsigned char const *hdr, size_t const len);
+static bool png_probe(unsigned char const *hdr, size_t const len,
+		      struct BMP_file * const bmp, char *err,
+		      size_t const errlen);
+static bool png_decode(struct BMP_file const * const bmp,
+		       unsigned char const *file, unsigned char *dst,
+		       size_t const len, char *err, size_t const errlen);
+static bool png_encode(struct BMP_file const * const bmp,
+		       unsigned char const *src, int const fd);
+static bool png_inflate(unsigned char const *zdata, size_t const zlen,
+			unsigned char *raw, size_t const need, size_t *end);
+static void *png_worker(void *arg);
+static bool png_segment(struct BMP_file const * const bmp,
+			struct Png_segment * const seg);
+static void png_filter(unsigned char const *row, unsigned char const *prev,
+		       size_t const rowlen, size_t const pxlen,
+		       unsigned int const level, unsigned char *out,
+		       unsigned char *tmp);
+static bool png_unfilter(unsigned char *row, unsigned char const *prev,
+			 size_t const rowlen, size_t const pxlen);
+static inline unsigned char paeth(unsigned char const a, unsigned char const b,
+				  unsigned char const c);
+static void put_chunk_frame(unsigned char *chunk, size_t const len,
+			    char const *type);
+static uint32_t read_be32(unsigned char const *buf);
+static void write_be32(unsigned char *buf, uint32_t const v);
+
+/* The pixels are compressed, so they are decoded and encoded */
+struct Carrier_format const png_format = {
+	.name = "png",
+	.fixed_header = false,
+	.match = png_match,
+	.probe = png_probe,
+	.stamp = NULL,
+	.decode = png_decode,
+	.encode = png_encode
+};
+
+/*
+ * Whether the first |len| bytes of a file, |hdr|, are those of a PNG file.
+ */
+static bool png_match(unsigned char const *hdr, size_t const len)
+{
+	return len >= PNG_SIG_LEN && memcmp(hdr, PNG_SIGNATURE, PNG_SIG_LEN) == 0;
+}
+
+/*
+ * Parses the headers found in the first |len| bytes of a PNG file, |hdr|, into
+ * |bmp|, see struct Carrier_format. The pixels are not in the file as such,
+ * so the whole file counts as headers, which png_encode() copies the other
+ * chunks from, and |bmp->datalen| is the length of the decoded pixels.
+ *
+ * Returns: true if file is supported; false otherwise.
+ */
+static bool png_probe(unsigned char const *hdr, size_t const len,
+		      struct BMP_file * const bmp, char *err,
+		      size_t const errlen)
+{
+	unsigned char const *ihdr = hdr + PNG_SIG_LEN + 8;
+
+	if (len < PNG_HEADERS_LEN ||
+	    read_be32(hdr + PNG_SIG_LEN) != PNG_IHDR_LEN ||
+	    memcmp(hdr + PNG_SIG_LEN + 4, "IHDR", 4) != 0) {
+		snprintf(err, errlen, "PNG file does not start with IHDR; "
+			 "possibly corrupt");
+		return false;
+	}
+
+	uint32_t const w = read_be32(ihdr);
+	uint32_t const h = read_be32(ihdr + 4);
+	unsigned int const depth = ihdr[8];
+	unsigned int const ctype = ihdr[9];
+
+	if (w == 0 || h == 0 || w > PNG_MAX_DIM || h > PNG_MAX_DIM) {
+		snprintf(err, errlen, "invalid image dimensions %ux%u",
+			 (unsigned int) w, (unsigned int) h);
+		return false;
+	}
+
+	if (depth != 8 || (ctype != PNG_GRAY && ctype != PNG_RGB &&
+			   ctype != PNG_GRAY_ALPHA && ctype != PNG_RGB_ALPHA)) {
+		snprintf(err, errlen, "only PNG files of 8-bit gray or color "
+			 "samples are supported, found %u-bit color type %u",
+			 depth, ctype);
+		return false;
+	}
+
+	if (ihdr[10] != 0 || ihdr[11] != 0) {
+		snprintf(err, errlen, "unknown PNG compression or filter method");
+		return false;
+	}
+
+	if (ihdr[12] != 0) {
+		snprintf(err, errlen, "interlaced PNG files are not supported");
+		return false;
+	}
+
+	bmp->pxlen = ctype == PNG_RGB_ALPHA ? 4 : ctype == PNG_RGB ? 3 :
+	    ctype == PNG_GRAY_ALPHA ? 2 : 1;
+	bmp->chans = ctype == PNG_RGB_ALPHA ? "rgba" : ctype == PNG_RGB ? "rgb" :
+	    ctype == PNG_GRAY_ALPHA ? "ya" : "y";
+	bmp->bpp = 8 * bmp->pxlen;
+	bmp->width = w;
+	bmp->height = h;
+	bmp->rowlen = bmp->width * bmp->pxlen;
+	bmp->topdown = true;
+	bmp->diblen = 0;
+	bmp->headerlen = PNG_HEADERS_LEN;
+	bmp->data_off = bmp->tot_size;
+
+	/* Pixel offsets are 32-bit, see texture_order() */
+	if (bmp->rowlen > CARRIER_MAX_FILE_SIZE / bmp->height) {
+		snprintf(err, errlen, "image is too large");
+		return false;
+	}
+	bmp->datalen = bmp->rowlen * bmp->height;
+
+	/* Images without hidden data have no tag */
+	unsigned char const *tag = hdr + PNG_HEADERS_LEN;
+	bmp->layout = LAYOUT_V1;
+	bmp->flags = 0;
+	if (len >= PNG_HEADERS_LEN + PNG_CHUNK_EXTRA + PNG_TAG_LEN &&
+	    read_be32(tag) == PNG_TAG_LEN &&
+	    memcmp(tag + 4, PNG_TAG_TYPE, 4) == 0) {
+		unsigned int const layout = (unsigned int) tag[8] << 8 | tag[9];
+
+		bmp->layout = layout == 0 ? LAYOUT_V1 : layout;
+		bmp->flags = (unsigned int) tag[10] << 8 | tag[11];
+	}
+
+	return true;
+}
+
+/*
+ * Decodes the first |len| bytes of the pixels of the PNG file |file|, see
+ * struct Carrier_format: only the rows which hold them are inflated. The
+ * checksum of the image data is verified when all of it is.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+static bool png_decode(struct BMP_file const * const bmp,
+		       unsigned char const *file, unsigned char *dst,
+		       size_t const len, char *err, size_t const errlen)
+{
+	size_t const tot = bmp->tot_size;
+	size_t const stride = bmp->rowlen + 1; /* With the filter byte */
+	size_t const nrows = (len + bmp->rowlen - 1) / bmp->rowlen;
+	size_t const need = nrows * stride;
+	unsigned char *zdata = NULL, *raw = NULL;
+	size_t zlen = 0, pos = PNG_SIG_LEN, inlen = 0;
+	bool ok = false, done = false;
+
+	if (!(raw = malloc(need))) {
+		snprintf(err, errlen, "out of memory");
+		goto out;
+	}
+
+	/*
+	 * The image data is the concatenation of the IDAT chunks. When only
+	 * the first rows are wanted, it is inflated as soon as it holds them.
+	 */
+	while (!done && tot - pos >= PNG_CHUNK_EXTRA) {
+		size_t const clen = read_be32(file + pos);
+		unsigned char const *type = file + pos + 4;
+
+		if (clen > tot - pos - PNG_CHUNK_EXTRA) {
+			snprintf(err, errlen, "PNG chunk runs past the end of "
+				 "the file; possibly corrupt");
+			goto out;
+		}
+
+		if (memcmp(type, "IDAT", 4) == 0) {
+			unsigned char *p = realloc(zdata, zlen + clen);
+
+			if (!p) {
+				snprintf(err, errlen, "out of memory");
+				goto out;
+			}
+			zdata = p;
+			memcpy(zdata + zlen, file + pos + 8, clen);
+			zlen += clen;
+			done = nrows < bmp->height &&
+			    png_inflate(zdata, zlen, raw, need, &inlen);
+		} else if (memcmp(type, "IEND", 4) == 0) {
+			break;
+		}
+
+		pos += clen + PNG_CHUNK_EXTRA;
+	}
+
+	if (!done && !png_inflate(zdata, zlen, raw, need, &inlen)) {
+		snprintf(err, errlen, "PNG image data corrupt or cut short");
+		goto out;
+	}
+
+	/* The Adler-32 of the whole follows the last block */
+	if (nrows == bmp->height &&
+	    (zlen - inlen < 4 || read_be32(zdata + inlen) !=
+	     adler32_buf(1, raw, need))) {
+		snprintf(err, errlen, "PNG image data checksum mismatch; "
+			 "possibly corrupt");
+		goto out;
+	}
+
+	for (size_t y = 0; y < nrows; y++) {
+		unsigned char *row = raw + y * stride;
+
+		if (!png_unfilter(row, y ? row - stride + 1 : NULL,
+				  bmp->rowlen, bmp->pxlen)) {
+			snprintf(err, errlen, "unknown PNG filter type %u", *row);
+			goto out;
+		}
+
+		size_t const off = y * bmp->rowlen;
+		size_t const n = len - off < bmp->rowlen ? len - off :
+		    bmp->rowlen;
+		memcpy(dst + off, row + 1, n);
+	}
+
+	ok = true;
+out:
+	free(zdata);
+	free(raw);
+	return ok;
+}
+
+/*
+ * Inflates the first |need| bytes of the zlib stream in the |zlen| bytes of
+ * |zdata| into |raw|, storing in |end| where its last block ends if they are
+ * all of it.
+ *
+ * Returns: true if successful, false if the stream is corrupt or cut short.
+ */
+static bool png_inflate(unsigned char const *zdata, size_t const zlen,
+			unsigned char *raw, size_t const need, size_t *end)
+{
+	size_t outlen, inlen;
+
+	/* A zlib header of DEFLATE with no preset dictionary */
+	if (zlen < 2 || (zdata[0] & 0x0FU) != 8 || (zdata[1] & 0x20U) ||
+	    ((unsigned int) zdata[0] << 8 | zdata[1]) % 31 != 0)
+		return false;
+
+	if (!inflate_buf(zdata + 2, zlen - 2, raw, need, &outlen, &inlen) ||
+	    outlen < need)
+		return false;
+
+	*end = 2 + inlen;
+	return true;
+}
+
+/*
+ * Writes the stego image |bmp| to |fd|, see struct Carrier_format: the chunks
+ * of its cover |src| in order, with the tag after IHDR and the IDAT chunks
+ * replaced by the new image data. The rows are cut into segments of about
+ * PNG_SEGMENT_LEN bytes, which the threads filter and compress on their own
+ * as they come, like pigz does: each ends on a byte boundary without being
+ * the last block, so they only need to be written one after the other, in
+ * IDAT chunks of their own, and closed with an empty last block and the
+ * Adler-32 of the whole, combined from those of the segments.
+ *
+ * Returns: true if successful, false otherwise, with |errno| set.
+ */
+static bool png_encode(struct BMP_file const * const bmp,
+		       unsigned char const *src, int const fd)
+{
+	size_t const stride = bmp->rowlen + 1;
+	size_t const per = stride < PNG_SEGMENT_LEN ? PNG_SEGMENT_LEN / stride :
+	    1;
+	struct Png_pool pool = {
+		.bmp = bmp,
+		.nsegs = (bmp->height + per - 1) / per,
+		.next = 0,
+		.failed = false
+	};
+	pthread_t *tids = NULL;
+	size_t started = 0, pos = PNG_SIG_LEN;
+	off_t off = 0;
+	bool ok = false, idat = false;
+	int err = ENOMEM;
+
+	if (!(pool.segs = calloc(pool.nsegs, sizeof(*pool.segs))))
+		return false;
+
+	for (size_t i = 0; i < pool.nsegs; i++) {
+		pool.segs[i].row = i * per;
+		pool.segs[i].nrows = bmp->height - i * per < per ?
+		    bmp->height - i * per : per;
+	}
+
+	size_t nthreads = bmp->nthreads ? bmp->nthreads : tune_threads();
+	if (nthreads > pool.nsegs)
+		nthreads = pool.nsegs;
+
+	/* The calling thread takes its share */
+	if (nthreads > 1 && !(tids = malloc((nthreads - 1) * sizeof(*tids))))
+		goto out;
+	for (; started + 1 < nthreads; started++)
+		if (pthread_create(&tids[started], NULL, png_worker, &pool))
+			break;
+	png_worker(&pool);
+	for (size_t i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+	if (pool.failed)
+		goto out;
+
+	/* The last block and the checksum of the image data */
+	unsigned char tail[PNG_CHUNK_EXTRA + 6];
+	uint32_t adler = 1;
+	for (size_t i = 0; i < pool.nsegs; i++)
+		adler = adler32_combine(adler, pool.segs[i].adler,
+					pool.segs[i].rawlen);
+	tail[8] = 0x03;
+	tail[9] = 0x00;
+	write_be32(tail + 10, adler);
+	put_chunk_frame(tail, 6, "IDAT");
+
+	unsigned char tag[PNG_CHUNK_EXTRA + PNG_TAG_LEN];
+	unsigned int const layout = bmp->layout == LAYOUT_V1 ? 0 : bmp->layout;
+	tag[8] = (unsigned char) (layout >> 8);
+	tag[9] = (unsigned char) layout;
+	tag[10] = (unsigned char) (bmp->flags >> 8);
+	tag[11] = (unsigned char) bmp->flags;
+	put_chunk_frame(tag, PNG_TAG_LEN, PNG_TAG_TYPE);
+
+	/* A cover whose chunks do not add up is only found out here */
+	err = EINVAL;
+	if (!pwrite_full(fd, PNG_SIGNATURE, PNG_SIG_LEN, off))
+		goto out_errno;
+	off += PNG_SIG_LEN;
+
+	/* probe_carrier() saw a whole IHDR, the rest is checked here */
+	while (bmp->data_off - pos >= PNG_CHUNK_EXTRA) {
+		size_t const clen = read_be32(src + pos);
+		unsigned char const *type = src + pos + 4;
+
+		if (clen > bmp->data_off - pos - PNG_CHUNK_EXTRA)
+			goto out;
+
+		if (memcmp(type, "IDAT", 4) == 0) {
+			/* The new image data goes where the first IDAT was */
+			for (size_t i = 0; !idat && i < pool.nsegs; i++) {
+				if (!pwrite_full(fd, pool.segs[i].buf,
+						 pool.segs[i].len, off))
+					goto out_errno;
+				off += (off_t) pool.segs[i].len;
+			}
+			if (!idat) {
+				if (!pwrite_full(fd, tail, sizeof(tail), off))
+					goto out_errno;
+				off += (off_t) sizeof(tail);
+			}
+			idat = true;
+		} else if (memcmp(type, PNG_TAG_TYPE, 4) != 0) {
+			if (!pwrite_full(fd, src + pos, clen + PNG_CHUNK_EXTRA,
+					 off))
+				goto out_errno;
+			off += (off_t) (clen + PNG_CHUNK_EXTRA);
+		}
+
+		if (memcmp(type, "IHDR", 4) == 0) {
+			if (!pwrite_full(fd, tag, sizeof(tag), off))
+				goto out_errno;
+			off += (off_t) sizeof(tag);
+		}
+
+		pos += clen + PNG_CHUNK_EXTRA;
+		if (memcmp(type, "IEND", 4) == 0)
+			break;
+	}
+
+	ok = idat;
+	goto out;
+
+out_errno:
+	err = errno;
+out:
+	for (size_t i = 0; i < pool.nsegs; i++)
+		free(pool.segs[i].buf);
+	free(pool.segs);
+	free(tids);
+	if (!ok)
+		errno = err;
+	return ok;
+}
+
+/*
+ * Compresses the segments of the pool |arg| one after the other, as they are
+ * handed out, until there are none left.
+ */
+static void *png_worker(void *arg)
+{
+	struct Png_pool * const pool = arg;
+
+	for (;;) {
+		size_t const i = __atomic_fetch_add(&pool->next, 1,
+						    __ATOMIC_RELAXED);
+
+		if (i >= pool->nsegs ||
+		    __atomic_load_n(&pool->failed, __ATOMIC_RELAXED))
+			break;
+
+		if (!png_segment(pool->bmp, &pool->segs[i]))
+			__atomic_store_n(&pool->failed, true, __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+/*
+ * Filters the rows of |seg| and compresses them into an IDAT chunk, headed
+ * by the zlib header if it is the first segment.
+ *
+ * Returns: true if successful, false if out of memory.
+ */
+static bool png_segment(struct BMP_file const * const bmp,
+			struct Png_segment * const seg)
+{
+	size_t const stride = bmp->rowlen + 1;
+	unsigned char const *px = (unsigned char const *) bmp->data;
+	unsigned int const level = bmp->level;
+	size_t const zhead = seg->row == 0 ? 2 : 0;
+	unsigned char *raw, *tmp;
+
+	seg->rawlen = seg->nrows * stride;
+	raw = malloc(seg->rawlen);
+	tmp = malloc(stride);
+	seg->buf = malloc(8 + zhead + DEFLATE_BOUND(seg->rawlen) + 4);
+	if (!raw || !tmp || !seg->buf)
+		goto fail;
+
+	for (size_t y = 0; y < seg->nrows; y++) {
+		size_t const r = seg->row + y;
+
+		png_filter(px + r * bmp->rowlen,
+			   r ? px + (r - 1) * bmp->rowlen : NULL, bmp->rowlen,
+			   bmp->pxlen, level, raw + y * stride, tmp);
+	}
+	seg->adler = adler32_buf(1, raw, seg->rawlen);
+
+	/* Window of 32K and the level in FLEVEL, as zlib sets them */
+	if (zhead) {
+		unsigned int const flevel = level < 2 ? 0 : level < 6 ? 1 :
+		    level == 6 ? 2 : 3;
+		unsigned int const hdr = 0x7800U | flevel << 6;
+
+		seg->buf[8] = 0x78;
+		seg->buf[9] = (unsigned char) ((hdr | (31 - hdr % 31)) & 0xFFU);
+	}
+
+	size_t const n = deflate_buf(raw, seg->rawlen, level,
+				     seg->buf + 8 + zhead);
+	if (n == 0)
+		goto fail;
+
+	seg->len = n + zhead + PNG_CHUNK_EXTRA;
+	put_chunk_frame(seg->buf, n + zhead, "IDAT");
+	free(raw);
+	free(tmp);
+	return true;
+
+fail:
+	free(raw);
+	free(tmp);
+	return false;
+}
+
+/*
+ * Filters the |rowlen| bytes of |row|, under the row |prev| (NULL for the
+ * first row), into |out|, headed by the filter type, with |tmp| as scratch of
+ * the same length. At |level| 0 nothing is filtered, as nothing is compressed;
+ * otherwise the filter chosen is the one whose output has the least sum of
+ * absolute values taken as signed bytes, the heuristic of libpng.
+ */
+static void png_filter(unsigned char const *row, unsigned char const *prev,
+		       size_t const rowlen, size_t const pxlen,
+		       unsigned int const level, unsigned char *out,
+		       unsigned char *tmp)
+{
+	uint64_t best = UINT64_MAX;
+
+	out[0] = 0;
+	memcpy(out + 1, row, rowlen);
+	if (level == 0)
+		return;
+
+	for (unsigned int f = 0; f <= 4; f++) {
+		uint64_t sum = 0;
+
+		tmp[0] = (unsigned char) f;
+		for (size_t i = 0; i < rowlen; i++) {
+			unsigned int const a = i >= pxlen ? row[i - pxlen] : 0;
+			unsigned int const b = prev ? prev[i] : 0;
+			unsigned int const c = prev && i >= pxlen ?
+			    prev[i - pxlen] : 0;
+			unsigned int p;
+
+			switch (f) {
+			case 0:
+				p = 0;
+				break;
+			case 1:
+				p = a;
+				break;
+			case 2:
+				p = b;
+				break;
+			case 3:
+				p = (a + b) / 2;
+				break;
+			default:
+				p = paeth((unsigned char) a, (unsigned char) b,
+					  (unsigned char) c);
+				break;
+			}
+
+			unsigned char const v = (unsigned char) (row[i] - p);
+			tmp[i + 1] = v;
+			sum += v < 128 ? v : 256U - v;
+		}
+
+		if (sum < best) {
+			best = sum;
+			memcpy(out, tmp, rowlen + 1);
+		}
+	}
+}
+
+/*
+ * Reverses the filter of |row|, whose first byte gives its type, in place;
+ * |prev| is the unfiltered row above it, without its filter byte, or NULL for
+ * the first row.
+ *
+ * Returns: true if successful, false if the filter type is unknown.
+ */
+static bool png_unfilter(unsigned char *row, unsigned char const *prev,
+			 size_t const rowlen, size_t const pxlen)
+{
+	unsigned char * const p = row + 1;
+
+	switch (row[0]) {
+	case 0:
+		break;
+	case 1:
+		for (size_t i = pxlen; i < rowlen; i++)
+			p[i] = (unsigned char) (p[i] + p[i - pxlen]);
+		break;
+	case 2:
+		for (size_t i = 0; prev && i < rowlen; i++)
+			p[i] = (unsigned char) (p[i] + prev[i]);
+		break;
+	case 3:
+		for (size_t i = 0; i < rowlen; i++) {
+			unsigned int const a = i >= pxlen ? p[i - pxlen] : 0;
+			unsigned int const b = prev ? prev[i] : 0;
+
+			p[i] = (unsigned char) (p[i] + (a + b) / 2);
+		}
+		break;
+	case 4:
+		for (size_t i = 0; i < rowlen; i++) {
+			unsigned char const a = i >= pxlen ? p[i - pxlen] : 0;
+			unsigned char const b = prev ? prev[i] : 0;
+			unsigned char const c = prev && i >= pxlen ?
+			    prev[i - pxlen] : 0;
+
+			p[i] = (unsigned char) (p[i] + paeth(a, b, c));
+		}
+		break;
+	default:
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Returns: whichever of |a| (left), |b| (above) and |c| (above left) is
+ * closest to |a| + |b| - |c|, the Paeth predictor.
+ */
+static inline unsigned char paeth(unsigned char const a, unsigned char const b,
+				  unsigned char const c)
+{
+	int const pa = abs((int) b - c);
+	int const pb = abs((int) a - c);
+	int const pc = abs((int) a + b - 2 * c);
+
+	if (pa <= pb && pa <= pc)
+		return a;
+	return pb <= pc ? b : c;
+}
+
+/*
+ * Fills in the length, |type| and CRC of the chunk |chunk|, whose |len| bytes
+ * of data follow the 8 bytes left for the first two.
+ */
+static void put_chunk_frame(unsigned char *chunk, size_t const len,
+			    char const *type)
+{
+	write_be32(chunk, (uint32_t) len);
+	memcpy(chunk + 4, type, 4);
+	write_be32(chunk + 8 + len, crc32_buf(0, chunk + 4, len + 4));
+}
+
+/*
+ * Reads a 32-bit big-endian value from |buf|.
+ */
+static uint32_t read_be32(unsigned char const *buf)
+{
+	return (uint32_t) buf[0] << 24 | (uint32_t) buf[1] << 16 |
+	    (uint32_t) buf[2] << 8 | (uint32_t) buf[3];
+}
+
+/*
+ * Writes |v| as a 32-bit big-endian value to |buf|.
+ */
+static void write_be32(unsigned char *buf, uint32_t const v)
+{
+	buf[0] = (unsigned char) (v >> 24);
+	buf[1] = (unsigned char) (v >> 16);
+	buf[2] = (unsigned char) (v >> 8);
+	buf[3] = (unsigned char) v;
+}
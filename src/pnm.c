@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../include/pnm.h"
+
+static bool pnm_match(unsigned char const *hdr, size_t const len);
+static bool pnm_probe(unsigned char const *hdr, size_t const len,
+		      struct BMP_file * const bmp, char *err,
+		      size_t const errlen);
+static size_t pnm_stamp(struct BMP_file const * const bmp,
+			unsigned char const *src, unsigned char *dst);
+static bool pnm_field(unsigned char const *hdr, size_t const len,
+		      size_t *pos, unsigned long *val, unsigned int *layout,
+		      unsigned int *flags);
+static size_t pnm_tag_len(unsigned char const *p, size_t const len);
+
+/* Stamping inserts the tag comment, so the headers change length */
+struct Carrier_format const pnm_format = {
+	.name = "pnm",
+	.fixed_header = false,
+	.match = pnm_match,
+	.probe = pnm_probe,
+	.stamp = pnm_stamp
+};
+
+/*
+ * Whether the first |len| bytes of a file, |hdr|, are those of a PNM file of
+ * any kind, so that those which are not supported are reported as such.
+ */
+static bool pnm_match(unsigned char const *hdr, size_t const len)
+{
+	return len >= 3 && hdr[0] == 'P' && hdr[1] >= '1' && hdr[1] <= '7' &&
+	    isspace(hdr[2]);
+}
+
+/*
+ * Parses the headers found in the first |len| bytes of a PNM file, |hdr|, into
+ * |bmp|, see struct Carrier_format.
+ *
+ * Returns: true if file is supported; false otherwise.
+ */
+static bool pnm_probe(unsigned char const *hdr, size_t const len,
+		      struct BMP_file * const bmp, char *err,
+		      size_t const errlen)
+{
+	unsigned long dim[3]; /* Width, height and maxval */
+	unsigned int layout = 0, flags = 0;
+	size_t pos = 2;
+
+	if (hdr[1] != PNM_GRAY && hdr[1] != PNM_COLOR) {
+		snprintf(err, errlen, "only binary PGM (P5) and PPM (P6) files "
+			 "are supported, found P%c", hdr[1]);
+		return false;
+	}
+
+	for (size_t i = 0; i < 3; i++) {
+		if (!pnm_field(hdr, len, &pos, &dim[i], &layout, &flags)) {
+			snprintf(err, errlen, "PNM header is malformed or "
+				 "longer than %u bytes", CARRIER_PROBE_LEN);
+			return false;
+		}
+	}
+
+	if (dim[0] == 0 || dim[1] == 0 || dim[0] > PNM_MAX_DIM ||
+	    dim[1] > PNM_MAX_DIM) {
+		snprintf(err, errlen, "invalid image dimensions %lux%lu",
+			 dim[0], dim[1]);
+		return false;
+	}
+
+	if (dim[2] == 0 || dim[2] > PNM_MAX_MAXVAL) {
+		snprintf(err, errlen, "only PNM files of at most 8 bits per "
+			 "sample are supported");
+		return false;
+	}
+
+	/* A single whitespace character separates the maxval from the pixels */
+	bmp->data_off = pos + 1;
+	if (pos >= len || !isspace(hdr[pos]) ||
+	    bmp->tot_size <= bmp->data_off) {
+		snprintf(err, errlen, "file seems to be missing its data "
+			 "section; possibly corrupt");
+		return false;
+	}
+
+	bmp->pxlen = hdr[1] == PNM_COLOR ? 3 : 1;
+	bmp->chans = hdr[1] == PNM_COLOR ? "rgb" : "y";
+	bmp->bpp = bmp->pxlen * 8;
+	bmp->width = dim[0];
+	bmp->height = dim[1];
+	bmp->rowlen = bmp->width * bmp->pxlen;
+	bmp->topdown = true;
+	bmp->diblen = 0;
+	bmp->headerlen = bmp->data_off;
+
+	/* Images without hidden data have no tag */
+	bmp->layout = layout == 0 ? LAYOUT_V1 : layout;
+	bmp->flags = flags;
+	return true;
+}
+
+/*
+ * Copies the |bmp->data_off| bytes of headers of a PNM file, |src|, to |dst|
+ * with the PNM_TAG comment of the data hidden in |bmp| after the magic
+ * number, in place of the one found there.
+ *
+ * Returns: the length of the new headers.
+ */
+static size_t pnm_stamp(struct BMP_file const * const bmp,
+			unsigned char const *src, unsigned char *dst)
+{
+	char tag[CARRIER_STAMP_GROW];
+	size_t const skip = pnm_tag_len(src + 2, bmp->data_off - 2);
+	int const n = snprintf(tag, sizeof(tag), "\n" PNM_TAG "%u %u\n",
+			       bmp->layout, bmp->flags);
+	size_t const rest = bmp->data_off - 2 - skip;
+
+	memmove(dst + 2 + (size_t) n, src + 2 + skip, rest);
+	dst[0] = src[0];
+	dst[1] = src[1];
+	memcpy(dst + 2, tag, (size_t) n);
+	return 2 + (size_t) n + rest;
+}
+
+/*
+ * Reads the unsigned decimal number which comes next in the first |len|
+ * bytes of a PNM header, |hdr|, from |*pos| on, into |val|, skipping the
+ * whitespace and comments before it. |*pos| is left after the number. The
+ * layout and flags of a PNM_TAG comment which is skipped are stored in
+ * |layout| and |flags|.
+ *
+ * Returns: true if a number was found, false otherwise.
+ */
+static bool pnm_field(unsigned char const *hdr, size_t const len,
+		      size_t *pos, unsigned long *val, unsigned int *layout,
+		      unsigned int *flags)
+{
+	size_t p = *pos;
+
+	while (p < len && (isspace(hdr[p]) || hdr[p] == '#')) {
+		if (hdr[p] != '#') {
+			p++;
+			continue;
+		}
+
+		unsigned char const *nl = memchr(hdr + p, '\n', len - p);
+		size_t const tlen = sizeof(PNM_TAG) - 1;
+		if (!nl)
+			return false;
+
+		/* Only the first tag counts, see pnm_stamp() */
+		size_t const end = (size_t) (nl - hdr);
+		if (*layout == 0 && end - p > tlen &&
+		    end - p < CARRIER_STAMP_GROW &&
+		    memcmp(hdr + p, PNM_TAG, tlen) == 0) {
+			char line[CARRIER_STAMP_GROW];
+			unsigned int l, f;
+
+			memcpy(line, hdr + p + tlen, end - p - tlen);
+			line[end - p - tlen] = '\0';
+			if (sscanf(line, "%u %u", &l, &f) == 2 && l != 0) {
+				*layout = l;
+				*flags = f;
+			}
+		}
+		p = end;
+	}
+
+	if (p >= len || !isdigit(hdr[p]))
+		return false;
+
+	unsigned long v = 0;
+	while (p < len && isdigit(hdr[p])) {
+		/* Anything larger is rejected by the caller anyway */
+		if (v <= PNM_MAX_DIM)
+			v = v * 10 + (unsigned long) (hdr[p] - '0');
+		p++;
+	}
+
+	*val = v;
+	*pos = p;
+	return true;
+}
+
+/*
+ * Returns: the length of the "\n" PNM_TAG "...\n" comment which pnm_stamp()
+ * put at |p|, the first |len| bytes after the magic number of a PNM header,
+ * or 0 if there is none.
+ */
+static size_t pnm_tag_len(unsigned char const *p, size_t const len)
+{
+	size_t const tlen = sizeof(PNM_TAG) - 1;
+
+	if (len < tlen + 2 || p[0] != '\n' || memcmp(p + 1, PNM_TAG, tlen) != 0)
+		return 0;
+
+	unsigned char const *end = memchr(p + 1, '\n', len - 1);
+	return end ? (size_t) (end - p) + 1 : 0;
+}
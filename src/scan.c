@@ -0,0 +1,497 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../include/scan.h"
+
+#define SCAN_READ_LEN 1024U /* Bytes read with the first pread() of a file */
+
+/* Directory waiting to be read by a worker */
+struct Scan_dir {
+	char            *path;
+	struct Scan_dir *next;
+};
+
+/* State shared between the worker threads of scan() */
+struct Scan_pool {
+	pthread_mutex_t   lock;
+	pthread_cond_t    cond;
+	struct Scan_dir   *head;  /* Directories waiting to be read */
+	size_t            busy;   /* Workers currently reading a directory */
+	bool              failed; /* Set if a directory could not be read */
+	struct Args const *args;
+};
+
+static void *scan_worker(void *arg);
+static bool push_dir(struct Scan_pool * const pool, char const *parent,
+		     char const *name);
+static void scan_dir(struct Scan_pool * const pool, char const *path);
+static void scan_file(struct Scan_pool * const pool, int const dfd,
+		      char const *path, char const *name);
+static void scan_fd(struct Scan_pool * const pool, int const fd,
+		    char const *path, char const *name);
+static bool check_lsb(unsigned char const *c, size_t const n,
+		      size_t const blues, bool const file, bool const varint,
+		      size_t *len);
+static bool check_simple(unsigned char const *c, size_t const n,
+			 size_t const blues, bool const file,
+			 bool const varint, size_t *len);
+static unsigned char lsb_byte(unsigned char const *c);
+
+/*
+ * This function is the public interface of the 'scan' mode. The directory
+ * trees in |args->files| are walked by a pool of worker threads and every
+ * image which seems to carry a payload is printed to stdout, together with
+ * the method, type and length of the payload.
+ *
+ * Returns: true if every directory could be walked, false otherwise.
+ */
+bool scan(struct Args const * const args)
+{
+	struct Scan_pool pool = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+		.head = NULL,
+		.busy = 0,
+		.failed = false,
+		.args = args
+	};
+
+	for (size_t i = 0; i < args->nfiles; i++) {
+		if (!push_dir(&pool, NULL, args->files[i]))
+			return false;
+	}
+
+	/* Workers mostly wait on metadata I/O, so use more than one per CPU */
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t nthreads = args->nthreads ? args->nthreads :
+	    (ncpu > 0 ? (size_t) ncpu * 4 : 4);
+
+	pthread_t *tids = malloc(nthreads * sizeof(*tids));
+	if (!tids) {
+		perror("malloc");
+		return false;
+	}
+
+	size_t started = 0;
+	for (; started < nthreads; started++) {
+		if (pthread_create(&tids[started], NULL, scan_worker,
+				   &pool) != 0) {
+			perror("pthread_create");
+			break;
+		}
+	}
+
+	/* If no thread could be started, do the work on this one */
+	if (started == 0)
+		scan_worker(&pool);
+
+	for (size_t i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+
+	free(tids);
+	return !pool.failed;
+}
+
+/*
+ * Worker thread of scan(). Reads directories off the shared queue until the
+ * queue is empty and no other worker can add to it anymore.
+ */
+static void *scan_worker(void *arg)
+{
+	struct Scan_pool * const pool = arg;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->head && pool->busy > 0)
+			pthread_cond_wait(&pool->cond, &pool->lock);
+
+		struct Scan_dir *dir = pool->head;
+		if (!dir)
+			break;
+
+		pool->head = dir->next;
+		pool->busy++;
+		pthread_mutex_unlock(&pool->lock);
+
+		scan_dir(pool, dir->path);
+		free(dir->path);
+		free(dir);
+
+		pthread_mutex_lock(&pool->lock);
+		pool->busy--;
+		if (!pool->head && pool->busy == 0)
+			pthread_cond_broadcast(&pool->cond);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+/*
+ * Adds the directory |name| inside of |parent| (or just |name| if |parent| is
+ * NULL) to the queue of |pool| and wakes up a waiting worker.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+static bool push_dir(struct Scan_pool * const pool, char const *parent,
+		     char const *name)
+{
+	struct Scan_dir *dir = malloc(sizeof(*dir));
+	size_t const len = (parent ? strlen(parent) + 1 : 0) + strlen(name) + 1;
+
+	if (!dir || !(dir->path = malloc(len))) {
+		perror("malloc");
+		free(dir);
+		return false;
+	}
+
+	if (parent)
+		snprintf(dir->path, len, "%s/%s", parent, name);
+	else
+		snprintf(dir->path, len, "%s", name);
+
+	pthread_mutex_lock(&pool->lock);
+	dir->next = pool->head;
+	pool->head = dir;
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	return true;
+}
+
+/*
+ * Reads the directory |path|. Sub-directories are queued for the workers and
+ * regular files are checked right away. Symbolic links are not followed.
+ */
+static void scan_dir(struct Scan_pool * const pool, char const *path)
+{
+	int const dfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	DIR *dp;
+
+	if (dfd < 0 || !(dp = fdopendir(dfd))) {
+		fprintf(stderr, "Error: could not open directory %s: %s\n",
+			path, strerror(errno));
+		if (dfd >= 0)
+			close(dfd);
+		__atomic_store_n(&pool->failed, true, __ATOMIC_RELAXED);
+		return;
+	}
+
+	struct dirent *de;
+	while ((de = readdir(dp))) {
+		unsigned char type = de->d_type;
+
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+			continue;
+
+		/* Not every file system fills in |d_type| */
+		if (type == DT_UNKNOWN) {
+			struct stat st;
+
+			if (fstatat(dfd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+				continue;
+			type = S_ISDIR(st.st_mode) ? DT_DIR :
+			    S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+		}
+
+		if (type == DT_DIR) {
+			if (!push_dir(pool, path, de->d_name))
+				__atomic_store_n(&pool->failed, true,
+						 __ATOMIC_RELAXED);
+		} else if (type == DT_REG) {
+			scan_file(pool, dfd, path, de->d_name);
+		}
+	}
+
+	closedir(dp);
+}
+
+/*
+ * Checks whether the file |name| in the directory |dfd| (named |path|) is a
+ * supported image carrying a payload of one of the methods and types selected in
+ * |pool->args|, and prints it if so.
+ *
+ * Only the headers and the first SCAN_PIXEL_LEN bytes of pixel data are read,
+ * or for a PNG file, the image data up to where they are decoded.
+ */
+static void scan_file(struct Scan_pool * const pool, int const dfd,
+		      char const *path, char const *name)
+{
+	int const fd = openat(dfd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	scan_fd(pool, fd, path, name);
+	close(fd);
+}
+
+/*
+ * Does the work of scan_file() on the open file |fd|.
+ */
+static void scan_fd(struct Scan_pool * const pool, int const fd,
+		    char const *path, char const *name)
+{
+	struct Args const * const args = pool->args;
+	unsigned char buf[SCAN_READ_LEN];
+	unsigned char pixels[SCAN_PIXEL_LEN];
+	unsigned char c[SCAN_PIXEL_LEN];
+	unsigned char *px;
+	struct BMP_file bmp = { .order = NULL };
+	struct stat st;
+	char err[128];
+
+	if (fstat(fd, &st) != 0 || st.st_size < CARRIER_MIN_FILE_SIZE ||
+	    st.st_size > CARRIER_MAX_FILE_SIZE)
+		return;
+
+	/* Only a few hundred bytes are needed; don't let readahead fetch more */
+	posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+
+	ssize_t const got = pread(fd, buf, sizeof(buf), 0);
+	if (got < 0)
+		return;
+
+	bmp.tot_size = (size_t) st.st_size;
+	if (!probe_carrier(buf, (size_t) got, &bmp, err, sizeof(err)))
+		return;
+
+	size_t const datalen = bmp.datalen;
+	size_t const want = datalen < SCAN_PIXEL_LEN ? datalen : SCAN_PIXEL_LEN;
+	size_t n;
+
+	if (bmp.fmt->decode) {
+		/* Only as much as holds the first rows is inflated */
+		if (!load_carrier(&bmp, fd, pixels, want, err, sizeof(err)))
+			return;
+		px = pixels;
+		n = want;
+	} else if (bmp.data_off + want <= (size_t) got) {
+		px = buf + bmp.data_off;
+		n = want;
+	} else {
+		ssize_t const pgot = pread(fd, pixels, want,
+					   (off_t) bmp.data_off);
+		if (pgot < 0)
+			return;
+		px = pixels;
+		n = (size_t) pgot;
+	}
+
+	/* Gather the carrier bytes in what was read, and count them all */
+	if (bmp.layout != LAYOUT_V1 && bmp.layout != LAYOUT_V2)
+		return;
+	bmp.data = (struct RGB *) px;
+	bmp.datalen = n;
+	n = carriers(&bmp);
+	carrier_get(&bmp, 8, 0, c, n);
+
+	bmp.datalen = datalen;
+	size_t const blues = carriers(&bmp);
+
+	/* LSB matching hides as LSB replacement does, for reveal() */
+	bool const lsb = !args->mflag || strncmp(args->mmet, "lsb", 3) == 0 ||
+	    strncmp(args->mmet, "match", 5) == 0;
+	bool const adaptive = !args->mflag ||
+	    strncmp(args->mmet, "adaptive", 8) == 0;
+	bool const simple = !args->mflag ||
+	    strncmp(args->mmet, "simple", 6) == 0;
+	bool const file = !args->tflag || strncmp(args->ttyp, "file", 4) == 0;
+	bool const msg = !args->tflag ||
+	    strncmp(args->ttyp, "message", 7) == 0;
+	bool const varint = bmp.flags & BMP_FLAG_VARINT;
+	char const *method = NULL;
+	char const *type = NULL;
+	size_t len;
+
+	/*
+	 * The carrier bytes of an adaptive payload are spread over the whole
+	 * image, but the flag which marks it is proof enough. Its length is
+	 * not known.
+	 */
+	if (bmp.flags & BMP_FLAG_ADAPTIVE) {
+		bool const fmsg = bmp.flags & BMP_FLAG_VARINT;
+
+		if (adaptive && (fmsg ? msg : file))
+			printf("%s/%s\t%s\t%s\t?\n", path, name, "adaptive",
+			       fmsg ? "message" : "file");
+		return;
+	}
+
+	/* A signed payload is told by its signature, its type by the flags */
+	if (bmp.flags & BMP_FLAG_SIGNED) {
+		unsigned char h[PREFIX_MAX_LEN];
+		size_t hn = 0;
+
+		if (!(varint ? msg : file))
+			return;
+
+		for (; hn < PREFIX_MAX_LEN && 8 * (hn + 1) <= n; hn++)
+			h[hn] = lsb_byte(c + 8 * hn);
+
+		if (lsb && decode_prefix(&bmp, !varint, h, hn, &len))
+			method = "lsb";
+		else if (simple && decode_prefix(&bmp, !varint, c, n, &len))
+			method = "simple";
+
+		if (method)
+			printf("%s/%s\t%s\t%s\t%zu\n", path, name, method,
+			       varint ? "message" : "file", len);
+		return;
+	}
+
+	/* Ordered from the least to the most likely to match by chance */
+	if (lsb && file && check_lsb(c, n, blues, true, false, &len)) {
+		method = "lsb";
+		type = "file";
+	} else if (lsb && msg && check_lsb(c, n, blues, false, varint, &len)) {
+		method = "lsb";
+		type = "message";
+	} else if (simple && file &&
+		   check_simple(c, n, blues, true, false, &len)) {
+		method = "simple";
+		type = "file";
+	} else if (simple && msg &&
+		   check_simple(c, n, blues, false, varint, &len)) {
+		method = "simple";
+		type = "message";
+	}
+
+	if (method)
+		printf("%s/%s\t%s\t%s\t%zu\n", path, name, method, type, len);
+}
+
+/*
+ * Decodes the length prefix of a payload hidden with the LSB method from the
+ * first |n| carrier bytes, gathered in |c|, and checks it for plausibility
+ * against the |blues| carrier bytes of the whole image. For messages, the
+ * first characters must also be printable.
+ *
+ * Returns: true if the image seems to carry a payload, false otherwise.
+ */
+static bool check_lsb(unsigned char const *c, size_t const n,
+		      size_t const blues, bool const file, bool const varint,
+		      size_t *len)
+{
+	size_t lenbits = 0;
+	size_t v = 0;
+
+	if (file) {
+		if (n < 32)
+			return false;
+		for (; lenbits < 32; lenbits++)
+			v |= (size_t) (c[lenbits] & 1) << lenbits;
+	} else {
+		unsigned char b;
+
+		/* A varint has up to VARINT_MAX_LEN bytes of 7 bits each */
+		do {
+			if (lenbits == 8 * VARINT_MAX_LEN || n < lenbits + 8)
+				return false;
+			b = lsb_byte(c + lenbits);
+			v |= (size_t) (varint ? b & 0x7F : b) << (7 * lenbits / 8);
+			lenbits += 8;
+		} while (varint && (b & 0x80));
+	}
+
+	/* Same bounds as enforced by reveal */
+	if (v == 0 || (v + lenbits / 8) * 8 > blues)
+		return false;
+
+	if (!file) {
+		size_t const peek = v < SCAN_PEEK_CHARS ? v : SCAN_PEEK_CHARS;
+
+		if (n < lenbits + peek * 8)
+			return false;
+
+		for (size_t i = 0; i < peek; i++) {
+			unsigned char const ch = lsb_byte(c + lenbits + i * 8);
+
+			if (!isprint(ch) && !isspace(ch))
+				return false;
+		}
+	}
+
+	*len = v;
+	return true;
+}
+
+/*
+ * Decodes the length prefix of a payload hidden with the simple method from
+ * the first |n| carrier bytes, gathered in |c|, and checks it for
+ * plausibility against the |blues| carrier bytes of the whole image. For
+ * messages, the first characters must also be printable.
+ *
+ * Returns: true if the image seems to carry a payload, false otherwise.
+ */
+static bool check_simple(unsigned char const *c, size_t const n,
+			 size_t const blues, bool const file,
+			 bool const varint, size_t *len)
+{
+	size_t lenbytes = 0;
+	size_t v = 0;
+
+	if (file) {
+		if (n < 4)
+			return false;
+		for (; lenbytes < 4; lenbytes++)
+			v |= (size_t) c[lenbytes] << (8 * lenbytes);
+	} else {
+		unsigned char b;
+
+		do {
+			if (lenbytes == VARINT_MAX_LEN || n < lenbytes + 1)
+				return false;
+			b = c[lenbytes];
+			v |= (size_t) (varint ? b & 0x7F : b) << (7 * lenbytes);
+			lenbytes++;
+		} while (varint && (b & 0x80));
+	}
+
+	if (v == 0 || v + lenbytes > blues)
+		return false;
+
+	if (!file) {
+		size_t const peek = v < SCAN_PEEK_CHARS ? v : SCAN_PEEK_CHARS;
+
+		if (n < lenbytes + peek)
+			return false;
+
+		for (size_t i = 0; i < peek; i++) {
+			unsigned char const ch = c[lenbytes + i];
+
+			if (!isprint(ch) && !isspace(ch))
+				return false;
+		}
+	}
+
+	*len = v;
+	return true;
+}
+
+/*
+ * Assembles a byte from the least significant bits of the 8 carrier bytes
+ * from |c| on.
+ */
+static unsigned char lsb_byte(unsigned char const *c)
+{
+	unsigned char b = 0;
+
+	for (size_t j = 0; j < 8; j++)
+		b |= (unsigned char) ((c[j] & 1) << j);
+
+	return b;
+}
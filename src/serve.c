@@ -0,0 +1,723 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../include/serve.h"
+#include "../include/helper.h"
+
+/* Set by a signal which asks the server to shut down */
+static volatile sig_atomic_t stop;
+
+static void on_signal(int const sig);
+static int serve_listen(char const *path);
+static void serve_conn(int const sock, struct Args const * const args,
+		       size_t *nreq);
+static bool serve_one(int const sock, struct Args const * const args,
+		      struct Serve_request const * const req, int const fd,
+		      char *err, size_t const errlen);
+static bool send_reply(int const sock, int const fd, char const *err);
+static bool send_msg(int const sock, void const *buf, size_t const len,
+		     int const fd);
+static ssize_t recv_msg(int const sock, void *buf, size_t const len,
+			int *fd);
+static bool send_full(int const sock, void const *buf, size_t len);
+static bool recv_full(int const sock, void *buf, size_t len);
+static int cover_memfd(char const *fname);
+static bool copy_fd(int const in, int const out, size_t len);
+
+/*
+ * This function is the public interface of the 'serve' mode. It listens on
+ * the Unix socket |args->files[0]| and hides the payload of every request in
+ * place in the cover whose descriptor came with it, with the method, layout
+ * and options given in |args|. The cover is mapped, not read, and handed back
+ * once it carries the payload. One line is printed for each request. Runs
+ * until interrupted.
+ *
+ * Returns: true if the server shut down cleanly, false otherwise.
+ */
+bool serve(struct Args const * const args)
+{
+	char const *path = args->files[0];
+
+	if (!args->mflag) {
+		fprintf(stderr, "Error: option -%c is required\n", 'm');
+		return false;
+	}
+
+	/* A key which cannot be read is reported now, not on every request */
+	unsigned char key[CHACHA_KEY_LEN];
+	bool const keyok = !args->kflag || read_key(args->keyfile, key);
+	memset(key, 0, sizeof(key));
+	if (!keyok)
+		return false;
+
+	int const lsock = serve_listen(path);
+	if (lsock < 0)
+		return false;
+
+	/* Without SA_RESTART, so that a blocked accept() returns */
+	struct sigaction sa = { .sa_handler = on_signal };
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	/* The progress messages of hide_data() are replaced by one line */
+	quiet = true;
+	printf("Listening on %s\n", path);
+	fflush(stdout);
+
+	bool ok = true;
+	size_t nreq = 0;
+
+	while (!stop) {
+		int const sock = accept4(lsock, NULL, NULL, SOCK_CLOEXEC);
+		if (sock < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			perror("accept4");
+			ok = false;
+			break;
+		}
+
+		/* A stalled client must not hold up the others for long */
+		struct timeval const tv = { .tv_sec = SERVE_TIMEOUT };
+		setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+		serve_conn(sock, args, &nreq);
+		close(sock);
+	}
+
+	close(lsock);
+	unlink(path);
+	fprintf(stderr, "Served %zu requests\n", nreq);
+	return ok;
+}
+
+/*
+ * This function is the public interface of the 'client' mode, a reference
+ * client of serve(). The image |args->files[1]| is copied into a memfd which
+ * is sent to the server at |args->files[0]| along with the payload given with
+ * -e; the cover which comes back is written to |args->outpath|.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+bool client(struct Args const * const args)
+{
+	bool const hidefile = (args->tflag &&
+			       strncmp(args->ttyp, "file", 4) == 0);
+	void const *payload = args->eval;
+	unsigned char *data = NULL;
+	size_t len = args->evallen;
+	char err[SERVE_ERR_LEN];
+	int fd = -1, sock = -1, back = -1;
+	bool ok = false;
+
+	if (hidefile) {
+		FILE *hfp = fopen(args->eval, "rb");
+		if (!hfp) {
+			perror("fopen");
+			return false;
+		}
+
+		if (get_file_size(hfp, &len))
+			payload = data = read_file(hfp, len);
+		fclose(hfp);
+		if (!data) {
+			fprintf(stderr, "Error: could not read file\n");
+			return false;
+		}
+	}
+
+	if ((fd = cover_memfd(args->files[1])) < 0)
+		goto out;
+
+	if ((sock = serve_connect(args->files[0])) < 0) {
+		fprintf(stderr, "Error: could not connect to %s: %s\n",
+			args->files[0], strerror(errno));
+		goto out;
+	}
+
+	back = serve_request(sock, fd, hidefile ? SERVE_FLAG_FILE : 0,
+			     payload, len, err, sizeof(err));
+	if (back < 0) {
+		fprintf(stderr, "Error: %s\n", err);
+		goto out;
+	}
+
+	struct stat st;
+	struct Out_file out;
+
+	if (fstat(back, &st) != 0 || !out_open(&out, args->outpath)) {
+		fprintf(stderr, "Error: could not create %s: %s\n",
+			args->outpath, strerror(errno));
+		goto out;
+	}
+
+	if (!copy_fd(back, out.fd, (size_t) st.st_size) ||
+	    !out_publish(&out, args->sync)) {
+		fprintf(stderr, "Error: could not write %s: %s\n",
+			args->outpath, strerror(errno));
+		out_abort(&out);
+		goto out;
+	}
+
+	close(out.fd);
+	info("Created steganographic file: %s\n", args->outpath);
+	ok = true;
+out:
+	if (back >= 0)
+		close(back);
+	if (sock >= 0)
+		close(sock);
+	if (fd >= 0)
+		close(fd);
+	free(data);
+	return ok;
+}
+
+/*
+ * Connects to the server listening on the Unix socket |path|.
+ *
+ * Returns: the connected socket, or -1 on error with |errno| set.
+ */
+int serve_connect(char const *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	int const sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		return -1;
+
+	if (connect(sock, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+		int const err = errno;
+
+		close(sock);
+		errno = err;
+		return -1;
+	}
+
+	return sock;
+}
+
+/*
+ * Asks the server connected to |sock| to hide the |len| bytes of |payload|
+ * (a file if |flags| has SERVE_FLAG_FILE) in the cover |fd|. If the server
+ * refuses, its reason is stored in |err|.
+ *
+ * Returns: the descriptor of the cover handed back, or -1 on error.
+ */
+int serve_request(int const sock, int const fd, uint32_t const flags,
+		  void const *payload, size_t const len, char *err,
+		  size_t const errlen)
+{
+	struct Serve_request const req = {
+		.magic = SERVE_MAGIC,
+		.flags = flags,
+		.len = len
+	};
+	struct Serve_reply rep;
+	int back = -1;
+
+	if (!send_msg(sock, &req, sizeof(req), fd)) {
+		snprintf(err, errlen, "could not send request: %s",
+			 strerror(errno));
+		return -1;
+	}
+
+	/* A refused request is answered before its payload is read */
+	bool const sent = send_full(sock, payload, len);
+	int const senderr = errno;
+
+	ssize_t const n = recv_msg(sock, &rep, sizeof(rep), &back);
+	if (n <= 0 || rep.magic != SERVE_MAGIC) {
+		if (!sent)
+			snprintf(err, errlen, "could not send request: %s",
+				 strerror(senderr));
+		else
+			snprintf(err, errlen, "no valid reply from server: %s",
+				 n < 0 ? strerror(errno) :
+				 "connection closed");
+		if (back >= 0)
+			close(back);
+		return -1;
+	}
+
+	if (rep.status == 0 && back >= 0)
+		return back;
+
+	/* The text is cut to fit |err|, the rest is left unread */
+	size_t const tlen = rep.errlen < errlen ? rep.errlen : errlen - 1;
+	if (!recv_full(sock, err, tlen))
+		snprintf(err, errlen, "server refused the request");
+	else
+		err[tlen] = '\0';
+
+	if (back >= 0)
+		close(back);
+	return -1;
+}
+
+/*
+ * Asks the accept() loop of serve() to stop.
+ */
+static void on_signal(int const sig)
+{
+	(void) sig;
+	stop = 1;
+}
+
+/*
+ * Creates a Unix socket bound to |path| and listening on it. A socket left
+ * there by a server which is gone is replaced.
+ *
+ * Returns: the socket, or -1 on error.
+ */
+static int serve_listen(char const *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct stat st;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Error: socket path is too long: %s\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		int const sock = serve_connect(path);
+
+		if (sock >= 0) {
+			close(sock);
+			fprintf(stderr, "Error: a server is already listening "
+				"on %s\n", path);
+			return -1;
+		}
+		if (errno == ECONNREFUSED)
+			unlink(path);
+	}
+
+	int const sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+	    listen(sock, SERVE_BACKLOG) != 0) {
+		fprintf(stderr, "Error: could not listen on %s: %s\n", path,
+			strerror(errno));
+		close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+/*
+ * Serves the requests which come in on |sock| until the client is done. A
+ * refused request ends the connection, as its payload is left unread. |nreq|
+ * counts the requests.
+ */
+static void serve_conn(int const sock, struct Args const * const args,
+		       size_t *nreq)
+{
+	for (;;) {
+		struct Serve_request req;
+		char err[SERVE_ERR_LEN];
+		int fd = -1;
+
+		ssize_t const n = recv_msg(sock, &req, sizeof(req), &fd);
+		if (n == 0)
+			return;
+
+		size_t const id = ++*nreq;
+		bool ok;
+
+		if (n < 0) {
+			snprintf(err, sizeof(err), "could not read request: %s",
+				 strerror(errno));
+			ok = false;
+		} else {
+			ok = serve_one(sock, args, &req, fd, err, sizeof(err));
+		}
+
+		if (ok)
+			printf("#%zu: hid %" PRIu64 " byte %s\n", id, req.len,
+			       req.flags & SERVE_FLAG_FILE ? "file" :
+			       "message");
+		else
+			fprintf(stderr, "Error: request #%zu: %s\n", id, err);
+		fflush(stdout);
+
+		bool const sent = send_reply(sock, ok ? fd : -1,
+					     ok ? NULL : err);
+		if (fd >= 0)
+			close(fd);
+		if (!ok || !sent)
+			return;
+	}
+}
+
+/*
+ * Hides the payload of |req|, which is read from |sock|, in the cover |fd|
+ * with the options in |args|. The cover is mapped shared, so the payload ends
+ * up in the memory of the client without a copy. On failure the reason is
+ * stored in |err|.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+static bool serve_one(int const sock, struct Args const * const args,
+		      struct Serve_request const * const req, int const fd,
+		      char *err, size_t const errlen)
+{
+	struct Args jargs = *args;
+	struct stat st;
+
+	if (req->magic != SERVE_MAGIC || (req->flags & ~SERVE_FLAGS_KNOWN)) {
+		snprintf(err, errlen, "malformed request");
+		return false;
+	}
+
+	if (fd < 0) {
+		snprintf(err, errlen, "no cover attached to the request");
+		return false;
+	}
+
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+	    st.st_size > CARRIER_MAX_FILE_SIZE) {
+		snprintf(err, errlen, "cover is not a regular file of at most "
+			 "%u bytes", CARRIER_MAX_FILE_SIZE);
+		return false;
+	}
+
+	/* The client must not be able to pull the mapping from under us */
+	int const seals = fcntl(fd, F_GET_SEALS);
+	if (seals < 0 || !(seals & F_SEAL_SHRINK)) {
+		snprintf(err, errlen, "cover is not sealed against shrinking");
+		return false;
+	}
+
+	jargs.tflag = true;
+	jargs.ttyp = req->flags & SERVE_FLAG_FILE ? "file" : "message";
+
+	struct BMP_file bmp = {
+		.tot_size = (size_t) st.st_size,
+		.fp = NULL
+	};
+	size_t const plen = bmp.tot_size < CARRIER_PROBE_LEN ? bmp.tot_size :
+	    CARRIER_PROBE_LEN;
+
+	if (bmp.tot_size == 0) {
+		snprintf(err, errlen, "cover is empty");
+		return false;
+	}
+
+	unsigned char *map = mmap(NULL, bmp.tot_size, PROT_READ | PROT_WRITE,
+				  MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		snprintf(err, errlen, "could not map cover: %s",
+			 strerror(errno));
+		return false;
+	}
+
+	bool ok = false;
+	unsigned char *payload = NULL;
+
+	if (!probe_carrier(map, plen, &bmp, err, errlen))
+		goto out;
+
+	/* The cover is handed back as it is, so its headers cannot grow */
+	if (!bmp.fmt->fixed_header) {
+		snprintf(err, errlen, "cannot hide in %s covers in place",
+			 bmp.fmt->name);
+		goto out;
+	}
+
+	bmp.data = (struct RGB *) (map + bmp.data_off);
+	bmp.datalen = bmp.tot_size - bmp.data_off;
+
+	/* Checked before the payload is read, which would be in vain */
+	size_t const cap = capacity(&bmp, &jargs);
+	if (req->len > cap) {
+		snprintf(err, errlen, "%s of %" PRIu64 " bytes too large for "
+			 "cover, which holds %zu", jargs.ttyp, req->len, cap);
+		goto out;
+	}
+
+	if (!(payload = malloc(req->len ? req->len : 1)) ||
+	    !recv_full(sock, payload, req->len)) {
+		snprintf(err, errlen, "could not read payload: %s",
+			 strerror(errno));
+		goto out;
+	}
+
+	/* hide_data() only says why on stderr, not to the client */
+	unsigned char key[CHACHA_KEY_LEN];
+	bool const keyok = !jargs.kflag || read_key(jargs.keyfile, key);
+	memset(key, 0, sizeof(key));
+	if (!keyok) {
+		snprintf(err, errlen, "could not read key file %s",
+			 jargs.keyfile);
+		goto out;
+	}
+
+	if (!hide_data(&bmp, &jargs, payload, req->len)) {
+		snprintf(err, errlen, "could not hide %s in cover", jargs.ttyp);
+		goto out;
+	}
+
+	stamp_carrier(&bmp, map, map);
+	ok = true;
+out:
+	free(payload);
+	munmap(map, bmp.tot_size);
+	return ok;
+}
+
+/*
+ * Replies to the request on |sock|: the cover |fd| if it succeeded, the error
+ * text |err| if not.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+static bool send_reply(int const sock, int const fd, char const *err)
+{
+	struct Serve_reply const rep = {
+		.magic = SERVE_MAGIC,
+		.status = err ? 1 : 0,
+		.errlen = err ? (uint32_t) strlen(err) : 0
+	};
+
+	return send_msg(sock, &rep, sizeof(rep), fd) &&
+	    send_full(sock, err, rep.errlen);
+}
+
+/*
+ * Sends the |len| bytes of |buf| on |sock|, with the descriptor |fd| attached
+ * unless it is -1.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+static bool send_msg(int const sock, void const *buf, size_t const len,
+		     int const fd)
+{
+	union {
+		struct cmsghdr hdr;
+		char           buf[CMSG_SPACE(sizeof(int))];
+	} ctl;
+	struct iovec iov = { .iov_base = (void *) buf, .iov_len = len };
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+	if (fd >= 0) {
+		memset(&ctl, 0, sizeof(ctl));
+		msg.msg_control = ctl.buf;
+		msg.msg_controllen = sizeof(ctl.buf);
+
+		struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+		c->cmsg_level = SOL_SOCKET;
+		c->cmsg_type = SCM_RIGHTS;
+		c->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(c), &fd, sizeof(int));
+	}
+
+	ssize_t n;
+	while ((n = sendmsg(sock, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+		;
+	if (n <= 0)
+		return false;
+
+	/* The descriptor went with the first byte */
+	return send_full(sock, (unsigned char const *) buf + n,
+			 len - (size_t) n);
+}
+
+/*
+ * Receives |len| bytes into |buf| from |sock|, and the descriptor attached to
+ * them into |fd| (-1 if there is none). A message with more than one
+ * descriptor is refused.
+ *
+ * Returns: |len|, 0 if the peer closed the connection before sending
+ * anything, or -1 on error with |errno| set.
+ */
+static ssize_t recv_msg(int const sock, void *buf, size_t const len, int *fd)
+{
+	union {
+		struct cmsghdr hdr;
+		char           buf[CMSG_SPACE(sizeof(int))];
+	} ctl;
+	struct iovec iov = { .iov_base = buf, .iov_len = len };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = ctl.buf,
+		.msg_controllen = sizeof(ctl.buf)
+	};
+
+	*fd = -1;
+
+	ssize_t n;
+	while ((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) < 0 &&
+	       errno == EINTR && !stop)
+		;
+	if (n <= 0)
+		return n;
+
+	for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c;
+	     c = CMSG_NXTHDR(&msg, c)) {
+		if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS &&
+		    c->cmsg_len == CMSG_LEN(sizeof(int)) && *fd < 0)
+			memcpy(fd, CMSG_DATA(c), sizeof(int));
+	}
+
+	/* Descriptors which did not fit were closed by the kernel */
+	if (msg.msg_flags & MSG_CTRUNC) {
+		if (*fd >= 0)
+			close(*fd);
+		*fd = -1;
+		errno = EPROTO;
+		return -1;
+	}
+
+	if (!recv_full(sock, (unsigned char *) buf + n, len - (size_t) n)) {
+		if (*fd >= 0)
+			close(*fd);
+		*fd = -1;
+		return -1;
+	}
+
+	return (ssize_t) len;
+}
+
+/*
+ * Sends the |len| bytes of |buf| on |sock|, retrying on short writes.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+static bool send_full(int const sock, void const *buf, size_t len)
+{
+	unsigned char const *p = buf;
+
+	while (len > 0) {
+		ssize_t const n = send(sock, p, len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+
+		p += n;
+		len -= (size_t) n;
+	}
+
+	return true;
+}
+
+/*
+ * Receives exactly |len| bytes from |sock| into |buf|.
+ *
+ * Returns: true if successful, false otherwise (including a closed
+ * connection, with |errno| set to ECONNRESET).
+ */
+static bool recv_full(int const sock, void *buf, size_t len)
+{
+	unsigned char *p = buf;
+
+	while (len > 0) {
+		ssize_t const n = recv(sock, p, len, 0);
+		if (n < 0 && errno == EINTR && !stop)
+			continue;
+		if (n == 0)
+			errno = ECONNRESET;
+		if (n <= 0)
+			return false;
+
+		p += n;
+		len -= (size_t) n;
+	}
+
+	return true;
+}
+
+/*
+ * Copies the file |fname| into a new memfd sealed against resizing, as a
+ * producer would render into one.
+ *
+ * Returns: the memfd, or -1 on error.
+ */
+static int cover_memfd(char const *fname)
+{
+	struct stat st;
+	int const in = open(fname, O_RDONLY | O_CLOEXEC);
+
+	if (in < 0 || fstat(in, &st) != 0) {
+		fprintf(stderr, "Error: could not open %s: %s\n", fname,
+			strerror(errno));
+		if (in >= 0)
+			close(in);
+		return -1;
+	}
+
+	int const fd = memfd_create("steg-cover",
+				    MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0) {
+		perror("memfd_create");
+		close(in);
+		return -1;
+	}
+
+	if (!copy_fd(in, fd, (size_t) st.st_size) ||
+	    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+		  F_SEAL_SEAL) != 0) {
+		fprintf(stderr, "Error: could not copy %s: %s\n", fname,
+			strerror(errno));
+		close(in);
+		close(fd);
+		return -1;
+	}
+
+	close(in);
+	return fd;
+}
+
+/*
+ * Copies the first |len| bytes of |in| to |out|, within the kernel.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+static bool copy_fd(int const in, int const out, size_t len)
+{
+	off_t off = 0;
+
+	while (len > 0) {
+		ssize_t const n = sendfile(out, in, &off, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n == 0)
+			errno = EIO;
+		if (n <= 0)
+			return false;
+
+		len -= (size_t) n;
+	}
+
+	return true;
+}
@@ -17,16 +17,65 @@
 
 #include "../include/stegan.h"
 
-static void hide_msg(struct BMP_file * const bmp, char const *msg,
-		     size_t const msglen);
-static void hide_msg_lsb(struct BMP_file * const bmp, char const *msg,
-			 size_t const msglen);
-static void reveal_msg(struct BMP_file * const bmp);
-static void reveal_msg_lsb(struct BMP_file * const bmp);
-static void hide_file(struct BMP_file * const bmp, char const *hfile);
-static void hide_file_lsb(struct BMP_file * const bmp, char const *hfile);
-static void reveal_file(struct BMP_file * const bmp);
-static void reveal_file_lsb(struct BMP_file * const bmp);
+/*
+ * The methods of -m. Every byte hidden is cut into pieces of |bits| bits, one
+ * for each carrier byte, so that it takes 8 / |bits| carrier bytes.
+ */
+struct Method {
+	char const   *name;     /* As given with -m */
+	unsigned int bits;      /* Bits hidden in every carrier byte */
+	bool         adaptive;  /* Carrier bytes in order of texture */
+	bool         matching;  /* LSBs changed by adding or subtracting 1 */
+};
+
+static struct Method const methods[] = {
+	/* The default, replaces the carrier bytes */
+	{ "simple", 8, false, false },
+	/* Changes their least significant bits only */
+	{ "lsb", 1, false, false },
+	/* Those of the most textured ones first */
+	{ "adaptive", 1, true, false },
+	/* Those of all of them, by adding or subtracting 1 */
+	{ "match", 1, false, true }
+};
+
+static struct Method const *find_method(struct Args const * const args);
+static void save_file(struct BMP_file const * const bmp,
+		      struct Args const * const args,
+		      unsigned char const *data, size_t const len);
+static bool put_payload(struct BMP_file * const bmp, unsigned int const bits,
+			size_t d, void const *src, size_t const len,
+			unsigned char const *key);
+static bool get_payload(struct BMP_file const * const bmp,
+			unsigned int const bits, size_t d, unsigned char *dst,
+			size_t const len, unsigned char const *key);
+static unsigned char const *load_key(struct BMP_file const * const bmp,
+				     struct Args const * const args,
+				     unsigned char *buf);
+static size_t prefix_len(struct BMP_file const * const bmp, size_t const plen);
+static size_t stream_len(struct BMP_file const * const bmp, size_t const len);
+static size_t len_prefix(struct BMP_file const * const bmp, bool const file,
+			 size_t len, unsigned char *buf);
+static size_t get_len_prefix(struct BMP_file const * const bmp,
+			     unsigned int const bits, bool const file,
+			     size_t *len);
+static unsigned char *read_message(struct BMP_file const * const bmp,
+				   size_t const max, size_t *len);
+static void print_msg(unsigned char *msg, size_t const len);
+static void put_prefix(struct BMP_file * const bmp, unsigned int const bits,
+		       void const *src, size_t const plen);
+static void get_prefix(struct BMP_file const * const bmp,
+		       unsigned int const bits, unsigned char *dst,
+		       size_t const plen);
+static size_t next_diff(unsigned char const *a, unsigned char const *b,
+			size_t i, size_t const n);
+static unsigned char sig_crc(struct BMP_file const * const bmp,
+			     unsigned char const *buf, size_t const n);
+static void put_chunk(struct BMP_file * const bmp, unsigned int const bits,
+		      size_t const d, void const *src, size_t const len);
+static void get_chunk(struct BMP_file const * const bmp,
+		      unsigned int const bits, size_t const d, void *dst,
+		      size_t const len);
 
 /*
  * This function is the public interface which invokes the appropriate
@@ -34,474 +83,1119 @@ static void reveal_file_lsb(struct BMP_file * const bmp);
  */
 void hide(struct BMP_file * const bmp, struct Args const * const args)
 {
-	/* Perform using LSB or simple method */
-	bool lsb = (args->mflag && strncmp(args->mmet, "lsb", 3) == 0);
-
 	/* Perform on files or messages */
 	bool hidefile = (args->tflag && strncmp(args->ttyp, "file", 4) == 0);
 
+	unsigned char const *payload = (unsigned char const *) args->eval;
+	unsigned char *data = NULL;
+	size_t len = args->evallen;
+
 	if (hidefile) {
-		lsb ? hide_file_lsb(bmp, args->eval) : hide_file(bmp, args->eval);
-	} else {
-		lsb ? hide_msg_lsb(bmp, args->eval, args->evallen) :
-		    hide_msg(bmp, args->eval, args->evallen);
+		FILE *hfp = fopen(args->eval, "rb");
+		if (!hfp) {
+			perror("fopen");
+			clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
+		}
+
+		if (!get_file_size(hfp, &len)) {
+			fprintf(stderr, "Error: could not obtain size of file\n");
+			fclose(hfp);
+			clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
+		}
+
+		/* A file is only read once it is known to fit */
+		if (len > capacity(bmp, args)) {
+			fprintf(stderr,
+				"Error: file too large to hide inside image\n");
+			fclose(hfp);
+			clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
+		}
+
+		payload = data = read_file(hfp, len);
+		fclose(hfp);
+		if (!data) {
+			fprintf(stderr, "Error: could not read file\n");
+			clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
+		}
+	} else if (args->mode == MODE_STEG && strcmp(args->eval, "-") == 0) {
+		/* The message is streamed in from stdin with "-" */
+		payload = data = read_message(bmp, capacity(bmp, args), &len);
 	}
 
+	bool const ok = hide_data(bmp, args, payload, len);
+	free(data);
+	if (!ok)
+		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
+
+	bmp->outpath = args->outpath;
+	bmp->sync = args->sync;
+	bmp->level = args->level;
+	bmp->nthreads = args->nthreads;
+
 	int const fd = create_bmp(bmp);
 	close(fd);
 }
 
 /*
- * This function is the public interface which invokes the appropriate
- * function for revealing steganographic data.
+ * Hides the |len| bytes of |data| in the pixels of |bmp| with the method,
+ * type, layout and options selected in |args|, setting the layout and flags
+ * of |bmp| to match, but does not write |bmp| anywhere. The payload must fit,
+ * see capacity().
+ *
+ * Returns: true if successful, false otherwise. The pixels of |bmp| may be
+ * changed either way.
  */
-void reveal(struct BMP_file * const bmp, struct Args const * const args)
+bool hide_data(struct BMP_file * const bmp, struct Args const * const args,
+	       void const *data, size_t const len)
 {
 	/* Perform using LSB or simple method */
-	bool lsb = (args->mflag && strncmp(args->mmet, "lsb", 3) == 0);
+	struct Method const *m = find_method(args);
+	size_t const unit = 8 / m->bits;
 
 	/* Perform on files or messages */
 	bool hidefile = (args->tflag && strncmp(args->ttyp, "file", 4) == 0);
+	char const *what = hidefile ? "file" : "message";
 
-	if (hidefile) {
-		lsb ? reveal_file_lsb(bmp) : reveal_file(bmp);
-	} else {
-		lsb ? reveal_msg_lsb(bmp) : reveal_msg(bmp);
-	}
-}
+	/* The payload is sealed if a key file was given */
+	size_t const extra = args->kflag ? SEAL_OVERHEAD : 0;
 
-/*
- * Hides |msg| in |data|.
- *
- * The message is hidden in the blue channel of the RGB pixel.
- */
-static void hide_msg(struct BMP_file * const bmp, char const *msg,
-		     size_t const msglen)
-{
+	bmp->layout = args->layout;
+	bmp->flags = (args->kflag ? BMP_FLAG_SEALED : 0) |
+	    (args->fflag ? BMP_FLAG_FEC : 0) |
+	    (hidefile ? 0 : BMP_FLAG_VARINT) | BMP_FLAG_ROWS |
+	    (m->adaptive ? BMP_FLAG_ADAPTIVE : 0) | BMP_FLAG_SIGNED;
+
+	/*
+	 * The length prefix takes |unit| carrier bytes for each of its bytes,
+	 * as does every byte hidden after it.
+	 */
+	unsigned char prefix[PREFIX_MAX_LEN];
+	size_t const plen = len_prefix(bmp, hidefile, len + extra, prefix);
 	size_t maxlimit;
-	if (!safe_subtract((bmp->datalen / 3), 1, &maxlimit)) {
+	if (!safe_subtract(carriers(bmp), unit * prefix_len(bmp, plen),
+			   &maxlimit)) {
 		fprintf(stderr,
 			"Error: possible underflow detected, "
-			"image too small for message\n");
-		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
+			"image too small for %s\n", what);
+		return false;
 	}
 
 	/* Make sure not to overflow |bmp->data| */
-	if (msglen > maxlimit) {
-		fprintf(stderr, "Error: message is too big for image\n");
-		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
+	if (stream_len(bmp, len + extra) > maxlimit / unit) {
+		fprintf(stderr, "Error: %s too large to hide inside image\n",
+			what);
+		return false;
+	}
+
+	/* Seal the payload if a key file was given */
+	unsigned char buf[CHACHA_KEY_LEN];
+	unsigned char const *key = args->kflag ? buf : NULL;
+	bool ok = !key || read_key(args->keyfile, buf);
+
+	/* A fresh key draws the directions of LSB matching */
+	unsigned char mkey[CHACHA_KEY_LEN];
+	if (ok && m->matching && !random_bytes(mkey, sizeof(mkey))) {
+		perror("getrandom");
+		ok = false;
 	}
 
-	bmp->data[0].b = (unsigned char) msglen;
+	/* The LSBs do not count towards the texture, so reveal() sees it too */
+	if (ok && m->adaptive)
+		ok = texture_order(bmp, args->nthreads);
+
+	if (ok) {
+		PROBE4(embed__start, m->name, len, bmp->layout, bmp->flags);
+		bmp->match = m->matching ? mkey : NULL;
+		put_prefix(bmp, m->bits, prefix, plen);
+		ok = put_payload(bmp, m->bits, unit * plen, data, len, key);
+		bmp->match = NULL;
+		PROBE2(embed__done, m->name, len);
+	}
 
-	for (size_t i = 0; i < msglen; i++)
-		bmp->data[i + 1].b = msg[i];
+	free(bmp->order);
+	bmp->order = NULL;
+	memset(buf, 0, sizeof(buf));
+	memset(mkey, 0, sizeof(mkey));
+	return ok;
 }
 
 /*
- * Hides |msg| in |data| using LSB method.
- *
- * The message is hidden in the blue channel of the RGB pixel.
+ * This function is the public interface which invokes the appropriate
+ * function for revealing steganographic data.
  */
-static void hide_msg_lsb(struct BMP_file * const bmp,
-			 char const *msg, size_t const msglen)
+void reveal(struct BMP_file * const bmp, struct Args const * const args)
 {
-	/* The LSB method requires 24 bytes to store the length of the message */
-	size_t maxlimit;
-	if (!safe_subtract((bmp->datalen / 3), 24, &maxlimit)) {
-		fprintf(stderr,
-			"Error: possible underflow detected, "
-			"image too small for message\n");
+	/* Perform using LSB or simple method */
+	struct Method const *m = find_method(args);
+	size_t const unit = 8 / m->bits;
+
+	/* Perform on files or messages */
+	bool hidefile = (args->tflag && strncmp(args->ttyp, "file", 4) == 0);
+
+	if (bmp->layout != LAYOUT_V1 && bmp->layout != LAYOUT_V2) {
+		fprintf(stderr, "Error: unsupported layout version %u\n",
+			bmp->layout);
 		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
 	}
 
-	/* Make sure not to overflow |data| */
-	if (msglen > maxlimit) {
-		fprintf(stderr, "Error: message is too big for image\n");
+	if (bmp->flags & ~BMP_FLAGS_KNOWN) {
+		fprintf(stderr, "Error: unsupported flags 0x%x\n", bmp->flags);
 		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
 	}
 
-	unsigned char bit;
-	unsigned char data;
-	size_t m = 0;       /* Index of |msg| */
-	size_t d = 0;       /* Index of |bmp->data| */
-
-	/* Write length of message in the first 8 blue bytes */
-	for (unsigned char j = 0; j < 8; j++) {
-		bit = (msglen >> j) & 1;
-		data = bmp->data[d].b;
+	if (!bmp->flags && bmp->layout == LAYOUT_V1 && !args->legacy) {
+		fprintf(stderr, "Error: no hidden data found (images hidden "
+			"before the header was marked need --%s)\n", "legacy");
+		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
+	}
 
-		/* Change 0th bit (LSB) to |bit| */
-		data = (data & ~(1 << 0)) | (bit << 0);
+	if ((bmp->flags & BMP_FLAG_SEALED) && !args->kflag) {
+		fprintf(stderr, "Error: payload is sealed, its key file must be "
+			"given with -%c\n", 'k');
+		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
+	}
 
-		bmp->data[d].b = data;
-		d++;
+	if (!(bmp->flags & BMP_FLAG_SEALED) && args->kflag) {
+		fprintf(stderr, "Error: payload is not sealed\n");
+		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
 	}
 
-	while (m < msglen && d < maxlimit) {
-		for (unsigned char j = 0; j < 8; j++) {
-			bit = (msg[m] >> j) & 1;
-			data = bmp->data[d].b;
+	if (!(bmp->flags & BMP_FLAG_ADAPTIVE) != !m->adaptive) {
+		fprintf(stderr, "Error: payload was %shidden with -%c adaptive\n",
+			m->adaptive ? "not " : "", 'm');
+		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
+	}
 
-			/* Change 0th bit (LSB) to |bit| */
-			data = (data & ~(1 << 0)) | (bit << 0);
+	if (m->adaptive && !texture_order(bmp, args->nthreads))
+		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
 
-			bmp->data[d].b = data;
-			d++;
-		}
+	unsigned char buf[CHACHA_KEY_LEN];
+	unsigned char const *key = load_key(bmp, args, buf);
+	size_t const extra = key ? SEAL_OVERHEAD : 0;
 
-		m++;
+	/* The length prefix is stored from the first carrier byte on */
+	size_t len = 0;
+	size_t const plen = get_len_prefix(bmp, m->bits, hidefile, &len);
+	if (!plen) {
+		fprintf(stderr, "Error: no hidden data found, or its length "
+			"is corrupt\n");
+		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
 	}
-}
 
-/*
- * Reveals message hidden within image.
- *
- * This function does the opposite of hide_msg(), but does not alter the
- * |data| values; just prints the message.
- */
-static void reveal_msg(struct BMP_file * const bmp)
-{
 	size_t maxlimit;
-	if (!safe_subtract((bmp->datalen / 3), 1, &maxlimit)) {
+	if (!safe_subtract(carriers(bmp), unit * prefix_len(bmp, plen),
+			   &maxlimit)) {
 		fprintf(stderr,
 			"Error: possible underflow detected, "
 			"steganographic image may be corrupt\n");
 		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
 	}
 
-	/* Length of message is stored in the first blue byte */
-	size_t msglen = (size_t) bmp->data[0].b;
-
-	if (msglen > maxlimit) {
+	/* Prevent out-of-bounds access to |bmp->data| */
+	if (stream_len(bmp, len) > maxlimit / unit || len < extra) {
 		fprintf(stderr,
 			"Error: length mismatch found; possibly corrupt\n");
 		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
 	}
+	len -= extra;
 
-	/* printf("[DEBUG] printing %zu bytes\n", len); */
-	printf("Message:\n");
-	size_t len = msglen + 1;  /* Add one accounting for length byte */
-	for (size_t i = 1; i < len; i++) {
-		if (isprint(bmp->data[i].b))
-			printf("%c", bmp->data[i].b);
+	unsigned char *data = malloc(len ? len : 1);
+	if (!data) {
+		perror("malloc");
+		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
 	}
-	printf("\nEnd of message\n");
+
+	PROBE4(extract__start, m->name, len, bmp->layout, bmp->flags);
+	bool const ok = get_payload(bmp, m->bits, unit * plen, data, len, key);
+	PROBE3(extract__done, m->name, len, ok);
+	if (!ok) {
+		fprintf(stderr, "Error: sealed payload failed authentication; "
+			"wrong key or corrupt image\n");
+		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
+	}
+	memset(buf, 0, sizeof(buf));
+	free(bmp->order);
+	bmp->order = NULL;
+
+	if (hidefile)
+		save_file(bmp, args, data, len);
+	else
+		print_msg(data, len);
+
+	free(data);
 }
 
 /*
- * Reveals message hidden within image using LSB method.
- *
- * This function does the opposite of hide_msg(), but does not alter the
- * |data| values; just prints the message.
+ * This function is the public interface for replacing the data hidden in the
+ * stego image |bmp| in place. Only the pixel bytes whose hidden bits change
+ * are written back to |bmp->fp|, which must be open for update; the pixels
+ * need not be loaded. The layout of |bmp| is kept.
  */
-static void reveal_msg_lsb(struct BMP_file * const bmp)
+void update(struct BMP_file * const bmp, struct Args const * const args)
 {
-	/* Length of message is stored in the first 8 blue bytes */
-	size_t len = 0;
-	size_t maxlimit = (bmp->datalen / 3);
-	unsigned char buf[8] = { 0 };
-	for (int8_t i = 0; i < 8; i++) {
-		buf[i] = (bmp->data[i].b >> 0) & 1;
-		len += (buf[i] << i);
+	/* Perform using LSB or simple method */
+	struct Method const *m = find_method(args);
+
+	/* Perform on files or messages */
+	bool hidefile = (args->tflag && strncmp(args->ttyp, "file", 4) == 0);
+
+	if (bmp->layout != LAYOUT_V1 && bmp->layout != LAYOUT_V2) {
+		fprintf(stderr, "Error: unsupported layout version %u\n",
+			bmp->layout);
+		clean_exit(bmp->fp, NULL, EXIT_FAILURE);
+	}
+
+	/* Compressed pixels are not where they can be written */
+	if (bmp->fmt->decode) {
+		fprintf(stderr, "Error: %s images cannot be updated in place, "
+			"the payload must be hidden again\n", bmp->fmt->name);
+		clean_exit(bmp->fp, NULL, EXIT_FAILURE);
+	}
+
+	/* A new nonce would change every hidden byte of a sealed payload */
+	if (bmp->flags & ~(BMP_FLAG_FEC | BMP_FLAG_VARINT | BMP_FLAG_ROWS |
+			   BMP_FLAG_SIGNED)) {
+		fprintf(stderr, "Error: payload is sealed or has unsupported "
+			"flags, it must be hidden again\n");
+		clean_exit(bmp->fp, NULL, EXIT_FAILURE);
+	}
+
+	if (!bmp->flags && bmp->layout == LAYOUT_V1 && !args->legacy) {
+		fprintf(stderr, "Error: no hidden data found (images hidden "
+			"before the header was marked need --%s)\n", "legacy");
+		clean_exit(bmp->fp, NULL, EXIT_FAILURE);
 	}
 
 	/*
-	 * Count the length byte and multiply by 8 to get the get the total number
-	 * of bytes the data is spread across in the LSB method.
+	 * The length prefix, the payload and its parity, if any, form one
+	 * stream of bytes, each of which takes |unit| carrier bytes from
+	 * carrier byte 0 on.
 	 */
-	len = (len + 1) * 8;
-	if (len > maxlimit) {
-		fprintf(stderr,
-			"Error: length mismatch found; possibly corrupt\n");
-		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
+	bool const fec = bmp->flags & BMP_FLAG_FEC;
+	size_t const unit = 8 / m->bits;
+	unsigned char prefix[PREFIX_MAX_LEN];
+	unsigned char const *payload = (unsigned char const *) args->eval;
+	unsigned char *data = NULL;
+	size_t paylen = args->evallen;
+	size_t parlen = 0;
+
+	struct Args largs = *args;
+	largs.layout = bmp->layout;
+	largs.fflag = fec;
+	size_t cap = capacity(bmp, &largs);
+
+	/* Images from before varint prefixes hold at most 255 bytes */
+	if (!hidefile && !(bmp->flags & BMP_FLAG_VARINT) &&
+	    cap > SUPPORTED_MAX_MSG_LEN)
+		cap = SUPPORTED_MAX_MSG_LEN;
+
+	if (hidefile) {
+		FILE *hfp = fopen(args->eval, "rb");
+		if (!hfp) {
+			perror("fopen");
+			clean_exit(bmp->fp, NULL, EXIT_FAILURE);
+		}
+
+		if (!get_file_size(hfp, &paylen) ||
+		    !(payload = data = read_file(hfp, paylen))) {
+			fprintf(stderr, "Error: could not read file\n");
+			fclose(hfp);
+			clean_exit(bmp->fp, NULL, EXIT_FAILURE);
+		}
+		fclose(hfp);
+	} else if (strcmp(args->eval, "-") == 0) {
+		payload = data = read_message(bmp, cap, &paylen);
 	}
 
-	unsigned char data = 0;  /* Byte buffer for reading bits */
-	unsigned char count = 0; /* Counter for byte buffer */
-	/* printf("[DEBUG] printing %zu bytes\n", len); */
-	printf("Message:\n");
-	for (size_t i = 8; i < len; i++) {
-		buf[i % 8] = (bmp->data[i].b >> 0) & 1;
-		count++;
-
-		if (count == 8) {
-			count = 0;
-			data = 0;
-			for (int8_t j = 7; j >= 0; j--)
-				data += (buf[j] << j);
-
-			if (isprint(data))
-				printf("%c", data);
+	if (paylen > cap) {
+		fprintf(stderr, "Error: %s too large to hide inside image\n",
+			hidefile ? "file" : "message");
+		clean_exit(bmp->fp, NULL, EXIT_FAILURE);
+	}
+
+	size_t const plen = len_prefix(bmp, hidefile, paylen, prefix);
+
+	unsigned char *stream = malloc(plen + paylen +
+				       (fec ? fec_parity_len(paylen) : 0));
+	if (!stream) {
+		perror("malloc");
+		clean_exit(bmp->fp, NULL, EXIT_FAILURE);
+	}
+
+	memcpy(stream, prefix, plen);
+	memcpy(stream + plen, payload, paylen);
+	free(data);
+
+	/* Only the parity of the codewords whose data changed will differ */
+	if (fec) {
+		parlen = fec_parity_len(paylen);
+		fec_encode(stream + plen, paylen, stream + plen + paylen);
+	}
+
+	/* Read the pixel bytes under the new stream, and what they now hide */
+	size_t const n = plen + paylen + parlen;
+	size_t const span = carrier_off(bmp, n * unit - 1) + 1;
+	int const fd = fileno(bmp->fp);
+	unsigned char *px = malloc(span);
+	unsigned char *cur = malloc(n);
+
+	if (!px || !cur) {
+		perror("malloc");
+		clean_exit(bmp->fp, NULL, EXIT_FAILURE);
+	}
+
+	if (!pread_full(fd, px, span, (off_t) bmp->data_off)) {
+		perror("pread");
+		clean_exit(bmp->fp, NULL, EXIT_FAILURE);
+	}
+
+	struct BMP_file view = *bmp;
+	view.data = (struct RGB *) px;
+	view.datalen = span;
+	carrier_get(&view, m->bits, 0, cur, n);
+
+	unsigned char mkey[CHACHA_KEY_LEN];
+	if (m->matching) {
+		if (!random_bytes(mkey, sizeof(mkey))) {
+			perror("getrandom");
+			clean_exit(bmp->fp, NULL, EXIT_FAILURE);
 		}
+		view.match = mkey;
 	}
-	printf("\nEnd of message\n");
+
+	/*
+	 * Rewrite the runs of stream bytes which differ, merging runs which are
+	 * close enough that one write is cheaper than two.
+	 */
+	size_t nwrites = 0;
+	size_t written = 0;
+	size_t i = next_diff(cur, stream, 0, n);
+
+	while (i < n) {
+		size_t end = i + 1;
+		size_t k;
+
+		while ((k = next_diff(cur, stream, end, n)) < n &&
+		       k - end < UPDATE_MERGE_GAP)
+			end = k + 1;
+
+		carrier_put(&view, m->bits, i * unit, stream + i, end - i);
+
+		/* From the first to the last carrier byte of the run */
+		size_t const off = carrier_off(bmp, i * unit);
+		size_t const len = carrier_off(bmp, end * unit - 1) + 1 - off;
+
+		if (!pwrite_full(fd, px + off, len,
+				 (off_t) (bmp->data_off + off))) {
+			perror("pwrite");
+			clean_exit(bmp->fp, NULL, EXIT_FAILURE);
+		}
+
+		nwrites++;
+		written += len;
+		i = k;
+	}
+
+	/*
+	 * The copies of the prefix are in the last carrier bytes. They are
+	 * read from the start of their row on, so that the row padding is
+	 * where the carrier bytes expect it.
+	 */
+	if (fec) {
+		view.datalen = bmp->tot_size - bmp->data_off;
+		size_t const first = carriers(&view) - 2 * plen * unit;
+		size_t const row = carrier_row(bmp, first);
+		size_t const off = carrier_off(bmp, row);
+		size_t const len = carrier_off(bmp, first + 2 * plen * unit - 1) +
+		    1 - off;
+		unsigned char *tail = malloc(len);
+
+		if (!tail) {
+			perror("malloc");
+			clean_exit(bmp->fp, NULL, EXIT_FAILURE);
+		}
+
+		view.data = (struct RGB *) tail;
+		view.datalen = len;
+
+		if (!pread_full(fd, tail, len, (off_t) (bmp->data_off + off))) {
+			perror("pread");
+			clean_exit(bmp->fp, NULL, EXIT_FAILURE);
+		}
+
+		size_t const d = first - row;
+		carrier_put(&view, m->bits, d, stream, plen);
+		carrier_put(&view, m->bits, d + plen * unit, stream, plen);
+
+		if (!pwrite_full(fd, tail, len, (off_t) (bmp->data_off + off))) {
+			perror("pwrite");
+			clean_exit(bmp->fp, NULL, EXIT_FAILURE);
+		}
+
+		free(tail);
+		nwrites++;
+		written += len;
+	}
+
+	if (!sync_fd(fd, args->sync)) {
+		perror("fsync");
+		clean_exit(bmp->fp, NULL, EXIT_FAILURE);
+	}
+
+	info("Updated %s: %zu pixel bytes in %zu writes\n",
+	     hidefile ? "file" : "message", written, nwrites);
+
+	memset(mkey, 0, sizeof(mkey));
+	free(cur);
+	free(px);
+	free(stream);
 }
 
 /*
- * Hides a file by the name of |hfile| inside image.
+ * Computes how much data the method and type selected in |args| can hide in
+ * |bmp| using the layout |args->layout|. Only the headers of |bmp| are used.
  *
- * The file is hidden in the blue channel of the RGB pixel.
+ * Returns: the largest payload (file or message) in bytes.
  */
-static void hide_file(struct BMP_file * const bmp, char const *hfile)
+size_t capacity(struct BMP_file const * const bmp,
+		struct Args const * const args)
 {
+	size_t const unit = 8 / find_method(args)->bits;
+	bool hidefile = (args->tflag && strncmp(args->ttyp, "file", 4) == 0);
+	struct BMP_file view = *bmp;
+	size_t cap;
+
+	/* The pixels need not be loaded, see probe_carrier() for |datalen| */
+	view.layout = args->layout;
+	view.flags = (args->fflag ? BMP_FLAG_FEC : 0) |
+	    (hidefile ? 0 : BMP_FLAG_VARINT) | BMP_FLAG_ROWS | BMP_FLAG_SIGNED;
+
 	/*
-	 * The maximum amount of bytes that could be written is the number of blue
-	 * bytes (hence dividing by 3) and subtract by 4 to account for the length
-	 * bytes which represent the size of the file to hide.
+	 * Subtract the length prefix written by each method. That of a message
+	 * is taken as long as it is for the largest length the image could hold.
 	 */
-	size_t maxlimit;
-	if (!safe_subtract((bmp->datalen / 3), 4, &maxlimit)) {
-		fprintf(stderr,
-			"Error: possible underflow detected, "
-			"image too small for file\n");
-		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
-	}
+	unsigned char prefix[PREFIX_MAX_LEN];
+	size_t const plen = len_prefix(&view, hidefile, carriers(&view), prefix);
+	if (!safe_subtract(carriers(&view), prefix_len(&view, plen) * unit,
+			   &cap))
+		return 0;
 
-	FILE *hfp = fopen(hfile, "rb");
-	if (!hfp) {
-		perror("fopen");
-		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
-	}
+	cap /= unit;
 
-	size_t hidelen;
-	if (!get_file_size(hfp, &hidelen)) {
-		fprintf(stderr, "Error: could not obtain size of file\n");
-		fclose(hfp);
-		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
-	}
+	/* The parity of the payload is hidden after it */
+	if (args->fflag)
+		cap = fec_data_len(cap);
 
-	if (hidelen > maxlimit) {
-		fprintf(stderr, "Error: file too large to hide inside image\n");
-		fclose(hfp);
-		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
-	}
+	/* The nonce and tag of a sealed payload count towards its length */
+	if (args->kflag && !safe_subtract(cap, SEAL_OVERHEAD, &cap))
+		return 0;
 
-	unsigned char *hdata = read_file(hfp, hidelen);
-	if (!hdata) {
-		fprintf(stderr, "Error: could not read file\n");
-		fclose(hfp);
-		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
+	return cap;
+}
+
+/*
+ * Number of bits of hidden data each carrier byte holds with the method
+ * selected in |args|.
+ */
+unsigned int method_bits(struct Args const * const args)
+{
+	return find_method(args)->bits;
+}
+
+/*
+ * Decodes the length prefix of a payload hidden in |bmp|, as it is hidden
+ * for a |file| or a message, from |buf|, the first |n| bytes hidden. With
+ * BMP_FLAG_SIGNED, its signature is checked, the magic number and version
+ * before anything else.
+ *
+ * Returns: the length of the prefix in bytes, whose value is stored in |len|,
+ * or 0 if it is malformed, its signature does not match or it does not end
+ * within |n| bytes.
+ */
+size_t decode_prefix(struct BMP_file const * const bmp, bool const file,
+		     unsigned char const *buf, size_t const n, size_t *len)
+{
+	bool const varint = !file && (bmp->flags & BMP_FLAG_VARINT);
+	bool const sig = bmp->flags & BMP_FLAG_SIGNED;
+	size_t i = 0;
+
+	if (sig) {
+		if (n < SIG_HEAD_LEN || buf[0] != SIG_MAGIC0 ||
+		    buf[1] != SIG_MAGIC1 || buf[2] != SIG_VERSION)
+			return 0;
+		i = SIG_HEAD_LEN;
 	}
 
-	/* Write size of file (4 bytes) */
-	for (size_t i = 0; i < 4; i++)
-		bmp->data[i].b = ((unsigned char) (hidelen >> (8 * i)));
+	*len = 0;
+	if (!varint) {
+		size_t const w = file ? 4 : 1;
 
-	/*
-	 * Replace bitmap file data with the file data to hide.
-	 * Start at offset of 4 because of the 4 length bytes.
-	 */
-	for (size_t i = 0; i < hidelen; i++)
-		bmp->data[i + 4].b = hdata[i];
+		if (n < i + w)
+			return 0;
+		for (size_t j = 0; j < w; j++)
+			*len |= (size_t) buf[i + j] << (8 * j);
+		i += w;
+	} else {
+		size_t j = 0;
+
+		do {
+			if (j == VARINT_MAX_LEN || i + j == n)
+				return 0;
+			*len |= (size_t) (buf[i + j] & 0x7F) << (7 * j);
+		} while (buf[i + j++] & 0x80);
+		i += j;
+	}
+
+	if (sig) {
+		if (i == n || buf[i] != sig_crc(bmp, buf, i))
+			return 0;
+		i++;
+	}
 
-	free(hdata);
-	fclose(hfp);
+	return i;
 }
 
 /*
- * Hides a file by the name of |hfile| inside image using LSB method.
+ * Looks up the method given with -m in |methods|, the first entry if there is
+ * none.
  *
- * The file is hidden in the blue channel of the RGB pixel.
+ * Returns: the method.
  */
-static void hide_file_lsb(struct BMP_file * const bmp, char const *hfile)
+static struct Method const *find_method(struct Args const * const args)
 {
-	/* Number of blue bytes - 32 bytes to store size of file */
-	size_t maxlimit;
-	if (!safe_subtract((bmp->datalen / 3), (8 * 4), &maxlimit)) {
-		fprintf(stderr,
-			"Error: possible underflow detected, "
-			"image too small for file\n");
-		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
+	size_t const n = sizeof(methods) / sizeof(methods[0]);
+
+	for (size_t i = 0; args->mflag && i < n; i++) {
+		if (strncmp(args->mmet, methods[i].name,
+			    strlen(methods[i].name)) == 0)
+			return &methods[i];
 	}
 
-	FILE *hfp = fopen(hfile, "rb");
-	if (!hfp) {
-		perror("fopen");
+	return &methods[0];
+}
+
+/*
+ * Writes the |len| bytes of a revealed file, |data|, to the file given with
+ * -o, or else to a new file named outXXXXXX in the current directory. It is
+ * flushed to the disk as --sync asks.
+ */
+static void save_file(struct BMP_file const * const bmp,
+		      struct Args const * const args,
+		      unsigned char const *data, size_t const len)
+{
+	struct Out_file out;
+	char outname[] = "outXXXXXX";
+	char const *name = args->outpath ? args->outpath : outname;
+	int outfd;
+
+	if (args->outpath) {
+		if (!out_open(&out, args->outpath)) {
+			fprintf(stderr, "Error: could not create %s: %s\n",
+				args->outpath, strerror(errno));
+			clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
+		}
+		outfd = out.fd;
+	} else if ((outfd = mkstemp(outname)) < 0) {
+		perror("mkstemp");
 		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
 	}
 
-	size_t hidelen;
-	if (!get_file_size(hfp, &hidelen)) {
-		fprintf(stderr, "Error: could not obtain size of file\n");
-		fclose(hfp);
+	if (!pwrite_full(outfd, data, len, 0)) {
+		fprintf(stderr, "Error: could not write %s: %s\n", name,
+			strerror(errno));
+		if (args->outpath)
+			out_abort(&out);
+		else
+			unlink(outname);
 		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
 	}
 
-	if (hidelen > maxlimit) {
-		fprintf(stderr, "Error: file too large to hide inside image\n");
-		fclose(hfp);
+	bool const ok = args->outpath ? out_publish(&out, args->sync) :
+	    sync_fd(outfd, args->sync) &&
+	    (args->sync != SYNC_FULL || sync_dir(outname));
+	if (!ok) {
+		fprintf(stderr, "Error: could not save %s: %s\n", name,
+			strerror(errno));
+		if (args->outpath)
+			out_abort(&out);
 		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
 	}
 
-	unsigned char *hdata = read_file(hfp, hidelen);
-	if (!hdata) {
-		fprintf(stderr, "Error: could not read file\n");
-		fclose(hfp);
+	close(outfd);
+	printf("Successfully decoded file: %s\n", name);
+}
+
+/*
+ * Loads the key of the key file given with -k into |buf|.
+ *
+ * Returns: |buf|, or NULL if no key file was given.
+ */
+static unsigned char const *load_key(struct BMP_file const * const bmp,
+				     struct Args const * const args,
+				     unsigned char *buf)
+{
+	if (!args->kflag)
+		return NULL;
+
+	if (!read_key(args->keyfile, buf))
 		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
-	}
 
-	unsigned char bit;
-	unsigned char data;
-	size_t h = 0; /* Index for |hdata| */
-	size_t d = 0; /* Index for |bmp->data| */
+	return buf;
+}
 
-	/* Write size of file in the first 32 blue bytes */
-	for (int8_t j = 0; j < 32; j++) {
-		bit = (hidelen >> j) & 1;
-		data = bmp->data[d].b;
+/*
+ * Computes the number of bytes taken by a length prefix of |plen| bytes in
+ * |bmp|. The prefix has no parity of its own; with FEC it is hidden three
+ * times instead.
+ *
+ * Returns: the number of bytes.
+ */
+static size_t prefix_len(struct BMP_file const * const bmp, size_t const plen)
+{
+	return bmp->flags & BMP_FLAG_FEC ? 3 * plen : plen;
+}
 
-		/* Change 0th bit (LSB) to |bit| */
-		data = (data & ~(1 << 0)) | (bit << 0);
+/*
+ * Computes the number of bytes hidden after the length prefix for a payload
+ * of |len| bytes in |bmp|, counting the parity added with FEC.
+ *
+ * Returns: the number of bytes.
+ */
+static size_t stream_len(struct BMP_file const * const bmp, size_t const len)
+{
+	return bmp->flags & BMP_FLAG_FEC ? len + fec_parity_len(len) : len;
+}
 
-		bmp->data[d].b = data;
-		d++;
+/*
+ * Encodes |len|, the length of a payload, as the length prefix of |bmp| into
+ * |buf|. That of a |file| is 4 little-endian bytes. That of a message is a
+ * varint (LEB128) with BMP_FLAG_VARINT, padded to VARINT_MAX_LEN bytes with
+ * FEC so that its copies have a fixed place; images from before that flag
+ * hold a single byte. With BMP_FLAG_SIGNED, the signature goes around it.
+ *
+ * Returns: the length of the prefix in bytes.
+ */
+static size_t len_prefix(struct BMP_file const * const bmp, bool const file,
+			 size_t len, unsigned char *buf)
+{
+	bool const pad = bmp->flags & BMP_FLAG_FEC;
+	bool const sig = bmp->flags & BMP_FLAG_SIGNED;
+	size_t n = 0;
+
+	if (sig) {
+		buf[n++] = SIG_MAGIC0;
+		buf[n++] = SIG_MAGIC1;
+		buf[n++] = SIG_VERSION;
 	}
 
-	while (h < hidelen && d < maxlimit) {
-		for (int8_t j = 0; j < 8; j++) {
-			bit = (hdata[h] >> j) & 1;
-			data = bmp->data[d].b;
+	if (file) {
+		for (size_t i = 0; i < 4; i++)
+			buf[n++] = (unsigned char) (len >> (8 * i));
+	} else if (!(bmp->flags & BMP_FLAG_VARINT)) {
+		buf[n++] = (unsigned char) len;
+	} else {
+		size_t const end = n + VARINT_MAX_LEN;
+
+		do {
+			buf[n] = (unsigned char) (len & 0x7F);
+			len >>= 7;
+			if (len || (pad && n + 1 < end))
+				buf[n] |= 0x80;
+		} while (buf[n++] & 0x80);
+	}
 
-			/* Change 0th bit (LSB) to |bit| */
-			data = (data & ~(1 << 0)) | (bit << 0);
+	if (sig) {
+		buf[n] = sig_crc(bmp, buf, n);
+		n++;
+	}
 
-			bmp->data[d].b = data;
-			d++;
-		}
+	return n;
+}
 
-		h++;
+/*
+ * Extracts the length prefix of a payload, hidden |bits| bits in each carrier
+ * byte as encoded by len_prefix(), into |len|. Only the first few carrier
+ * bytes are read, so an image without a payload is turned down at once.
+ *
+ * Returns: the length of the prefix in bytes, or 0 if it is malformed or
+ * runs past the carrier bytes of |bmp|.
+ */
+static size_t get_len_prefix(struct BMP_file const * const bmp,
+			     unsigned int const bits, bool const file,
+			     size_t *len)
+{
+	bool const varint = !file && (bmp->flags & BMP_FLAG_VARINT);
+	size_t const unit = 8 / bits;
+	unsigned char buf[PREFIX_MAX_LEN];
+	size_t n = (bmp->flags & BMP_FLAG_SIGNED ? SIG_LEN : 0) +
+	    (file ? 4 : varint ? VARINT_MAX_LEN : 1);
+
+	/* The copies of a prefix with FEC are |n| bytes long */
+	if (bmp->flags & BMP_FLAG_FEC) {
+		if (carriers(bmp) < prefix_len(bmp, n) * unit)
+			return 0;
+		get_prefix(bmp, bits, buf, n);
+		return decode_prefix(bmp, file, buf, n, len) == n ? n : 0;
 	}
 
-	free(hdata);
-	fclose(hfp);
+	/* A varint may end before |n| bytes, the payload follows it */
+	if (carriers(bmp) / unit < n)
+		n = carriers(bmp) / unit;
+	carrier_get(bmp, bits, 0, buf, n);
+
+	return decode_prefix(bmp, file, buf, n, len);
 }
 
 /*
- * Reveals file hidden within image.
+ * Reads a message of at most |max| bytes from stdin for |bmp|. The caller must
+ * free it.
  *
- * This function does the opposite of hide_file(), but does not alter the
- * |data| values; just creates the revealed file.
+ * Returns: the message, whose length is stored in |len|.
  */
-static void reveal_file(struct BMP_file * const bmp)
+static unsigned char *read_message(struct BMP_file const * const bmp,
+				   size_t const max, size_t *len)
 {
-	/* Obtain the length of the hidden file by reading the first 4 bytes */
-	size_t hidelen = 0;
-	for (size_t i = 0; i < 4; i++)
-		hidelen += ((unsigned int) (bmp->data[i].b << (8 * i)));
+	unsigned char *msg = read_stream(stdin, max, len);
 
-	/* Account for the 4 length bytes */
-	size_t maxlimit;
-	if (!safe_subtract((bmp->datalen / 3), 4, &maxlimit)) {
-		fprintf(stderr,
-			"Error: possible underflow detected, "
-			"steganographic image may be corrupt\n");
+	if (!msg) {
+		if (errno == EFBIG)
+			fprintf(stderr, "Error: message is too big for image\n");
+		else
+			perror("read");
 		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
 	}
 
-	if (hidelen > maxlimit) {
-		fprintf(stderr,
-			"Error: length mismatch found; possibly corrupt\n");
+	if (*len == 0) {
+		fprintf(stderr, "Error: message read from stdin is empty\n");
+		free(msg);
 		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
 	}
 
-	unsigned char *hdata = malloc(hidelen);
-	if (!hdata) {
-		perror("malloc");
-		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
+	return msg;
+}
+
+/*
+ * Prints the |len| bytes of the revealed message |msg|, leaving out what is
+ * neither printable nor white space. The bytes kept are moved together in
+ * place and written out at once.
+ */
+static void print_msg(unsigned char *msg, size_t const len)
+{
+	size_t n = 0;
+
+	for (size_t i = 0; i < len; i++) {
+		if (isprint(msg[i]) || isspace(msg[i]))
+			msg[n++] = msg[i];
 	}
 
-	/*
-	 * Begin extracting the hidden file data. Start at offset of 4 because the
-	 * 4 length bytes at the beginning.
-	 */
-	for (size_t i = 0; i < hidelen; i++)
-		hdata[i] = bmp->data[i + 4].b;
+	printf("Message:\n");
+	fwrite(msg, 1, n, stdout);
+	printf("\nEnd of message\n");
+}
 
-	char outname[] = "outXXXXXX";
-	int outfd = mkstemp(outname);
-	if (outfd < 0) {
-		perror("mkstemp");
-		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
+/*
+ * Hides the length prefix |src| of |plen| bytes at carrier byte 0, |bits|
+ * bits in each carrier byte. With FEC, two copies go to the last carrier
+ * bytes, where they do not depend on the length they hold.
+ */
+static void put_prefix(struct BMP_file * const bmp, unsigned int const bits,
+		       void const *src, size_t const plen)
+{
+	size_t const unit = 8 / bits;
+	size_t const end = carriers(bmp);
+
+	carrier_put(bmp, bits, 0, src, plen);
+	if (!(bmp->flags & BMP_FLAG_FEC))
+		return;
+
+	carrier_put(bmp, bits, end - plen * unit, src, plen);
+	carrier_put(bmp, bits, end - 2 * plen * unit, src, plen);
+}
+
+/*
+ * Extracts the length prefix of |plen| bytes hidden with put_prefix() into
+ * |dst|. With FEC, every bit is the majority of its three copies.
+ */
+static void get_prefix(struct BMP_file const * const bmp,
+		       unsigned int const bits, unsigned char *dst,
+		       size_t const plen)
+{
+	size_t const unit = 8 / bits;
+	size_t const end = carriers(bmp);
+	unsigned char a[PREFIX_MAX_LEN];
+	unsigned char b[PREFIX_MAX_LEN];
+
+	carrier_get(bmp, bits, 0, dst, plen);
+	if (!(bmp->flags & BMP_FLAG_FEC))
+		return;
+
+	carrier_get(bmp, bits, end - plen * unit, a, plen);
+	carrier_get(bmp, bits, end - 2 * plen * unit, b, plen);
+	for (size_t i = 0; i < plen; i++)
+		dst[i] = (dst[i] & a[i]) | (dst[i] & b[i]) | (a[i] & b[i]);
+}
+
+/*
+ * Hides the |len| bytes of |src| from carrier byte |d| on, |bits| bits in
+ * each carrier byte. With a |key|, the payload is sealed on the way: a random
+ * nonce, the payload encrypted with ChaCha20 and the Poly1305 tag are hidden
+ * instead, SEAL_OVERHEAD bytes more. Encryption goes |tune.chunk| bytes at
+ * a time, so every chunk is embedded while it is still in the cache. With FEC,
+ * the parity of the hidden bytes follows them.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+static bool put_payload(struct BMP_file * const bmp, unsigned int const bits,
+			size_t d, void const *src, size_t const len,
+			unsigned char const *key)
+{
+	bool const fec = bmp->flags & BMP_FLAG_FEC;
+	size_t const unit = 8 / bits;
+	size_t const n = len + (key ? SEAL_OVERHEAD : 0);
+	size_t const end = d + n * unit;
+	unsigned char const *s = src;
+	unsigned char *sealed = NULL; /* What was hidden, if FEC needs it */
+
+	if (!key) {
+		for (size_t off = 0; off < len; off += PAYLOAD_CHUNK) {
+			size_t const c = len - off < PAYLOAD_CHUNK ?
+			    len - off : PAYLOAD_CHUNK;
+
+			put_chunk(bmp, bits, d + off * unit, s + off, c);
+		}
+	} else {
+		unsigned char nonce[CHACHA_NONCE_LEN];
+		unsigned char *chunk = malloc(tune.chunk);
+		unsigned char tag[POLY1305_TAG_LEN];
+		struct Aead aead;
+		size_t pos = 0;
+
+		if (!chunk || (fec && !(sealed = malloc(n)))) {
+			perror("malloc");
+			free(chunk);
+			free(sealed);
+			return false;
+		}
+
+		if (!random_bytes(nonce, sizeof(nonce))) {
+			perror("getrandom");
+			free(chunk);
+			free(sealed);
+			return false;
+		}
+
+		put_chunk(bmp, bits, d, nonce, sizeof(nonce));
+		d += sizeof(nonce) * unit;
+		if (sealed)
+			memcpy(sealed, nonce, sizeof(nonce));
+		pos += sizeof(nonce);
+
+		aead_init(&aead, key, nonce);
+		for (size_t off = 0; off < len; off += tune.chunk) {
+			size_t const c = len - off < tune.chunk ?
+			    len - off : tune.chunk;
+
+			memcpy(chunk, s + off, c);
+			aead_encrypt(&aead, chunk, c);
+			put_chunk(bmp, bits, d, chunk, c);
+			d += c * unit;
+			if (sealed)
+				memcpy(sealed + pos, chunk, c);
+			pos += c;
+		}
+
+		aead_final(&aead, tag);
+		put_chunk(bmp, bits, d, tag, sizeof(tag));
+		if (sealed)
+			memcpy(sealed + pos, tag, sizeof(tag));
+		memset(chunk, 0, tune.chunk);
+		free(chunk);
+		s = sealed;
 	}
 
-	if (write(outfd, hdata, hidelen) < 0) {
-		perror("write");
-		close(outfd);
-		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
+	if (fec) {
+		size_t const parlen = fec_parity_len(n);
+		unsigned char *parity = malloc(parlen);
+
+		if (!parity) {
+			perror("malloc");
+			free(sealed);
+			return false;
+		}
+
+		fec_encode(s, n, parity);
+		put_chunk(bmp, bits, end, parity, parlen);
+		free(parity);
 	}
 
-	close(outfd);
-	printf("Successfully decoded file: %s\n", outname);
+	free(sealed);
+	return true;
 }
 
 /*
- * Reveals file hidden using the LSB method within image.
+ * Extracts the |len| bytes hidden with put_payload() from carrier byte |d| on
+ * into |dst|, correcting them with their parity if they have FEC, and
+ * decrypting and authenticating them if a |key| is given.
  *
- * This function does the opposite of hide_file_lsb(), but does not alter the
- * |data| values; just creates the revealed file.
+ * Returns: true if successful, false if the payload failed authentication.
  */
-static void reveal_file_lsb(struct BMP_file * const bmp)
+static bool get_payload(struct BMP_file const * const bmp,
+			unsigned int const bits, size_t d, unsigned char *dst,
+			size_t const len, unsigned char const *key)
 {
-	size_t hidelen = 0; /* Size of hidden file */
+	size_t const unit = 8 / bits;
+	size_t const n = len + (key ? SEAL_OVERHEAD : 0);
+	unsigned char *sealed = NULL; /* What was hidden, once corrected */
+
+	if (bmp->flags & BMP_FLAG_FEC) {
+		size_t const parlen = fec_parity_len(n);
+		unsigned char *parity = malloc(parlen);
+		unsigned char *buf = key ? (sealed = malloc(n)) : dst;
+		size_t fixed;
+
+		if (!parity || !buf) {
+			perror("malloc");
+			clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
+		}
 
-	/* Obtain size of file is stored in the first 32 blue bytes */
-	unsigned char buf[32] = { 0 };
-	for (int8_t i = 0; i < 32; ++i) {
-		buf[i] = (bmp->data[i].b >> 0) & 1;
-		hidelen += ((1 << i) * buf[i]);
-	}
+		get_chunk(bmp, bits, d, buf, n);
+		get_chunk(bmp, bits, d + n * unit, parity, parlen);
 
-	/* Prevent out-of-bounds access to |bmp->data| */
-	size_t fullsize = (hidelen + 4) * 8;
-	size_t maxlimit = (bmp->datalen / 3);
-	if (fullsize > maxlimit) {
-		fprintf(stderr,
-			"Error: length mismatch found; possibly corrupt\n");
-		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
+		if (!fec_decode(buf, n, parity, &fixed)) {
+			fprintf(stderr, "Error: payload is damaged beyond what "
+				"its error correction can repair\n");
+			clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
+		}
+		if (fixed)
+			info("Corrected %zu damaged bytes\n", fixed);
+
+		free(parity);
+		if (!key)
+			return true;
 	}
 
-	unsigned char *hdata = malloc(hidelen);
-	if (!hdata) {
-		perror("malloc");
-		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
+	if (!key) {
+		for (size_t off = 0; off < len; off += PAYLOAD_CHUNK) {
+			size_t const c = len - off < PAYLOAD_CHUNK ?
+			    len - off : PAYLOAD_CHUNK;
+
+			get_chunk(bmp, bits, d + off * unit, dst + off, c);
+		}
+		return true;
 	}
 
-	/*
-	 * Begin extracting the hidden file data. Start at offset of 32 because the
-	 * first 32 bytes contain the size of the file.
-	 */
-	size_t h = 0;                 /* Index for |hdata| */
-	size_t datalen = hidelen * 8; /* Bytes in |bmp->data| */
-	unsigned char count = 0;
-	unsigned char data = 0;
-	for (size_t i = 0; i < datalen; ++i) {
-		buf[i % 8] = (bmp->data[i + 32].b >> 0) & 1;
-		count++;
-
-		if (count == 8) {
-			count = 0;
-			data = 0;
-			for (int8_t j = 7; j >= 0; --j)
-				data += (buf[j] << j);
-
-			hdata[h++] = data;
+	unsigned char nonce[CHACHA_NONCE_LEN];
+	unsigned char tag[POLY1305_TAG_LEN];
+	unsigned char expect[POLY1305_TAG_LEN];
+	struct Aead aead;
+
+	if (sealed) {
+		memcpy(nonce, sealed, sizeof(nonce));
+		memcpy(dst, sealed + sizeof(nonce), len);
+		memcpy(tag, sealed + sizeof(nonce) + len, sizeof(tag));
+		free(sealed);
+
+		aead_init(&aead, key, nonce);
+		aead_decrypt(&aead, dst, len);
+	} else {
+		get_chunk(bmp, bits, d, nonce, sizeof(nonce));
+		d += sizeof(nonce) * unit;
+
+		aead_init(&aead, key, nonce);
+		for (size_t off = 0; off < len; off += tune.chunk) {
+			size_t const c = len - off < tune.chunk ?
+			    len - off : tune.chunk;
+
+			get_chunk(bmp, bits, d, dst + off, c);
+			aead_decrypt(&aead, dst + off, c);
+			d += c * unit;
 		}
+
+		get_chunk(bmp, bits, d, tag, sizeof(tag));
 	}
 
-	char outname[] = "outXXXXXX";
-	int outfd = mkstemp(outname);
-	if (outfd < 0) {
-		perror("mkstemp");
-		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
+	aead_final(&aead, expect);
+
+	if (!aead_tag_equal(tag, expect)) {
+		memset(dst, 0, len);
+		return false;
 	}
 
-	if (write(outfd, hdata, hidelen) < 0) {
-		perror("write");
-		close(outfd);
-		clean_exit(bmp->fp, bmp->data, EXIT_FAILURE);
+	return true;
+}
+
+/*
+ * Finds the first index from |i| on at which the |n| bytes of |a| and |b|
+ * differ, comparing 16 bytes at a time where SSE2 is available.
+ *
+ * Returns: the index, or |n| if the rest of |a| and |b| is equal.
+ */
+static size_t next_diff(unsigned char const *a, unsigned char const *b,
+			size_t i, size_t const n)
+{
+#ifdef __SSE2__
+	for (; i + 16 <= n; i += 16) {
+		__m128i const x = _mm_loadu_si128((__m128i const *) (a + i));
+		__m128i const y = _mm_loadu_si128((__m128i const *) (b + i));
+		unsigned int const ne =
+		    ~(unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) &
+		    0xFFFFU;
+
+		if (ne)
+			return i + (size_t) __builtin_ctz(ne);
 	}
+#endif
 
-	close(outfd);
-	printf("Successfully decoded file: %s\n", outname);
+	while (i < n && a[i] == b[i])
+		i++;
+
+	return i;
+}
+
+/*
+ * carrier_put(), reported to the embed__chunk probe.
+ */
+static void put_chunk(struct BMP_file * const bmp, unsigned int const bits,
+		      size_t const d, void const *src, size_t const len)
+{
+	carrier_put(bmp, bits, d, src, len);
+	PROBE3(embed__chunk, bits, d, len);
+}
+
+/*
+ * carrier_get(), reported to the extract__chunk probe.
+ */
+static void get_chunk(struct BMP_file const * const bmp,
+		      unsigned int const bits, size_t const d, void *dst,
+		      size_t const len)
+{
+	carrier_get(bmp, bits, d, dst, len);
+	PROBE3(extract__chunk, bits, d, len);
+}
+
+/*
+ * Computes the CRC-8 of the signature of |bmp|: of the |n| bytes of |buf|,
+ * the signature and length before it, and of the layout and flags in the BMP
+ * header, so that it also fails if those were changed.
+ *
+ * Returns: the CRC-8.
+ */
+static unsigned char sig_crc(struct BMP_file const * const bmp,
+			     unsigned char const *buf, size_t const n)
+{
+	unsigned char const hdr[] = {
+		(unsigned char) bmp->layout,
+		(unsigned char) bmp->flags,
+		(unsigned char) (bmp->flags >> 8)
+	};
+	unsigned int crc = 0;
+
+	for (size_t i = 0; i < n + sizeof(hdr); i++) {
+		crc ^= i < n ? buf[i] : hdr[i - n];
+		for (int b = 0; b < 8; b++)
+			crc = ((crc << 1) ^ (crc & 0x80 ? SIG_CRC_POLY : 0)) &
+			    0xFF;
+	}
+
+	return (unsigned char) crc;
 }
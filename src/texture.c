@@ -0,0 +1,385 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../include/texture.h"
+#include "../include/helper.h"
+
+/* The levels of one image, computed a band of rows at a time */
+struct Texture_pool {
+	struct BMP_file const *bmp;
+	unsigned char         *levels; /* Level of each carrier byte */
+	size_t                len;     /* Pixel bytes holding carrier bytes */
+	size_t                step;    /* Bytes between carrier bytes in a row */
+	size_t                run;     /* Carrier bytes per row */
+	size_t                rows;    /* Rows holding carrier bytes */
+	size_t                nbands;
+	size_t                (*counts)[TEXTURE_LEVELS]; /* Carrier bytes of
+							    each level in
+							    each band */
+	size_t                next;    /* Next band to take */
+	bool                  scatter; /* Second pass, see texture_order() */
+};
+
+/* A thread of a Texture_pool */
+struct Texture_worker {
+	struct Texture_pool *pool;
+	unsigned char       *tmp;      /* Levels of one row of pixel bytes */
+};
+
+static bool texture_run(struct Texture_worker * const ws, size_t const nw);
+static void *texture_worker(void *arg);
+static void texture_band(struct Texture_worker * const w, size_t const band);
+static void texture_scatter(struct Texture_pool const * const pool,
+			    size_t const band);
+static size_t row_bytes(struct Texture_pool const * const pool,
+			size_t const y);
+static void row_levels(unsigned char const *up, unsigned char const *row,
+		       unsigned char const *down, size_t const n,
+		       size_t const px, unsigned char *out);
+static unsigned char level_at(unsigned char const *up,
+			      unsigned char const *row,
+			      unsigned char const *down, size_t const i,
+			      size_t const n, size_t const px);
+
+/*
+ * Sets |bmp->order| to the offsets in |bmp->data| of the carrier bytes of
+ * |bmp|, the most textured first, so that carrier_put() hides data where it
+ * is hardest to detect. The texture of a carrier byte is its difference to
+ * the same channel of the four neighbouring pixels, and its level is the bit
+ * length of that; ties keep the pixel order. Least significant bits are left
+ * out, so an image gives the same order before and after LSB embedding. The
+ * levels are computed, and then sorted, in tiles of TEXTURE_BAND rows by
+ * |nthreads| threads (0 for one per CPU). |bmp->order| must be freed by the caller.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+bool texture_order(struct BMP_file * const bmp, unsigned int const nthreads)
+{
+	size_t const rowbytes = bmp->width * bmp->pxlen;
+	struct Texture_pool pool = {
+		.bmp = bmp,
+		.len = bmp->datalen,
+		.step = bmp->layout == LAYOUT_V2 ? 1 : bmp->pxlen,
+		.run = bmp->layout == LAYOUT_V2 ? rowbytes : bmp->width,
+		.next = 0
+	};
+
+	/* Carrier bytes are taken row by row, see carriers() */
+	if (!(bmp->flags & BMP_FLAG_ROWS)) {
+		fprintf(stderr, "Error: adaptive payload of an image without "
+			"rows; possibly corrupt\n");
+		return false;
+	}
+
+	if (pool.len > bmp->height * bmp->rowlen)
+		pool.len = bmp->height * bmp->rowlen;
+	pool.rows = (pool.len + bmp->rowlen - 1) / bmp->rowlen;
+	pool.nbands = (pool.rows + TEXTURE_BAND - 1) / TEXTURE_BAND;
+
+	size_t const n = carriers(bmp);
+	bmp->order = malloc((n ? n : 1) * sizeof(*bmp->order));
+	pool.levels = malloc(n ? n : 1);
+	pool.counts = calloc(pool.nbands ? pool.nbands : 1,
+			     sizeof(*pool.counts));
+
+	size_t nw = nthreads ? nthreads : tune_threads();
+	if (pool.len < TEXTURE_MIN_MT)
+		nw = 1;
+	if (nw > pool.nbands)
+		nw = pool.nbands ? pool.nbands : 1;
+
+	struct Texture_worker *ws = calloc(nw, sizeof(*ws));
+	bool ok = bmp->order && pool.levels && pool.counts && ws;
+
+	for (size_t i = 0; ok && i < nw; i++) {
+		ws[i].pool = &pool;
+		ok = (ws[i].tmp = malloc(rowbytes ? rowbytes : 1)) != NULL;
+	}
+
+	if (!ok) {
+		perror("malloc");
+		goto out;
+	}
+
+	/* The levels of every band, and how many carrier bytes each has */
+	ok = texture_run(ws, nw);
+
+	/*
+	 * Each band then writes its carrier bytes of each level where they go
+	 * in the order: after those of higher levels, and after those of the
+	 * same level in the bands before it.
+	 */
+	size_t at = 0;
+	for (size_t l = TEXTURE_LEVELS; ok && l-- > 0;) {
+		for (size_t b = 0; b < pool.nbands; b++) {
+			size_t const cnt = pool.counts[b][l];
+
+			pool.counts[b][l] = at;
+			at += cnt;
+		}
+	}
+
+	if (ok && at != n) {
+		fprintf(stderr, "Error: texture map does not cover the image\n");
+		ok = false;
+	}
+
+	pool.scatter = true;
+	pool.next = 0;
+	ok = ok && texture_run(ws, nw);
+
+out:
+	for (size_t i = 0; ws && i < nw; i++)
+		free(ws[i].tmp);
+	free(ws);
+	free(pool.counts);
+	free(pool.levels);
+	if (!ok) {
+		free(bmp->order);
+		bmp->order = NULL;
+	}
+
+	return ok;
+}
+
+/*
+ * Runs the current pass of the Texture_pool of the workers |ws| on |nw|
+ * threads, this one included.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+static bool texture_run(struct Texture_worker * const ws, size_t const nw)
+{
+	pthread_t *tids = malloc(nw * sizeof(*tids));
+	if (!tids) {
+		perror("malloc");
+		return false;
+	}
+
+	/* If no thread could be started, this one does all the work */
+	size_t started = 1;
+	for (; started < nw; started++) {
+		if (pthread_create(&tids[started], NULL, texture_worker,
+				   &ws[started]) != 0)
+			break;
+	}
+
+	texture_worker(&ws[0]);
+	for (size_t i = 1; i < started; i++)
+		pthread_join(tids[i], NULL);
+
+	free(tids);
+	return true;
+}
+
+/*
+ * Runs the current pass of the Texture_pool of the worker |arg| on its bands
+ * until none is left.
+ */
+static void *texture_worker(void *arg)
+{
+	struct Texture_worker * const w = arg;
+	struct Texture_pool * const pool = w->pool;
+
+	for (;;) {
+		size_t const band = __atomic_fetch_add(&pool->next, 1,
+						       __ATOMIC_RELAXED);
+		if (band >= pool->nbands)
+			break;
+		if (pool->scatter)
+			texture_scatter(pool, band);
+		else
+			texture_band(w, band);
+	}
+
+	return NULL;
+}
+
+/*
+ * Stores the levels of the carrier bytes in the rows of |band| and counts
+ * those of each level.
+ */
+static void texture_band(struct Texture_worker * const w, size_t const band)
+{
+	struct Texture_pool * const pool = w->pool;
+	struct BMP_file const * const bmp = pool->bmp;
+	unsigned char const *px = (unsigned char const *) bmp->data;
+	size_t hist[4][TEXTURE_LEVELS] = { { 0 } };
+	size_t const end = (band + 1) * TEXTURE_BAND < pool->rows ?
+	    (band + 1) * TEXTURE_BAND : pool->rows;
+
+	for (size_t y = band * TEXTURE_BAND; y < end; y++) {
+		size_t const n = row_bytes(pool, y);
+		size_t const k = n / pool->step < pool->run ? n / pool->step :
+		    pool->run;
+		unsigned char const *row = px + y * bmp->rowlen;
+
+		/* Edge rows, and a row above a cut-off one, are their own
+		 * neighbours */
+		unsigned char const *up = y > 0 ? row - bmp->rowlen : row;
+		unsigned char const *down = row_bytes(pool, y + 1) >= n ?
+		    row + bmp->rowlen : row;
+
+		unsigned char *lv = pool->levels + y * pool->run;
+		unsigned char *out = pool->step == 1 ? lv : w->tmp;
+
+		row_levels(up, row, down, n, bmp->pxlen, out);
+
+		if (pool->step != 1) {
+			for (size_t x = 0; x < k; x++)
+				lv[x] = out[x * pool->step];
+		}
+
+		/* Four histograms, so that runs of a level do not serialize */
+		size_t x = 0;
+		for (; x + 4 <= k; x += 4) {
+			hist[0][lv[x]]++;
+			hist[1][lv[x + 1]]++;
+			hist[2][lv[x + 2]]++;
+			hist[3][lv[x + 3]]++;
+		}
+		for (; x < k; x++)
+			hist[0][lv[x]]++;
+	}
+
+	for (size_t l = 0; l < TEXTURE_LEVELS; l++)
+		pool->counts[band][l] = hist[0][l] + hist[1][l] + hist[2][l] +
+		    hist[3][l];
+}
+
+/*
+ * Writes the offsets of the carrier bytes in the rows of |band| to the order,
+ * each level from where the counts of the band say it starts.
+ */
+static void texture_scatter(struct Texture_pool const * const pool,
+			    size_t const band)
+{
+	struct BMP_file const * const bmp = pool->bmp;
+	size_t pos[TEXTURE_LEVELS];
+	size_t const end = (band + 1) * TEXTURE_BAND < pool->rows ?
+	    (band + 1) * TEXTURE_BAND : pool->rows;
+
+	memcpy(pos, pool->counts[band], sizeof(pos));
+
+	for (size_t y = band * TEXTURE_BAND; y < end; y++) {
+		size_t const n = row_bytes(pool, y);
+		size_t const k = n / pool->step < pool->run ? n / pool->step :
+		    pool->run;
+		unsigned char const *lv = pool->levels + y * pool->run;
+		uint32_t off = (uint32_t) (y * bmp->rowlen);
+
+		for (size_t x = 0; x < k; x++, off += (uint32_t) pool->step)
+			bmp->order[pos[lv[x]]++] = off;
+	}
+}
+
+/*
+ * Returns the number of pixel bytes (without the padding) of row |y| of the
+ * carrier bytes of |pool|; fewer for a cut-off last row, 0 past it.
+ */
+static size_t row_bytes(struct Texture_pool const * const pool,
+			size_t const y)
+{
+	struct BMP_file const * const bmp = pool->bmp;
+	size_t const rowbytes = bmp->width * bmp->pxlen;
+	size_t const start = y * bmp->rowlen;
+
+	if (y >= pool->rows || start >= pool->len)
+		return 0;
+	return pool->len - start < rowbytes ? pool->len - start : rowbytes;
+}
+
+/*
+ * Stores the level of each of the |n| bytes of |row| in |out|. |up| and |down|
+ * are the rows around it, and |px| the bytes per pixel.
+ */
+static void row_levels(unsigned char const *up, unsigned char const *row,
+		       unsigned char const *down, size_t const n,
+		       size_t const px, unsigned char *out)
+{
+	size_t i = 0;
+
+	/* The first pixel has no left neighbour */
+	for (; i < px && i < n; i++)
+		out[i] = level_at(up, row, down, i, n, px);
+
+#ifdef __SSE2__
+	/* Absolute differences of unsigned bytes are two saturating ones */
+#define ABSDIFF(a, b) _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a))
+
+	__m128i const keep = _mm_set1_epi8((char) 0xFE);
+
+	for (; i + px + 16 <= n; i += 16) {
+		__m128i const x = _mm_and_si128(
+			_mm_loadu_si128((__m128i const *) (row + i)), keep);
+		__m128i const l = _mm_and_si128(
+			_mm_loadu_si128((__m128i const *) (row + i - px)), keep);
+		__m128i const r = _mm_and_si128(
+			_mm_loadu_si128((__m128i const *) (row + i + px)), keep);
+		__m128i const u = _mm_and_si128(
+			_mm_loadu_si128((__m128i const *) (up + i)), keep);
+		__m128i const d = _mm_and_si128(
+			_mm_loadu_si128((__m128i const *) (down + i)), keep);
+		__m128i const c = _mm_adds_epu8(
+			_mm_adds_epu8(ABSDIFF(x, l), ABSDIFF(x, r)),
+			_mm_adds_epu8(ABSDIFF(x, u), ABSDIFF(x, d)));
+
+		/* The bit length: one for each power of two not above it */
+		__m128i lv = _mm_setzero_si128();
+		for (unsigned int b = 0; b < 8; b++) {
+			__m128i const t = _mm_set1_epi8((char) (1U << b));
+
+			lv = _mm_sub_epi8(lv, _mm_cmpeq_epi8(_mm_min_epu8(c, t),
+							     t));
+		}
+
+		_mm_storeu_si128((__m128i *) (out + i), lv);
+	}
+#undef ABSDIFF
+#endif
+
+	for (; i < n; i++)
+		out[i] = level_at(up, row, down, i, n, px);
+}
+
+/*
+ * Returns the level of byte |i| of the |n| bytes of |row|, as row_levels().
+ * The first and last pixels of a row are their own left and right
+ * neighbours.
+ */
+static unsigned char level_at(unsigned char const *up,
+			      unsigned char const *row,
+			      unsigned char const *down, size_t const i,
+			      size_t const n, size_t const px)
+{
+	int const x = row[i] & 0xFE;
+	int const l = (i >= px ? row[i - px] : row[i]) & 0xFE;
+	int const r = (i + px < n ? row[i + px] : row[i]) & 0xFE;
+	int const u = up[i] & 0xFE;
+	int const d = down[i] & 0xFE;
+
+	/* Saturated as the bytes of row_levels() are */
+	unsigned int const h = abs(x - l) + abs(x - r);
+	unsigned int const v = abs(x - u) + abs(x - d);
+	unsigned int c = (h < 255 ? h : 255) + (v < 255 ? v : 255);
+	unsigned char lv = 0;
+
+	for (c = c < 255 ? c : 255; c; c >>= 1)
+		lv++;
+
+	return lv;
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../include/tga.h"
+
+static bool tga_match(unsigned char const *hdr, size_t const len);
+static bool tga_probe(unsigned char const *hdr, size_t const len,
+		      struct BMP_file * const bmp, char *err,
+		      size_t const errlen);
+static size_t tga_stamp(struct BMP_file const * const bmp,
+			unsigned char const *src, unsigned char *dst);
+
+/* The headers of a TGA file keep their length when they are stamped */
+struct Carrier_format const tga_format = {
+	.name = "tga",
+	.fixed_header = true,
+	.match = tga_match,
+	.probe = tga_probe,
+	.stamp = tga_stamp
+};
+
+/*
+ * Whether the first |len| bytes of a file, |hdr|, look like those of a TGA
+ * file of any kind. TGA has no magic number, so this checks that every field
+ * of the header holds one of the values it may.
+ */
+static bool tga_match(unsigned char const *hdr, size_t const len)
+{
+	if (len < TGAHEADERLEN)
+		return false;
+
+	unsigned int const type = hdr[2] & ~8U; /* RLE variants */
+	unsigned int const bpp = hdr[16];
+
+	return hdr[1] <= 1 && type >= 1 && type <= 3 &&
+	    (bpp == 8 || bpp == 15 || bpp == 16 || bpp == 24 || bpp == 32) &&
+	    (hdr[12] | hdr[13]) != 0 && (hdr[14] | hdr[15]) != 0 &&
+	    (hdr[17] & 0xC0) == 0;
+}
+
+/*
+ * Parses the headers found in the first |len| bytes of a TGA file, |hdr|, into
+ * |bmp|, see struct Carrier_format.
+ *
+ * Returns: true if file is supported; false otherwise.
+ */
+static bool tga_probe(unsigned char const *hdr, size_t const len,
+		      struct BMP_file * const bmp, char *err,
+		      size_t const errlen)
+{
+	unsigned int const type = hdr[2];
+	unsigned int const bpp = hdr[16];
+
+	(void) len;
+	if (hdr[1] != 0 || (type != TGA_TRUECOLOR && type != TGA_GRAY)) {
+		snprintf(err, errlen, "color-mapped and compressed TGA files "
+			 "are not supported");
+		return false;
+	}
+
+	if (type == TGA_TRUECOLOR ? bpp != 24 && bpp != 32 : bpp != 8) {
+		snprintf(err, errlen, "only TGA files of 24 or 32 (color) or 8 "
+			 "(gray) bits per pixel are supported, found %u", bpp);
+		return false;
+	}
+
+	/* The image ID comes between the header and the pixels */
+	bmp->data_off = TGAHEADERLEN + hdr[0];
+	if (bmp->tot_size <= bmp->data_off) {
+		snprintf(err, errlen, "file seems to be missing its data "
+			 "section; possibly corrupt");
+		return false;
+	}
+
+	bmp->pxlen = bpp / 8;
+	bmp->chans = bpp == 32 ? "bgra" : bpp == 24 ? "bgr" : "y";
+	bmp->bpp = bpp;
+	bmp->width = (size_t) hdr[12] | (size_t) hdr[13] << 8;
+	bmp->height = (size_t) hdr[14] | (size_t) hdr[15] << 8;
+	bmp->rowlen = bmp->width * bmp->pxlen;
+	bmp->topdown = hdr[17] & TGA_DESC_TOP;
+	bmp->diblen = 0;
+	bmp->headerlen = TGAHEADERLEN;
+
+	/* Images without hidden data hold 0 here */
+	unsigned int const layout = (unsigned int) hdr[TGA_LAYOUT_OFF] |
+	    (unsigned int) hdr[TGA_LAYOUT_OFF + 1] << 8;
+	bmp->layout = layout == 0 ? LAYOUT_V1 : layout;
+	bmp->flags = (unsigned int) hdr[TGA_FLAGS_OFF] |
+	    (unsigned int) hdr[TGA_FLAGS_OFF + 1] << 8;
+	return true;
+}
+
+/*
+ * Copies the |bmp->data_off| bytes of headers of a TGA file, |src|, to |dst|,
+ * recording the layout and flags of the data hidden in |bmp| in the unused
+ * color map specification.
+ *
+ * Returns: the length of the headers.
+ */
+static size_t tga_stamp(struct BMP_file const * const bmp,
+			unsigned char const *src, unsigned char *dst)
+{
+	unsigned int const layout = bmp->layout == LAYOUT_V1 ? 0 : bmp->layout;
+
+	memmove(dst, src, bmp->data_off);
+	dst[TGA_LAYOUT_OFF] = (unsigned char) layout;
+	dst[TGA_LAYOUT_OFF + 1] = (unsigned char) (layout >> 8);
+	dst[TGA_FLAGS_OFF] = (unsigned char) bmp->flags;
+	dst[TGA_FLAGS_OFF + 1] = (unsigned char) (bmp->flags >> 8);
+	dst[TGA_CMAP_BPP_OFF] = 0;
+	return bmp->data_off;
+}
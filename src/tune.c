@@ -0,0 +1,780 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../include/tune.h"
+#include "../include/args.h"
+#include "../include/bmp.h"
+#include "../include/crypto.h"
+#include "../include/fec.h"
+#include "../include/helper.h"
+
+/* Passes over the pixels shared by the threads of bench_threads() */
+struct Tune_pool {
+	size_t passes; /* Passes to make in all */
+	size_t next;   /* Next pass to take, atomically */
+	bool   copy;   /* memcpy() the pixels rather than hide and extract */
+};
+
+/* A thread of bench_threads(), with pixels of its own */
+struct Tune_worker {
+	struct Tune_pool *pool;
+	struct BMP_file  view;    /* Every byte a carrier byte, see init_view() */
+	unsigned char    *payload;
+	size_t           len;     /* Bytes of |payload|, which fills |view| */
+	unsigned char    *copy;   /* TUNE_PIXELS_LEN bytes memcpy() writes */
+};
+
+/* Names of enum Tune_simd, in the profile and for --tune */
+static char const * const simd_names[] = { "scalar", "sse2", "avx2" };
+
+struct Tune tune = {
+	.threads = 0,
+	.chunk = SEAL_CHUNK,
+	.direct = false,
+	.direct_chunk = DIRECT_CHUNK,
+	.simd = TUNE_SIMD_AVX2
+};
+
+static bool profile_path(char *path, size_t const len);
+static bool read_profile(char const *path, struct Tune * const t);
+static bool write_profile(char const *path, struct Tune const * const t,
+			  char const *notes);
+static bool tune_set(struct Tune * const t, char const *key,
+		     char const *val);
+static bool parse_bytes(char const *val, size_t *n);
+static bool make_parents(char const *path);
+static double now(void);
+static void init_view(struct BMP_file * const v, unsigned char *px,
+		      unsigned int const pxlen, unsigned int const layout);
+static double bench_kernels(struct Tune_worker * const w);
+static double bench_threads(struct Tune_worker *ws, size_t const n,
+			    size_t const passes, bool const copy);
+static void *bench_worker(void *arg);
+static double bench_chunk(struct Tune_worker * const w, size_t const chunk);
+static bool bench_io(char const *dir, struct Tune * const t);
+static double rate(size_t const bytes, double const secs);
+
+/*
+ * Loads the tuning profile into |tune|, if there is one, and applies the
+ * overrides |spec| given with --tune (comma-separated <KEY>=<VALUE> pairs,
+ * with the keys of the profile) on top of it, if not NULL. A profile which
+ * cannot be read is reported and left out.
+ *
+ * Returns: true if successful, false if |spec| is invalid.
+ */
+bool tune_load(char const *spec)
+{
+	char path[PATH_MAX];
+	struct Tune t = tune;
+
+	if (profile_path(path, sizeof(path)) && !read_profile(path, &t))
+		t = tune;
+
+	if (spec) {
+		char *buf = strdup(spec);
+		char *save = NULL;
+
+		if (!buf) {
+			perror("strdup");
+			return false;
+		}
+
+		for (char *e = strtok_r(buf, ",", &save); e;
+		     e = strtok_r(NULL, ",", &save)) {
+			char *eq = strchr(e, '=');
+
+			if (eq)
+				*eq = '\0';
+			if (!eq || !tune_set(&t, e, eq + 1)) {
+				if (eq)
+					*eq = '=';
+				fprintf(stderr, "Error: invalid --%s entry "
+					"'%s'\n", "tune", e);
+				free(buf);
+				return false;
+			}
+		}
+		free(buf);
+	}
+
+	tune = t;
+	return true;
+}
+
+/*
+ * Threads of a pool of CPU-bound workers when -j is not given: those of the
+ * tuning profile, or one per CPU.
+ */
+size_t tune_threads(void)
+{
+	long const ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (tune.threads)
+		return tune.threads;
+	return ncpu > 0 ? (size_t) ncpu : 1;
+}
+
+/*
+ * This function is the public interface of the 'calibrate' mode. Short
+ * benchmarks of the embedding and extracting kernels, of memory bandwidth,
+ * of sealing chunk sizes and of the file I/O in the directory
+ * |args->files[0]| (or the current one) choose the parameters of struct
+ * Tune, which are written to |args->outpath| or the tuning profile.
+ *
+ * Returns: true if the profile was written, false otherwise.
+ */
+bool calibrate(struct Args const * const args)
+{
+	char const *dir = args->nfiles ? args->files[0] : ".";
+	char path[PATH_MAX];
+	char notes[256];
+	long const cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t const ncpu = cpus > 0 ? (size_t) cpus : 1;
+	struct Tune t = tune;
+	bool ok = false;
+
+	if (args->outpath) {
+		if (strlen(args->outpath) >= sizeof(path)) {
+			fprintf(stderr, "Error: %s\n", strerror(ENAMETOOLONG));
+			return false;
+		}
+		strcpy(path, args->outpath);
+	} else if (!profile_path(path, sizeof(path))) {
+		fprintf(stderr, "Error: no tuning profile to write, $%s is "
+			"empty and no -%c given\n", TUNE_ENV, 'o');
+		return false;
+	}
+
+	struct Tune_worker *ws = calloc(ncpu, sizeof(*ws));
+	struct Tune_pool pool = { 0, 0, false };
+
+	if (!ws) {
+		perror("calloc");
+		return false;
+	}
+
+	for (size_t i = 0; i < ncpu; i++) {
+		unsigned char *px = malloc(TUNE_PIXELS_LEN);
+
+		ws[i].pool = &pool;
+		ws[i].payload = malloc(TUNE_PIXELS_LEN / 8);
+		ws[i].copy = malloc(TUNE_PIXELS_LEN);
+		if (px) {
+			init_view(&ws[i].view, px, 3, LAYOUT_V2);
+			ws[i].len = carriers(&ws[i].view) / 8;
+		}
+		if (!px || !ws[i].payload || !ws[i].copy) {
+			perror("malloc");
+			goto out;
+		}
+		if (!random_bytes(px, TUNE_PIXELS_LEN) ||
+		    !random_bytes(ws[i].payload, ws[i].len)) {
+			perror("getrandom");
+			goto out;
+		}
+	}
+
+	/* The widest kernels, unless narrower ones are clearly faster */
+	printf("kernels:");
+	double best = 0;
+	for (int s = TUNE_SIMD_AVX2; s >= TUNE_SIMD_NONE; s--) {
+		tune.simd = (enum Tune_simd) s;
+		double const secs = bench_kernels(&ws[0]);
+
+		printf(" %s %.1f ms", simd_names[s], secs * 1e3);
+		if (s == TUNE_SIMD_AVX2 || secs < best * 0.95) {
+			best = secs;
+			t.simd = tune.simd;
+		}
+	}
+	tune.simd = t.simd;
+	printf(", using %s\n", simd_names[t.simd]);
+
+	/* The fewest threads within 5% of the most throughput */
+	size_t const passes = 2 * ncpu > 8 ? 2 * ncpu : 8;
+	size_t const total = passes * TUNE_PIXELS_LEN;
+	size_t nbest = 1;
+	double tbest = 0;
+
+	printf("threads:");
+	for (size_t n = 1; n <= ncpu; n = n < ncpu && 2 * n > ncpu ? ncpu :
+	     2 * n) {
+		double const secs = bench_threads(ws, n, passes, false);
+
+		printf(" %zu %.0f MB/s", n, rate(total, secs));
+		if (n == 1 || secs < tbest) {
+			tbest = secs;
+			nbest = n;
+		}
+	}
+	for (size_t n = 1; n < nbest; n *= 2) {
+		if (bench_threads(ws, n, passes, false) <= tbest * 1.05) {
+			nbest = n;
+			break;
+		}
+	}
+	t.threads = nbest == ncpu ? 0 : (unsigned int) nbest;
+	printf(", using %zu\n", nbest);
+
+	double const copy1 = bench_threads(ws, 1, passes, true);
+	double const copyn = bench_threads(ws, nbest, passes, true);
+	snprintf(notes, sizeof(notes), "memory: %.0f MB/s on 1 thread, "
+		 "%.0f MB/s on %zu", rate(total, copy1), rate(total, copyn),
+		 nbest);
+	printf("%s\n", notes);
+
+	/* The default chunk, unless another is clearly faster */
+	double cbest = bench_chunk(&ws[0], SEAL_CHUNK);
+	printf("chunk:");
+	for (size_t c = 1024; c <= ws[0].len; c *= 2) {
+		double const secs = c == SEAL_CHUNK ? cbest :
+		    bench_chunk(&ws[0], c);
+
+		printf(" %zuK %.0f MB/s", c >> 10, rate(ws[0].len, secs));
+		if (secs < cbest * 0.97) {
+			cbest = secs;
+			t.chunk = c;
+		}
+	}
+	printf(", using %zuK\n", t.chunk >> 10);
+
+	if (!bench_io(dir, &t))
+		goto out;
+
+	if (!make_parents(path) || !write_profile(path, &t, notes)) {
+		fprintf(stderr, "Error: could not write %s: %s\n", path,
+			strerror(errno));
+		goto out;
+	}
+
+	printf("Wrote tuning profile %s\n", path);
+	ok = true;
+out:
+	for (size_t i = 0; i < ncpu; i++) {
+		free(ws[i].view.data);
+		free(ws[i].payload);
+		free(ws[i].copy);
+	}
+	free(ws);
+	return ok;
+}
+
+/*
+ * Stores the name of the tuning profile in the |len| bytes of |path|: that
+ * given by TUNE_ENV, or TUNE_PROFILE under $XDG_CACHE_HOME or ~/.cache.
+ *
+ * Returns: true if there is one, false if TUNE_ENV is empty or it would not
+ * fit.
+ */
+static bool profile_path(char *path, size_t const len)
+{
+	char const *env = getenv(TUNE_ENV);
+	char const *cache = getenv("XDG_CACHE_HOME");
+	char const *home = getenv("HOME");
+	int n;
+
+	if (env)
+		n = snprintf(path, len, "%s", env);
+	else if (cache && *cache == '/')
+		n = snprintf(path, len, "%s/%s", cache, TUNE_PROFILE);
+	else if (home && *home)
+		n = snprintf(path, len, "%s/.cache/%s", home, TUNE_PROFILE);
+	else
+		return false;
+
+	return n > 0 && (size_t) n < len;
+}
+
+/*
+ * Reads the tuning profile |path|, one <KEY> <VALUE> pair per line, into |t|.
+ * Lines starting with '#' are comments.
+ *
+ * Returns: true if it was read or does not exist, false if it is invalid.
+ */
+static bool read_profile(char const *path, struct Tune * const t)
+{
+	FILE *fp = fopen(path, "r");
+	size_t lineno = 0;
+	char *line = NULL;
+	size_t linecap = 0;
+	ssize_t len;
+	bool ok = true;
+
+	if (!fp) {
+		if (errno == ENOENT)
+			return true;
+		fprintf(stderr, "Warning: could not read tuning profile %s: "
+			"%s\n", path, strerror(errno));
+		return false;
+	}
+
+	while (ok && (len = getline(&line, &linecap, fp)) >= 0) {
+		char *save = NULL;
+
+		lineno++;
+		while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+			line[--len] = '\0';
+		if (len == 0 || line[0] == '#')
+			continue;
+
+		char const *key = strtok_r(line, " \t", &save);
+		char const *val = strtok_r(NULL, " \t", &save);
+
+		if (!key || !val || strtok_r(NULL, " \t", &save) ||
+		    !tune_set(t, key, val)) {
+			fprintf(stderr, "Warning: %s:%zu: invalid entry, "
+				"tuning profile left out\n", path, lineno);
+			ok = false;
+		}
+	}
+
+	free(line);
+	fclose(fp);
+	return ok;
+}
+
+/*
+ * Writes |t| as the tuning profile |path|, replacing it at once, with the
+ * comment |notes|.
+ *
+ * Returns: true if successful, false otherwise, with |errno| set.
+ */
+static bool write_profile(char const *path, struct Tune const * const t,
+			  char const *notes)
+{
+	struct Out_file out;
+	char buf[512];
+	int const n = snprintf(buf, sizeof(buf),
+			       "# Written by steg calibrate\n"
+			       "# %s\n"
+			       "threads %u\n"
+			       "chunk %zu\n"
+			       "direct %d\n"
+			       "direct_chunk %zu\n"
+			       "kernels %s\n",
+			       notes, t->threads, t->chunk, t->direct,
+			       t->direct_chunk, simd_names[t->simd]);
+
+	if (n < 0 || (size_t) n >= sizeof(buf)) {
+		errno = EOVERFLOW;
+		return false;
+	}
+
+	if (!out_open(&out, path))
+		return false;
+	if (!write_full(out.fd, buf, (size_t) n) ||
+	    !out_publish(&out, SYNC_NONE)) {
+		out_abort(&out);
+		return false;
+	}
+
+	close(out.fd);
+	return true;
+}
+
+/*
+ * Sets the parameter |key| of |t| to |val|: "threads" (0 for one per CPU),
+ * "chunk" and "direct_chunk" (bytes, with an optional K or M), "direct" (0 or
+ * 1) or "kernels" ("scalar", "sse2" or "avx2").
+ *
+ * Returns: true if both are valid, false otherwise.
+ */
+static bool tune_set(struct Tune * const t, char const *key,
+		     char const *val)
+{
+	size_t n;
+
+	if (strcmp(key, "threads") == 0) {
+		if (!parse_bytes(val, &n) || n > 1024 || strpbrk(val, "KM"))
+			return false;
+		t->threads = (unsigned int) n;
+	} else if (strcmp(key, "chunk") == 0) {
+		if (!parse_bytes(val, &n) || n == 0 || n > TUNE_MAX_CHUNK ||
+		    n % CHACHA_BLOCK_LEN)
+			return false;
+		t->chunk = n;
+	} else if (strcmp(key, "direct") == 0) {
+		if (strcmp(val, "0") != 0 && strcmp(val, "1") != 0)
+			return false;
+		t->direct = val[0] == '1';
+	} else if (strcmp(key, "direct_chunk") == 0) {
+		if (!parse_bytes(val, &n) || n == 0 || n > TUNE_MAX_DIRECT ||
+		    n % DIRECT_ALIGN)
+			return false;
+		t->direct_chunk = n;
+	} else if (strcmp(key, "kernels") == 0) {
+		size_t i = 0;
+
+		while (i < sizeof(simd_names) / sizeof(simd_names[0]) &&
+		       strcmp(val, simd_names[i]) != 0)
+			i++;
+		if (i == sizeof(simd_names) / sizeof(simd_names[0]))
+			return false;
+		t->simd = (enum Tune_simd) i;
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Parses a number of bytes, followed by K for KiB or M for MiB, into |n|.
+ *
+ * Returns: true if it is valid, false otherwise.
+ */
+static bool parse_bytes(char const *val, size_t *n)
+{
+	char *end;
+	unsigned long long v;
+
+	errno = 0;
+	v = strtoull(val, &end, 10);
+	if (*val < '0' || *val > '9' || errno)
+		return false;
+
+	unsigned int const shift = *end == 'K' ? 10 : *end == 'M' ? 20 : 0;
+	if (shift)
+		end++;
+	if (*end != '\0' || v > (SIZE_MAX >> shift))
+		return false;
+
+	*n = (size_t) v << shift;
+	return true;
+}
+
+/*
+ * Creates the directories leading to |path| which do not exist yet.
+ *
+ * Returns: true if successful, false otherwise, with |errno| set.
+ */
+static bool make_parents(char const *path)
+{
+	char dir[PATH_MAX];
+	size_t const len = strlen(path);
+
+	if (len >= sizeof(dir)) {
+		errno = ENAMETOOLONG;
+		return false;
+	}
+	memcpy(dir, path, len + 1);
+
+	for (char *p = strchr(dir + 1, '/'); p; p = strchr(p + 1, '/')) {
+		*p = '\0';
+		if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+			return false;
+		*p = '/';
+	}
+
+	return true;
+}
+
+/*
+ * Returns: the time of a monotonic clock, in seconds.
+ */
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+/*
+ * Sets up |v| as an image of TUNE_PIXELS_LEN bytes of pixels |px|, |pxlen|
+ * bytes each, rows without padding, hiding in |layout|.
+ */
+static void init_view(struct BMP_file * const v, unsigned char *px,
+		      unsigned int const pxlen, unsigned int const layout)
+{
+	memset(v, 0, sizeof(*v));
+	v->pxlen = pxlen;
+	v->bpp = 8 * pxlen;
+	v->width = 1024;
+	v->rowlen = v->width * pxlen;
+	v->height = TUNE_PIXELS_LEN / v->rowlen;
+	v->datalen = v->rowlen * v->height;
+	v->layout = layout;
+	v->flags = BMP_FLAG_ROWS;
+	v->data = (struct RGB *) px;
+}
+
+/*
+ * Times the kernels chosen for |tune.simd|: hiding and extracting the payload
+ * of |w| in the pixels of |w| with 1 and 8 bits per carrier byte, LSB matching
+ * included, in every byte and in those of one channel of 24 and 32-bit
+ * pixels, and ChaCha20 and the Reed-Solomon code over the payload.
+ *
+ * Returns: the fastest of TUNE_ROUNDS runs, in seconds.
+ */
+static double bench_kernels(struct Tune_worker * const w)
+{
+	static unsigned int const shapes[][2] = {
+		{ 3, LAYOUT_V2 }, { 3, LAYOUT_V1 }, { 4, LAYOUT_V1 }
+	};
+	unsigned char key[CHACHA_KEY_LEN] = { 0 };
+	unsigned char *px = (unsigned char *) w->view.data;
+	double best = 0;
+
+	for (unsigned int r = 0; r < TUNE_ROUNDS; r++) {
+		double const start = now();
+
+		for (size_t i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++) {
+			struct BMP_file v;
+
+			init_view(&v, px, shapes[i][0], shapes[i][1]);
+			size_t const n = carriers(&v) / 8 < w->len ?
+			    carriers(&v) / 8 : w->len;
+
+			carrier_put(&v, 1, 0, w->payload, n);
+			carrier_get(&v, 1, 0, w->copy, n);
+			v.match = key;
+			carrier_put(&v, 1, 0, w->payload, n);
+			v.match = NULL;
+			carrier_put(&v, 8, 0, w->payload, n);
+			carrier_get(&v, 8, 0, w->copy, n);
+		}
+		/* |len| is at most an eighth of |copy|, which holds the parity too */
+		size_t fixed;
+		fec_encode(w->copy, w->len, w->copy + w->len);
+		fec_decode(w->copy, w->len, w->copy + w->len, &fixed);
+		chacha20_stream(key, 0, w->copy, w->len);
+
+		double const secs = now() - start;
+		if (r == 0 || secs < best)
+			best = secs;
+	}
+
+	return best;
+}
+
+/*
+ * Times |passes| passes over the pixels of the workers of |ws| on |n|
+ * threads, the calling one included: hiding and extracting a payload, or a
+ * memcpy() of them if |copy| is set.
+ *
+ * Returns: the fastest of TUNE_ROUNDS runs, in seconds.
+ */
+static double bench_threads(struct Tune_worker *ws, size_t const n,
+			    size_t const passes, bool const copy)
+{
+	struct Tune_pool * const pool = ws[0].pool;
+	pthread_t *tids = malloc(n * sizeof(*tids));
+	double best = 0;
+
+	for (unsigned int r = 0; r < TUNE_ROUNDS; r++) {
+		size_t started = 0;
+
+		pool->passes = passes;
+		pool->next = 0;
+		pool->copy = copy;
+
+		double const start = now();
+		for (; tids && started + 1 < n; started++)
+			if (pthread_create(&tids[started], NULL, bench_worker,
+					   &ws[started + 1]))
+				break;
+		bench_worker(&ws[0]);
+		for (size_t i = 0; i < started; i++)
+			pthread_join(tids[i], NULL);
+
+		double const secs = now() - start;
+		if (r == 0 || secs < best)
+			best = secs;
+	}
+
+	free(tids);
+	return best;
+}
+
+/*
+ * Thread function of bench_threads(), which makes passes until there are
+ * none left.
+ */
+static void *bench_worker(void *arg)
+{
+	struct Tune_worker * const w = arg;
+	struct Tune_pool * const pool = w->pool;
+
+	while (__atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED) <
+	       pool->passes) {
+		if (pool->copy) {
+			memcpy(w->copy, w->view.data, TUNE_PIXELS_LEN);
+			continue;
+		}
+		carrier_put(&w->view, 1, 0, w->payload, w->len);
+		carrier_get(&w->view, 1, 0, w->copy, w->len);
+	}
+
+	return NULL;
+}
+
+/*
+ * Times sealing the payload of |w| and hiding it in the pixels of |w|,
+ * |chunk| bytes at a time, as put_payload() does.
+ *
+ * Returns: the fastest of TUNE_ROUNDS runs, in seconds.
+ */
+static double bench_chunk(struct Tune_worker * const w, size_t const chunk)
+{
+	unsigned char const key[CHACHA_KEY_LEN] = { 0 };
+	unsigned char const nonce[CHACHA_NONCE_LEN] = { 0 };
+	unsigned char tag[POLY1305_TAG_LEN];
+	struct Aead aead;
+	double best = 0;
+
+	for (unsigned int r = 0; r < TUNE_ROUNDS; r++) {
+		double const start = now();
+
+		aead_init(&aead, key, nonce);
+		for (size_t off = 0; off < w->len; off += chunk) {
+			size_t const c = w->len - off < chunk ?
+			    w->len - off : chunk;
+
+			memcpy(w->copy, w->payload + off, c);
+			aead_encrypt(&aead, w->copy, c);
+			carrier_put(&w->view, 1, 8 * off, w->copy, c);
+		}
+		aead_final(&aead, tag);
+
+		double const secs = now() - start;
+		if (r == 0 || secs < best)
+			best = secs;
+	}
+
+	return best;
+}
+
+/*
+ * Times writing and reading TUNE_IO_LEN bytes in |dir|, through the page cache
+ * (read from the disk, not from the cache) and with O_DIRECT in transfers of
+ * several sizes. O_DIRECT is chosen into |t| if it is clearly faster, and its
+ * best transfer size in any case.
+ *
+ * Returns: true if successful, false if the file could not be written.
+ */
+static bool bench_io(char const *dir, struct Tune * const t)
+{
+	static size_t const sizes[] = { 1U << 20, 4U << 20, 8U << 20, 16U << 20 };
+	unsigned char const key[CHACHA_KEY_LEN] = { 0 };
+	char path[PATH_MAX];
+	void *buf = NULL;
+	int dfd = -1;
+	bool ok = false;
+
+	if (snprintf(path, sizeof(path), "%s/.steg-calibrate-XXXXXX", dir) >=
+	    (int) sizeof(path)) {
+		fprintf(stderr, "Error: %s: %s\n", dir, strerror(ENAMETOOLONG));
+		return false;
+	}
+
+	int const fd = mkstemp(path);
+	if (fd < 0) {
+		fprintf(stderr, "Error: could not create a file in %s: %s\n",
+			dir, strerror(errno));
+		return false;
+	}
+	dfd = open(path, O_RDWR | O_DIRECT | O_CLOEXEC);
+	unlink(path);
+
+	if (posix_memalign(&buf, DIRECT_ALIGN, TUNE_IO_LEN) != 0) {
+		perror("posix_memalign");
+		goto out;
+	}
+	chacha20_stream(key, 0, buf, TUNE_IO_LEN);
+
+	/* The blocks are allocated first, so every run overwrites them */
+	if (!pwrite_full(fd, buf, TUNE_IO_LEN, 0) || fdatasync(fd) != 0) {
+		fprintf(stderr, "Error: could not write in %s: %s\n", dir,
+			strerror(errno));
+		goto out;
+	}
+
+	double start = now();
+	if (!pwrite_full(fd, buf, TUNE_IO_LEN, 0) || fdatasync(fd) != 0)
+		goto fail;
+	double const bw = now() - start;
+
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	start = now();
+	if (!pread_full(fd, buf, TUNE_IO_LEN, 0))
+		goto fail;
+	double const br = now() - start;
+
+	printf("I/O in %s: buffered %.0f MB/s write, %.0f MB/s read", dir,
+	       rate(TUNE_IO_LEN, bw), rate(TUNE_IO_LEN, br));
+
+	double best = 0;
+	for (size_t i = 0; dfd >= 0 && i < sizeof(sizes) / sizeof(sizes[0]);
+	     i++) {
+		double w, r;
+		size_t off;
+
+		start = now();
+		for (off = 0; off < TUNE_IO_LEN; off += sizes[i])
+			if (pwrite(dfd, (unsigned char *) buf + off, sizes[i],
+				   (off_t) off) != (ssize_t) sizes[i])
+				break;
+		if (off < TUNE_IO_LEN || fdatasync(dfd) != 0)
+			break;
+		w = now() - start;
+
+		start = now();
+		for (off = 0; off < TUNE_IO_LEN; off += sizes[i])
+			if (pread(dfd, (unsigned char *) buf + off, sizes[i],
+				  (off_t) off) != (ssize_t) sizes[i])
+				break;
+		if (off < TUNE_IO_LEN)
+			break;
+		r = now() - start;
+
+		printf("; O_DIRECT %zuM %.0f/%.0f MB/s", sizes[i] >> 20,
+		       rate(TUNE_IO_LEN, w), rate(TUNE_IO_LEN, r));
+		if (i == 0 || w + r < best) {
+			best = w + r;
+			t->direct_chunk = sizes[i];
+		}
+	}
+
+	/* O_DIRECT has to make up for the page cache, which can be shared */
+	t->direct = best > 0 && best < 0.9 * (bw + br);
+	if (best > 0)
+		printf(", using %s, %zuM transfers\n",
+		       t->direct ? "O_DIRECT" : "the page cache",
+		       t->direct_chunk >> 20);
+	else
+		printf(", O_DIRECT refused\n");
+
+	ok = true;
+	goto out;
+fail:
+	fprintf(stderr, "Error: I/O failed in %s: %s\n", dir, strerror(errno));
+out:
+	if (dfd >= 0)
+		close(dfd);
+	close(fd);
+	free(buf);
+	return ok;
+}
+
+/*
+ * Returns: |bytes| in |secs| seconds, in MB/s.
+ */
+static double rate(size_t const bytes, double const secs)
+{
+	return secs > 0 ? (double) bytes / secs / 1e6 : 0;
+}
@@ -0,0 +1,569 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../include/video.h"
+#include "../include/helper.h"
+#include "../include/stegan.h"
+
+/* Chroma subsampling of a YUV4MPEG2 colour space with 8-bit samples */
+struct Chroma {
+	char const   *name;   /* Value of the C parameter */
+	unsigned int hdiv;    /* Luma samples per chroma sample, across */
+	unsigned int vdiv;    /* And down */
+	unsigned int nchroma; /* Number of chroma planes */
+	unsigned int nalpha;  /* Number of alpha planes */
+};
+
+static struct Chroma const chromas[] = {
+	{ "420jpeg",  2, 2, 2, 0 },
+	{ "420paldv", 2, 2, 2, 0 },
+	{ "420mpeg2", 2, 2, 2, 0 },
+	{ "420",      2, 2, 2, 0 },
+	{ "422",      2, 1, 2, 0 },
+	{ "411",      4, 1, 2, 0 },
+	{ "444",      1, 1, 2, 0 },
+	{ "444alpha", 1, 1, 2, 1 },
+	{ "mono",     1, 1, 0, 0 },
+};
+
+static bool video_open(struct Video * const v, struct Args const * const args);
+static bool y4m_header(struct Video * const v);
+static int video_read(struct Video * const v);
+static bool video_write(struct Video const * const v, int const out);
+static bool video_pass(struct Video * const v, int const out);
+static bool embed(struct Video * const v, struct Args const * const args,
+		  int const out);
+static bool extract(struct Video * const v, struct Args const * const args,
+		    int const out);
+static ssize_t read_line(int const fd, char *buf, size_t const max);
+static int open_payload(struct Args const * const args);
+
+/*
+ * This function is the public interface of the 'video' mode. The payload is
+ * hidden in (-e), or recovered from (-d), the stream of frames read from
+ * |args->files[0]| ("-" for stdin) as it goes by, one frame at a time. Each
+ * frame carries a chunk of the payload after a VIDEO_CHUNK_HDR byte header
+ * holding the length of the chunk and VIDEO_CHUNK_LAST, so the payload may
+ * be a pipe of unknown length which is read as data comes in. The frames
+ * after the last chunk are passed on untouched. The output, the frames or the
+ * payload, goes to |args->outpath|, or stdout.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+bool video(struct Args const * const args)
+{
+	struct Video v = { .in = -1, .frame = NULL };
+	struct Out_file out = { .fd = STDOUT_FILENO };
+	bool ok = false;
+
+	if (!args->mflag) {
+		fprintf(stderr, "Error: option -%c is required\n", 'm');
+		return false;
+	}
+
+	/* The texture of a frame would have to be worked out for every one */
+	if (strncmp(args->mmet, "adaptive", 8) == 0) {
+		fprintf(stderr, "Error: -%c %s is not supported for video\n",
+			'm', "adaptive");
+		return false;
+	}
+
+	if (!video_open(&v, args))
+		goto done;
+
+	if (args->outpath && !out_open(&out, args->outpath)) {
+		fprintf(stderr, "Error: could not create %s: %s\n",
+			args->outpath, strerror(errno));
+		goto done;
+	}
+
+	ok = args->eflag ? embed(&v, args, out.fd) : extract(&v, args, out.fd);
+
+	if (args->outpath) {
+		if (ok && !out_publish(&out, args->sync)) {
+			fprintf(stderr, "Error: could not save %s: %s\n",
+				args->outpath, strerror(errno));
+			ok = false;
+		}
+		if (ok)
+			close(out.fd);
+		else
+			out_abort(&out);
+	}
+
+	if (ok)
+		fprintf(stderr, "%s %zu frames\n",
+			args->eflag ? "Hid the payload in" : "Found the payload in",
+			v.frames);
+done:
+	if (v.in > STDIN_FILENO)
+		close(v.in);
+	free(v.frame);
+	return ok;
+}
+
+/*
+ * Opens the stream |args->files[0]| into |v|, reading the header of a
+ * YUV4MPEG2 stream or taking the frame size of raw BGR24 from -s, and sets up
+ * the carrier bytes of its frames.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+static bool video_open(struct Video * const v, struct Args const * const args)
+{
+	char const *name = args->files[0];
+
+	if (strcmp(name, "-") == 0) {
+		v->in = STDIN_FILENO;
+	} else if ((v->in = open(name, O_RDONLY | O_CLOEXEC)) < 0) {
+		fprintf(stderr, "Error: could not open %s: %s\n", name,
+			strerror(errno));
+		return false;
+	}
+
+	v->y4m = args->width == 0;
+	v->linelen = 0;
+
+	if (v->y4m) {
+		if (!y4m_header(v))
+			return false;
+	} else {
+		v->width = args->width;
+		v->height = args->height;
+		v->framelen = v->width * v->height * 3;
+	}
+
+	if (!(v->frame = malloc(v->framelen))) {
+		perror("malloc");
+		return false;
+	}
+
+	/*
+	 * Rows of these frames have no padding, so the carrier bytes are the
+	 * whole frame (BGR24), or the luma plane at its start (YUV4MPEG2).
+	 */
+	struct BMP_file *b = &v->view;
+
+	memset(b, 0, sizeof(*b));
+	b->pxlen = v->y4m ? 1 : 3;
+	b->bpp = b->pxlen * 8;
+	b->width = v->width;
+	b->height = v->height;
+	b->rowlen = v->width * b->pxlen;
+	b->datalen = b->rowlen * v->height;
+	b->layout = v->y4m ? LAYOUT_V2 : args->layout;
+	b->flags = BMP_FLAG_ROWS;
+	b->data = (struct RGB *) v->frame;
+
+	return true;
+}
+
+/*
+ * Reads and checks the header of the YUV4MPEG2 stream of |v|, which is kept
+ * in |v->line| to be passed on. Only the size and the colour space matter.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+static bool y4m_header(struct Video * const v)
+{
+	ssize_t const n = read_line(v->in, v->line, sizeof(v->line));
+
+	if (n < (ssize_t) sizeof(Y4M_MAGIC) - 1 ||
+	    memcmp(v->line, Y4M_MAGIC, sizeof(Y4M_MAGIC) - 1) != 0) {
+		fprintf(stderr, "Error: not a YUV4MPEG2 stream; give the frame "
+			"size of raw BGR24 with -%c\n", 's');
+		return false;
+	}
+	v->linelen = (size_t) n;
+
+	char params[Y4M_LINE_MAX];
+	struct Chroma const *c = &chromas[0]; /* The default is 420jpeg */
+	unsigned long w = 0, h = 0;
+
+	memcpy(params, v->line + sizeof(Y4M_MAGIC) - 1,
+	       v->linelen - sizeof(Y4M_MAGIC));
+	params[v->linelen - sizeof(Y4M_MAGIC)] = '\0';
+
+	for (char *save, *t = strtok_r(params, " ", &save); t;
+	     t = strtok_r(NULL, " ", &save)) {
+		if (t[0] == 'W') {
+			w = strtoul(t + 1, NULL, 10);
+		} else if (t[0] == 'H') {
+			h = strtoul(t + 1, NULL, 10);
+		} else if (t[0] == 'C') {
+			size_t i = 0;
+
+			while (i < sizeof(chromas) / sizeof(*chromas) &&
+			       strcmp(t + 1, chromas[i].name) != 0)
+				i++;
+			if (i == sizeof(chromas) / sizeof(*chromas)) {
+				fprintf(stderr, "Error: unsupported colour "
+					"space '%s'\n", t + 1);
+				return false;
+			}
+			c = &chromas[i];
+		}
+	}
+
+	if (w == 0 || h == 0 || w > VIDEO_MAX_DIM || h > VIDEO_MAX_DIM) {
+		fprintf(stderr, "Error: invalid frame size %lux%lu\n", w, h);
+		return false;
+	}
+
+	v->width = w;
+	v->height = h;
+
+	size_t const cw = (w + c->hdiv - 1) / c->hdiv;
+	size_t const ch = (h + c->vdiv - 1) / c->vdiv;
+	v->framelen = w * h * (1 + c->nalpha) + cw * ch * c->nchroma;
+
+	return true;
+}
+
+/*
+ * Reads the next frame of |v|, with its header line for YUV4MPEG2.
+ *
+ * Returns: 1 if a frame was read, 0 at the end of the stream, -1 on error.
+ */
+static int video_read(struct Video * const v)
+{
+	if (v->y4m) {
+		ssize_t const n = read_line(v->in, v->line, sizeof(v->line));
+
+		if (n == 0)
+			return 0;
+		if (n < (ssize_t) sizeof(Y4M_FRAME) ||
+		    memcmp(v->line, Y4M_FRAME, sizeof(Y4M_FRAME) - 1) != 0 ||
+		    (v->line[sizeof(Y4M_FRAME) - 1] != ' ' &&
+		     v->line[sizeof(Y4M_FRAME) - 1] != '\n')) {
+			fprintf(stderr, "Error: bad header of frame %zu\n",
+				v->frames + 1);
+			return -1;
+		}
+		v->linelen = (size_t) n;
+	}
+
+	ssize_t const n = read_full(v->in, v->frame, v->framelen);
+	if (n < 0) {
+		perror("read");
+		return -1;
+	}
+
+	if (n == 0 && !v->y4m)
+		return 0;
+
+	if ((size_t) n != v->framelen) {
+		fprintf(stderr, "Error: frame %zu is cut short\n",
+			v->frames + 1);
+		return -1;
+	}
+
+	v->frames++;
+	return 1;
+}
+
+/*
+ * Writes the current frame of |v|, with its header line, to |out|.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+static bool video_write(struct Video const * const v, int const out)
+{
+	if (!write_full(out, v->line, v->linelen) ||
+	    !write_full(out, v->frame, v->framelen)) {
+		perror("write");
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Copies the rest of the stream of |v| to |out| as it is, within the kernel
+ * if one of them is a pipe.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+static bool video_pass(struct Video * const v, int const out)
+{
+	ssize_t n;
+
+	while ((n = splice(v->in, NULL, out, NULL, VIDEO_SPLICE_LEN,
+			   SPLICE_F_MOVE | SPLICE_F_MORE)) != 0) {
+		if (n < 0 && errno == EINVAL)
+			break;
+		if (n < 0 && errno != EINTR) {
+			perror("splice");
+			return false;
+		}
+	}
+
+	/* Neither end is a pipe */
+	while (n != 0) {
+		n = read_full(v->in, v->frame, v->framelen);
+		if (n < 0) {
+			perror("read");
+			return false;
+		}
+		if (!write_full(out, v->frame, (size_t) n)) {
+			perror("write");
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Hides the payload given with -e in the frames of |v| and writes them to
+ * |out|, one chunk of the payload per frame. The payload is read as it comes
+ * in: a frame gets whatever a pipe holds at the time, which may be nothing.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+static bool embed(struct Video * const v, struct Args const * const args,
+		  int const out)
+{
+	bool const hidefile = (args->tflag &&
+			       strncmp(args->ttyp, "file", 4) == 0);
+	unsigned int const bits = method_bits(args);
+	size_t const unit = 8 / bits;
+	size_t const cap = carriers(&v->view) / unit;
+	bool const matching = strncmp(args->mmet, "match", 5) == 0;
+	unsigned char mkey[CHACHA_KEY_LEN];
+
+	if (cap <= VIDEO_CHUNK_HDR) {
+		fprintf(stderr, "Error: frames are too small to carry data\n");
+		return false;
+	}
+
+	size_t room = cap - VIDEO_CHUNK_HDR;
+	if (room > ~VIDEO_CHUNK_LAST)
+		room = ~VIDEO_CHUNK_LAST;
+
+	int const pfd = hidefile ? open_payload(args) : -1;
+	if (hidefile && pfd < 0)
+		return false;
+
+	unsigned char *buf = malloc(room);
+	char const *msg = args->eval;
+	size_t left = args->evallen;
+	bool ok = buf && write_full(out, v->line, v->linelen);
+
+	for (bool last = false; ok && !last;) {
+		int const r = video_read(v);
+		if (r <= 0) {
+			if (r == 0)
+				fprintf(stderr, "Error: video ends before the "
+					"payload does, after %zu frames\n",
+					v->frames);
+			ok = false;
+			break;
+		}
+
+		size_t n;
+		if (hidefile) {
+			ssize_t const got = read(pfd, buf, room);
+
+			if (got < 0 && errno != EAGAIN && errno != EINTR) {
+				perror("read");
+				ok = false;
+				break;
+			}
+			n = got > 0 ? (size_t) got : 0;
+			last = got == 0;
+		} else {
+			n = left < room ? left : room;
+			memcpy(buf, msg, n);
+			msg += n;
+			left -= n;
+			last = left == 0;
+		}
+
+		uint32_t const h = (uint32_t) n | (last ? VIDEO_CHUNK_LAST : 0);
+		unsigned char const hdr[VIDEO_CHUNK_HDR] = {
+			(unsigned char) h, (unsigned char) (h >> 8),
+			(unsigned char) (h >> 16), (unsigned char) (h >> 24)
+		};
+
+		/* Every frame draws the directions of LSB matching anew */
+		if (matching && !random_bytes(mkey, sizeof(mkey))) {
+			perror("getrandom");
+			ok = false;
+			break;
+		}
+		v->view.match = matching ? mkey : NULL;
+
+		carrier_put(&v->view, bits, 0, hdr, sizeof(hdr));
+		carrier_put(&v->view, bits, unit * sizeof(hdr), buf, n);
+		ok = video_write(v, out);
+	}
+
+	v->view.match = NULL;
+	memset(mkey, 0, sizeof(mkey));
+
+	if (!buf)
+		perror("malloc");
+	if (pfd >= 0)
+		close(pfd);
+	free(buf);
+
+	return ok && video_pass(v, out);
+}
+
+/*
+ * Recovers the payload hidden by embed() in the frames of |v| and writes it
+ * to |out| chunk by chunk. Reading stops after the last chunk. A message
+ * which goes to stdout is printed as reveal() prints it: between "Message:"
+ * and "End of message" lines, without what is neither printable nor white
+ * space.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+static bool extract(struct Video * const v, struct Args const * const args,
+		    int const out)
+{
+	bool const msg = !args->outpath && !(args->tflag &&
+			 strncmp(args->ttyp, "file", 4) == 0);
+	unsigned int const bits = method_bits(args);
+	size_t const unit = 8 / bits;
+	size_t const cap = carriers(&v->view) / unit;
+
+	if (cap <= VIDEO_CHUNK_HDR) {
+		fprintf(stderr, "Error: frames are too small to carry data\n");
+		return false;
+	}
+
+	unsigned char *buf = malloc(cap - VIDEO_CHUNK_HDR);
+	if (!buf) {
+		perror("malloc");
+		return false;
+	}
+
+	static char const head[] = "Message:\n";
+	static char const tail[] = "\nEnd of message\n";
+	bool ok = !msg || write_full(out, head, sizeof(head) - 1);
+
+	if (!ok)
+		perror("write");
+
+	for (bool last = false; ok && !last;) {
+		int const r = video_read(v);
+		if (r <= 0) {
+			if (r == 0)
+				fprintf(stderr, "Error: video ends before the "
+					"payload does, after %zu frames\n",
+					v->frames);
+			ok = false;
+			break;
+		}
+
+		unsigned char hdr[VIDEO_CHUNK_HDR];
+		carrier_get(&v->view, bits, 0, hdr, sizeof(hdr));
+
+		uint32_t const h = (uint32_t) hdr[0] |
+		    (uint32_t) hdr[1] << 8 | (uint32_t) hdr[2] << 16 |
+		    (uint32_t) hdr[3] << 24;
+		size_t const n = h & ~VIDEO_CHUNK_LAST;
+
+		if (n > cap - VIDEO_CHUNK_HDR) {
+			fprintf(stderr, "Error: no payload found in frame %zu, "
+				"or it is corrupt\n", v->frames);
+			ok = false;
+			break;
+		}
+
+		carrier_get(&v->view, bits, unit * sizeof(hdr), buf, n);
+
+		size_t keep = n;
+		if (msg) {
+			keep = 0;
+			for (size_t i = 0; i < n; i++)
+				if (isprint(buf[i]) || isspace(buf[i]))
+					buf[keep++] = buf[i];
+		}
+
+		if (!write_full(out, buf, keep)) {
+			perror("write");
+			ok = false;
+		}
+		last = h & VIDEO_CHUNK_LAST;
+	}
+
+	if (ok && msg && !write_full(out, tail, sizeof(tail) - 1)) {
+		perror("write");
+		ok = false;
+	}
+
+	free(buf);
+	return ok;
+}
+
+/*
+ * Reads a line, up to and including its newline, from |fd| into |buf|, one
+ * byte at a time so that nothing after it is consumed. The line must fit in
+ * |max| bytes.
+ *
+ * Returns: the length of the line, 0 at the end of the stream, or -1 on error
+ * (including a line which does not end).
+ */
+static ssize_t read_line(int const fd, char *buf, size_t const max)
+{
+	size_t n = 0;
+
+	while (n == 0 || buf[n - 1] != '\n') {
+		if (n == max)
+			return -1;
+
+		ssize_t const got = read(fd, buf + n, 1);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got < 0)
+			return -1;
+		if (got == 0)
+			return n == 0 ? 0 : -1;
+		n++;
+	}
+
+	return (ssize_t) n;
+}
+
+/*
+ * Opens the payload file given with -e. Reads from a pipe do not wait for
+ * data, so that the frames keep going by while it has none.
+ *
+ * Returns: the descriptor, or -1 on error.
+ */
+static int open_payload(struct Args const * const args)
+{
+	int const fd = open(args->eval, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		fprintf(stderr, "Error: could not open %s: %s\n", args->eval,
+			strerror(errno));
+		return -1;
+	}
+
+	int const fl = fcntl(fd, F_GETFL);
+	if (fl < 0 || fcntl(fd, F_SETFL, fl | O_NONBLOCK) != 0) {
+		perror("fcntl");
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
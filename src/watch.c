@@ -0,0 +1,661 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../include/watch.h"
+#include "../include/helper.h"
+
+/* A cover of the cover directory */
+struct Watch_cover {
+	char   *path;
+	size_t cap;  /* Capacity for the method, type and options in use */
+};
+
+/* A payload waiting to be hidden */
+struct Watch_item {
+	struct Watch_item *next;
+	char              name[]; /* File name in the spool directory */
+};
+
+/* State shared between the watching thread and the workers of watch() */
+struct Watch_pool {
+	struct Args const  *args;
+	char const         *outdir;
+	int                spoolfd;
+	struct Watch_cover *covers;  /* By increasing capacity */
+	size_t             ncovers;
+	struct Cover_cache cache;
+	pthread_mutex_t    lock;     /* Protects the queue and |done| */
+	pthread_cond_t     ready;    /* Signalled when either changes */
+	struct Watch_item  *head;    /* Queue of payloads, oldest first */
+	struct Watch_item  *tail;
+	bool               done;     /* Set when the workers are to stop */
+	size_t             nhidden;
+	size_t             nfailed;
+};
+
+/* Set by a signal which asks the watch to end */
+static volatile sig_atomic_t stop;
+
+static void on_signal(int const sig);
+static bool load_covers(struct Watch_pool * const pool, char const *dir);
+static int cmp_cap(void const *a, void const *b);
+static bool wanted(char const *name);
+static bool enqueue(struct Watch_pool * const pool, char const *name);
+static bool scan_spool(struct Watch_pool * const pool, char const *spool);
+static bool read_events(struct Watch_pool * const pool, int const ifd,
+			char const *spool);
+static void *watch_worker(void *arg);
+static void watch_one(struct Watch_pool * const pool, char const *name);
+static bool hide_one(struct Watch_pool * const pool, char const *name,
+		     int const fd, char *out, size_t const outlen,
+		     char const **cover, char *err, size_t const errlen);
+static bool write_out(struct BMP_file const * const bmp, char const *path,
+		      enum Sync const sync);
+
+/*
+ * This function is the public interface of the 'watch' mode. Payload files
+ * which land in the spool directory |args->files[0]|, or are already there,
+ * are each hidden in the smallest cover of the directory |args->files[1]|
+ * which holds them, with the method, layout and options given in |args|, on
+ * a pool of worker threads sharing a cache of covers. The stego image is
+ * published atomically in the directory |args->files[2]| and the payload is
+ * removed; one line is printed for each. Runs until interrupted.
+ *
+ * Returns: true if the watch ended cleanly, false otherwise.
+ */
+bool watch(struct Args const * const args)
+{
+	char const *spool = args->files[0];
+	struct Args jargs = *args;
+	struct Watch_pool pool = {
+		.args = &jargs,
+		.outdir = args->files[2],
+		.spoolfd = -1,
+		.covers = NULL,
+		.ncovers = 0,
+		.head = NULL,
+		.tail = NULL,
+		.done = false
+	};
+	struct stat sst, ost;
+	pthread_t *tids = NULL;
+	size_t started = 0;
+	int ifd = -1;
+	bool ok = false;
+
+	if (!args->mflag) {
+		fprintf(stderr, "Error: option -%c is required\n", 'm');
+		return false;
+	}
+
+	/* Every payload is a file */
+	jargs.tflag = true;
+	jargs.ttyp = "file";
+
+	/* A key which cannot be read is reported now, not for every payload */
+	unsigned char key[CHACHA_KEY_LEN];
+	bool const keyok = !args->kflag || read_key(args->keyfile, key);
+	memset(key, 0, sizeof(key));
+	if (!keyok)
+		return false;
+
+	pool.spoolfd = open(spool, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (pool.spoolfd < 0 || fstat(pool.spoolfd, &sst) != 0) {
+		fprintf(stderr, "Error: could not open %s: %s\n", spool,
+			strerror(errno));
+		goto out_fd;
+	}
+
+	if (stat(pool.outdir, &ost) != 0 || !S_ISDIR(ost.st_mode)) {
+		fprintf(stderr, "Error: %s is not a directory\n", pool.outdir);
+		goto out_fd;
+	}
+
+	/* The stego images would be taken for payloads */
+	if (sst.st_dev == ost.st_dev && sst.st_ino == ost.st_ino) {
+		fprintf(stderr, "Error: the output directory must not be the "
+			"spool directory\n");
+		goto out_fd;
+	}
+
+	if (!load_covers(&pool, args->files[1]))
+		goto out_fd;
+
+	/* The watch is set up before the spool is listed, so nothing is lost */
+	ifd = inotify_init1(IN_CLOEXEC);
+	if (ifd < 0 || inotify_add_watch(ifd, spool, WATCH_EVENTS |
+					 IN_ONLYDIR) < 0) {
+		fprintf(stderr, "Error: could not watch %s: %s\n", spool,
+			strerror(errno));
+		goto out_fd;
+	}
+
+	size_t const nthreads = args->nthreads ? args->nthreads :
+	    tune_threads();
+
+	/*
+	 * The workers already keep every thread busy, see texture_order() and
+	 * the compression of PNG images
+	 */
+	jargs.nthreads = 1;
+
+	if (!(tids = malloc(nthreads * sizeof(*tids)))) {
+		perror("malloc");
+		goto out_fd;
+	}
+
+	size_t const mb = args->cachemb ? args->cachemb : BATCH_CACHE_MB;
+	cache_init(&pool.cache, mb << 20);
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.ready, NULL);
+
+	/* Progress messages of the jobs would interleave */
+	quiet = true;
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	/* Only this thread takes the signals, so that its read() returns */
+	sigset_t sigs, old;
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &sigs, &old);
+
+	for (; started < nthreads; started++) {
+		if (pthread_create(&tids[started], NULL, watch_worker,
+				   &pool) != 0) {
+			perror("pthread_create");
+			break;
+		}
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (started == 0)
+		goto out;
+
+	/* Without SA_RESTART, so that a blocked read() returns */
+	struct sigaction sa = { .sa_handler = on_signal };
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	printf("Watching %s with %zu covers\n", spool, pool.ncovers);
+	ok = scan_spool(&pool, spool) && read_events(&pool, ifd, spool);
+
+out:
+	pthread_mutex_lock(&pool.lock);
+	pool.done = true;
+	pthread_cond_broadcast(&pool.ready);
+	pthread_mutex_unlock(&pool.lock);
+
+	for (size_t i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+
+	/* Payloads left in the queue are still in the spool for next time */
+	while (pool.head) {
+		struct Watch_item * const it = pool.head;
+
+		pool.head = it->next;
+		free(it);
+	}
+
+	fprintf(stderr, "Hid %zu payloads, %zu failed\n", pool.nhidden,
+		pool.nfailed);
+	fprintf(stderr, "Cover cache: %zu hits, %zu misses, %zu evictions\n",
+		pool.cache.hits, pool.cache.misses, pool.cache.evictions);
+
+	pthread_cond_destroy(&pool.ready);
+	pthread_mutex_destroy(&pool.lock);
+	cache_destroy(&pool.cache);
+	free(tids);
+out_fd:
+	for (size_t i = 0; i < pool.ncovers; i++)
+		free(pool.covers[i].path);
+	free(pool.covers);
+	if (ifd >= 0)
+		close(ifd);
+	if (pool.spoolfd >= 0)
+		close(pool.spoolfd);
+	return ok;
+}
+
+/*
+ * Asks the watch to end.
+ */
+static void on_signal(int const sig)
+{
+	(void) sig;
+	stop = 1;
+}
+
+/*
+ * Measures every cover in the directory |dir| from its headers and keeps the
+ * ones which can be used in |pool|, by increasing capacity.
+ *
+ * Returns: true if there is at least one cover, false otherwise.
+ */
+static bool load_covers(struct Watch_pool * const pool, char const *dir)
+{
+	DIR *d = opendir(dir);
+	struct dirent *de;
+	size_t cap = 0;
+	bool ok = true;
+
+	if (!d) {
+		fprintf(stderr, "Error: could not open %s: %s\n", dir,
+			strerror(errno));
+		return false;
+	}
+
+	while (ok && (de = readdir(d))) {
+		char path[PATH_MAX];
+		size_t room;
+
+		if (de->d_name[0] == '.')
+			continue;
+
+		int const n = snprintf(path, sizeof(path), "%s/%s", dir,
+				       de->d_name);
+		if (n < 0 || (size_t) n >= sizeof(path) ||
+		    !cover_capacity(pool->args, path, &room))
+			continue;
+
+		if (pool->ncovers == cap) {
+			size_t const ncap = cap ? cap * 2 : 64;
+			struct Watch_cover *covers = realloc(pool->covers,
+				ncap * sizeof(*covers));
+			if (!covers) {
+				perror("realloc");
+				ok = false;
+				break;
+			}
+			pool->covers = covers;
+			cap = ncap;
+		}
+
+		if (!(pool->covers[pool->ncovers].path = strdup(path))) {
+			perror("strdup");
+			ok = false;
+			break;
+		}
+		pool->covers[pool->ncovers++].cap = room;
+	}
+
+	closedir(d);
+
+	if (ok && pool->ncovers == 0) {
+		fprintf(stderr, "Error: no usable cover in %s\n", dir);
+		ok = false;
+	}
+
+	if (ok)
+		qsort(pool->covers, pool->ncovers, sizeof(*pool->covers),
+		      cmp_cap);
+	return ok;
+}
+
+/*
+ * Orders covers by increasing capacity, for qsort().
+ */
+static int cmp_cap(void const *a, void const *b)
+{
+	size_t const x = ((struct Watch_cover const *) a)->cap;
+	size_t const y = ((struct Watch_cover const *) b)->cap;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Tells whether the file |name| of the spool is a payload to hide: hidden
+ * files (including the payloads being worked on) and the payloads which
+ * failed are left alone.
+ */
+static bool wanted(char const *name)
+{
+	size_t const len = strlen(name);
+	size_t const flen = sizeof(WATCH_FAILED) - 1;
+
+	return name[0] != '.' &&
+	    !(len > flen && strcmp(name + len - flen, WATCH_FAILED) == 0);
+}
+
+/*
+ * Queues the payload |name| and wakes up a worker.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+static bool enqueue(struct Watch_pool * const pool, char const *name)
+{
+	size_t const len = strlen(name);
+	struct Watch_item *it = malloc(sizeof(*it) + len + 1);
+
+	if (!it) {
+		perror("malloc");
+		return false;
+	}
+
+	it->next = NULL;
+	memcpy(it->name, name, len + 1);
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->tail)
+		pool->tail->next = it;
+	else
+		pool->head = it;
+	pool->tail = it;
+	pthread_cond_signal(&pool->ready);
+	pthread_mutex_unlock(&pool->lock);
+	return true;
+}
+
+/*
+ * Queues every payload in the directory |spool|: those there before the watch
+ * began, or whose events were lost.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+static bool scan_spool(struct Watch_pool * const pool, char const *spool)
+{
+	DIR *d = opendir(spool);
+	struct dirent *de;
+	bool ok = true;
+
+	if (!d) {
+		fprintf(stderr, "Error: could not open %s: %s\n", spool,
+			strerror(errno));
+		return false;
+	}
+
+	while (ok && (de = readdir(d))) {
+		if ((de->d_type == DT_REG || de->d_type == DT_UNKNOWN) &&
+		    wanted(de->d_name))
+			ok = enqueue(pool, de->d_name);
+	}
+
+	closedir(d);
+	return ok;
+}
+
+/*
+ * Queues the payloads of the events of the inotify instance |ifd|, which
+ * watches |spool|, until a signal asks to stop.
+ *
+ * Returns: true if stopped by a signal, false on error.
+ */
+static bool read_events(struct Watch_pool * const pool, int const ifd,
+			char const *spool)
+{
+	/* Events are aligned like the struct, which has an int first */
+	static _Alignas(struct inotify_event) char buf[WATCH_BUF_LEN];
+
+	while (!stop) {
+		ssize_t const n = read(ifd, buf, sizeof(buf));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			perror("read");
+			return false;
+		}
+
+		for (char *p = buf; p < buf + n;) {
+			struct inotify_event const *ev = (void *) p;
+
+			p += sizeof(*ev) + ev->len;
+
+			/* The kernel dropped events, so look at all files */
+			if (ev->mask & IN_Q_OVERFLOW) {
+				if (!scan_spool(pool, spool))
+					return false;
+				continue;
+			}
+
+			if (ev->mask & IN_IGNORED) {
+				fprintf(stderr, "Error: %s went away\n", spool);
+				return false;
+			}
+
+			if (ev->len && !(ev->mask & IN_ISDIR) &&
+			    wanted(ev->name) && !enqueue(pool, ev->name))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Worker thread of watch(). Hides the queued payloads one after the other
+ * until the watch ends.
+ */
+static void *watch_worker(void *arg)
+{
+	struct Watch_pool * const pool = arg;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		while (!pool->head && !pool->done)
+			pthread_cond_wait(&pool->ready, &pool->lock);
+
+		if (pool->done) {
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+
+		struct Watch_item * const it = pool->head;
+		pool->head = it->next;
+		if (!pool->head)
+			pool->tail = NULL;
+		pthread_mutex_unlock(&pool->lock);
+
+		watch_one(pool, it->name);
+		free(it);
+	}
+
+	return NULL;
+}
+
+/*
+ * Hides the payload |name| of the spool. It is first renamed with the prefix
+ * WATCH_CLAIM, so that only one worker takes it and no new event comes up;
+ * afterwards it is removed, or renamed with the suffix WATCH_FAILED if it
+ * could not be hidden.
+ */
+static void watch_one(struct Watch_pool * const pool, char const *name)
+{
+	char claim[NAME_MAX + 1];
+	char failed[NAME_MAX + 1];
+	char out[PATH_MAX];
+	char err[PATH_MAX + 128];
+	char const *cover = NULL;
+
+	if ((size_t) snprintf(claim, sizeof(claim), "%s%s", WATCH_CLAIM,
+			      name) >= sizeof(claim) ||
+	    (size_t) snprintf(failed, sizeof(failed), "%s%s", name,
+			      WATCH_FAILED) >= sizeof(failed)) {
+		fprintf(stderr, "Error: %s: file name too long\n", name);
+		__atomic_add_fetch(&pool->nfailed, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	/* A payload queued twice, or gone, has nothing left to do */
+	if (renameat(pool->spoolfd, name, pool->spoolfd, claim) != 0) {
+		if (errno != ENOENT) {
+			fprintf(stderr, "Error: could not take %s: %s\n", name,
+				strerror(errno));
+			__atomic_add_fetch(&pool->nfailed, 1, __ATOMIC_RELAXED);
+		}
+		return;
+	}
+
+	int const fd = openat(pool->spoolfd, claim, O_RDONLY | O_CLOEXEC);
+	bool ok = false;
+
+	if (fd < 0)
+		snprintf(err, sizeof(err), "%s", strerror(errno));
+	else
+		ok = hide_one(pool, name, fd, out, sizeof(out), &cover, err,
+			      sizeof(err));
+	if (fd >= 0)
+		close(fd);
+
+	if (ok && unlinkat(pool->spoolfd, claim, 0) == 0) {
+		/* A single call keeps lines of different threads apart */
+		printf("%s\t%s\t%s\n", name, cover, out);
+		__atomic_add_fetch(&pool->nhidden, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	if (ok)
+		snprintf(err, sizeof(err), "hidden in %s, but could not be "
+			 "removed: %s", out, strerror(errno));
+
+	fprintf(stderr, "Error: %s: %s\n", name, err);
+	renameat(pool->spoolfd, claim, pool->spoolfd, failed);
+	__atomic_add_fetch(&pool->nfailed, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Hides the payload |name|, open as |fd|, in the smallest cover which holds
+ * it and publishes the stego image in the output directory. The name of the
+ * image is stored in |out| and that of the cover in |cover|; on failure the
+ * reason is stored in |err|.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+static bool hide_one(struct Watch_pool * const pool, char const *name,
+		     int const fd, char *out, size_t const outlen,
+		     char const **cover, char *err, size_t const errlen)
+{
+	struct Args const * const args = pool->args;
+	struct stat st;
+
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+		snprintf(err, errlen, "not a regular file");
+		return false;
+	}
+
+	size_t const len = (size_t) st.st_size;
+
+	/* The smallest cover which holds the payload */
+	size_t lo = 0, hi = pool->ncovers;
+	while (lo < hi) {
+		size_t const mid = lo + (hi - lo) / 2;
+
+		if (pool->covers[mid].cap < len)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == pool->ncovers) {
+		snprintf(err, errlen, "no cover holds %zu bytes", len);
+		return false;
+	}
+	*cover = pool->covers[lo].path;
+
+	/* The image is in the format of the cover, so it gets its suffix */
+	char const *ext = strrchr(*cover, '.');
+	if (!ext || strchr(ext, '/'))
+		ext = ".bmp";
+
+	if ((size_t) snprintf(out, outlen, "%s/%s%s", pool->outdir, name,
+			      ext) >= outlen) {
+		snprintf(err, errlen, "output file name too long");
+		return false;
+	}
+
+	/* Checked here, so that the error names the payload and the key file */
+	unsigned char key[CHACHA_KEY_LEN];
+	bool const keyok = !args->kflag || read_key(args->keyfile, key);
+	memset(key, 0, sizeof(key));
+	if (!keyok) {
+		snprintf(err, errlen, "could not read key file %s",
+			 args->keyfile);
+		return false;
+	}
+
+	unsigned char *payload = malloc(len ? len : 1);
+	ssize_t const got = payload ? read_full(fd, payload, len) : -1;
+	if (got != (ssize_t) len) {
+		snprintf(err, errlen, "could not read payload: %s",
+			 got < 0 ? strerror(errno) : "file shrank");
+		free(payload);
+		return false;
+	}
+
+	struct Cover *cv = cache_get(&pool->cache, *cover);
+	struct BMP_file bmp;
+	bool ok = false;
+
+	if (!cv) {
+		snprintf(err, errlen, "could not load cover %s", *cover);
+		free(payload);
+		return false;
+	}
+
+	/* And which cover shrank since it was measured */
+	if (capacity(&cv->bmp, args) < len) {
+		snprintf(err, errlen, "cover %s no longer holds %zu bytes",
+			 *cover, len);
+	} else if (!cover_map(cv, &bmp)) {
+		snprintf(err, errlen, "could not map cover %s", *cover);
+	} else {
+		if (!hide_data(&bmp, args, payload, len)) {
+			snprintf(err, errlen, "could not hide payload in %s",
+				 *cover);
+		} else {
+			bmp.level = args->level;
+			bmp.nthreads = args->nthreads;
+			ok = write_out(&bmp, out, args->sync);
+			if (!ok)
+				snprintf(err, errlen, "could not write %s: %s",
+					 out, strerror(errno));
+		}
+		cover_unmap(cv, &bmp);
+	}
+
+	cache_release(&pool->cache, cv);
+	free(payload);
+	return ok;
+}
+
+/*
+ * Writes the stego image |bmp|, a view of a cached cover, to |path|, which
+ * only appears once it is complete and as durable as |sync| asks.
+ *
+ * Returns: true if successful, false otherwise, with |errno| set.
+ */
+static bool write_out(struct BMP_file const * const bmp, char const *path,
+		      enum Sync const sync)
+{
+	struct Out_file out;
+
+	/* The header of the cover, shared with the other workers, is copied */
+	if (!out_open(&out, path))
+		return false;
+
+	bool const ok = write_carrier(bmp, bmp->header, out.fd) &&
+	    out_publish(&out, sync);
+	int const err = errno;
+
+	if (ok)
+		close(out.fd);
+	else
+		out_abort(&out);
+	errno = err;
+	return ok;
+}
@@ -0,0 +1,69 @@
+#!/bin/sh
+# Copyright (C) 2017 Chris Tarazi
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Analyzes a 24-bit BMP whose rows are padded, 201 pixels of 3 bytes in 604,
+# and a PNG of the same pixels, whose rows are not. The padding, filled with
+# noise, is not part of the image, so the results of every channel match.
+#
+# Usage: check_analyze.sh <STEG>
+
+set -e
+
+steg=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+python3 - <<'PY'
+import random, struct, zlib
+
+def chunk(kind, data):
+    crc = zlib.crc32(kind + data) & 0xffffffff
+    return struct.pack('>I', len(data)) + kind + data + struct.pack('>I', crc)
+
+random.seed(1)
+w, h = 201, 300
+rows = [bytes((x * 5 + y * 3 + random.randint(0, 30)) & 255
+              for x in range(3 * w)) for y in range(h)]
+
+# Top-down, so that the rows are in the same order as those of the PNG
+pad = (4 - 3 * w % 4) % 4
+pixels = b''.join(r + bytes(random.randint(0, 255) for _ in range(pad))
+                  for r in rows)
+with open('padded.bmp', 'wb') as f:
+    f.write(b'BM' + struct.pack('<IHHI', 54 + len(pixels), 0, 0, 54) +
+            struct.pack('<IiiHHIIiiII', 40, w, -h, 1, 24, 0, len(pixels),
+                        2835, 2835, 0, 0) + pixels)
+
+# The channels of a BMP pixel are in the order b, g, r; those of the PNG get
+# the same bytes, so that channel 0 of both is the same
+idat = b''.join(b'\0' + r for r in rows)
+with open('plain.png', 'wb') as f:
+    f.write(b'\x89PNG\r\n\x1a\n' +
+            chunk(b'IHDR', struct.pack('>IIBBBBB', w, h, 8, 2, 0, 0, 0)) +
+            chunk(b'IDAT', zlib.compress(idat, 6)) + chunk(b'IEND', b''))
+PY
+
+# Only the values, without the file name and the names of the channels
+bmp=$("$steg" analyze -a -j 1 padded.bmp | cut -f 2- | sed 's/[a-z]: //g')
+png=$("$steg" analyze -a -j 1 plain.png | cut -f 2- | sed 's/[a-z]: //g')
+
+if [ -z "$bmp" ] || [ "$bmp" != "$png" ]; then
+	echo "FAIL: padded BMP: $bmp"
+	echo "      PNG:        $png"
+	exit 1
+fi
+echo "analyze: padded rows skipped"
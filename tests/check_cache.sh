@@ -0,0 +1,62 @@
+#!/bin/sh
+# Copyright (C) 2017 Chris Tarazi
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Runs 64 batch jobs on 16 threads over 4 covers, large enough that the jobs
+# which start together all miss on them while they load. Each cover must be
+# loaded once, by the first job; the others wait for it and count as hits.
+#
+# Usage: check_cache.sh <STEG>
+
+set -e
+
+steg=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+python3 - <<'PY'
+import struct
+
+w, h = 1500, 1500
+pixels = bytes(x * 7 & 255 for x in range(3 * w)) * h
+with open('cover.bmp', 'wb') as f:
+    f.write(b'BM' + struct.pack('<IHHI', 54 + len(pixels), 0, 0, 54) +
+            struct.pack('<IiiHHIIiiII', 40, w, h, 1, 24, 0, len(pixels),
+                        2835, 2835, 0, 0) + pixels)
+PY
+
+for i in 1 2 3 4; do
+	cp cover.bmp cover$i.bmp
+done
+head -c 100 /dev/urandom > payload
+j=0
+while [ $j -lt 16 ]; do
+	j=$((j + 1))
+	for i in 1 2 3 4; do
+		printf 'cover%s.bmp\tpayload\n' $i
+	done
+done > jobs
+
+"$steg" batch -m lsb -t file -j 16 jobs > out 2> log
+stats=$(grep '^Cover cache:' log)
+
+if [ "$(wc -l < out)" -ne 64 ] ||
+    [ "$stats" != "Cover cache: 60 hits, 4 misses, 0 evictions" ]; then
+	echo "FAIL: $stats"
+	cat log
+	exit 1
+fi
+echo "cache: 4 covers loaded once for 64 jobs"
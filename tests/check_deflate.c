@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks deflate_buf() against zlib, a reference inflater, and against
+ * inflate_buf() with the Adler-32 of the result, at every level. The data is
+ * mostly literals of 144 and up, whose codes in the fixed code are 9 bits
+ * long, in pieces short enough to go out in fixed blocks too.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* zlib declares an adler32_combine() of its own */
+#define adler32_combine zlib_adler32_combine
+#include <zlib.h>
+#undef adler32_combine
+
+#include "../include/deflate.h"
+
+#define NKINDS 4U
+
+static void fill(unsigned char *buf, size_t const len, unsigned int const kind);
+static bool check(unsigned char const *src, size_t const len,
+		  unsigned int const level);
+
+int main(void)
+{
+	static size_t const lens[] = {
+		1, 10, 100, 300, 1000, 5000, 70000, 300000
+	};
+	unsigned int failed = 0, total = 0;
+
+	srand(1);
+	for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+		unsigned char *src = malloc(lens[i]);
+
+		if (!src) {
+			perror("malloc");
+			return EXIT_FAILURE;
+		}
+
+		for (unsigned int kind = 0; kind < NKINDS; kind++) {
+			fill(src, lens[i], kind);
+			for (unsigned int level = 0; level <= DEFLATE_MAX_LEVEL;
+			     level++) {
+				total++;
+				if (check(src, lens[i], level))
+					continue;
+				fprintf(stderr, "FAIL: %zu bytes of kind %u at "
+					"level %u\n", lens[i], kind, level);
+				failed++;
+			}
+		}
+		free(src);
+	}
+
+	printf("deflate: %u of %u passed\n", total - failed, total);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*
+ * Fills the |len| bytes of |buf| with data of the sort |kind|: random bytes
+ * of 144 and up, runs broken up by them, a few values near 255, or the
+ * filtered rows of a smooth image.
+ */
+static void fill(unsigned char *buf, size_t const len, unsigned int const kind)
+{
+	for (size_t i = 0; i < len; i++) {
+		switch (kind) {
+		case 0:
+			buf[i] = (unsigned char) (144 + rand() % 112);
+			break;
+		case 1:
+			buf[i] = (unsigned char) (i % 50 < 25 ? 200 : rand());
+			break;
+		case 2:
+			buf[i] = (unsigned char) (250 + rand() % 4);
+			break;
+		default:
+			buf[i] = (unsigned char) (i % 3601 == 0 ? 2 :
+						  rand() % 5 - 2);
+			break;
+		}
+	}
+}
+
+/*
+ * Compresses the |len| bytes of |src| at |level| into a zlib stream, as PNG
+ * images hold it, and decompresses it with zlib and with inflate_buf().
+ *
+ * Returns: true if both give |src| back, false otherwise.
+ */
+static bool check(unsigned char const *src, size_t const len,
+		  unsigned int const level)
+{
+	unsigned char *z = malloc(2 + DEFLATE_BOUND(len) + 6);
+	unsigned char *out = malloc(len + 1);
+	bool ok = false;
+
+	if (!z || !out)
+		goto out;
+
+	z[0] = 0x78;
+	z[1] = 0x01;
+	size_t n = deflate_buf(src, len, level, z + 2);
+	if (n == 0)
+		goto out;
+	n += 2;
+
+	/* An empty last block with fixed codes, then the checksum */
+	uint32_t const adler = adler32_buf(1, src, len);
+	z[n++] = 0x03;
+	z[n++] = 0x00;
+	for (int shift = 24; shift >= 0; shift -= 8)
+		z[n++] = (unsigned char) (adler >> shift);
+
+	uLongf zlen = len + 1;
+	if (uncompress(out, &zlen, z, n) != Z_OK || zlen != len ||
+	    memcmp(out, src, len) != 0)
+		goto out;
+
+	size_t outlen, inlen;
+	memset(out, 0, len + 1);
+	if (!inflate_buf(z + 2, n - 2, out, len + 1, &outlen, &inlen) ||
+	    outlen != len || adler32_buf(1, out, outlen) != adler)
+		goto out;
+
+	ok = memcmp(out, src, len) == 0;
+out:
+	free(z);
+	free(out);
+	return ok;
+}
@@ -0,0 +1,88 @@
+#!/bin/sh
+# Copyright (C) 2017 Chris Tarazi
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Hides a file at every compression level in two RGB covers and checks the
+# stego images with Python's zlib, a reference inflater, and with steg -d. The
+# image data of both takes several segments of PNG_SEGMENT_LEN. That of the
+# noisy 200x627 one, all literals, ends with a block short enough to go out
+# with fixed codes.
+#
+# Usage: check_png.sh <STEG>
+
+set -e
+
+steg=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+python3 - <<'PY'
+import random, struct, zlib
+
+def chunk(kind, data):
+    crc = zlib.crc32(kind + data) & 0xffffffff
+    return struct.pack('>I', len(data)) + kind + data + struct.pack('>I', crc)
+
+def png(name, w, h, pixel):
+    rows = b''.join(b'\0' + bytes(pixel(x, y) for x in range(3 * w))
+                    for y in range(h))
+    with open(name, 'wb') as f:
+        f.write(b'\x89PNG\r\n\x1a\n' +
+                chunk(b'IHDR', struct.pack('>IIBBBBB', w, h, 8, 2, 0, 0, 0)) +
+                chunk(b'IDAT', zlib.compress(rows, 6)) + chunk(b'IEND', b''))
+
+random.seed(1)
+png('smooth.png', 1200, 900,
+    lambda x, y: (x * 7 + y * 3 + random.randint(0, 40)) & 255)
+png('noise.png', 200, 627, lambda x, y: random.randint(0, 255))
+with open('payload', 'wb') as f:
+    f.write(bytes(random.randint(128, 255) for _ in range(20000)))
+PY
+
+failed=0
+for cover in smooth noise; do
+for level in 0 1 2 3 4 5 6 7 8 9; do
+	rm -f stego.png out
+	"$steg" -m lsb -t file -l 2 -z $level -e payload -o stego.png \
+		$cover.png > /dev/null
+	if ! python3 - <<'PY'
+import struct, sys, zlib
+
+data = open('stego.png', 'rb').read()
+pos, idat = 8, b''
+while pos < len(data):
+    n, = struct.unpack('>I', data[pos:pos + 4])
+    if data[pos + 4:pos + 8] == b'IDAT':
+        idat += data[pos + 8:pos + 8 + n]
+    pos += 12 + n
+try:
+    zlib.decompress(idat)
+except zlib.error as e:
+    sys.exit('zlib: %s' % e)
+PY
+	then
+		echo "FAIL: $cover, level $level, zlib"
+		failed=1
+	elif ! "$steg" -m lsb -t file -d -o out stego.png > /dev/null ||
+	    ! cmp -s payload out; then
+		echo "FAIL: $cover, level $level, steg -d"
+		failed=1
+	fi
+done
+done
+
+[ $failed -eq 0 ] && echo "png: all levels passed"
+exit $failed
@@ -0,0 +1,83 @@
+#!/bin/sh
+# Copyright (C) 2017 Chris Tarazi
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Has steg watch hide 32 payloads on 8 threads at once under a umask of 027,
+# and checks that each stego image came out with the mode 0640 which open()
+# would give it: workers publish through out_open(), which must not change
+# the umask of the process under the others' feet. With <PRELOAD>, a library
+# which refuses O_TMPFILE, they fall back to named temporary files.
+#
+# Usage: check_watch.sh <STEG> [<PRELOAD>]
+
+set -e
+
+steg=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+preload=
+[ -n "$2" ] && preload=$(cd "$(dirname "$2")" && pwd)/$(basename "$2")
+cover=$(cd "$(dirname "$0")/../samples" && pwd)/tree.bmp
+dir=$(mktemp -d)
+pid=
+trap '[ -n "$pid" ] && kill $pid 2> /dev/null; rm -rf "$dir"' EXIT
+cd "$dir"
+
+mkdir spool covers out
+for i in 1 2 3 4; do
+	cp "$cover" covers/cover$i.bmp
+done
+
+umask 027
+LD_PRELOAD=$preload "$steg" watch -m lsb -j 8 spool covers out > log 2>&1 &
+pid=$!
+
+# Written under a hidden name and renamed in, as producers should
+n=32
+i=0
+while [ $i -lt $n ]; do
+	i=$((i + 1))
+	head -c 1000 /dev/urandom > spool/.payload$i
+	mv spool/.payload$i spool/payload$i
+done
+
+tries=0
+while [ "$(ls out | grep -c '\.bmp$')" -lt $n ] && [ $tries -lt 100 ]; do
+	tries=$((tries + 1))
+	sleep 0.1
+done
+kill $pid
+wait $pid 2> /dev/null || true
+pid=
+
+failed=0
+if grep -q '^umask() called' log; then
+	echo "FAIL: $(grep -m 1 '^umask() called' log)"
+	failed=1
+fi
+count=$(ls out | grep -c '\.bmp$' || true)
+if [ "$count" -ne $n ]; then
+	echo "FAIL: $count of $n payloads hidden"
+	cat log
+	failed=1
+fi
+for f in out/*.bmp; do
+	mode=$(stat -c %a "$f")
+	if [ "$mode" != 640 ]; then
+		echo "FAIL: $f has mode $mode, not 640"
+		failed=1
+	fi
+done
+
+[ $failed -eq 0 ] && echo "watch: $n concurrent outputs with mode 640${preload:+, without O_TMPFILE}"
+exit $failed
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2017 Chris Tarazi
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Preloaded by tests/check_watch.sh to refuse O_TMPFILE, as some file systems
+ * do, so that out_open() falls back to a named temporary file. It also reports
+ * any umask() call made while the process has more than one thread, which is
+ * a race even where it happens to come out right.
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+int open(char const *path, int flags, ...);
+int open64(char const *path, int flags, ...) __attribute__((alias("open")));
+
+mode_t umask(mode_t mask)
+{
+	static mode_t (*next)(mode_t);
+	DIR *d = opendir("/proc/self/task");
+	unsigned int threads = 0;
+
+	for (struct dirent *e; d && (e = readdir(d));)
+		threads += e->d_name[0] != '.';
+	if (d)
+		closedir(d);
+	if (threads > 1)
+		fprintf(stderr, "umask() called with %u threads\n", threads);
+
+	if (!next)
+		*(void **) &next = dlsym(RTLD_NEXT, "umask");
+	return next(mask);
+}
+
+int open(char const *path, int flags, ...)
+{
+	static int (*next)(char const *, int, ...);
+	mode_t mode = 0;
+	va_list ap;
+
+	if ((flags & O_TMPFILE) == O_TMPFILE) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	if (flags & (O_CREAT | O_TMPFILE)) {
+		va_start(ap, flags);
+		mode = (mode_t) va_arg(ap, int);
+		va_end(ap);
+	}
+
+	if (!next)
+		*(void **) &next = dlsym(RTLD_NEXT, "open");
+	return next(path, flags, mode);
+}